@@ -25,6 +25,9 @@ Now with persistent preference storage and background validation of device conne
 #include <thread>
 #include <mutex>
 #include <functional>
+#include <map>
+#include <memory>
+#include <ctime>
 
 #include <json/json.h>
 
@@ -33,9 +36,23 @@ Now with persistent preference storage and background validation of device conne
 #pragma comment(lib, "Shlwapi.lib")
 
 #include "Resource.h"
+#include "HeosModel.h"
+#include "HeosIcons.h"
+#include "HeosToolbar.h"
+#include "HeosPrefs.h"
+#include "HeosTrace.h"
+#include "HeosAutomation.h"
+#include "HeosRamp.h"
+#include "HeosConnection.h"
+#include "HeosServer.h"
+#include "HeosBatch.h"
+#include "HeosArtCache.h"
+#include "HeosNowPlaying.h"
 
 #define TRAY_ICON_UID 1
 #define WM_TRAYICON (WM_USER + 1)
+#define WM_NOW_PLAYING (WM_USER + 2)
+#define WM_TRAY_ICON_CHANGED (WM_USER + 3) // wParam is the icon ID
 #define ID_TRAY_EXIT 1001
 #define ID_TRAY_CONNECT 1002
 #define ID_TRAY_DEVICE_INFO 1003
@@ -47,6 +64,9 @@ Now with persistent preference storage and background validation of device conne
 #define ID_BUTTON_VOL_UP 2005
 #define ID_BUTTON_OPTICAL 2006
 #define TRAY_ICON_TOOLTIP L"HEOS Controller"
+#define DEFERRED_INIT_TIMER 2
+#define AUTOMATION_TIMER 3
+#define STARTUP_TRACE_FILE "startup-trace.json"
 
 HINSTANCE hInst;
 HWND hwndMain;
@@ -54,19 +74,29 @@ HWND hwndToolbar = NULL;
 NOTIFYICONDATA nid;
 bool isConnected = false;
 bool isMuted = false;
-//bool isPlaying = false;
-//std::string currentInput = "";
+int volumeLevel = -1; // as the device last reported it
 std::string deviceName = "Not connected";
 std::string deviceIP = "";
 std::string devicePID = "";
-const char* PREFS_FILE = "prefs.json";
+std::mutex deviceMutex; // guards the device state above, which every thread reads
+HeosPrefsStore prefsStore("prefs.json");
+HeosPrefs prefs; // as loaded, then updated by ValidateConnection()
+std::mutex prefsMutex;
+HeosTrace startupTrace; // from static initialization until the first ValidateConnection() is done
+bool fastStart = true; // defer what the first button press does not need until the tray is idle
+bool writeStartupTrace = false;
+std::unique_ptr<HeosAutomation> automation; // screen-share rules, fed by titleSource
+HeosWinEventTitleSource titleSource;
 
 // Forward declarations
 LRESULT CALLBACK WndProc(HWND, UINT, WPARAM, LPARAM);
 void ShowContextMenu(HWND, POINT);
 void ShowButtonToolbar();
 void ValidateConnection();
-void SlackMonitorLoop();
+void DeferredInit();
+void StartAutomation();
+void HandleApiRequest(const HeosApiRequest& request, HeosServer::Respond respond);
+void PublishState();
 
 // Custom stream buffer that redirects output to OutputDebugString
 class OutputDebugStreamBuf : public std::streambuf {
@@ -102,12 +132,6 @@ private:
 
 OutputDebugStream out;  // Create a custom output stream
 
-struct HeosPlayer {
-	std::string name;
-	std::string ip;
-	std::string pid;
-};
-
 std::wstring ToWString(const std::string& str) {
 	return std::wstring(str.begin(), str.end());
 }
@@ -141,11 +165,18 @@ std::string ToLowercase(const std::string& in) {
 	return out;
 }
 
-void AddAppToStartup() {
-	WCHAR path[MAX_PATH];
-	SHGetFolderPathW(NULL, CSIDL_STARTUP, NULL, 0, path);
+// Looked up once; the first SHGetFolderPath call loads a good part of the shell
+const WCHAR* StartupLinkPath() {
+	static WCHAR path[MAX_PATH] = {};
+	if (!path[0]) {
+		SHGetFolderPathW(NULL, CSIDL_STARTUP, NULL, 0, path);
+		wcscat_s(path, L"\\HEOSController.lnk");
+	}
+	return path;
+}
 
-	wcscat_s(path, L"\\HEOSController.lnk");
+void AddAppToStartup() {
+	const WCHAR* path = StartupLinkPath();
 
 	// Don't create if it already exists
 	if (PathFileExistsW(path)) return;
@@ -173,78 +204,181 @@ void AddAppToStartup() {
 }
 
 void RemoveAppFromStartup() {
-	WCHAR path[MAX_PATH];
-	SHGetFolderPathW(NULL, CSIDL_STARTUP, NULL, 0, path);
-	wcscat_s(path, L"\\HEOSController.lnk");
-
-	DeleteFileW(path);
+	DeleteFileW(StartupLinkPath());
 }
 
 bool IsStartupEnabled() {
-	WCHAR path[MAX_PATH];
-	SHGetFolderPathW(NULL, CSIDL_STARTUP, NULL, 0, path);
-	wcscat_s(path, L"\\HEOSController.lnk");
-	return PathFileExistsW(path);
+	return PathFileExistsW(StartupLinkPath());
 }
 
-void SendHeosCommand(const std::string& command, const std::string& params = "", const std::function<void(const std::string&)>& callback = NULL)
+HeosConnection heosConnection; // every player command goes over this one
+HeosServer apiServer(HandleApiRequest);
+
+// Art is fetched as soon as a track starts, so the toolbar never waits for it
+HeosArtCache artCache("art", 96, 2 * 1024 * 1024, 32 * 1024 * 1024);
+HeosNowPlaying nowPlaying([](const HeosNowPlayingState& state) {
+	artCache.Prefetch(state.media.image_url);
+	PublishState();
+	PostMessage(hwndMain, WM_NOW_PLAYING, 0, 0);
+	});
+HICON artIcon = NULL; // on the play button while there is art for what is playing
+
+// The device state as one consistent copy.
+struct DeviceState {
+	bool connected;
+	bool muted;
+	int volume;
+	std::string name;
+	std::string ip;
+	std::string pid;
+};
+
+DeviceState CurrentDevice()
 {
-	std::thread([command, params, callback] {
-		if (deviceIP.length() < 4 + 3)
-		{
-			std::cout << "Device not ready; IP is empty: " << deviceIP << std::endl;
-			return;
-		}
+	std::lock_guard<std::mutex> lock(deviceMutex);
+	return { isConnected, isMuted, volumeLevel, deviceName, deviceIP, devicePID };
+}
 
-		WSADATA wsaData;
-		SOCKET sock = INVALID_SOCKET;
-		sockaddr_in server;
+// "...&level=25..." in a get_volume reply
+int ParseVolumeLevel(const std::string& response)
+{
+	size_t at = response.find("level=");
+	return at == std::string::npos ? -1 : atoi(response.c_str() + at + 6);
+}
 
-		WSAStartup(MAKEWORD(2, 2), &wsaData);
+// What the API serves and streams to /events.
+void PublishState()
+{
+	DeviceState device = CurrentDevice();
+	Json::Value state;
+	state["connected"] = device.connected;
+	state["device"] = device.name;
+	state["ip"] = device.ip;
+	state["pid"] = device.pid;
+	state["muted"] = device.muted;
+	state["volume"] = device.volume;
+	HeosNowPlayingState playing = nowPlaying.Current();
+	if (playing.known) {
+		Json::Value& media = state["nowPlaying"];
+		media["song"] = playing.media.song;
+		media["artist"] = playing.media.artist;
+		media["album"] = playing.media.album;
+		media["station"] = playing.media.station;
+		media["state"] = playing.playState;
+	}
+	Json::BufferWriter writer;
+	writer.write(state);
+	apiServer.PublishState(writer.str());
+}
 
-		sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-		server.sin_family = AF_INET;
-		server.sin_port = htons(1255);
-		inet_pton(AF_INET, deviceIP.c_str(), &server.sin_addr);
+bool IsDeviceReady(const DeviceState& device)
+{
+	if (device.ip.length() < 4 + 3)
+	{
+		std::cout << "Device not ready; IP is empty: " << device.ip << std::endl;
+		return false;
+	}
+	return true;
+}
 
-		std::string out;
-		if (connect(sock, (SOCKADDR*)&server, sizeof(server)) == 0) {
+// "player/command?pid=...&params"
+std::string PlayerCommand(const DeviceState& device, const std::string& command, const std::string& params)
+{
+	auto fullCommand = "player/" + command;
+	std::string app = "?";
+	if (!device.pid.empty()) {
+		fullCommand += app + "pid=" + device.pid;
+		app = "&";
+	}
+	if (!params.empty()) {
+		fullCommand += app + params;
+	}
+	return fullCommand;
+}
 
-			auto fullCommand = "heos://player/" + command;
-			std::string app = "?";
-			if (!devicePID.empty()) {
-				fullCommand += app + "pid=" + devicePID;
-				app = "&";
-			}
-			if (!params.empty()) {
-				fullCommand += app + params;
-				app = "&";
-			}
-			fullCommand += "\r\n";
+// Logs the reply, and keeps the volume the API reports up to date
+void CommandDone(const std::string& command, bool ok, const std::string& reply)
+{
+	if (!ok) {
+		std::cerr << "No reply from HEOS device to " << command << "." << std::endl;
+		return;
+	}
+	std::cout << reply << std::endl;
+	if (command == "get_volume" || command == "set_volume") {
+		int level = ParseVolumeLevel(reply);
+		bool changed;
+		{
+			std::lock_guard<std::mutex> lock(deviceMutex);
+			changed = level >= 0 && level != volumeLevel;
+			if (changed)
+				volumeLevel = level;
+		}
+		if (changed)
+			PublishState();
+	}
+}
 
-			send(sock, fullCommand.c_str(), (int)fullCommand.length(), 0);
+// Sends heos://player/command to the device and waits for the reply, which is
+// empty if there was none. Returns false if there is no device to send to.
+bool SendHeosCommandNow(const std::string& command, const std::string& params, std::string& out)
+{
+	DeviceState device = CurrentDevice();
+	if (!IsDeviceReady(device))
+		return false;
+
+	out.clear();
+	bool ok = heosConnection.Send(device.ip, PlayerCommand(device, command, params), out);
+	CommandDone(command, ok, out);
+	return true;
+}
 
-			// Optional: receive response
-			char buffer[1024];
-			int bytesReceived = recv(sock, buffer, sizeof(buffer) - 1, 0);
-			if (bytesReceived > 0) {
-				buffer[bytesReceived] = '\0';
-				out = buffer;
-				std::cout << buffer << std::endl;
-			}
-		}
-		else {
-			std::cerr << "Failed to connect to HEOS device." << std::endl;
-		}
+// Ducking fades; set_volume goes out in order, one at a time, and waits for the reply
+HeosVolumeRamp volumeRamp([](int level) {
+	std::string reply;
+	return SendHeosCommandNow("set_volume", "level=" + std::to_string(level), reply) && !reply.empty();
+	});
+
+// What a running automation rule changed, so it can be put back when it ends
+struct AutomationUndo {
+	bool unmute = false;
+	int volume = -1;
+	unsigned duck = 0; // bumped when a duck starts or ends
+};
+std::map<std::string, AutomationUndo> automationUndo; // by rule name
+std::mutex automationMutex;
 
-		closesocket(sock);
-		WSACleanup();
+// The user changed the volume: the ramp stops, and no duck puts back the
+// level from before it.
+void CancelVolumeRamp()
+{
+	std::lock_guard<std::mutex> lock(automationMutex);
+	volumeRamp.Cancel();
+	for (auto& undo : automationUndo)
+		undo.second.volume = -1;
+}
 
+// Queued behind the commands sent before it; the callback gets the reply, or
+// "" if there was none, on the connection's thread. With no device to send
+// to, it gets "" right away, on the calling thread.
+void SendHeosCommand(const std::string& command, const std::string& params = "", const std::function<void(const std::string&)>& callback = NULL)
+{
+	DeviceState device = CurrentDevice();
+	if (!IsDeviceReady(device))
+	{
 		if (callback != NULL)
 		{
-			callback(out);
+			callback("");
 		}
-		}).detach();
+		return;
+	}
+
+	heosConnection.SendAsync(device.ip, PlayerCommand(device, command, params), [command, callback](bool ok, const std::string& reply) {
+		CommandDone(command, ok, reply);
+		if (callback != NULL)
+		{
+			callback(ok ? reply : "");
+		}
+		});
 }
 
 //bool SendHttpRequest(const std::string & command, const std::string& params = "") {
@@ -394,8 +528,12 @@ std::string DiscoverHEOSDevice() {
 	return "";
 }
 
-std::vector<HeosPlayer> GetHeosPlayers(const std::string& ip) {
-	std::vector<HeosPlayer> players;
+const int REPLY_TIMEOUT_MS = 5000; // for GetHeosReply()
+
+// Sends heos://command to the device at ip and decodes the payload of the reply.
+// False unless the device answered "success" in time.
+template <class Payload>
+bool GetHeosReply(const std::string& ip, const std::string& command, Payload& payload) {
 	WSADATA wsaData;
 	WSAStartup(MAKEWORD(2, 2), &wsaData);
 
@@ -408,50 +546,79 @@ std::vector<HeosPlayer> GetHeosPlayers(const std::string& ip) {
 	if (connect(sock, (sockaddr*)&server, (int)sizeof(server)) == SOCKET_ERROR) {
 		closesocket(sock);
 		WSACleanup();
-		return players;
+		return false;
 	}
+	// A device that takes the connection but never answers must not hang discovery
+	HeosSetTimeout(sock, REPLY_TIMEOUT_MS);
 
-	std::string command = "heos://player/get_players\r\n";
-	send(sock, command.c_str(), (int)command.size(), 0);
+	std::string request = "heos://" + command + "\r\n";
+	send(sock, request.c_str(), (int)request.size(), 0);
 
+	// Line by line, as HeosConnection::ReadReply: slow commands first answer
+	// "command under process", and change events may come in between
+	std::string received;
+	std::string line;
+	bool answered = false;
 	char buffer[8192];
-	int bytesReceived = recv(sock, buffer, sizeof(buffer) - 1, 0);
-	buffer[bytesReceived] = '\0';
+	int bytesReceived;
+	while (!answered && received.size() <= 1024 * 1024 && (bytesReceived = recv(sock, buffer, sizeof(buffer), 0)) > 0) {
+		received.append(buffer, (size_t)bytesReceived);
+		size_t end;
+		while (!answered && (end = received.find("\r\n")) != std::string::npos) {
+			line = received.substr(0, end);
+			received.erase(0, end + 2);
+			answered = line.find('{') != std::string::npos && HeosEventName(line).empty()
+				&& line.find("command under process") == std::string::npos;
+		}
+	}
 
 	closesocket(sock);
 	WSACleanup();
 
-	std::string response(buffer);
-	size_t jsonStart = response.find('{');
-	if (jsonStart != std::string::npos) {
-		std::string jsonPart = response.substr(jsonStart);
-		try {
-			Json::Reader reader;
-			Json::Value root;
-			if (reader.parse(jsonPart, root)) {
-				const Json::Value& playersJson = root["payload"];
-				for (const auto& item : playersJson) {
-					HeosPlayer player;
-					player.name = item["name"].asString();
-					player.ip = item["ip"].asString();
-					player.pid = item["pid"].asString();
-					players.push_back(player);
-				}
-			}
-			else {
-				std::cerr << "Failed to parse JSON.\n";
-			}
-		}
-		catch (...) {
-			std::cerr << "Error during JSON parsing.\n";
-		}
+	if (!answered) {
+		std::cerr << "No reply to " << command << "\n";
+		return false;
+	}
+
+	// Straight into the payload; no Value tree is built.
+	HeosReply<Payload> reply;
+	Json::String errs;
+	bool decoded;
+	try {
+		decoded = Json::decode(line.data(), line.data() + line.size(), reply, &errs);
+	}
+	catch (...) {
+		std::cerr << "Error during JSON parsing.\n";
+		return false;
 	}
+	if (!decoded) {
+		std::cerr << "Failed to parse JSON.\n" << errs;
+		return false;
+	}
+	if (reply.heos.result != "success") {
+		std::cerr << command << " failed: " << reply.heos.message << "\n";
+		return false;
+	}
+
+	payload = std::move(reply.payload);
+	return true;
+}
 
+std::vector<HeosPlayer> GetHeosPlayers(const std::string& ip) {
+	std::vector<HeosPlayer> players;
+	GetHeosReply(ip, "player/get_players", players);
 	return players;
 }
 
+std::vector<HeosGroup> GetHeosGroups(const std::string& ip) {
+	std::vector<HeosGroup> groups;
+	GetHeosReply(ip, "group/get_groups", groups);
+	return groups;
+}
+
+// Only on the UI thread; other threads post WM_TRAY_ICON_CHANGED.
 void ChangeTrayIcon(int iconID) {
-	HICON hIcon = (HICON)LoadImage(GetModuleHandle(NULL), MAKEINTRESOURCE(iconID), IMAGE_ICON, 0, 0, LR_SHARED);
+	HICON hIcon = HeosGetIcon(iconID, GetSystemMetrics(SM_CXSMICON));
 	nid.hIcon = hIcon;
 	nid.uFlags = NIF_ICON; // We're updating the icon only
 	Shell_NotifyIcon(NIM_MODIFY, &nid);
@@ -459,8 +626,12 @@ void ChangeTrayIcon(int iconID) {
 
 void SetMutedInternally(bool muted)
 {
-	isMuted = muted;
-	ChangeTrayIcon(isMuted ? IDI_TRAY_MUTED : IDI_TRAY);
+	{
+		std::lock_guard<std::mutex> lock(deviceMutex);
+		isMuted = muted;
+	}
+	PostMessage(hwndMain, WM_TRAY_ICON_CHANGED, muted ? IDI_TRAY_MUTED : IDI_TRAY, 0);
+	PublishState();
 }
 
 void GetMuteState(const std::function<void()>& callback)
@@ -477,53 +648,94 @@ void SetMuteState(bool muted)
 	SendHeosCommand("set_mute", muted ? "state=on" : "state=off");
 }
 
-//void GetPlayState()
-//{
-//	SendHeosCommand("get_play_state", "", [](const std::string& response) {
-//		isPlaying = response.find("state=play") != std::string::npos;
-//		});
-//}
-//
-//void SetPlayState(bool play)
-//{
-//	SendHeosCommand("set_play_state", play ? "state=play" : "state=pause");
-//}
-
-//void GetInput()
-//{
-//	SendHeosCommand("get_now_playing_media", "", [](const std::string& response) {
-//		currentInput.clear();
-//
-//		try
-//		{
-//			Json::Value root;
-//			Json::CharReaderBuilder builder;
-//			std::string errs;
-//			std::istringstream s(response);
-//			if (Json::parseFromStream(builder, s, &root, &errs)) {
-//				currentInput = ToLowercase(root["payload"]["song"].asString());
-//			}
-//		}
-//		catch (...) { }
-//		});
-//}
-
-//bool IsOpticalIn()
-//{
-//	return currentInput.find("optical") != std::string::npos;
-//}
-
 void SetInput(const std::string input)
 {
-	//currentInput = input;
 	SendHeosCommand("play_input", "input=inputs/" + input);
 }
 
-int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int)
+// HEOS.exe --batch [script] [--device ip]: runs the script, or stdin if there
+// is none, without the tray and exits with 1 if a step failed. See HeosBatch.h.
+int RunBatch()
 {
+	// A GUI program gets no console; write to the one it was started from
+	// (cmd does not wait for it, so use start /wait), unless redirected
+	if (GetFileType(GetStdHandle(STD_OUTPUT_HANDLE)) == FILE_TYPE_UNKNOWN && AttachConsole(ATTACH_PARENT_PROCESS)) {
+		FILE* stream;
+		freopen_s(&stream, "CONOUT$", "w", stdout);
+		freopen_s(&stream, "CONOUT$", "w", stderr);
+	}
+
+	int argc;
+	LPWSTR* argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+	std::wstring script;
+	std::string ip;
+	std::string pid;
+	for (int i = 1; i < argc; ++i) {
+		bool hasValue = i + 1 < argc && wcsncmp(argv[i + 1], L"--", 2) != 0;
+		if (wcscmp(argv[i], L"--batch") == 0 && hasValue) {
+			script = argv[++i];
+		}
+		else if (wcscmp(argv[i], L"--device") == 0 && hasValue) {
+			std::wstring device = argv[++i];
+			ip.assign(device.begin(), device.end());
+		}
+	}
+	LocalFree(argv);
+
+	if (ip.empty()) {
+		HeosPrefs known;
+		if (prefsStore.Load(known)) {
+			if (const HeosKnownDevice* device = HeosFindDevice(known, HeosCurrentNetwork())) {
+				ip = device->ip;
+				pid = device->pid;
+			}
+		}
+	}
+	if (ip.empty())
+		ip = DiscoverHEOSDevice();
+	if (ip.empty()) {
+		std::cerr << "No HEOS device found.\n";
+		return 2;
+	}
+	if (pid.empty()) {
+		for (const auto& player : GetHeosPlayers(ip)) {
+			if (pid.empty() || player.ip == ip)
+				pid = player.pid;
+		}
+	}
+	std::cout << "Device " << ip << ", player " << pid << "\n";
+
+	std::vector<HeosBatchStep> steps;
+	std::string error;
+	std::ifstream file;
+	if (!script.empty()) {
+		file.open(script.c_str());
+		if (!file) {
+			std::cerr << "Cannot open the script.\n";
+			return 2;
+		}
+	}
+	if (!HeosParseBatch(script.empty() ? std::cin : file, pid, steps, &error)) {
+		std::cerr << error << "\n";
+		return 2;
+	}
+	return HeosRunBatch(heosConnection, ip, steps, std::cout).failed ? 1 : 0;
+}
+
+int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR cmdLine, int)
+{
+	if (strstr(cmdLine, "--batch") != NULL)
+		return RunBatch();
+
 	std::cout.rdbuf(out.rdbuf());  // Redirect all std::cout output
 	hInst = hInstance;
 
+	startupTrace.NameThread("main");
+	startupTrace.Begin("WinMain");
+	fastStart = strstr(cmdLine, "--no-fast-start") == NULL;
+	writeStartupTrace = strstr(cmdLine, "--trace-startup") != NULL;
+
+	startupTrace.Begin("create window");
 	WNDCLASS wc = {};
 	wc.lpfnWndProc = WndProc;
 	wc.hInstance = hInstance;
@@ -531,8 +743,11 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int)
 	RegisterClass(&wc);
 
 	hwndMain = CreateWindowEx(0, L"TrayIconClass", L"Tray Icon", 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, hInstance, NULL);
+	artCache.OnReady([](const std::string&) { PostMessage(hwndMain, WM_NOW_PLAYING, 0, 0); });
+	startupTrace.End();
 
-	HICON hIcon = (HICON)LoadImage(GetModuleHandle(NULL), MAKEINTRESOURCE(IDI_TRAY), IMAGE_ICON, 0, 0, LR_SHARED);
+	startupTrace.Begin("tray icon");
+	HICON hIcon = HeosGetIcon(IDI_TRAY, GetSystemMetrics(SM_CXSMICON));
 
 	ZeroMemory(&nid, sizeof(nid));
 	nid.cbSize = sizeof(nid);
@@ -545,27 +760,52 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int)
 	wcscpy_s(nid.szTip, TRAY_ICON_TOOLTIP);
 
 	Shell_NotifyIcon(NIM_ADD, &nid);
+	startupTrace.End();
 
-	std::ifstream in(PREFS_FILE);
-	if (in) {
-		Json::Value root;
-		in >> root;
-
-		deviceIP = root.get("ip", "").asString();
-		devicePID = root.get("pid", "").asString();
-		deviceName = root.get("name", "Not connected").asString();
+	startupTrace.Begin("load prefs");
+	std::string prefsError;
+	if (!prefsStore.Load(prefs, &prefsError)) {
+		std::cout << "Prefs not loaded: " << prefsError << "\n";
 	}
+	startupTrace.End();
 
-	if (!deviceIP.empty())
-	{
+	// Start with the device last used on this network; ValidateConnection()
+	// checks it. Finding the network can wait on an ARP reply from the
+	// gateway, so that happens off the UI thread.
+	std::thread([] {
+		startupTrace.NameThread("network");
+		startupTrace.Begin("current network");
+		std::string network = HeosCurrentNetwork();
+		startupTrace.End();
+		HeosKnownDevice known;
+		{
+			std::lock_guard<std::mutex> lock(prefsMutex);
+			const HeosKnownDevice* found = HeosFindDevice(prefs, network);
+			if (!found)
+				return;
+			known = *found;
+		}
+		{
+			std::lock_guard<std::mutex> lock(deviceMutex);
+			if (!deviceIP.empty())
+				return; // ConnectToDevice() got there first
+			deviceIP = known.ip;
+			devicePID = known.pid;
+			deviceName = known.name.empty() ? "Not connected" : known.name;
+		}
+		std::cout << "On network " << network << ", last used " << known.name << " at " << known.ip << "\n";
+		startupTrace.Instant("first command possible");
 		GetMuteState(NULL);
-		//GetPlayState();
-		//GetInput();
-	}
-
-	ValidateConnection();
+		}).detach();
 
-	//std::thread slackMonitorLoop(SlackMonitorLoop);
+	// WM_TIMER only comes when the queue is otherwise empty, so a click on
+	// the tray icon is handled before the deferred work
+	if (fastStart)
+		SetTimer(hwndMain, DEFERRED_INIT_TIMER, USER_TIMER_MINIMUM, NULL);
+	else
+		DeferredInit();
+	startupTrace.End();
+	startupTrace.Instant("tray interactive");
 
 	MSG msg;
 	while (GetMessage(&msg, NULL, 0, 0))
@@ -574,7 +814,14 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int)
 		DispatchMessage(&msg);
 	}
 
+	titleSource.Stop();
+	nowPlaying.Stop();
+	apiServer.Stop();
 	Shell_NotifyIcon(NIM_DELETE, &nid);
+	if (artIcon)
+		DestroyIcon(artIcon);
+	HeosFreeIcons();
+	prefsStore.Flush();
 	return 0;
 }
 
@@ -585,7 +832,8 @@ void ShowContextMenu(HWND hwnd, POINT pt)
 
 	bool startupEnabled = IsStartupEnabled();
 
-	std::wstring info = isConnected ? L"Connected to " + std::wstring(deviceName.begin(), deviceName.end()) + L" (" + std::wstring(deviceIP.begin(), deviceIP.end()) + L")" : L"Not connected";
+	DeviceState device = CurrentDevice();
+	std::wstring info = device.connected ? L"Connected to " + std::wstring(device.name.begin(), device.name.end()) + L" (" + std::wstring(device.ip.begin(), device.ip.end()) + L")" : L"Not connected";
 	AppendMenu(hMenu, MF_STRING | MF_DISABLED, ID_TRAY_DEVICE_INFO, info.c_str());
 	AppendMenu(hMenu, MF_STRING, ID_TRAY_CONNECT, L"Connect!");
 	AppendMenu(hMenu, MF_STRING | (startupEnabled ? MF_CHECKED : 0), ID_TRAY_STARTUP, L"Launch on startup");
@@ -599,190 +847,475 @@ void ShowContextMenu(HWND hwnd, POINT pt)
 #define ARRAY_LENGTH(arr) (sizeof(arr) / sizeof((arr)[0]))
 int buttonIDs[] = { ID_BUTTON_PLAY_PAUSE, ID_BUTTON_MUTE, ID_BUTTON_VOL_DOWN, ID_BUTTON_VOL_UP, ID_BUTTON_OPTICAL };
 #define BUTTON_COUNT ARRAY_LENGTH(buttonIDs)
-#define ICO_SIZE 64
 #define BUTTON_SIZE 32
 #define MARGIN 32
 
-//HICON LoadButtonIcon(LPCWSTR iconPath)
-HICON LoadButtonIcon(int iconID)
-{
-	// Load a large icon and scale it down to fit 32x32 using an image list
-	HICON hIconLarge = (HICON)LoadImage(GetModuleHandle(NULL), MAKEINTRESOURCE(iconID), IMAGE_ICON, ICO_SIZE, ICO_SIZE, LR_SHARED);
-	if (!hIconLarge) return NULL;
+HeosToolbarState toolbarState;
+HeosLatencyProbe toolbarFromClick; // tray click to first paint, including the double-click wait
+HeosLatencyProbe toolbarFromShow;  // ShowButtonToolbar() to first paint
+HWND toolbarButtons[BUTTON_COUNT];
+int toolbarButtonSize = 0;
 
-	// Create image list with 32x32 size
-	HIMAGELIST hImageList = ImageList_Create(BUTTON_SIZE, BUTTON_SIZE, ILC_COLOR32 | ILC_MASK, 1, 1);
-	if (!hImageList) return hIconLarge;
+LRESULT CALLBACK ToolbarProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
+{
+	switch (msg) {
+	case WM_COMMAND:
+		// A button click moves the focus; that must not hide the toolbar
+		toolbarState.ButtonClicked();
+		break;
 
-	ImageList_AddIcon(hImageList, hIconLarge);
-	HICON hIconSmall = ImageList_GetIcon(hImageList, 0, ILD_NORMAL);
+	case WM_ACTIVATE:
+		if (LOWORD(wParam) == WA_INACTIVE)
+		{
+			// Hide on focus loss, unless the focus went to one of our buttons
+			if (!toolbarState.Deactivated(IsChild(hwnd, (HWND)lParam) != FALSE))
+				return 0;
+			ShowWindow(hwnd, SW_HIDE);
+			return 0;
+		}
+		break;
 
-	ImageList_Destroy(hImageList);
-	DestroyIcon(hIconLarge);
+	case WM_WINDOWPOSCHANGED:
+		// However it was hidden, the next tray click has to show it again
+		if (((WINDOWPOS*)lParam)->flags & SWP_HIDEWINDOW)
+			toolbarState.Hidden();
+		break;
 
-	return hIconSmall;
+	case WM_PAINT:
+	{
+		LRESULT result = WndProc(hwnd, msg, wParam, lParam);
+		if (toolbarFromShow.Stop()) {
+			toolbarFromClick.Stop();
+			std::cout << "Toolbar open: " << toolbarFromClick.Report() << " from click, " << toolbarFromShow.Report() << " from show\n";
+		}
+		toolbarState.MessageHandled();
+		return result;
+	}
+	}
+	toolbarState.MessageHandled();
+	return WndProc(hwnd, msg, wParam, lParam);
 }
 
-
-void ShowButtonToolbar()
+HeosToolbarLayout CurrentToolbarLayout()
 {
-	if (hwndToolbar != NULL)
-		return; // Already shown
-
 	RECT workArea;
 	SystemParametersInfo(SPI_GETWORKAREA, 0, &workArea, 0);
 
-	hwndToolbar = CreateWindowEx(WS_EX_TOOLWINDOW | WS_EX_TOPMOST, L"STATIC", NULL,
-		WS_POPUP | WS_VISIBLE,
-		workArea.right - BUTTON_SIZE * BUTTON_COUNT - MARGIN, workArea.bottom - BUTTON_SIZE - MARGIN,
-		BUTTON_SIZE * BUTTON_COUNT, BUTTON_SIZE,
-		NULL, NULL, hInst, NULL);
+	HDC hdcScreen = GetDC(NULL);
+	int dpi = GetDeviceCaps(hdcScreen, LOGPIXELSX);
+	ReleaseDC(NULL, hdcScreen);
+
+	HeosToolbarRect area;
+	area.left = workArea.left;
+	area.top = workArea.top;
+	area.right = workArea.right;
+	area.bottom = workArea.bottom;
+	return HeosLayoutToolbar(area, BUTTON_COUNT, BUTTON_SIZE, MARGIN, dpi);
+}
 
-	HWND buttons[BUTTON_COUNT];
-	//LPCWSTR icons[] = { L"play.ico", L"pause.ico", L"mute.ico", L"voldown.ico", L"volup.ico", L"optical.ico" };
+// Shows the album art on the play button, or the play icon when there is none.
+void UpdatePlayButton()
+{
+	if (!hwndToolbar || toolbarButtonSize == 0)
+		return;
+	HICON icon = HeosGetIcon(IDI_BUTTON_PLAY, toolbarButtonSize);
+	HICON previous = artIcon;
+	artIcon = NULL;
+	HeosImage art;
+	if (artCache.Get(nowPlaying.Current().media.image_url, art)) {
+		artIcon = HeosCreateIcon(HeosFitImage(art, toolbarButtonSize * 3 / 4));
+		if (artIcon)
+			icon = artIcon;
+	}
+	SendMessage(toolbarButtons[0], BM_SETIMAGE, IMAGE_ICON, (LPARAM)icon);
+	if (previous)
+		DestroyIcon(previous);
+}
 
+void LayoutToolbarButtons(int buttonSize)
+{
+	toolbarButtonSize = buttonSize;
 	for (int i = 0; i < BUTTON_COUNT; ++i) {
 		int iconID = buttonIDs[i] - ID_BUTTON_PLAY_PAUSE + IDI_BUTTON_PLAY;
-		//HICON hIcon = LoadButtonIcon(icons[i]);
-		HICON hIcon = LoadButtonIcon(iconID);
-		buttons[i] = CreateWindow(L"BUTTON", NULL,
-			WS_CHILD | WS_VISIBLE | BS_ICON,
-			i * BUTTON_SIZE, 0, BUTTON_SIZE, BUTTON_SIZE,
-			hwndToolbar, (HMENU)(INT_PTR)buttonIDs[i], hInst, NULL);
-		SendMessage(buttons[i], BM_SETIMAGE, IMAGE_ICON, (LPARAM)hIcon);
+		MoveWindow(toolbarButtons[i], i * buttonSize, 0, buttonSize, buttonSize, FALSE);
+		SendMessage(toolbarButtons[i], BM_SETIMAGE, IMAGE_ICON, (LPARAM)HeosGetIcon(iconID, buttonSize));
 	}
+	UpdatePlayButton();
+}
+
+// The toolbar window and its buttons are built on first use; after that a click only moves and shows it
+void ShowButtonToolbar()
+{
+	toolbarFromShow.Start();
+
+	HeosToolbarLayout layout = CurrentToolbarLayout();
+
+	switch (toolbarState.Open(layout)) {
+	case HeosToolbarState::Action::None:
+		toolbarFromShow.Cancel(); // already open: nothing to time
+		return;
+
+	case HeosToolbarState::Action::Create:
+		hwndToolbar = CreateWindowEx(WS_EX_TOOLWINDOW | WS_EX_TOPMOST, L"STATIC", NULL,
+			WS_POPUP,
+			layout.x, layout.y, layout.width, layout.height,
+			NULL, NULL, hInst, NULL);
+		for (int i = 0; i < BUTTON_COUNT; ++i) {
+			toolbarButtons[i] = CreateWindow(L"BUTTON", NULL,
+				WS_CHILD | WS_VISIBLE | BS_ICON,
+				0, 0, 0, 0,
+				hwndToolbar, (HMENU)(INT_PTR)buttonIDs[i], hInst, NULL);
+		}
+		LayoutToolbarButtons(layout.buttonSize);
+		SetWindowLongPtr(hwndToolbar, GWLP_WNDPROC, (LONG_PTR)ToolbarProc);
+		break;
 
-	ShowWindow(hwndToolbar, SW_SHOWNOACTIVATE);
+	case HeosToolbarState::Action::Relayout:
+		LayoutToolbarButtons(layout.buttonSize);
+		break;
+
+	case HeosToolbarState::Action::Show:
+		break;
+	}
+
+	SetWindowPos(hwndToolbar, HWND_TOPMOST, layout.x, layout.y, layout.width, layout.height, SWP_NOACTIVATE | SWP_SHOWWINDOW);
 	SetForegroundWindow(hwndToolbar);
 	SetFocus(hwndToolbar);
+}
 
-	// Track whether we're processing a button click
-	static bool processingButtonClick = false;
+// Startup ends with the first ValidateConnection(): stop the trace and report it.
+void FinishStartupTrace()
+{
+	if (startupTrace.IsClosed())
+		return;
+	startupTrace.Close();
+
+	std::cout << "Startup: tray interactive at " << startupTrace.InstantAt("tray interactive") / 1000.0
+		<< " ms, first command possible at " << startupTrace.InstantAt("first command possible") / 1000.0
+		<< " ms, connected at " << startupTrace.InstantAt("connected") / 1000.0 << " ms"
+		<< (fastStart ? " (fast start)" : "") << "\n";
+	if (writeStartupTrace && startupTrace.WriteChromeJson(STARTUP_TRACE_FILE))
+		std::cout << "Startup trace written to " << STARTUP_TRACE_FILE << "\n";
+}
 
-	// Auto-hide on focus loss, but not when clicking buttons
-	SetWindowLongPtr(hwndToolbar, GWLP_WNDPROC, (LONG_PTR)+[](HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) -> LRESULT {
-		switch (msg) {
-		case WM_COMMAND:
-			// Set flag when processing button clicks
-			processingButtonClick = true;
-			break;
+// Everything startup does that the first button press does not need.
+void DeferredInit()
+{
+	HeosTrace::Scope scope(startupTrace, "deferred init");
 
-		case WM_ACTIVATE:
-			if (LOWORD(wParam) == WA_INACTIVE)
-			{
-				// Check if we're just clicking a button in our toolbar
-				HWND hwndFocus = GetFocus();
-				HWND hwndActive = (HWND)lParam;
-
-				// If we're processing a button click or the active window is one of our buttons, don't close
-				if (processingButtonClick || IsChild(hwnd, hwndActive))
-				{
-					processingButtonClick = false;
-					return 0;
-				}
+	startupTrace.Begin("startup link");
+	StartupLinkPath();
+	startupTrace.End();
 
-				// Otherwise close the toolbar
-				ShowWindow(hwndToolbar, SW_HIDE);
-				DestroyWindow(hwndToolbar);
-				hwndToolbar = NULL;
-				return 0;
-			}
-			break;
-		}
-		processingButtonClick = false;
-		return WndProc(hwnd, msg, wParam, lParam);
-		});
+	startupTrace.Begin("icon prep");
+	HeosGetIcon(IDI_TRAY_MUTED, GetSystemMetrics(SM_CXSMICON));
+	int buttonSize = CurrentToolbarLayout().buttonSize;
+	for (int i = 0; i < BUTTON_COUNT; ++i)
+		HeosGetIcon(buttonIDs[i] - ID_BUTTON_PLAY_PAUSE + IDI_BUTTON_PLAY, buttonSize);
+	startupTrace.End();
+
+	ValidateConnection();
+
+	startupTrace.Begin("automation");
+	StartAutomation();
+	startupTrace.End();
+
+	int apiPort;
+	{
+		std::lock_guard<std::mutex> lock(prefsMutex);
+		apiPort = prefs.apiPort;
+	}
+	if (apiPort > 0) {
+		HeosTrace::Scope api(startupTrace, "api server");
+		PublishState();
+		if (apiServer.Start((unsigned short)apiPort))
+			std::cout << "API listening on 127.0.0.1:" << apiServer.Port() << "\n";
+		else
+			std::cout << "API could not listen on port " << apiPort << "\n";
+	}
 }
 
-void ValidateConnection()
+void ConnectToDevice()
 {
-	std::thread([] {
-		std::string ip = DiscoverHEOSDevice();
+	startupTrace.Begin("current network");
+	std::string network = HeosCurrentNetwork();
+	startupTrace.End();
+	HeosKnownDevice device;
+	{
+		std::lock_guard<std::mutex> lock(prefsMutex);
+		if (const HeosKnownDevice* known = HeosFindDevice(prefs, network))
+			device = *known;
+	}
+
+	// The device known on this network usually still answers; only go
+	// through the 5 second discovery if it does not.
+	std::string ip = device.ip;
+	std::vector<HeosPlayer> players;
+	auto started = std::chrono::steady_clock::now();
+	if (!ip.empty()) {
+		HeosTrace::Scope scope(startupTrace, "get_players (known device)");
+		players = GetHeosPlayers(ip);
+		if (players.empty())
+			std::cout << "Known device " << ip << " is not answering.\n";
+	}
+	if (players.empty()) {
+		startupTrace.Begin("discovery");
+		ip = DiscoverHEOSDevice();
+		startupTrace.End();
 		if (ip.empty()) {
 			std::cout << "No HEOS device found.\n";
 			return;
 		}
 
 		std::cout << "Discovered HEOS IP: " << ip << "\n";
-		auto players = GetHeosPlayers(ip);
-
-		isConnected = false;
-		deviceName = "Not connected";
-		deviceIP.clear();
-		devicePID.clear();
+		HeosTrace::Scope scope(startupTrace, "get_players");
+		started = std::chrono::steady_clock::now();
+		players = GetHeosPlayers(ip);
+	}
+	int rttMs = (int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count();
+
+	// Stay with the player used before on this network, if it is still there
+	const HeosPlayer* chosen = nullptr;
+	for (const auto& player : players) {
+		std::cout << "Player: " << player.name << " at " << player.ip << " = " + player.pid + "\n";
+		if (!chosen || player.pid == device.pid)
+			chosen = &player;
+	}
+	{
+		std::lock_guard<std::mutex> lock(deviceMutex);
+		isConnected = chosen != nullptr;
+		deviceName = chosen ? chosen->name : "Not connected";
+		deviceIP = chosen ? chosen->ip : "";
+		devicePID = chosen ? chosen->pid : "";
+		volumeLevel = -1;
+	}
+	if (!chosen) {
+		nowPlaying.Stop(); // nothing to watch, and what it knew is gone
+		PublishState();
+		return;
+	}
 
-		for (const auto& player : players) {
-			std::cout << "Player: " << player.name << " at " << player.ip << " = " + player.pid + "\n";
-			isConnected = true;
-			deviceName = players[0].name;
-			deviceIP = players[0].ip;
-			devicePID = players[0].pid;
-		}
+	startupTrace.Instant("first command possible");
+	startupTrace.Instant("connected");
+	PublishState();
+	GetMuteState(NULL);
+	SendHeosCommand("get_volume");
+	// Validating again mostly finds the player it watches already; let it be
+	if (!nowPlaying.IsWatching(chosen->ip, chosen->pid))
+		nowPlaying.Start(chosen->ip, chosen->pid);
+
+	device.network = network;
+	device.ip = chosen->ip;
+	device.pid = chosen->pid;
+	device.name = chosen->name;
+	device.lastSeen = (int64_t)std::time(nullptr);
+	device.rttMs = rttMs;
+	device.players = players;
+	startupTrace.Begin("get_groups");
+	device.groups = GetHeosGroups(ip);
+	startupTrace.End();
+	std::cout << "Remembering " << device.name << " for network " << network << " (" << rttMs << " ms)\n";
+
+	std::lock_guard<std::mutex> lock(prefsMutex);
+	HeosRememberDevice(prefs, device);
+	prefsStore.Save(prefs);
+}
 
-		Json::Value root;
+void ValidateConnection()
+{
+	std::thread([] {
+		startupTrace.NameThread("connect");
 		{
-			root["ip"] = deviceIP;
-			root["pid"] = devicePID;
-			root["name"] = deviceName;
+			HeosTrace::Scope scope(startupTrace, "validate connection");
+			ConnectToDevice();
 		}
-		std::ofstream out(PREFS_FILE);
-		out << root;
-
-		GetMuteState(NULL);
+		FinishStartupTrace();
 		}).detach();
 }
 
 void ToggleMute()
 {
-	GetMuteState([]() { SetMuteState(!isMuted); });
+	GetMuteState([]() { SetMuteState(!CurrentDevice().muted); });
+}
+
+// Answers an API request once the device has answered command: with the
+// state, which the reply has updated by then.
+std::function<void(const std::string&)> RespondWithState(HeosServer::Respond respond)
+{
+	return [respond](const std::string& reply) {
+		HeosStatusReply status;
+		if (!Json::decode(reply.data(), reply.data() + reply.size(), status, nullptr) || status.heos.result != "success")
+			respond({ 502, "{\"error\":\"the device did not do it\"}" });
+		else
+			respond({ 200, apiServer.State() });
+	};
 }
 
-// Check if any window title includes "Slack (Screen Sharing)"
-bool IsSlackScreenSharing() {
-	HWND hwnd = nullptr;
-	wchar_t title[512];
-	while ((hwnd = FindWindowEx(nullptr, hwnd, nullptr, nullptr)) != nullptr) {
-		if (!IsWindowVisible(hwnd)) continue;
-		GetWindowTextW(hwnd, title, 512);
-		std::wstring wTitle(title);
-		if (wTitle.find(L"Slack") != std::wstring::npos &&
-			wTitle.find(L"Screen Sharing") != std::wstring::npos) {
-			return true;
+// The local control API. Runs on the server thread: everything here is
+// queued on heosConnection, and the response goes out when the reply is in.
+void HandleApiRequest(const HeosApiRequest& request, HeosServer::Respond respond)
+{
+	auto param = [&request](const char* name) {
+		auto found = request.params.find(name);
+		return found == request.params.end() ? std::string() : found->second;
+	};
+	bool isState = request.path == "/state";
+	if (!isState && request.path != "/mute" && request.path != "/volume" && request.path != "/input") {
+		respond({ 404, "{\"error\":\"no such endpoint\"}" });
+		return;
+	}
+	if (request.method != (isState ? "GET" : "POST")) {
+		respond({ 405, isState ? "{\"error\":\"use GET\"}" : "{\"error\":\"use POST\"}" });
+		return;
+	}
+	if (isState) {
+		respond({ 200, apiServer.State() });
+		return;
+	}
+	if (!IsDeviceReady(CurrentDevice())) {
+		respond({ 503, "{\"error\":\"not connected\"}" });
+		return;
+	}
+
+	if (request.path == "/mute") {
+		std::string state = param("state");
+		if (state == "on" || state == "off") {
+			SetMutedInternally(state == "on");
+			SendHeosCommand("set_mute", "state=" + state, RespondWithState(respond));
+		}
+		else if (state.empty() || state == "toggle") {
+			GetMuteState([respond]() {
+				bool muted = !CurrentDevice().muted;
+				SetMutedInternally(muted);
+				SendHeosCommand("set_mute", muted ? "state=on" : "state=off", RespondWithState(respond));
+				});
+		}
+		else {
+			respond({ 400, "{\"error\":\"state is on, off or toggle\"}" });
+		}
+	}
+	else if (request.path == "/volume") {
+		std::string level = param("level");
+		std::string step = param("step");
+		if (!level.empty() && level.size() <= 3 && level.find_first_not_of("0123456789") == std::string::npos && atoi(level.c_str()) <= 100) {
+			CancelVolumeRamp();
+			SendHeosCommand("set_volume", "level=" + level, RespondWithState(respond));
+		}
+		else if (level.empty() && (step == "up" || step == "down")) {
+			CancelVolumeRamp();
+			SetMutedInternally(false);
+			SendHeosCommand("volume_" + step);
+			SendHeosCommand("get_volume", "", RespondWithState(respond));
+		}
+		else {
+			respond({ 400, "{\"error\":\"level is 0 to 100, or step is up or down\"}" });
+		}
+	}
+	else {
+		// inputs/optical_in_1 and the like
+		std::string name = param("name");
+		if (name.empty() || name.size() > 32 || name.find_first_not_of("abcdefghijklmnopqrstuvwxyz0123456789_") != std::string::npos) {
+			respond({ 400, "{\"error\":\"name is an input, like optical_in_1\"}" });
+			return;
 		}
+		SendHeosCommand("play_input", "input=inputs/" + name, RespondWithState(respond));
 	}
-	return false;
 }
 
-void SlackMonitorLoop() {
-	bool wasSharing = false;
-	bool hasMuted = false;
-	while (true) {
-		bool isSharing = IsSlackScreenSharing();
-		if (isSharing && !wasSharing) {
-			std::cout << "[Slack] Detected screen sharing  muting HEOS\n";
-			GetMuteState([&hasMuted]() {
-				if (!isMuted)
-				{
-					hasMuted = true;
+void RunAutomationRule(const HeosAutomationRule& rule, bool active)
+{
+	std::cout << "[Automation] " << rule.name << (active ? " started\n" : " ended\n");
+	std::string name = rule.name;
+	if (rule.action == "mute") {
+		if (active) {
+			GetMuteState([name]() {
+				if (!CurrentDevice().muted) {
+					std::lock_guard<std::mutex> lock(automationMutex);
+					automationUndo[name].unmute = true;
 					SetMuteState(true);
 				}
-			});
-		}
-		else if (!isSharing && wasSharing) {
-			std::cout << "[Slack] Screen sharing stopped  checking mute status\n";
-			if (hasMuted) {
-				std::cout << "[Slack] Unmuting HEOS\n";
-				hasMuted = false;
-				SetMuteState(false);
-			}
-			else {
-				std::cout << "[Slack] Was already muted  skipping unmute\n";
-			}
+				});
+			return;
+		}
+		bool unmute;
+		{
+			std::lock_guard<std::mutex> lock(automationMutex);
+			unmute = automationUndo[name].unmute;
+			automationUndo[name].unmute = false;
+		}
+		if (unmute)
+			SetMuteState(false);
+		else
+			std::cout << "[Automation] Was already muted, not unmuting\n";
+	}
+	else if (rule.action == "duck") {
+		HeosRampCurve curve = HeosRampCurve::Ease;
+		if (!HeosParseRampCurve(rule.curve, curve))
+			std::cout << "[Automation] Unknown curve " << rule.curve << ", easing\n";
+		auto duration = std::chrono::milliseconds(rule.rampMs);
+
+		std::unique_lock<std::mutex> lock(automationMutex);
+		unsigned duck = ++automationUndo[name].duck;
+		if (active) {
+			int level = rule.volume;
+			// The callback takes the lock, and runs on this thread if there is
+			// no device
+			lock.unlock();
+			SendHeosCommand("get_volume", "", [name, duck, level, duration, curve](const std::string& response) {
+				int current = ParseVolumeLevel(response);
+				std::lock_guard<std::mutex> lock(automationMutex);
+				// Not if the rule ended (or started over) while the reply was on its way
+				if (current <= level || automationUndo[name].duck != duck)
+					return;
+				automationUndo[name].volume = current;
+				volumeRamp.Start(current, level, duration, curve);
+				});
+			return;
 		}
+		// Unless the user set the volume since; then it stays where they put it
+		int volume = automationUndo[name].volume;
+		automationUndo[name].volume = -1;
+		// From wherever the duck got to, if it was still going
+		int from = volumeRamp.Level() >= 0 ? volumeRamp.Level() : rule.volume;
+		if (volume >= 0)
+			volumeRamp.Start(from, volume, duration, curve);
+	}
+	else if (rule.action == "input") {
+		// The previous input is not known, so there is nothing to go back to
+		if (active && !rule.input.empty())
+			SetInput(rule.input);
+	}
+	else {
+		std::cout << "[Automation] Unknown action " << rule.action << "\n";
+	}
+}
 
-		wasSharing = isSharing;
-		std::this_thread::sleep_for(std::chrono::seconds(2));
+// Runs HeosAutomation::Update() when the next rule delay runs out
+void ScheduleAutomation()
+{
+	auto due = automation->NextDue();
+	if (due == HeosAutomation::Clock::time_point::max()) {
+		KillTimer(hwndMain, AUTOMATION_TIMER);
+		return;
 	}
+	long long wait = std::chrono::duration_cast<std::chrono::milliseconds>(due - HeosAutomation::Clock::now()).count();
+	SetTimer(hwndMain, AUTOMATION_TIMER, (UINT)(wait > USER_TIMER_MINIMUM ? wait : USER_TIMER_MINIMUM), NULL);
+}
+
+// Title changes come in as WinEvents on this thread; nothing polls.
+void StartAutomation()
+{
+	std::vector<HeosAutomationRule> rules;
+	{
+		std::lock_guard<std::mutex> lock(prefsMutex);
+		rules = prefs.automation;
+	}
+	if (rules.empty())
+		rules = HeosDefaultAutomationRules();
+
+	automation.reset(new HeosAutomation(rules, RunAutomationRule));
+	if (!titleSource.Start(*automation, ScheduleAutomation))
+		std::cout << "[Automation] Could not hook window events\n";
 }
 
 static UINT_PTR clickTimerID = 0;
@@ -796,6 +1329,8 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 		case WM_LBUTTONDOWN:
 			if (!waitingForDoubleClick) {
 				waitingForDoubleClick = true;
+				if (!toolbarState.IsVisible())
+					toolbarFromClick.Start();
 				auto dblClickTime = 100;//GetDoubleClickTime(); // 100 because the default is 500 and that is just too long.
 				clickTimerID = SetTimer(hwnd, 1, 100, NULL);
 			}
@@ -821,8 +1356,24 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 		}
 		break;
 
+	case WM_NOW_PLAYING:
+		UpdatePlayButton();
+		break;
+
+	case WM_TRAY_ICON_CHANGED:
+		ChangeTrayIcon((int)wParam);
+		break;
+
 	case WM_TIMER:
-		if (wParam == clickTimerID) {
+		if (wParam == DEFERRED_INIT_TIMER) {
+			KillTimer(hwnd, DEFERRED_INIT_TIMER);
+			DeferredInit();
+		}
+		else if (wParam == AUTOMATION_TIMER) {
+			automation->Update();
+			ScheduleAutomation();
+		}
+		else if (wParam == clickTimerID) {
 			// Timer expired without a double-click, so process as single click
 			KillTimer(hwnd, clickTimerID);
 			clickTimerID = 0;
@@ -851,26 +1402,29 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 		}
 		break;
 		case ID_BUTTON_PLAY_PAUSE:
-			//GetInput();
-			//if (IsOpticalIn())
-			{
+		{
+			// The optical input plays whatever this PC plays, so that is what to pause
+			HeosNowPlayingState playing = nowPlaying.Current();
+			if (!playing.known || playing.IsInput("optical"))
 				keybd_event(VK_MEDIA_PLAY_PAUSE, 0, KEYEVENTF_EXTENDEDKEY, 0);
-			}
-			//else
-			//{
-			//	SetPlayState(!isPlaying);
-			//}
+			else
+				SendHeosCommand("set_play_state", playing.playState == "play" ? "state=pause" : "state=play");
 			break;
+		}
 		case ID_BUTTON_MUTE:
 			ToggleMute();
 			break;
 		case ID_BUTTON_VOL_DOWN:
+			CancelVolumeRamp(); // the user knows better
 			SetMutedInternally(false);
 			SendHeosCommand("volume_down");
+			SendHeosCommand("get_volume");
 			break;
 		case ID_BUTTON_VOL_UP:
+			CancelVolumeRamp();
 			SetMutedInternally(false);
 			SendHeosCommand("volume_up");
+			SendHeosCommand("get_volume");
 			break;
 		case ID_BUTTON_OPTICAL:
 			SetInput("optical_in_1");
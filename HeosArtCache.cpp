@@ -0,0 +1,446 @@
+#ifdef _WIN32
+#include <windows.h>
+#include <wininet.h>
+#include <wincodec.h>
+#include <shlwapi.h>
+#pragma comment(lib, "wininet.lib")
+#pragma comment(lib, "windowscodecs.lib")
+#else
+#include <netdb.h>
+#include <sys/stat.h>
+#include "HeosSocket.h"
+#endif
+
+#include "HeosArtCache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+#include <json/json.h>
+
+namespace {
+
+const size_t MAX_DOWNLOAD = 16 * 1024 * 1024;
+const int MAX_DIMENSION = 4096; // bigger art is not worth decoding
+
+// FNV-1a, so a URL maps to the same file every run
+std::string FileName(const std::string& url)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (unsigned char c : url) {
+		hash ^= c;
+		hash *= 1099511628211ull;
+	}
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.img", (unsigned long long)hash);
+	return name;
+}
+
+// Only names FileName() makes, so an edited index cannot point elsewhere
+bool IsFileName(const std::string& name)
+{
+	return name.size() == 20 && name.compare(16, 4, ".img") == 0 && name.find_first_not_of("0123456789abcdef") == 16;
+}
+
+bool LoadFile(const std::string& path, std::string& data)
+{
+	std::ifstream in(path, std::ios::binary);
+	if (!in)
+		return false;
+	data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	return !in.bad();
+}
+
+bool SaveFile(const std::string& path, const std::string& data)
+{
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	out.write(data.data(), (std::streamsize)data.size());
+	out.close();
+	return (bool)out;
+}
+
+// Written aside and renamed over, so a crash leaves a whole index
+bool SaveFileAtomically(const std::string& path, const std::string& data)
+{
+	std::string temp = path + ".tmp";
+	if (!SaveFile(temp, data))
+		return false;
+#ifdef _WIN32
+	bool ok = MoveFileExA(temp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	bool ok = rename(temp.c_str(), path.c_str()) == 0;
+#endif
+	if (!ok)
+		std::remove(temp.c_str());
+	return ok;
+}
+
+void MakeDirectory(const std::string& path)
+{
+#ifdef _WIN32
+	CreateDirectoryA(path.c_str(), NULL);
+#else
+	mkdir(path.c_str(), 0755);
+#endif
+}
+
+// Fitted in size x size, never scaled up
+HeosImage FitThumbnail(const HeosImage& image, int size)
+{
+	if (image.width <= size && image.height <= size)
+		return image;
+	return HeosFitImage(image, size);
+}
+
+size_t Bytes(const HeosImage& image)
+{
+	return image.pixels.size() * sizeof(uint32_t);
+}
+
+} // namespace
+
+#ifdef _WIN32
+bool HeosHttpGet(const std::string& url, std::string& body)
+{
+	body.clear();
+	HINTERNET internet = InternetOpenA("HEOS Controller", INTERNET_OPEN_TYPE_PRECONFIG, NULL, NULL, 0);
+	if (!internet)
+		return false;
+	// The art cache is the cache
+	HINTERNET request = InternetOpenUrlA(internet, url.c_str(), NULL, 0, INTERNET_FLAG_NO_CACHE_WRITE | INTERNET_FLAG_NO_UI | INTERNET_FLAG_NO_COOKIES, 0);
+	bool ok = request != NULL;
+	if (ok) {
+		DWORD status = 0;
+		DWORD length = sizeof(status);
+		ok = HttpQueryInfoA(request, HTTP_QUERY_STATUS_CODE | HTTP_QUERY_FLAG_NUMBER, &status, &length, NULL) && status == 200;
+		char buffer[16384];
+		DWORD read = 0;
+		while (ok && InternetReadFile(request, buffer, sizeof(buffer), &read) && read > 0) {
+			body.append(buffer, read);
+			ok = body.size() <= MAX_DOWNLOAD;
+		}
+		InternetCloseHandle(request);
+	}
+	InternetCloseHandle(internet);
+	return ok && !body.empty();
+}
+
+bool HeosDecodeArt(const std::string& data, HeosImage& image)
+{
+	if (HeosDecodePng((const unsigned char*)data.data(), data.size(), image))
+		return true;
+
+	// The calling thread has COM initialized; the cache's worker does
+	IWICImagingFactory* factory = NULL;
+	IStream* stream = NULL;
+	IWICBitmapDecoder* decoder = NULL;
+	IWICBitmapFrameDecode* frame = NULL;
+	IWICBitmapSource* converted = NULL;
+	UINT width = 0;
+	UINT height = 0;
+	bool ok = SUCCEEDED(CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory)))
+		&& (stream = SHCreateMemStream((const BYTE*)data.data(), (UINT)data.size())) != NULL
+		&& SUCCEEDED(factory->CreateDecoderFromStream(stream, NULL, WICDecodeMetadataCacheOnDemand, &decoder))
+		&& SUCCEEDED(decoder->GetFrame(0, &frame))
+		&& SUCCEEDED(WICConvertBitmapSource(GUID_WICPixelFormat32bppBGRA, frame, &converted))
+		&& SUCCEEDED(converted->GetSize(&width, &height))
+		&& width > 0 && height > 0 && width <= MAX_DIMENSION && height <= MAX_DIMENSION;
+	if (ok) {
+		image.width = (int)width;
+		image.height = (int)height;
+		image.pixels.resize((size_t)width * height);
+		ok = SUCCEEDED(converted->CopyPixels(NULL, width * 4, width * height * 4, (BYTE*)image.pixels.data()));
+	}
+	if (converted) converted->Release();
+	if (frame) frame->Release();
+	if (decoder) decoder->Release();
+	if (stream) stream->Release();
+	if (factory) factory->Release();
+	return ok;
+}
+#else
+bool HeosHttpGet(const std::string& url, std::string& body)
+{
+	body.clear();
+	const std::string scheme = "http://";
+	if (url.compare(0, scheme.size(), scheme) != 0)
+		return false;
+	size_t slash = url.find('/', scheme.size());
+	std::string host = url.substr(scheme.size(), slash == std::string::npos ? std::string::npos : slash - scheme.size());
+	std::string path = slash == std::string::npos ? "/" : url.substr(slash);
+	std::string port = "80";
+	size_t colon = host.find(':');
+	if (colon != std::string::npos) {
+		port = host.substr(colon + 1);
+		host.erase(colon);
+	}
+
+	addrinfo hints = {};
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo* address = NULL;
+	if (getaddrinfo(host.c_str(), port.c_str(), &hints, &address) != 0)
+		return false;
+	HeosSocket sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	bool ok = sock != HEOS_NO_SOCKET;
+	if (ok) {
+		HeosSetTimeout(sock, 10000);
+		ok = connect(sock, address->ai_addr, address->ai_addrlen) == 0;
+	}
+	freeaddrinfo(address);
+
+	// HTTP/1.0, so the body simply ends when the connection does
+	std::string request = "GET " + path + " HTTP/1.0\r\nHost: " + host + "\r\nConnection: close\r\n\r\n";
+	ok = ok && send(sock, request.data(), request.size(), HEOS_SEND_FLAGS) == (ssize_t)request.size();
+	std::string response;
+	char buffer[16384];
+	int count;
+	while (ok && (count = (int)recv(sock, buffer, sizeof(buffer), 0)) > 0) {
+		response.append(buffer, (size_t)count);
+		ok = response.size() <= MAX_DOWNLOAD;
+	}
+	if (sock != HEOS_NO_SOCKET)
+		HeosCloseSocket(sock);
+
+	size_t headerEnd = response.find("\r\n\r\n");
+	size_t space = response.find(' ');
+	if (!ok || headerEnd == std::string::npos || space > headerEnd || response.compare(space + 1, 4, "200 ") != 0)
+		return false;
+	body = response.substr(headerEnd + 4);
+	return !body.empty();
+}
+
+bool HeosDecodeArt(const std::string& data, HeosImage& image)
+{
+	return HeosDecodePng((const unsigned char*)data.data(), data.size(), image);
+}
+#endif
+
+HeosArtCache::HeosArtCache(std::string directory, int thumbnailSize, size_t memoryLimit, size_t diskLimit, Fetch fetch)
+	: directory(std::move(directory)), thumbnailSize(thumbnailSize), memoryLimit(memoryLimit), diskLimit(diskLimit), fetch(std::move(fetch))
+{
+}
+
+HeosArtCache::~HeosArtCache()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	changed.notify_all();
+	if (worker.joinable())
+		worker.join();
+}
+
+void HeosArtCache::OnReady(Ready handler)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	ready = std::move(handler);
+}
+
+void HeosArtCache::Prefetch(const std::string& url)
+{
+	if (url.empty())
+		return;
+	std::lock_guard<std::mutex> lock(mutex);
+	auto found = byUrl.find(url);
+	if (found != byUrl.end()) {
+		thumbnails.splice(thumbnails.begin(), thumbnails, found->second);
+		return;
+	}
+	// The index is read on the worker, so nothing touches the disk before the first prefetch
+	if (!worker.joinable() && !stopping)
+		worker = std::thread(&HeosArtCache::WorkerLoop, this);
+	if (std::find(queue.begin(), queue.end(), url) == queue.end()) {
+		queue.push_back(url);
+		changed.notify_all();
+	}
+}
+
+bool HeosArtCache::Get(const std::string& url, HeosImage& thumbnail)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto found = byUrl.find(url);
+	if (found == byUrl.end())
+		return false;
+	thumbnails.splice(thumbnails.begin(), thumbnails, found->second);
+	thumbnail = found->second->image;
+	return true;
+}
+
+void HeosArtCache::Wait()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!queue.empty() || busy)
+		changed.wait(lock);
+}
+
+size_t HeosArtCache::MemoryBytes() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return memoryBytes;
+}
+
+size_t HeosArtCache::DiskBytes() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return diskBytes;
+}
+
+size_t HeosArtCache::Fetches() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return fetches;
+}
+
+void HeosArtCache::WorkerLoop()
+{
+#ifdef _WIN32
+	CoInitializeEx(NULL, COINIT_MULTITHREADED); // for WIC
+#endif
+	LoadIndex();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;) {
+		while (!stopping && queue.empty())
+			changed.wait(lock);
+		if (stopping)
+			break;
+		std::string url = queue.front();
+		queue.pop_front();
+		busy = true;
+		bool known = byUrl.count(url) != 0;
+		lock.unlock();
+
+		HeosImage thumbnail;
+		bool ok = known || Load(url, thumbnail);
+		if (!ok) {
+			std::string data;
+			HeosImage image;
+			bool fetched = fetch(url, data);
+			ok = fetched && HeosDecodeArt(data, image);
+			if (ok) {
+				thumbnail = FitThumbnail(image, thumbnailSize);
+				Store(url, data);
+			}
+			std::lock_guard<std::mutex> count(mutex);
+			fetches += fetched ? 1 : 0;
+		}
+		if (ok && !known)
+			Remember(url, std::move(thumbnail));
+
+		Ready handler;
+		{
+			std::lock_guard<std::mutex> relock(mutex);
+			handler = ready;
+		}
+		if (ok && handler)
+			handler(url);
+
+		lock.lock();
+		busy = false;
+		changed.notify_all();
+	}
+	lock.unlock();
+#ifdef _WIN32
+	CoUninitialize();
+#endif
+}
+
+void HeosArtCache::LoadIndex()
+{
+	MakeDirectory(directory);
+	std::string data;
+	HeosArtIndex loaded;
+	if (!LoadFile(directory + "/index.json", data) || !Json::decode(data.data(), data.data() + data.size(), loaded, nullptr))
+		return; // start empty; files it listed are overwritten as they come again
+
+	size_t bytes = 0;
+	for (auto& file : loaded.files) {
+		if (IsFileName(file.file) && file.size > 0 && !file.url.empty()) {
+			bytes += (size_t)file.size;
+			index.files.push_back(std::move(file));
+		}
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	diskBytes = bytes;
+}
+
+void HeosArtCache::SaveIndex()
+{
+	Json::BufferWriter writer;
+	writer.write(Json::toValue(index));
+	SaveFileAtomically(directory + "/index.json", writer.str());
+}
+
+bool HeosArtCache::Load(const std::string& url, HeosImage& thumbnail)
+{
+	auto found = std::find_if(index.files.begin(), index.files.end(), [&url](const HeosArtFile& file) { return file.url == url; });
+	if (found == index.files.end())
+		return false;
+	HeosArtFile file = *found;
+	index.files.erase(found);
+
+	std::string data;
+	HeosImage image;
+	bool ok = LoadFile(directory + "/" + file.file, data) && (int64_t)data.size() == file.size && HeosDecodeArt(data, image);
+	if (ok) {
+		thumbnail = FitThumbnail(image, thumbnailSize);
+		index.files.push_back(file); // now the most recently used
+	}
+	else {
+		std::remove((directory + "/" + file.file).c_str());
+		std::lock_guard<std::mutex> lock(mutex);
+		diskBytes -= (size_t)file.size;
+	}
+	SaveIndex();
+	return ok;
+}
+
+void HeosArtCache::Store(const std::string& url, const std::string& data)
+{
+	if (data.size() > diskLimit)
+		return;
+	HeosArtFile file;
+	file.url = url;
+	file.file = FileName(url);
+	file.size = (int64_t)data.size();
+	// A file of the same name goes: the same URL again, or a hash collision
+	size_t bytes = 0;
+	auto same = [&file](const HeosArtFile& other) { return other.file == file.file; };
+	for (const auto& other : index.files)
+		bytes += same(other) ? 0 : (size_t)other.size;
+	index.files.erase(std::remove_if(index.files.begin(), index.files.end(), same), index.files.end());
+	if (!SaveFile(directory + "/" + file.file, data)) {
+		std::remove((directory + "/" + file.file).c_str());
+		SaveIndex();
+		std::lock_guard<std::mutex> lock(mutex);
+		diskBytes = bytes;
+		return;
+	}
+	index.files.push_back(file);
+	bytes += data.size();
+
+	while (bytes > diskLimit && index.files.size() > 1) {
+		std::remove((directory + "/" + index.files.front().file).c_str());
+		bytes -= (size_t)index.files.front().size;
+		index.files.erase(index.files.begin());
+	}
+	SaveIndex();
+	std::lock_guard<std::mutex> lock(mutex);
+	diskBytes = bytes;
+}
+
+void HeosArtCache::Remember(const std::string& url, HeosImage thumbnail)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	memoryBytes += Bytes(thumbnail);
+	thumbnails.push_front({ url, std::move(thumbnail) });
+	byUrl[url] = thumbnails.begin();
+	while (memoryBytes > memoryLimit && thumbnails.size() > 1) {
+		memoryBytes -= Bytes(thumbnails.back().image);
+		byUrl.erase(thumbnails.back().url);
+		thumbnails.pop_back();
+	}
+}
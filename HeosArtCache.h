@@ -0,0 +1,118 @@
+#pragma once
+
+// Album art by URL, fetched ahead of time so the toolbar has it the moment it
+// opens. Thumbnails are kept in memory and the downloaded files on disk, each
+// up to a size limit past which the least recently used go first. What is on
+// disk survives a restart, so known art needs no network at all.
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <json/binding.h>
+
+#include "HeosIcons.h"
+
+// GET url into body; false unless the answer was 200. Off Windows, http only.
+bool HeosHttpGet(const std::string& url, std::string& body);
+
+// PNG anywhere; on Windows also whatever WIC reads, JPEG in particular.
+bool HeosDecodeArt(const std::string& data, HeosImage& image);
+
+// One downloaded file, as listed in the cache directory's index.json.
+struct HeosArtFile {
+	std::string url;
+	std::string file;
+	int64_t size = 0;
+};
+
+// Least recently used first.
+struct HeosArtIndex {
+	std::vector<HeosArtFile> files;
+};
+
+class HeosArtCache {
+public:
+	using Fetch = std::function<bool(const std::string& url, std::string& body)>;
+	// Called on the cache's thread when art for url can be had from Get().
+	using Ready = std::function<void(const std::string& url)>;
+
+	HeosArtCache(std::string directory, int thumbnailSize, size_t memoryLimit, size_t diskLimit, Fetch fetch = HeosHttpGet);
+	~HeosArtCache();
+
+	void OnReady(Ready ready);
+	// Gets url ready in the background; returns at once.
+	void Prefetch(const std::string& url);
+	// The thumbnail, fitted in thumbnailSize x thumbnailSize, if it is in
+	// memory. Does not fetch.
+	bool Get(const std::string& url, HeosImage& thumbnail);
+	// Until every Prefetch() so far is done.
+	void Wait();
+
+	size_t MemoryBytes() const;
+	size_t DiskBytes() const;
+	size_t Fetches() const;
+
+private:
+	struct Thumbnail {
+		std::string url;
+		HeosImage image;
+	};
+
+	void WorkerLoop();
+	// On the worker thread
+	void LoadIndex();
+	void SaveIndex();
+	bool Load(const std::string& url, HeosImage& thumbnail);
+	void Store(const std::string& url, const std::string& data);
+	void Remember(const std::string& url, HeosImage thumbnail);
+
+	const std::string directory;
+	const int thumbnailSize;
+	const size_t memoryLimit;
+	const size_t diskLimit;
+	const Fetch fetch;
+
+	mutable std::mutex mutex;
+	std::condition_variable changed;
+	std::deque<std::string> queue;
+	bool busy = false;
+	bool stopping = false;
+	Ready ready;
+	std::list<Thumbnail> thumbnails; // most recently used first
+	std::unordered_map<std::string, std::list<Thumbnail>::iterator> byUrl;
+	size_t memoryBytes = 0;
+	size_t fetches = 0;
+
+	HeosArtIndex index;              // worker thread only
+	size_t diskBytes = 0;            // guarded by mutex, written by the worker
+	std::thread worker;
+};
+
+namespace Json {
+
+template <> struct Binding<HeosArtFile> {
+	static constexpr auto fields() {
+		return std::make_tuple(
+			field("url", &HeosArtFile::url),
+			field("file", &HeosArtFile::file),
+			field("size", &HeosArtFile::size));
+	}
+};
+
+template <> struct Binding<HeosArtIndex> {
+	static constexpr auto fields() {
+		return std::make_tuple(
+			field("files", &HeosArtIndex::files));
+	}
+};
+
+} // namespace Json
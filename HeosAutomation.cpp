@@ -0,0 +1,331 @@
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include "HeosAutomation.h"
+
+#include <map>
+
+namespace {
+
+unsigned char FoldCase(unsigned char c)
+{
+	return c >= 'A' && c <= 'Z' ? (unsigned char)(c - 'A' + 'a') : c;
+}
+
+std::string Folded(const std::string& text)
+{
+	std::string folded(text);
+	for (auto& c : folded)
+		c = (char)FoldCase((unsigned char)c);
+	return folded;
+}
+
+} // namespace
+
+std::vector<HeosAutomationRule> HeosDefaultAutomationRules()
+{
+	HeosAutomationRule slack;
+	slack.name = "Slack screen sharing";
+	slack.match = { "Slack", "Screen Sharing" };
+	slack.action = "mute";
+	return { slack };
+}
+
+HeosTitleMatcher::HeosTitleMatcher(const std::vector<std::string>& patterns)
+{
+	// Trie of the folded patterns; -1 is no edge yet
+	next.assign(256, -1);
+	std::vector<std::vector<uint32_t>> own(1);
+	for (size_t i = 0; i < patterns.size(); ++i) {
+		if (patterns[i].empty())
+			continue;
+		int32_t state = 0;
+		for (unsigned char c : patterns[i]) {
+			c = FoldCase(c);
+			if (next[state * 256 + c] < 0) {
+				next[state * 256 + c] = (int32_t)own.size();
+				own.emplace_back();
+				next.resize(next.size() + 256, -1);
+			}
+			state = next[state * 256 + c];
+		}
+		own[state].push_back((uint32_t)i);
+	}
+	patternCount = patterns.size();
+	seen.assign(patternCount, 0);
+
+	// Breadth first, so a state's failure link is done before the state:
+	// missing edges become the failure state's edge, which turns the trie
+	// into a DFA, and each state also reports what its failure state does.
+	size_t states = own.size();
+	std::vector<int32_t> fail(states, 0);
+	std::vector<int32_t> queue;
+	queue.reserve(states);
+	for (int c = 0; c < 256; ++c) {
+		int32_t& target = next[c];
+		if (target < 0)
+			target = 0;
+		else
+			queue.push_back(target);
+	}
+	for (size_t head = 0; head < queue.size(); ++head) {
+		int32_t state = queue[head];
+		for (int c = 0; c < 256; ++c) {
+			int32_t& target = next[state * 256 + c];
+			if (target < 0) {
+				target = next[fail[state] * 256 + c];
+			}
+			else {
+				fail[target] = next[fail[state] * 256 + c];
+				queue.push_back(target);
+			}
+		}
+	}
+
+	std::vector<std::vector<uint32_t>> all(states);
+	all[0] = own[0];
+	for (int32_t state : queue) {
+		all[state] = own[state];
+		all[state].insert(all[state].end(), all[fail[state]].begin(), all[fail[state]].end());
+	}
+	outputStart.resize(states + 1);
+	for (size_t state = 0; state < states; ++state) {
+		outputStart[state] = (uint32_t)outputs.size();
+		outputs.insert(outputs.end(), all[state].begin(), all[state].end());
+	}
+	outputStart[states] = (uint32_t)outputs.size();
+
+	// Patterns are folded, so upper case letters go where lower case ones do
+	for (size_t state = 0; state < states; ++state) {
+		for (int c = 'A'; c <= 'Z'; ++c)
+			next[state * 256 + c] = next[state * 256 + c - 'A' + 'a'];
+	}
+}
+
+namespace {
+
+std::vector<std::string> RulePatterns(const std::vector<HeosAutomationRule>& rules, std::vector<std::vector<uint32_t>>& patternRules, std::vector<uint32_t>& required)
+{
+	// The same pattern in several rules is matched once
+	std::map<std::string, uint32_t> ids;
+	std::vector<std::string> patterns;
+	required.assign(rules.size(), 0);
+	for (size_t rule = 0; rule < rules.size(); ++rule) {
+		for (const auto& text : rules[rule].match) {
+			if (text.empty())
+				continue;
+			auto inserted = ids.emplace(Folded(text), (uint32_t)patterns.size());
+			if (inserted.second) {
+				patterns.push_back(inserted.first->first);
+				patternRules.emplace_back();
+			}
+			auto& users = patternRules[inserted.first->second];
+			if (users.empty() || users.back() != rule) {
+				users.push_back((uint32_t)rule);
+				++required[rule];
+			}
+		}
+	}
+	return patterns;
+}
+
+} // namespace
+
+HeosAutomation::HeosAutomation(std::vector<HeosAutomationRule> rules, Action action)
+	: rules(std::move(rules))
+	, action(std::move(action))
+	, matcher(RulePatterns(this->rules, patternRules, required))
+	, states(this->rules.size())
+	, found(this->rules.size(), 0)
+{
+}
+
+void HeosAutomation::Match(const std::string& title, std::vector<uint32_t>& matching)
+{
+	matching.clear();
+	matcher.Scan(title, [&](size_t pattern) {
+		for (uint32_t rule : patternRules[pattern]) {
+			if (found[rule]++ == 0)
+				touched.push_back(rule);
+			if (found[rule] == required[rule])
+				matching.push_back(rule);
+		}
+		});
+	for (uint32_t rule : touched)
+		found[rule] = 0;
+	touched.clear();
+	std::sort(matching.begin(), matching.end());
+}
+
+void HeosAutomation::TitleChanged(uint64_t window, const std::string& title, Clock::time_point now)
+{
+	auto inserted = windows.emplace(window, Window());
+	Window& known = inserted.first->second;
+	// Browsers and editors retitle often; most changes do not matter
+	if (!inserted.second && known.title == title)
+		return;
+	known.title = title;
+	Match(title, matching);
+	SetRules(known.rules, matching, now);
+	Update(now);
+}
+
+void HeosAutomation::WindowClosed(uint64_t window, Clock::time_point now)
+{
+	auto known = windows.find(window);
+	if (known == windows.end())
+		return;
+	matching.clear();
+	SetRules(known->second.rules, matching, now);
+	windows.erase(known);
+	Update(now);
+}
+
+void HeosAutomation::SetRules(std::vector<uint32_t>& current, std::vector<uint32_t>& matching, Clock::time_point now)
+{
+	// Both are sorted
+	size_t i = 0;
+	size_t j = 0;
+	while (i < current.size() || j < matching.size()) {
+		if (j == matching.size() || (i < current.size() && current[i] < matching[j])) {
+			--states[current[i]].windows;
+			Schedule(current[i++], now);
+		}
+		else if (i == current.size() || matching[j] < current[i]) {
+			++states[matching[j]].windows;
+			Schedule(matching[j++], now);
+		}
+		else {
+			++i;
+			++j;
+		}
+	}
+	current.swap(matching);
+}
+
+void HeosAutomation::Schedule(size_t rule, Clock::time_point now)
+{
+	RuleState& state = states[rule];
+	bool wanted = state.windows > 0;
+	if (wanted == state.active) {
+		// Back to how it was before the delay ran out
+		state.pending = false;
+	}
+	else if (!state.pending) {
+		state.pending = true;
+		state.due = now + std::chrono::milliseconds(wanted ? rules[rule].onDelayMs : rules[rule].offDelayMs);
+	}
+}
+
+void HeosAutomation::Update(Clock::time_point now)
+{
+	for (size_t rule = 0; rule < states.size(); ++rule) {
+		RuleState& state = states[rule];
+		if (!state.pending || state.due > now)
+			continue;
+		state.pending = false;
+		state.active = !state.active;
+		if (action)
+			action(rules[rule], state.active);
+	}
+}
+
+HeosAutomation::Clock::time_point HeosAutomation::NextDue() const
+{
+	Clock::time_point due = Clock::time_point::max();
+	for (const auto& state : states) {
+		if (state.pending && state.due < due)
+			due = state.due;
+	}
+	return due;
+}
+
+#ifdef _WIN32
+namespace {
+
+// WinEvent callbacks have no context pointer
+HeosAutomation* hookAutomation = nullptr;
+std::function<void()> hookChanged;
+HWINEVENTHOOK hookShowHide = NULL;
+HWINEVENTHOOK hookNameChange = NULL;
+
+std::string WindowTitle(HWND hwnd)
+{
+	// InternalGetWindowText does not send WM_GETTEXT, so a hung window
+	// cannot block us
+	wchar_t title[512];
+	int length = InternalGetWindowText(hwnd, title, 512);
+	if (length <= 0)
+		return std::string();
+	int size = WideCharToMultiByte(CP_UTF8, 0, title, length, NULL, 0, NULL, NULL);
+	std::string utf8((size_t)size, '\0');
+	WideCharToMultiByte(CP_UTF8, 0, title, length, &utf8[0], size, NULL, NULL);
+	return utf8;
+}
+
+// Hidden windows do not count, as with the old polling
+void ReportWindow(HWND hwnd)
+{
+	if (IsWindowVisible(hwnd))
+		hookAutomation->TitleChanged((uint64_t)(uintptr_t)hwnd, WindowTitle(hwnd));
+	else
+		hookAutomation->WindowClosed((uint64_t)(uintptr_t)hwnd);
+}
+
+void CALLBACK OnWinEvent(HWINEVENTHOOK, DWORD event, HWND hwnd, LONG idObject, LONG idChild, DWORD, DWORD)
+{
+	if (!hookAutomation || !hwnd || idObject != OBJID_WINDOW || idChild != CHILDID_SELF)
+		return;
+	if (event == EVENT_OBJECT_DESTROY)
+		hookAutomation->WindowClosed((uint64_t)(uintptr_t)hwnd);
+	else if (GetAncestor(hwnd, GA_ROOT) == hwnd)
+		ReportWindow(hwnd);
+	else
+		return;
+	if (hookChanged)
+		hookChanged();
+}
+
+BOOL CALLBACK OnEnumWindow(HWND hwnd, LPARAM)
+{
+	ReportWindow(hwnd);
+	return TRUE;
+}
+
+} // namespace
+
+bool HeosWinEventTitleSource::Start(HeosAutomation& automation, std::function<void()> changed)
+{
+	if (hookAutomation)
+		return false;
+	hookAutomation = &automation;
+	hookChanged = std::move(changed);
+
+	// EVENT_OBJECT_DESTROY, SHOW and HIDE are consecutive
+	DWORD flags = WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS;
+	hookShowHide = SetWinEventHook(EVENT_OBJECT_DESTROY, EVENT_OBJECT_HIDE, NULL, OnWinEvent, 0, 0, flags);
+	hookNameChange = SetWinEventHook(EVENT_OBJECT_NAMECHANGE, EVENT_OBJECT_NAMECHANGE, NULL, OnWinEvent, 0, 0, flags);
+	if (!hookShowHide || !hookNameChange) {
+		Stop();
+		return false;
+	}
+
+	EnumWindows(OnEnumWindow, 0);
+	if (hookChanged)
+		hookChanged();
+	return true;
+}
+
+void HeosWinEventTitleSource::Stop()
+{
+	if (hookShowHide)
+		UnhookWinEvent(hookShowHide);
+	if (hookNameChange)
+		UnhookWinEvent(hookNameChange);
+	hookShowHide = NULL;
+	hookNameChange = NULL;
+	hookAutomation = nullptr;
+	hookChanged = nullptr;
+}
+#endif
@@ -0,0 +1,173 @@
+#pragma once
+
+// Screen-share automation: rules that mute, duck or switch the input while
+// a window with a matching title is open. Titles come in as change events
+// (a WinEvent hook on Windows, a synthetic feed anywhere else) and are
+// matched against the patterns of all rules in one pass.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <json/binding.h>
+
+struct HeosAutomationRule {
+	std::string name;
+	// All of these must appear in one window title, ignoring ASCII case.
+	std::vector<std::string> match;
+	// "mute", "duck" (to volume) or "input" (switch to input).
+	std::string action = "mute";
+	int volume = 10;
+	// duck: how long the fade down, and back up afterwards, takes, and its
+	// curve: "linear", "ease" or "exponential".
+	int rampMs = 1500;
+	std::string curve = "ease";
+	std::string input;
+	// Hysteresis: how long a match must hold before the rule starts, and
+	// how long it must be gone before the rule ends.
+	int onDelayMs = 0;
+	int offDelayMs = 2000;
+};
+
+// What the Slack loop used to do: mute while Slack is sharing the screen.
+std::vector<HeosAutomationRule> HeosDefaultAutomationRules();
+
+// Aho-Corasick automaton over UTF-8 bytes, folded to ASCII lower case.
+class HeosTitleMatcher {
+public:
+	// Empty patterns are ignored.
+	explicit HeosTitleMatcher(const std::vector<std::string>& patterns);
+
+	size_t PatternCount() const { return patternCount; }
+	// Calls found(pattern) for every pattern in text, once each.
+	template <class Found>
+	void Scan(const std::string& text, Found&& found) const;
+
+private:
+	size_t patternCount = 0;
+	std::vector<int32_t> next;            // [state * 256 + byte], fully resolved
+	std::vector<uint32_t> outputStart;    // [state], into outputs; one extra at the end
+	std::vector<uint32_t> outputs;        // pattern indices, including those of suffix states
+	mutable std::vector<uint32_t> seen;   // [pattern] = scan number it was last found in
+	mutable uint32_t scans = 0;
+};
+
+class HeosAutomation {
+public:
+	using Clock = std::chrono::steady_clock;
+	// A rule started (active) or ended.
+	using Action = std::function<void(const HeosAutomationRule& rule, bool active)>;
+
+	// Rules without patterns never match.
+	HeosAutomation(std::vector<HeosAutomationRule> rules, Action action);
+
+	// window is any id that stays the same for the life of the window.
+	void TitleChanged(uint64_t window, const std::string& title, Clock::time_point now = Clock::now());
+	void WindowClosed(uint64_t window, Clock::time_point now = Clock::now());
+	// Starts and ends the rules whose delay has run out.
+	void Update(Clock::time_point now = Clock::now());
+	// When Update() has something to do next, or Clock::time_point::max().
+	Clock::time_point NextDue() const;
+
+	const std::vector<HeosAutomationRule>& Rules() const { return rules; }
+	bool IsActive(size_t rule) const { return states[rule].active; }
+	// Windows that currently match the rule.
+	int MatchingWindows(size_t rule) const { return states[rule].windows; }
+
+private:
+	struct RuleState {
+		int windows = 0;
+		bool active = false;
+		bool pending = false;
+		Clock::time_point due;
+	};
+	struct Window {
+		std::string title;
+		std::vector<uint32_t> rules; // matching
+	};
+
+	void Match(const std::string& title, std::vector<uint32_t>& matching);
+	void SetRules(std::vector<uint32_t>& current, std::vector<uint32_t>& matching, Clock::time_point now);
+	void Schedule(size_t rule, Clock::time_point now);
+
+	std::vector<HeosAutomationRule> rules;
+	Action action;
+	// Filled while matcher is built
+	std::vector<std::vector<uint32_t>> patternRules; // [pattern] = rules that need it
+	std::vector<uint32_t> required;  // [rule] = distinct patterns it needs
+	HeosTitleMatcher matcher;
+	std::vector<RuleState> states;
+	std::unordered_map<uint64_t, Window> windows;
+	std::vector<uint32_t> found;     // [rule] = patterns found in the title being matched
+	std::vector<uint32_t> touched;   // rules with found > 0
+	std::vector<uint32_t> matching;  // scratch
+};
+
+// Where title changes come from.
+class HeosTitleSource {
+public:
+	virtual ~HeosTitleSource() = default;
+	// Reports the titles of the windows that are open, then every change,
+	// to automation. changed is called after each event so the caller can
+	// reschedule Update().
+	virtual bool Start(HeosAutomation& automation, std::function<void()> changed) = 0;
+	virtual void Stop() = 0;
+};
+
+#ifdef _WIN32
+// Out-of-context WinEvent hook on title, show, hide and destroy events of
+// top-level windows. The events arrive on the thread that called Start(),
+// which must pump messages. Only one can run at a time.
+class HeosWinEventTitleSource : public HeosTitleSource {
+public:
+	~HeosWinEventTitleSource() override { Stop(); }
+	bool Start(HeosAutomation& automation, std::function<void()> changed) override;
+	void Stop() override;
+};
+#endif
+
+template <class Found>
+void HeosTitleMatcher::Scan(const std::string& text, Found&& found) const
+{
+	if (patternCount == 0)
+		return;
+	if (++scans == 0) {
+		std::fill(seen.begin(), seen.end(), 0);
+		scans = 1;
+	}
+	const int32_t* table = next.data();
+	int32_t state = 0;
+	for (unsigned char c : text) {
+		state = table[state * 256 + c];
+		for (uint32_t i = outputStart[state], end = outputStart[state + 1]; i < end; ++i) {
+			uint32_t pattern = outputs[i];
+			if (seen[pattern] != scans) {
+				seen[pattern] = scans;
+				found(pattern);
+			}
+		}
+	}
+}
+
+namespace Json {
+
+template <> struct Binding<HeosAutomationRule> {
+	static constexpr auto fields() {
+		return std::make_tuple(
+			field("name", &HeosAutomationRule::name),
+			field("match", &HeosAutomationRule::match),
+			field("action", &HeosAutomationRule::action),
+			field("volume", &HeosAutomationRule::volume),
+			field("rampMs", &HeosAutomationRule::rampMs),
+			field("curve", &HeosAutomationRule::curve),
+			field("input", &HeosAutomationRule::input),
+			field("onDelayMs", &HeosAutomationRule::onDelayMs),
+			field("offDelayMs", &HeosAutomationRule::offDelayMs));
+	}
+};
+
+} // namespace Json
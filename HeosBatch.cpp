@@ -0,0 +1,236 @@
+#include "HeosBatch.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <thread>
+
+#include "HeosModel.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+const int DEFAULT_WAIT_MS = 5000;
+const int MAX_VOLUME_STEP = 10; // what volume_up and volume_down take
+
+// A whole number of at most 6 digits, optionally signed with one of signs
+bool ParseNumber(const std::string& text, const char* signs, int& number)
+{
+	size_t start = !text.empty() && strchr(signs, text[0]) ? 1 : 0;
+	if (text.size() == start || text.size() - start > 6 || text.find_first_not_of("0123456789", start) != std::string::npos)
+		return false;
+	number = atoi(text.c_str() + start);
+	if (start && text[0] == '-')
+		number = -number;
+	return true;
+}
+
+bool IsName(const std::string& text)
+{
+	return !text.empty() && text.size() <= 64 && text.find_first_not_of("abcdefghijklmnopqrstuvwxyz0123456789_") == std::string::npos;
+}
+
+std::string Replace(std::string text, const std::string& from, const std::string& to)
+{
+	for (size_t at = text.find(from); at != std::string::npos; at = text.find(from, at + to.size()))
+		text.replace(at, from.size(), to);
+	return text;
+}
+
+double Milliseconds(Clock::duration duration)
+{
+	return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+void LogStep(std::ostream& log, const HeosBatchStep& step, const char* result, double tookMs, double atMs)
+{
+	char line[256];
+	snprintf(line, sizeof(line), "%5d  %-36.36s %-7s %9.1f ms %10.1f ms\n", step.line, step.text.c_str(), result, tookMs, atMs);
+	log << line;
+}
+
+} // namespace
+
+bool HeosParseBatch(std::istream& in, const std::string& pid, std::vector<HeosBatchStep>& steps, std::string* errs)
+{
+	std::string text;
+	for (int number = 1; std::getline(in, text); ++number) {
+		if (!text.empty() && text.back() == '\r')
+			text.pop_back();
+		std::istringstream words(text);
+		std::string op, arg, extra;
+		words >> op >> arg;
+		if (op.empty() || op[0] == '#')
+			continue;
+
+		HeosBatchStep step;
+		step.line = number;
+		step.text = text.substr(text.find_first_not_of(" \t"));
+		std::string player = "?pid=" + pid;
+		std::string error;
+		int value = 0;
+		if (op == "mute") {
+			if (arg == "on" || arg == "off")
+				step.commands.push_back("player/set_mute" + player + "&state=" + arg);
+			else if (arg == "toggle")
+				step.commands.push_back("player/toggle_mute" + player);
+			else
+				error = "mute takes on, off or toggle";
+		}
+		else if (op == "volume") {
+			if (!ParseNumber(arg, "+-", value) || value < -100 || value > 100 || (arg[0] != '+' && arg[0] != '-' && value < 0)) {
+				error = "volume takes a level from 0 to 100, or +N or -N";
+			}
+			else if (arg[0] != '+' && arg[0] != '-') {
+				step.commands.push_back("player/set_volume" + player + "&level=" + arg);
+			}
+			else {
+				// The device steps at most 10 at a time
+				for (int left = std::abs(value); left > 0; left -= MAX_VOLUME_STEP) {
+					step.commands.push_back(std::string(value > 0 ? "player/volume_up" : "player/volume_down") + player
+						+ "&step=" + std::to_string(std::min(left, MAX_VOLUME_STEP)));
+				}
+			}
+		}
+		else if (op == "input") {
+			if (IsName(arg))
+				step.commands.push_back("player/play_input" + player + "&input=inputs/" + arg);
+			else
+				error = "input takes an input name, like optical_in_1";
+		}
+		else if (op == "send") {
+			if (!arg.empty())
+				step.commands.push_back(Replace(arg, "{pid}", pid));
+			else
+				error = "send takes a CLI command, like player/get_volume?pid={pid}";
+		}
+		else if (op == "wait") {
+			std::string timeout;
+			words >> step.event >> timeout;
+			step.waitMs = DEFAULT_WAIT_MS;
+			if (arg != "event" || !IsName(step.event) || (!timeout.empty() && !ParseNumber(timeout, "", step.waitMs)))
+				error = "wait takes event, an event name and an optional timeout in ms";
+		}
+		else if (op == "sleep") {
+			if (!ParseNumber(arg, "", step.waitMs))
+				error = "sleep takes a time in ms";
+		}
+		else {
+			error = "unknown operation " + op;
+		}
+
+		if (error.empty() && (words >> extra))
+			error = "unexpected " + extra;
+		if (!error.empty()) {
+			if (errs)
+				*errs = "line " + std::to_string(number) + ": " + error;
+			return false;
+		}
+		steps.push_back(step);
+	}
+	return true;
+}
+
+HeosBatchResult HeosRunBatch(HeosConnection& connection, const std::string& ip, const std::vector<HeosBatchStep>& steps, std::ostream& log)
+{
+	HeosBatchResult result;
+	result.steps = steps.size();
+
+	// Event names come in while replies are read, and while waiting
+	std::vector<std::string> seen;
+	connection.OnEvent([&seen](const std::string& line) { seen.push_back(HeosEventName(line)); });
+
+	auto start = Clock::now();
+	log << " line  step                                 result       took         at\n";
+	bool needEvents = std::any_of(steps.begin(), steps.end(), [](const HeosBatchStep& step) { return !step.event.empty(); });
+	if (needEvents) {
+		std::string reply;
+		if (!connection.Send(ip, "system/register_for_change_events?enable=on", reply))
+			log << "Could not register for change events\n";
+	}
+
+	for (size_t i = 0; i < steps.size();) {
+		const HeosBatchStep& step = steps[i];
+		if (!step.event.empty()) {
+			auto began = Clock::now();
+			auto match = [&step](const std::string& name) { return name == step.event; };
+			bool ok = std::find_if(seen.begin(), seen.end(), match) != seen.end()
+				|| connection.WaitForEvent(ip, [&step](const std::string& line) { return HeosEventName(line) == step.event; }, step.waitMs);
+			// Events up to this one are used up
+			auto found = std::find_if(seen.begin(), seen.end(), match);
+			if (found != seen.end())
+				seen.erase(seen.begin(), found + 1);
+			result.failed += ok ? 0 : 1;
+			auto now = Clock::now();
+			LogStep(log, step, ok ? "ok" : "timeout", Milliseconds(now - began), Milliseconds(now - start));
+			++i;
+			continue;
+		}
+		if (step.commands.empty()) {
+			auto began = Clock::now();
+			std::this_thread::sleep_for(std::chrono::milliseconds(step.waitMs));
+			auto now = Clock::now();
+			LogStep(log, step, "ok", Milliseconds(now - began), Milliseconds(now - start));
+			++i;
+			continue;
+		}
+
+		// The command steps from here to the next wait or sleep go out together
+		size_t end = i;
+		std::vector<std::string> requests;
+		std::vector<size_t> stepOf;
+		for (; end < steps.size() && !steps[end].commands.empty(); ++end) {
+			for (const auto& command : steps[end].commands) {
+				requests.push_back(command);
+				stepOf.push_back(end);
+			}
+		}
+
+		// A step took from when the one before it was answered (or the burst
+		// went out) until its last reply came in
+		seen.clear();
+		auto began = Clock::now();
+		auto previous = began;
+		bool failed = false;
+		std::vector<std::string> failures;
+		size_t answered = 0;
+		connection.SendAll(ip, requests, [&](size_t index, const std::string& reply) {
+			answered = index + 1;
+			HeosStatusReply status;
+			if (!Json::decode(reply.data(), reply.data() + reply.size(), status, nullptr) || status.heos.result != "success") {
+				failed = true;
+				failures.push_back(reply);
+			}
+			if (index + 1 < requests.size() && stepOf[index + 1] == stepOf[index])
+				return;
+			auto now = Clock::now();
+			LogStep(log, steps[stepOf[index]], failed ? "FAIL" : "ok", Milliseconds(now - previous), Milliseconds(now - start));
+			for (const auto& failure : failures)
+				log << "       " << failure << "\n";
+			result.failed += failed ? 1 : 0;
+			failed = false;
+			failures.clear();
+			previous = now;
+			});
+
+		// What was not answered, because the connection failed
+		for (size_t unanswered = answered < stepOf.size() ? stepOf[answered] : end; unanswered < end; ++unanswered) {
+			LogStep(log, steps[unanswered], "noreply", 0, Milliseconds(Clock::now() - start));
+			++result.failed;
+		}
+		i = end;
+	}
+
+	connection.OnEvent(nullptr);
+	result.totalMs = Milliseconds(Clock::now() - start);
+	char summary[128];
+	snprintf(summary, sizeof(summary), "%u steps, %u failed, %.1f ms\n", (unsigned)result.steps, (unsigned)result.failed, result.totalMs);
+	log << summary;
+	return result;
+}
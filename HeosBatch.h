@@ -0,0 +1,40 @@
+#pragma once
+
+// Headless batch mode: a script of player operations, one per line, run over
+// a HeosConnection with the time each step took. Operations in a row are
+// pipelined; "wait" and "sleep" wait for everything before them.
+//
+//   mute on|off|toggle
+//   volume 25 | +5 | -5
+//   input optical_in_1
+//   send player/get_volume?pid={pid}    any CLI command; {pid} is filled in
+//   wait event player_volume_changed    [timeout in ms, 5000 if left out]
+//   sleep 250
+//   # comment
+
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "HeosConnection.h"
+
+struct HeosBatchStep {
+	int line = 0;
+	std::string text;                  // as written
+	std::vector<std::string> commands; // CLI commands it sends
+	std::string event;                 // to wait for
+	int waitMs = 0;                    // for the event, or to sleep
+};
+
+struct HeosBatchResult {
+	size_t steps = 0;
+	size_t failed = 0;
+	double totalMs = 0;
+};
+
+// False, with the offending line in errs, if the script has a mistake.
+bool HeosParseBatch(std::istream& in, const std::string& pid, std::vector<HeosBatchStep>& steps, std::string* errs);
+
+// Runs steps against the device at ip, writing a line per step to log.
+HeosBatchResult HeosRunBatch(HeosConnection& connection, const std::string& ip, const std::vector<HeosBatchStep>& steps, std::ostream& log);
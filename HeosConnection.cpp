@@ -0,0 +1,249 @@
+#include "HeosConnection.h"
+
+#include <chrono>
+
+std::string HeosEventName(const std::string& line)
+{
+	size_t at = line.find("\"event/");
+	if (at == std::string::npos)
+		return "";
+	at += 7;
+	size_t end = line.find('"', at);
+	return end == std::string::npos ? "" : line.substr(at, end - at);
+}
+
+HeosConnection::HeosConnection(int port, int timeoutMs)
+	: port(port), timeoutMs(timeoutMs)
+{
+	HeosSocketsUp();
+}
+
+HeosConnection::~HeosConnection()
+{
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		stopping = true;
+	}
+	queued.notify_all();
+	if (worker.joinable())
+		worker.join();
+	Close();
+	HeosSocketsDown();
+}
+
+bool HeosConnection::Open(const std::string& ip)
+{
+	if (sock != HEOS_NO_SOCKET && connectedIP == ip)
+		return true;
+	Disconnect();
+
+	sockaddr_in server = {};
+	server.sin_family = AF_INET;
+	server.sin_port = htons((unsigned short)port);
+	if (inet_pton(AF_INET, ip.c_str(), &server.sin_addr) != 1)
+		return false;
+
+	sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (sock == HEOS_NO_SOCKET)
+		return false;
+	HeosSetTimeout(sock, timeoutMs);
+	int noDelay = 1;
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+	if (connect(sock, (sockaddr*)&server, sizeof(server)) != 0) {
+		Disconnect();
+		return false;
+	}
+	connectedIP = ip;
+	++connects;
+	return true;
+}
+
+void HeosConnection::Disconnect()
+{
+	if (sock != HEOS_NO_SOCKET)
+		HeosCloseSocket(sock);
+	sock = HEOS_NO_SOCKET;
+	connectedIP.clear();
+	received.clear();
+}
+
+bool HeosConnection::Write(const std::string& command)
+{
+	std::string request = "heos://" + command + "\r\n";
+	for (size_t sent = 0; sent < request.size();) {
+		int count = send(sock, request.data() + sent, (int)(request.size() - sent), HEOS_SEND_FLAGS);
+		if (count <= 0)
+			return false;
+		sent += (size_t)count;
+	}
+	return true;
+}
+
+bool HeosConnection::ReadLine(std::string& line, int timeoutMs, bool& timedOut)
+{
+	timedOut = false;
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+	size_t end;
+	while ((end = received.find("\r\n")) == std::string::npos) {
+		long long left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+		HeosPollFd fd = {};
+		fd.fd = sock;
+		fd.events = POLLIN;
+		if (left <= 0 || HeosPoll(&fd, 1, (int)left) == 0) {
+			timedOut = true;
+			return false;
+		}
+		char buffer[4096];
+		int count = recv(sock, buffer, sizeof(buffer), 0);
+		if (count <= 0 || received.size() > 1024 * 1024)
+			return false;
+		received.append(buffer, (size_t)count);
+	}
+	line = received.substr(0, end);
+	received.erase(0, end + 2);
+	return true;
+}
+
+bool HeosConnection::ReadReply(std::string& reply)
+{
+	std::string line;
+	bool timedOut;
+	while (ReadLine(line, timeoutMs, timedOut)) {
+		if (!HeosEventName(line).empty()) {
+			if (eventHandler)
+				eventHandler(line);
+			continue;
+		}
+		// Slow commands first answer "command under process", then for real
+		if (line.find('{') == std::string::npos || line.find("command under process") != std::string::npos)
+			continue;
+		reply.swap(line);
+		return true;
+	}
+	return false;
+}
+
+bool HeosConnection::Send(const std::string& ip, const std::string& command, std::string& reply)
+{
+	std::lock_guard<std::mutex> lock(sendMutex);
+	for (int attempt = 0; attempt < 2; ++attempt) {
+		bool fresh = sock == HEOS_NO_SOCKET || connectedIP != ip;
+		if (!Open(ip))
+			return false;
+		if (Write(command) && ReadReply(reply)) {
+			++commands;
+			return true;
+		}
+		// A reply that comes in late would be taken for the next one's
+		Disconnect();
+		if (fresh)
+			return false;
+	}
+	return false;
+}
+
+bool HeosConnection::SendAll(const std::string& ip, const std::vector<std::string>& requests, const Replied& replied)
+{
+	std::lock_guard<std::mutex> lock(sendMutex);
+	for (int attempt = 0; attempt < 2; ++attempt) {
+		bool fresh = sock == HEOS_NO_SOCKET || connectedIP != ip;
+		if (!Open(ip))
+			return false;
+		size_t written = 0;
+		size_t answered = 0;
+		std::string reply;
+		while (answered < requests.size()) {
+			// Bounded, or both ends could end up blocked writing
+			while (written < requests.size() && written - answered < PIPELINE_DEPTH && Write(requests[written]))
+				++written;
+			if (answered == written || !ReadReply(reply))
+				break;
+			++commands;
+			replied(answered++, reply);
+		}
+		if (answered == requests.size())
+			return true;
+		Disconnect();
+		// Only go again if none of them can have been done
+		if (fresh || answered > 0)
+			return false;
+	}
+	return false;
+}
+
+bool HeosConnection::WaitForEvent(const std::string& ip, const std::function<bool(const std::string& event)>& done, int timeoutMs)
+{
+	std::lock_guard<std::mutex> lock(sendMutex);
+	if (!Open(ip))
+		return false;
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+	for (;;) {
+		long long left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+		std::string line;
+		bool timedOut = left <= 0;
+		if (timedOut || !ReadLine(line, (int)left, timedOut)) {
+			// A line cut off by the timeout stays in received for later
+			if (!timedOut)
+				Disconnect();
+			return false;
+		}
+		if (HeosEventName(line).empty())
+			continue;
+		if (eventHandler)
+			eventHandler(line);
+		if (done(line))
+			return true;
+	}
+}
+
+void HeosConnection::OnEvent(EventHandler handler)
+{
+	std::lock_guard<std::mutex> lock(sendMutex);
+	eventHandler = std::move(handler);
+}
+
+void HeosConnection::SendAsync(std::string ip, std::string command, Callback done)
+{
+	std::lock_guard<std::mutex> lock(queueMutex);
+	if (!worker.joinable() && !stopping)
+		worker = std::thread(&HeosConnection::WorkerLoop, this);
+	queue.push_back({ std::move(ip), std::move(command), std::move(done) });
+	queued.notify_all();
+}
+
+void HeosConnection::Close()
+{
+	std::lock_guard<std::mutex> lock(sendMutex);
+	Disconnect();
+}
+
+size_t HeosConnection::Connects() const
+{
+	std::lock_guard<std::mutex> lock(sendMutex);
+	return connects;
+}
+
+size_t HeosConnection::Commands() const
+{
+	std::lock_guard<std::mutex> lock(sendMutex);
+	return commands;
+}
+
+void HeosConnection::WorkerLoop()
+{
+	std::unique_lock<std::mutex> lock(queueMutex);
+	while (!stopping) {
+		if (queue.empty()) {
+			queued.wait(lock);
+			continue;
+		}
+		Queued next = std::move(queue.front());
+		queue.pop_front();
+		lock.unlock();
+		std::string reply;
+		bool ok = Send(next.ip, next.command, reply);
+		if (next.done)
+			next.done(ok, reply);
+		lock.lock();
+	}
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+// The one connection to the device's CLI port (1255) that every command goes
+// through. It stays open between commands and is reopened when it breaks or
+// the device changes. Replies come back in the order the commands went out,
+// so they cannot be mixed up; change events the device sends in between
+// (once registered for) are told apart and passed on.
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "HeosSocket.h"
+
+// "player_volume_changed" for an event/player_volume_changed line, else "".
+std::string HeosEventName(const std::string& line);
+
+class HeosConnection {
+public:
+	using Callback = std::function<void(bool ok, const std::string& reply)>;
+	using Replied = std::function<void(size_t index, const std::string& reply)>;
+	using EventHandler = std::function<void(const std::string& event)>;
+
+	static const size_t PIPELINE_DEPTH = 32;
+
+	explicit HeosConnection(int port = 1255, int timeoutMs = 5000);
+	~HeosConnection();
+
+	// Sends heos://command to the device at ip and waits for its reply (the
+	// JSON line, without the line end). Tries a second time over a fresh
+	// connection if the open one turns out to be dead.
+	bool Send(const std::string& ip, const std::string& command, std::string& reply);
+	// The same on the connection's worker thread, in the order queued; done
+	// is called there.
+	void SendAsync(std::string ip, std::string command, Callback done);
+	// Pipelined: keeps up to PIPELINE_DEPTH requests going out ahead of
+	// their replies, calling replied(i, reply) as each comes in. False if
+	// the connection failed before every one was answered.
+	bool SendAll(const std::string& ip, const std::vector<std::string>& requests, const Replied& replied);
+	// Reads change events until done returns true for one (true), or
+	// timeoutMs passes or the connection fails (false).
+	bool WaitForEvent(const std::string& ip, const std::function<bool(const std::string& event)>& done, int timeoutMs);
+	// Gets every event line read, with the connection locked; set it
+	// before sending.
+	void OnEvent(EventHandler handler);
+	void Close();
+
+	size_t Connects() const;
+	size_t Commands() const;
+
+private:
+	struct Queued {
+		std::string ip;
+		std::string command;
+		Callback done;
+	};
+
+	// With sendMutex held
+	bool Open(const std::string& ip);
+	void Disconnect();
+	bool Write(const std::string& command);
+	bool ReadLine(std::string& line, int timeoutMs, bool& timedOut);
+	bool ReadReply(std::string& reply);
+
+	void WorkerLoop();
+
+	const int port;
+	const int timeoutMs;
+
+	mutable std::mutex sendMutex; // one command at a time
+	HeosSocket sock = HEOS_NO_SOCKET;
+	std::string connectedIP;
+	std::string received;         // read past the last reply
+	EventHandler eventHandler;
+	size_t connects = 0;
+	size_t commands = 0;
+
+	std::mutex queueMutex;
+	std::condition_variable queued;
+	std::deque<Queued> queue;
+	bool stopping = false;
+	std::thread worker;
+};
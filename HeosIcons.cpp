@@ -0,0 +1,868 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#include "HeosIcons.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#include <map>
+#include <mutex>
+#include <utility>
+#endif
+
+namespace {
+
+// Big images are not icons; the limit also keeps size arithmetic in range.
+const int MAX_IMAGE_SIZE = 4096;
+
+uint32_t ReadLE16(const unsigned char* p) { return p[0] | (p[1] << 8); }
+uint32_t ReadLE32(const unsigned char* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+uint32_t ReadBE32(const unsigned char* p) { return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+
+uint32_t Pixel(uint32_t a, uint32_t r, uint32_t g, uint32_t b) { return (a << 24) | (r << 16) | (g << 8) | b; }
+
+// DEFLATE (RFC 1951). Codes up to FAST_BITS long, which is nearly all of
+// them, are decoded with one table lookup; longer ones a bit at a time.
+const int FAST_BITS = 9;
+
+class Inflater {
+public:
+	Inflater(const unsigned char* data, size_t size, unsigned char* out, size_t limit) : data(data), size(size), out(out), limit(limit) {}
+
+	bool Run();
+	size_t Produced() const { return produced; }
+
+private:
+	struct Huffman {
+		uint16_t counts[16];   // codes of each length
+		uint16_t symbols[288]; // ordered by code
+		uint16_t fast[1 << FAST_BITS]; // by the next bits: length << 9 | symbol, or 0
+	};
+
+	void Refill();
+	uint32_t Bits(int count);
+	static bool Build(Huffman& code, const unsigned char* lengths, int n);
+	int Decode(const Huffman& code);
+	bool Stored();
+	bool Codes(const Huffman& lengthCode, const Huffman& distanceCode);
+	bool Fixed();
+	bool Dynamic();
+
+	const unsigned char* data;
+	size_t size;
+	unsigned char* out;
+	size_t limit;
+	size_t produced = 0;
+	size_t pos = 0;
+	uint32_t bitBuffer = 0;
+	int bitCount = 0;
+	bool overrun = false;
+};
+
+// Tops up the bit buffer without flagging the end of the input, so that a
+// table lookup can peek past the last code.
+void Inflater::Refill()
+{
+	while (bitCount <= 24 && pos < size) {
+		bitBuffer |= (uint32_t)data[pos++] << bitCount;
+		bitCount += 8;
+	}
+}
+
+uint32_t Inflater::Bits(int count)
+{
+	while (bitCount < count) {
+		if (pos == size) {
+			overrun = true;
+			return 0;
+		}
+		bitBuffer |= (uint32_t)data[pos++] << bitCount;
+		bitCount += 8;
+	}
+	uint32_t value = bitBuffer & ((1u << count) - 1);
+	bitBuffer >>= count;
+	bitCount -= count;
+	return value;
+}
+
+bool Inflater::Build(Huffman& code, const unsigned char* lengths, int n)
+{
+	memset(code.counts, 0, sizeof(code.counts));
+	memset(code.fast, 0, sizeof(code.fast));
+	for (int symbol = 0; symbol < n; ++symbol)
+		++code.counts[lengths[symbol]];
+	if (code.counts[0] == n)
+		return true; // no codes: fine until one is used
+
+	// Over-subscribed sets are corrupt; incomplete ones are allowed.
+	int left = 1;
+	for (int length = 1; length < 16; ++length) {
+		left = (left << 1) - code.counts[length];
+		if (left < 0)
+			return false;
+	}
+
+	uint16_t offsets[16];
+	offsets[1] = 0;
+	for (int length = 1; length < 15; ++length)
+		offsets[length + 1] = offsets[length] + code.counts[length];
+	for (int symbol = 0; symbol < n; ++symbol) {
+		if (lengths[symbol])
+			code.symbols[offsets[lengths[symbol]]++] = (uint16_t)symbol;
+	}
+
+	// Canonical codes are assigned in symbol order within each length; the
+	// stream sends them most significant bit first, so index by the reverse.
+	int next[16];
+	next[1] = 0;
+	for (int length = 1; length < 15; ++length)
+		next[length + 1] = (next[length] + code.counts[length]) << 1;
+	for (int symbol = 0; symbol < n; ++symbol) {
+		int length = lengths[symbol];
+		if (length == 0)
+			continue;
+		int bits = next[length]++;
+		if (length > FAST_BITS)
+			continue;
+		int reversed = 0;
+		for (int i = 0; i < length; ++i)
+			reversed |= ((bits >> i) & 1) << (length - 1 - i);
+		for (int fill = reversed; fill < (1 << FAST_BITS); fill += 1 << length)
+			code.fast[fill] = (uint16_t)(length << 9 | symbol);
+	}
+	return true;
+}
+
+int Inflater::Decode(const Huffman& code)
+{
+	Refill();
+	uint16_t entry = code.fast[bitBuffer & ((1u << FAST_BITS) - 1)];
+	int entryLength = entry >> 9;
+	if (entry && entryLength <= bitCount) {
+		bitBuffer >>= entryLength;
+		bitCount -= entryLength;
+		return entry & 0x1ff;
+	}
+
+	int bits = 0;  // code read so far
+	int first = 0; // first code of the current length
+	int index = 0; // its position in symbols
+	for (int length = 1; length < 16; ++length) {
+		bits |= (int)Bits(1);
+		if (overrun)
+			return -1;
+		int count = code.counts[length];
+		if (bits - first < count)
+			return code.symbols[index + bits - first];
+		index += count;
+		first = (first + count) << 1;
+		bits <<= 1;
+	}
+	return -1;
+}
+
+bool Inflater::Stored()
+{
+	// Skip to the byte boundary, then hand back the whole bytes that Refill()
+	// read ahead: the length fields start right after the block header.
+	bitBuffer >>= bitCount & 7;
+	bitCount -= bitCount & 7;
+	pos -= bitCount / 8;
+	bitBuffer = 0;
+	bitCount = 0;
+	if (size - pos < 4)
+		return false;
+	uint32_t length = ReadLE16(data + pos);
+	if ((~length & 0xffff) != ReadLE16(data + pos + 2))
+		return false;
+	pos += 4;
+	if (size - pos < length || limit - produced < length)
+		return false;
+	memcpy(out + produced, data + pos, length);
+	produced += length;
+	pos += length;
+	return true;
+}
+
+bool Inflater::Codes(const Huffman& lengthCode, const Huffman& distanceCode)
+{
+	static const uint16_t lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+	static const uint8_t lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+	static const uint16_t distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+	static const uint8_t distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+	for (;;) {
+		int symbol = Decode(lengthCode);
+		if (symbol < 0)
+			return false;
+		if (symbol < 256) {
+			if (produced == limit)
+				return false;
+			out[produced++] = (unsigned char)symbol;
+			continue;
+		}
+		if (symbol == 256)
+			return true;
+		symbol -= 257;
+		if (symbol >= 29)
+			return false;
+		size_t length = lengthBase[symbol] + Bits(lengthExtra[symbol]);
+		int distanceSymbol = Decode(distanceCode);
+		if (distanceSymbol < 0 || distanceSymbol >= 30)
+			return false;
+		size_t distance = distanceBase[distanceSymbol] + Bits(distanceExtra[distanceSymbol]);
+		if (overrun || distance > produced || limit - produced < length)
+			return false;
+		// The copy may overlap what it produces, so go byte by byte.
+		const unsigned char* from = out + produced - distance;
+		unsigned char* to = out + produced;
+		for (size_t i = 0; i < length; ++i)
+			to[i] = from[i];
+		produced += length;
+	}
+}
+
+bool Inflater::Fixed()
+{
+	struct FixedCodes {
+		Huffman lengthCode, distanceCode;
+		FixedCodes() {
+			unsigned char lengths[288];
+			int symbol = 0;
+			for (; symbol < 144; ++symbol) lengths[symbol] = 8;
+			for (; symbol < 256; ++symbol) lengths[symbol] = 9;
+			for (; symbol < 280; ++symbol) lengths[symbol] = 7;
+			for (; symbol < 288; ++symbol) lengths[symbol] = 8;
+			Build(lengthCode, lengths, 288);
+			std::fill(lengths, lengths + 30, (unsigned char)5);
+			Build(distanceCode, lengths, 30);
+		}
+	};
+	static const FixedCodes fixed;
+	return Codes(fixed.lengthCode, fixed.distanceCode);
+}
+
+bool Inflater::Dynamic()
+{
+	static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+	int lengthCount = (int)Bits(5) + 257;
+	int distanceCount = (int)Bits(5) + 1;
+	int codeLengthCount = (int)Bits(4) + 4;
+	if (overrun || lengthCount > 286 || distanceCount > 30)
+		return false;
+
+	unsigned char lengths[286 + 30] = {};
+	for (int i = 0; i < codeLengthCount; ++i)
+		lengths[order[i]] = (unsigned char)Bits(3);
+	Huffman lengthCode, distanceCode;
+	if (overrun || !Build(lengthCode, lengths, 19))
+		return false;
+
+	int index = 0;
+	while (index < lengthCount + distanceCount) {
+		int symbol = Decode(lengthCode);
+		if (symbol < 0)
+			return false;
+		if (symbol < 16) {
+			lengths[index++] = (unsigned char)symbol;
+			continue;
+		}
+		unsigned char repeated = 0;
+		int times;
+		if (symbol == 16) {
+			if (index == 0)
+				return false;
+			repeated = lengths[index - 1];
+			times = 3 + (int)Bits(2);
+		}
+		else if (symbol == 17)
+			times = 3 + (int)Bits(3);
+		else
+			times = 11 + (int)Bits(7);
+		if (overrun || index + times > lengthCount + distanceCount)
+			return false;
+		while (times--)
+			lengths[index++] = repeated;
+	}
+	if (lengths[256] == 0) // a block needs its end code
+		return false;
+	if (!Build(lengthCode, lengths, lengthCount) || !Build(distanceCode, lengths + lengthCount, distanceCount))
+		return false;
+	return Codes(lengthCode, distanceCode);
+}
+
+bool Inflater::Run()
+{
+	for (;;) {
+		uint32_t last = Bits(1);
+		uint32_t type = Bits(2);
+		if (overrun)
+			return false;
+		bool ok = type == 0 ? Stored() : type == 1 ? Fixed() : type == 2 ? Dynamic() : false;
+		if (!ok || overrun)
+			return false;
+		if (last)
+			return true;
+	}
+}
+
+// zlib (RFC 1950) framing around the DEFLATE data, which must fill out
+// exactly.
+bool Inflate(const unsigned char* data, size_t size, std::vector<unsigned char>& out)
+{
+	if (size < 2 || (data[0] & 0x0f) != 8 || ((data[0] << 8) | data[1]) % 31 != 0 || (data[1] & 0x20))
+		return false;
+	Inflater inflater(data + 2, size - 2, out.data(), out.size());
+	return inflater.Run() && inflater.Produced() == out.size();
+}
+
+// Written to compile to conditional moves: branches on pixel data mispredict.
+int Paeth(int a, int b, int c)
+{
+	int pa = std::abs(b - c); // = |p - a| for p = a + b - c
+	int pb = std::abs(a - c);
+	int pc = std::abs(a + b - 2 * c);
+	if (pb < pa) {
+		pa = pb;
+		a = b;
+	}
+	return pc < pa ? c : a;
+}
+
+// Undoes the per-row filters in place; rows keep their filter byte. The
+// first row reads a row of zeros above it.
+bool Unfilter(std::vector<unsigned char>& data, int height, size_t rowBytes, size_t pixelBytes)
+{
+	std::vector<unsigned char> zeros(rowBytes);
+	for (int y = 0; y < height; ++y) {
+		unsigned char* row = &data[y * (rowBytes + 1)];
+		const unsigned char* above = y ? row - rowBytes : zeros.data();
+		unsigned char filter = *row++;
+		size_t first = std::min(pixelBytes, rowBytes); // bytes with nothing to their left
+		switch (filter) {
+		case 0:
+			break;
+		case 1:
+			for (size_t i = pixelBytes; i < rowBytes; ++i)
+				row[i] = (unsigned char)(row[i] + row[i - pixelBytes]);
+			break;
+		case 2:
+			for (size_t i = 0; i < rowBytes; ++i)
+				row[i] = (unsigned char)(row[i] + above[i]);
+			break;
+		case 3:
+			for (size_t i = 0; i < first; ++i)
+				row[i] = (unsigned char)(row[i] + (above[i] >> 1));
+			for (size_t i = first; i < rowBytes; ++i)
+				row[i] = (unsigned char)(row[i] + ((row[i - pixelBytes] + above[i]) >> 1));
+			break;
+		case 4:
+			for (size_t i = 0; i < first; ++i)
+				row[i] = (unsigned char)(row[i] + above[i]);
+			for (size_t i = first; i < rowBytes; ++i)
+				row[i] = (unsigned char)(row[i] + Paeth(row[i - pixelBytes], above[i], above[i - pixelBytes]));
+			break;
+		default:
+			return false;
+		}
+	}
+	return true;
+}
+
+// Entry bits x..x+bits of a row with bits <= 8 per entry, most significant
+// first, as PNG and BMP both pack them.
+unsigned PackedEntry(const unsigned char* row, int x, int bits)
+{
+	int bit = x * bits;
+	return (row[bit >> 3] >> (8 - bits - (bit & 7))) & ((1u << bits) - 1);
+}
+
+bool DecodeDib(const unsigned char* data, size_t size, HeosImage& image)
+{
+	if (size < 40)
+		return false;
+	uint32_t headerSize = ReadLE32(data);
+	int width = (int)ReadLE32(data + 4);
+	int height = (int)ReadLE32(data + 8) / 2; // color rows, then the AND mask
+	int bitCount = (int)ReadLE16(data + 14);
+	uint32_t compression = ReadLE32(data + 16);
+	uint32_t colorsUsed = ReadLE32(data + 32);
+	if (headerSize < 40 || headerSize > size || width <= 0 || height <= 0 || width > MAX_IMAGE_SIZE || height > MAX_IMAGE_SIZE)
+		return false;
+	if (compression != 0) // BI_RGB only; icons are never compressed
+		return false;
+	if (bitCount != 1 && bitCount != 4 && bitCount != 8 && bitCount != 24 && bitCount != 32)
+		return false;
+
+	const unsigned char* palette = data + headerSize;
+	uint32_t paletteCount = 0;
+	if (bitCount <= 8)
+		paletteCount = colorsUsed && colorsUsed < (1u << bitCount) ? colorsUsed : 1u << bitCount;
+	const unsigned char* colors = palette + paletteCount * 4;
+	size_t colorStride = ((size_t)width * bitCount + 31) / 32 * 4;
+	size_t maskStride = ((size_t)width + 31) / 32 * 4;
+	if ((size_t)(colors - data) + colorStride * height > size)
+		return false;
+	const unsigned char* mask = colors + colorStride * height;
+	bool hasMask = (size_t)(mask - data) + maskStride * height <= size;
+
+	image.width = width;
+	image.height = height;
+	image.pixels.resize((size_t)width * height);
+	bool hasAlpha = false;
+	for (int y = 0; y < height; ++y) {
+		const unsigned char* row = colors + colorStride * (height - 1 - y); // bottom-up
+		uint32_t* out = &image.pixels[(size_t)y * width];
+		for (int x = 0; x < width; ++x) {
+			if (bitCount == 32) {
+				const unsigned char* p = row + x * 4;
+				out[x] = Pixel(p[3], p[2], p[1], p[0]);
+				hasAlpha |= p[3] != 0;
+			}
+			else if (bitCount == 24) {
+				const unsigned char* p = row + x * 3;
+				out[x] = Pixel(255, p[2], p[1], p[0]);
+			}
+			else {
+				unsigned entry = PackedEntry(row, x, bitCount);
+				if (entry >= paletteCount)
+					return false;
+				const unsigned char* p = palette + entry * 4;
+				out[x] = Pixel(255, p[2], p[1], p[0]);
+			}
+		}
+	}
+
+	// 32-bit entries carry their own alpha; older ones use the mask. A set
+	// mask bit is transparent.
+	if (hasAlpha || !hasMask) {
+		if (!hasAlpha && bitCount == 32) {
+			for (uint32_t& pixel : image.pixels)
+				pixel |= 0xff000000u;
+		}
+		return true;
+	}
+	for (int y = 0; y < height; ++y) {
+		const unsigned char* row = mask + maskStride * (height - 1 - y);
+		uint32_t* out = &image.pixels[(size_t)y * width];
+		for (int x = 0; x < width; ++x)
+			out[x] = PackedEntry(row, x, 1) ? 0 : out[x] | 0xff000000u;
+	}
+	return true;
+}
+
+} // namespace
+
+bool HeosDecodePng(const unsigned char* data, size_t size, HeosImage& image)
+{
+	static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	if (size < 8 || memcmp(data, signature, 8) != 0)
+		return false;
+
+	int width = 0, height = 0, depth = 0, colorType = -1;
+	std::vector<unsigned char> compressed;
+	unsigned char palette[256][4];
+	int paletteCount = 0;
+	int transparentGray = -1;
+	int transparentRgb[3] = { -1, -1, -1 };
+	for (size_t pos = 8; pos + 12 <= size;) {
+		uint32_t length = ReadBE32(data + pos);
+		const unsigned char* type = data + pos + 4;
+		const unsigned char* chunk = data + pos + 8;
+		if (length > size - pos - 12)
+			return false;
+		pos += 12 + length;
+
+		if (!memcmp(type, "IHDR", 4)) {
+			if (length < 13)
+				return false;
+			width = (int)ReadBE32(chunk);
+			height = (int)ReadBE32(chunk + 4);
+			depth = chunk[8];
+			colorType = chunk[9];
+			if (chunk[10] != 0 || chunk[11] != 0)
+				return false;
+			if (chunk[12] != 0) // Adam7 interlacing: never used for icons
+				return false;
+		}
+		else if (!memcmp(type, "PLTE", 4)) {
+			paletteCount = (int)std::min<uint32_t>(length / 3, 256);
+			for (int i = 0; i < paletteCount; ++i) {
+				palette[i][0] = chunk[i * 3];
+				palette[i][1] = chunk[i * 3 + 1];
+				palette[i][2] = chunk[i * 3 + 2];
+				palette[i][3] = 255;
+			}
+		}
+		else if (!memcmp(type, "tRNS", 4)) {
+			if (colorType == 3) {
+				for (int i = 0; i < (int)length && i < paletteCount; ++i)
+					palette[i][3] = chunk[i];
+			}
+			else if (colorType == 0 && length >= 2)
+				transparentGray = (int)((chunk[0] << 8) | chunk[1]);
+			else if (colorType == 2 && length >= 6) {
+				for (int i = 0; i < 3; ++i)
+					transparentRgb[i] = (int)((chunk[i * 2] << 8) | chunk[i * 2 + 1]);
+			}
+		}
+		else if (!memcmp(type, "IDAT", 4))
+			compressed.insert(compressed.end(), chunk, chunk + length);
+		else if (!memcmp(type, "IEND", 4))
+			break;
+	}
+	if (width <= 0 || height <= 0 || width > MAX_IMAGE_SIZE || height > MAX_IMAGE_SIZE)
+		return false;
+
+	int channels;
+	switch (colorType) {
+	case 0: channels = 1; break;
+	case 2: channels = 3; break;
+	case 3: channels = 1; break;
+	case 4: channels = 2; break;
+	case 6: channels = 4; break;
+	default: return false;
+	}
+	bool validDepth = depth == 8 || (depth == 16 && colorType != 3) || ((depth == 1 || depth == 2 || depth == 4) && (colorType == 0 || colorType == 3));
+	if (!validDepth || (colorType == 3 && paletteCount == 0))
+		return false;
+
+	size_t rowBytes = ((size_t)width * channels * depth + 7) / 8;
+	size_t pixelBytes = std::max<size_t>(1, (size_t)channels * depth / 8);
+	size_t expected = (rowBytes + 1) * height;
+	std::vector<unsigned char> raw(expected);
+	if (!Inflate(compressed.data(), compressed.size(), raw))
+		return false;
+	if (!Unfilter(raw, height, rowBytes, pixelBytes))
+		return false;
+
+	image.width = width;
+	image.height = height;
+	image.pixels.resize((size_t)width * height);
+	const int step = depth == 16 ? 2 : 1; // 16-bit samples keep their high byte
+	for (int y = 0; y < height; ++y) {
+		const unsigned char* row = &raw[y * (rowBytes + 1) + 1];
+		uint32_t* out = &image.pixels[(size_t)y * width];
+		for (int x = 0; x < width; ++x) {
+			if (colorType == 3) {
+				unsigned entry = PackedEntry(row, x, depth);
+				if ((int)entry >= paletteCount)
+					return false;
+				const unsigned char* p = palette[entry];
+				out[x] = Pixel(p[3], p[0], p[1], p[2]);
+				continue;
+			}
+			const unsigned char* p = row + (size_t)x * channels * step;
+			if (colorType == 0) {
+				unsigned gray = depth < 8 ? PackedEntry(row, x, depth) : p[0];
+				unsigned sample = depth == 16 ? (p[0] << 8) | p[1] : gray;
+				if (depth < 8)
+					gray = gray * 255 / ((1u << depth) - 1);
+				out[x] = Pixel((int)sample == transparentGray ? 0 : 255, gray, gray, gray);
+			}
+			else if (colorType == 2) {
+				bool transparent = depth == 16
+					? ((p[0] << 8) | p[1]) == transparentRgb[0] && ((p[2] << 8) | p[3]) == transparentRgb[1] && ((p[4] << 8) | p[5]) == transparentRgb[2]
+					: p[0] == transparentRgb[0] && p[1] == transparentRgb[1] && p[2] == transparentRgb[2];
+				out[x] = Pixel(transparent ? 0 : 255, p[0], p[step], p[2 * step]);
+			}
+			else if (colorType == 4)
+				out[x] = Pixel(p[step], p[0], p[0], p[0]);
+			else
+				out[x] = Pixel(p[3 * step], p[0], p[step], p[2 * step]);
+		}
+	}
+	return true;
+}
+
+bool HeosDecodeIconImage(const unsigned char* data, size_t size, HeosImage& image)
+{
+	if (size >= 8 && data[0] == 0x89 && !memcmp(data + 1, "PNG", 3))
+		return HeosDecodePng(data, size, image);
+	return DecodeDib(data, size, image);
+}
+
+bool HeosDecodeIco(const unsigned char* data, size_t size, int wantedSize, HeosImage& image)
+{
+	if (size < 6 || ReadLE16(data) != 0 || ReadLE16(data + 4) == 0)
+		return false;
+	uint32_t count = ReadLE16(data + 4);
+	if (6 + 16 * (size_t)count > size)
+		return false;
+
+	int best = -1, bestSize = 0, bestDepth = 0;
+	for (uint32_t i = 0; i < count; ++i) {
+		const unsigned char* entry = data + 6 + 16 * i;
+		int entrySize = entry[0] ? entry[0] : 256;
+		int entryDepth = (int)ReadLE16(entry + 6);
+		uint32_t length = ReadLE32(entry + 8);
+		uint32_t offset = ReadLE32(entry + 12);
+		if (offset > size || length > size - offset)
+			continue;
+		bool better;
+		if (best < 0)
+			better = true;
+		else if (entrySize == bestSize)
+			better = entryDepth > bestDepth;
+		else if ((entrySize >= wantedSize) != (bestSize >= wantedSize))
+			better = entrySize >= wantedSize;
+		else
+			better = entrySize >= wantedSize ? entrySize < bestSize : entrySize > bestSize;
+		if (better) {
+			best = (int)i;
+			bestSize = entrySize;
+			bestDepth = entryDepth;
+		}
+	}
+	if (best < 0)
+		return false;
+	const unsigned char* entry = data + 6 + 16 * best;
+	return HeosDecodeIconImage(data + ReadLE32(entry + 12), ReadLE32(entry + 8), image);
+}
+
+namespace {
+
+// Weights below are fixed point with this many fraction bits.
+const int WEIGHT_BITS = 14;
+
+// For each target pixel along one axis, the source pixels it covers and by
+// how much; the weights of one target pixel add up to exactly 1.
+struct Spans {
+	std::vector<int> first;       // first source pixel, per target pixel
+	std::vector<size_t> offsets;  // into weights, per target pixel plus one
+	std::vector<uint32_t> weights;
+
+	Spans(int sourceSize, int targetSize);
+};
+
+Spans::Spans(int sourceSize, int targetSize)
+{
+	first.resize(targetSize);
+	offsets.resize(targetSize + 1);
+	for (int t = 0; t < targetSize; ++t) {
+		// Target pixel t spans [begin, end) in units of 1/targetSize source
+		// pixel.
+		int64_t begin = (int64_t)t * sourceSize;
+		int64_t end = begin + sourceSize;
+		first[t] = (int)(begin / targetSize);
+		offsets[t] = weights.size();
+		uint32_t total = 0;
+		size_t largest = offsets[t];
+		for (int s = first[t]; (int64_t)s * targetSize < end; ++s) {
+			int64_t covered = std::min<int64_t>(end, (int64_t)(s + 1) * targetSize) - std::max<int64_t>(begin, (int64_t)s * targetSize);
+			weights.push_back((uint32_t)((covered << WEIGHT_BITS) / sourceSize));
+			total += weights.back();
+			if (weights.back() > weights[largest])
+				largest = weights.size() - 1;
+		}
+		weights[largest] += (1u << WEIGHT_BITS) - total; // rounding residue
+	}
+	offsets[targetSize] = weights.size();
+}
+
+} // namespace
+
+HeosImage HeosScaleImage(const HeosImage& source, int width, int height)
+{
+	HeosImage target;
+	if (width <= 0 || height <= 0 || source.width <= 0 || source.height <= 0)
+		return target;
+	if (width == source.width && height == source.height)
+		return source;
+
+	// Premultiply once, one channel per element, so the passes below are
+	// plain multiply-adds.
+	std::vector<unsigned char> premultiplied(source.pixels.size() * 4);
+	for (size_t i = 0; i < source.pixels.size(); ++i) {
+		uint32_t pixel = source.pixels[i];
+		uint32_t alpha = pixel >> 24;
+		premultiplied[i * 4] = (unsigned char)(((pixel & 0xff) * alpha + 127) / 255);
+		premultiplied[i * 4 + 1] = (unsigned char)((((pixel >> 8) & 0xff) * alpha + 127) / 255);
+		premultiplied[i * 4 + 2] = (unsigned char)((((pixel >> 16) & 0xff) * alpha + 127) / 255);
+		premultiplied[i * 4 + 3] = (unsigned char)alpha;
+	}
+
+	// Horizontal pass, keeping 8 fraction bits so the vertical pass does not
+	// round twice.
+	const int keptBits = 8;
+	Spans columns(source.width, width);
+	std::vector<uint32_t> horizontal((size_t)source.height * width * 4);
+	for (int y = 0; y < source.height; ++y) {
+		const unsigned char* in = &premultiplied[(size_t)y * source.width * 4];
+		uint32_t* out = &horizontal[(size_t)y * width * 4];
+		for (int x = 0; x < width; ++x) {
+			const unsigned char* pixel = in + (size_t)columns.first[x] * 4;
+			uint32_t sum[4] = {};
+			for (size_t i = columns.offsets[x]; i < columns.offsets[x + 1]; ++i, pixel += 4) {
+				for (int c = 0; c < 4; ++c)
+					sum[c] += columns.weights[i] * pixel[c];
+			}
+			for (int c = 0; c < 4; ++c)
+				out[x * 4 + c] = (sum[c] + (1u << (WEIGHT_BITS - keptBits - 1))) >> (WEIGHT_BITS - keptBits);
+		}
+	}
+
+	// Unpremultiplying divides by alpha; multiply by its reciprocal instead.
+	static const struct Reciprocals {
+		uint32_t of[256];
+		Reciprocals() {
+			of[0] = 0;
+			for (uint32_t alpha = 1; alpha < 256; ++alpha)
+				of[alpha] = ((255u << 16) + alpha / 2) / alpha;
+		}
+	} reciprocals;
+
+	Spans rows(source.height, height);
+	target.width = width;
+	target.height = height;
+	target.pixels.resize((size_t)width * height);
+	const int shift = WEIGHT_BITS + keptBits;
+	std::vector<uint32_t> sums((size_t)width * 4);
+	for (int y = 0; y < height; ++y) {
+		std::fill(sums.begin(), sums.end(), 0);
+		for (size_t i = rows.offsets[y]; i < rows.offsets[y + 1]; ++i) {
+			const uint32_t* in = &horizontal[(size_t)(rows.first[y] + (i - rows.offsets[y])) * width * 4];
+			const uint32_t weight = rows.weights[i];
+			for (size_t c = 0; c < sums.size(); ++c)
+				sums[c] += weight * in[c];
+		}
+		uint32_t* out = &target.pixels[(size_t)y * width];
+		for (int x = 0; x < width; ++x) {
+			uint32_t channel[4];
+			for (int c = 0; c < 4; ++c)
+				channel[c] = (sums[x * 4 + c] + (1u << (shift - 1))) >> shift;
+			uint32_t alpha = channel[3];
+			for (int c = 0; c < 3; ++c)
+				channel[c] = std::min<uint32_t>(255, (channel[c] * reciprocals.of[alpha] + 0x8000) >> 16);
+			out[x] = Pixel(alpha, channel[2], channel[1], channel[0]);
+		}
+	}
+	return target;
+}
+
+HeosImage HeosFitImage(const HeosImage& source, int size)
+{
+	if (source.width <= 0 || source.height <= 0)
+		return HeosImage();
+	int width = source.width >= source.height ? size : std::max(1, source.width * size / source.height);
+	int height = source.height >= source.width ? size : std::max(1, source.height * size / source.width);
+	return HeosScaleImage(source, width, height);
+}
+
+#ifdef _WIN32
+
+namespace {
+
+std::mutex iconMutex;
+std::map<std::pair<int, int>, HICON> icons; // (iconID, size)
+
+bool LoadIconResource(int iconID, int size, HeosImage& image)
+{
+	HMODULE module = GetModuleHandle(NULL);
+	HRSRC group = FindResource(module, MAKEINTRESOURCE(iconID), RT_GROUP_ICON);
+	HGLOBAL groupData = group ? LoadResource(module, group) : NULL;
+	if (!groupData)
+		return false;
+	int entryID = LookupIconIdFromDirectoryEx((PBYTE)LockResource(groupData), TRUE, size, size, LR_DEFAULTCOLOR);
+	HRSRC entry = entryID ? FindResource(module, MAKEINTRESOURCE(entryID), RT_ICON) : NULL;
+	HGLOBAL entryData = entry ? LoadResource(module, entry) : NULL;
+	if (!entryData)
+		return false;
+	return HeosDecodeIconImage((const unsigned char*)LockResource(entryData), SizeofResource(module, entry), image);
+}
+
+HICON CreateIconFromImage(const HeosImage& image)
+{
+	BITMAPV5HEADER header = {};
+	header.bV5Size = sizeof(header);
+	header.bV5Width = image.width;
+	header.bV5Height = -image.height; // top-down, like HeosImage
+	header.bV5Planes = 1;
+	header.bV5BitCount = 32;
+	header.bV5Compression = BI_BITFIELDS;
+	header.bV5RedMask = 0x00ff0000;
+	header.bV5GreenMask = 0x0000ff00;
+	header.bV5BlueMask = 0x000000ff;
+	header.bV5AlphaMask = 0xff000000;
+
+	void* bits = NULL;
+	HDC dc = GetDC(NULL);
+	HBITMAP color = CreateDIBSection(dc, (BITMAPINFO*)&header, DIB_RGB_COLORS, &bits, NULL, 0);
+	ReleaseDC(NULL, dc);
+	if (!color)
+		return NULL;
+	memcpy(bits, image.pixels.data(), image.pixels.size() * sizeof(uint32_t));
+
+	// The alpha channel decides transparency; the mask only has to exist.
+	std::vector<unsigned char> maskBits((size_t)(image.width + 15) / 16 * 2 * image.height);
+	HBITMAP mask = CreateBitmap(image.width, image.height, 1, 1, maskBits.data());
+
+	ICONINFO info = {};
+	info.fIcon = TRUE;
+	info.hbmMask = mask;
+	info.hbmColor = color;
+	HICON icon = mask ? CreateIconIndirect(&info) : NULL;
+	if (mask)
+		DeleteObject(mask);
+	DeleteObject(color);
+	return icon;
+}
+
+// Fitted into size x size and centered on transparency, so a non-square
+// entry keeps its proportions instead of being stretched.
+HeosImage SquareImage(const HeosImage& source, int size)
+{
+	HeosImage fitted = HeosFitImage(source, size);
+	if (fitted.width == size && fitted.height == size)
+		return fitted;
+	HeosImage square;
+	square.width = size;
+	square.height = size;
+	square.pixels.assign((size_t)size * size, 0);
+	int left = (size - fitted.width) / 2;
+	int top = (size - fitted.height) / 2;
+	for (int y = 0; y < fitted.height; ++y)
+		std::copy_n(&fitted.pixels[(size_t)y * fitted.width], fitted.width, &square.pixels[(size_t)(top + y) * size + left]);
+	return square;
+}
+
+} // namespace
+
+HICON HeosGetIcon(int iconID, int size)
+{
+	std::lock_guard<std::mutex> lock(iconMutex);
+	auto found = icons.find(std::make_pair(iconID, size));
+	if (found != icons.end())
+		return found->second;
+
+	HICON icon = NULL;
+	HeosImage image;
+	if (LoadIconResource(iconID, size, image))
+		icon = CreateIconFromImage(SquareImage(image, size));
+	if (!icon) // let the system have a go at anything we cannot decode
+		icon = (HICON)LoadImage(GetModuleHandle(NULL), MAKEINTRESOURCE(iconID), IMAGE_ICON, size, size, 0);
+	icons[std::make_pair(iconID, size)] = icon;
+	return icon;
+}
+
+void HeosFreeIcons()
+{
+	std::lock_guard<std::mutex> lock(iconMutex);
+	for (auto& icon : icons) {
+		if (icon.second)
+			DestroyIcon(icon.second);
+	}
+	icons.clear();
+}
+
+HICON HeosCreateIcon(const HeosImage& image)
+{
+	return CreateIconFromImage(image);
+}
+
+#endif
@@ -0,0 +1,50 @@
+#pragma once
+
+// Icon pipeline: decodes the shipped .ico assets (BMP or PNG entries) and
+// scales them to the size that is needed, once. The decoding and scaling
+// parts are plain C++ so they can be built and measured off Windows.
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+// Rows top to bottom, one 0xAARRGGBB pixel each (BGRA bytes in memory, as in
+// a 32-bit DIB), straight alpha.
+struct HeosImage {
+	int width = 0;
+	int height = 0;
+	std::vector<uint32_t> pixels;
+};
+
+// One image as stored in an .ico entry or an RT_ICON resource: a PNG, or a
+// BMP DIB of 1, 4, 8, 24 or 32 bits with its AND mask.
+bool HeosDecodeIconImage(const unsigned char* data, size_t size, HeosImage& image);
+
+// The entry of an .ico file that suits wantedSize x wantedSize best: the
+// smallest one at least that big, else the biggest; the deeper one on a tie.
+bool HeosDecodeIco(const unsigned char* data, size_t size, int wantedSize, HeosImage& image);
+
+// Non-interlaced PNG, any color type, bit depths 1 to 16.
+bool HeosDecodePng(const unsigned char* data, size_t size, HeosImage& image);
+
+// Box filter: each target pixel is the coverage-weighted average of the
+// source pixels under it, in premultiplied alpha so transparent pixels do
+// not darken the edges.
+HeosImage HeosScaleImage(const HeosImage& source, int width, int height);
+
+// Scaled to fit in size x size, keeping its aspect ratio.
+HeosImage HeosFitImage(const HeosImage& source, int size);
+
+#ifdef _WIN32
+// Icon resource iconID at size x size pixels, decoded and scaled on first
+// use. The cache owns the handle; it stays valid until HeosFreeIcons().
+HICON HeosGetIcon(int iconID, int size);
+void HeosFreeIcons();
+
+// An icon of image as it is; the caller destroys it.
+HICON HeosCreateIcon(const HeosImage& image);
+#endif
@@ -0,0 +1,140 @@
+#pragma once
+
+// Typed HEOS replies, decoded straight from the socket by Json::BindingHandler.
+
+#include <string>
+#include <vector>
+
+#include <json/binding.h>
+
+struct HeosStatus {
+	std::string command;
+	std::string result;
+	std::string message;
+};
+
+struct HeosPlayer {
+	std::string name;
+	std::string ip;
+	std::string pid;
+	std::string gid;
+	std::string model;
+	std::string version;
+	std::string network;
+	std::string serial;
+	int lineout = 0;
+};
+
+struct HeosGroupMember {
+	std::string name;
+	std::string pid;
+	std::string role; // "leader" or "member"
+};
+
+struct HeosGroup {
+	std::string name;
+	std::string gid;
+	std::vector<HeosGroupMember> players;
+};
+
+// get_now_playing_media. Inputs such as optical in come as type "station"
+// with mid "inputs/optical_in_1".
+struct HeosNowPlayingMedia {
+	std::string type; // "song" or "station"
+	std::string song;
+	std::string album;
+	std::string artist;
+	std::string station;
+	std::string image_url;
+	std::string album_id;
+	std::string mid;
+	std::string sid;
+};
+
+// {"heos": {...}, "payload": ...}
+template <class Payload>
+struct HeosReply {
+	HeosStatus heos;
+	Payload payload;
+};
+
+// Any reply, when only whether the command worked matters.
+struct HeosStatusReply {
+	HeosStatus heos;
+};
+
+namespace Json {
+
+template <> struct Binding<HeosStatus> {
+	static constexpr auto fields() {
+		return std::make_tuple(
+			field("command", &HeosStatus::command),
+			field("result", &HeosStatus::result),
+			field("message", &HeosStatus::message));
+	}
+};
+
+template <> struct Binding<HeosPlayer> {
+	static constexpr auto fields() {
+		return std::make_tuple(
+			field("name", &HeosPlayer::name),
+			field("ip", &HeosPlayer::ip),
+			field("pid", &HeosPlayer::pid),
+			field("gid", &HeosPlayer::gid),
+			field("model", &HeosPlayer::model),
+			field("version", &HeosPlayer::version),
+			field("network", &HeosPlayer::network),
+			field("serial", &HeosPlayer::serial),
+			field("lineout", &HeosPlayer::lineout));
+	}
+};
+
+template <> struct Binding<HeosGroupMember> {
+	static constexpr auto fields() {
+		return std::make_tuple(
+			field("name", &HeosGroupMember::name),
+			field("pid", &HeosGroupMember::pid),
+			field("role", &HeosGroupMember::role));
+	}
+};
+
+template <> struct Binding<HeosGroup> {
+	static constexpr auto fields() {
+		return std::make_tuple(
+			field("name", &HeosGroup::name),
+			field("gid", &HeosGroup::gid),
+			field("players", &HeosGroup::players));
+	}
+};
+
+template <> struct Binding<HeosNowPlayingMedia> {
+	static constexpr auto fields() {
+		return std::make_tuple(
+			field("type", &HeosNowPlayingMedia::type),
+			field("song", &HeosNowPlayingMedia::song),
+			field("album", &HeosNowPlayingMedia::album),
+			field("artist", &HeosNowPlayingMedia::artist),
+			field("station", &HeosNowPlayingMedia::station),
+			field("image_url", &HeosNowPlayingMedia::image_url),
+			field("album_id", &HeosNowPlayingMedia::album_id),
+			field("mid", &HeosNowPlayingMedia::mid),
+			field("sid", &HeosNowPlayingMedia::sid));
+	}
+};
+
+template <> struct Binding<HeosStatusReply> {
+	static constexpr auto fields() {
+		return std::make_tuple(
+			field("heos", &HeosStatusReply::heos));
+	}
+};
+
+template <class Payload> struct Binding<HeosReply<Payload>> {
+	static constexpr auto fields() {
+		return std::make_tuple(
+			field("heos", &HeosReply<Payload>::heos),
+			field("payload", &HeosReply<Payload>::payload));
+	}
+};
+
+} // namespace Json
@@ -0,0 +1,213 @@
+#include "HeosNowPlaying.h"
+
+#include <chrono>
+
+namespace {
+
+const int WAIT_SLICE_MS = 500;  // how soon Stop() is noticed
+const int RETRY_MS = 5000;      // after the device did not answer
+const int TIMEOUT_MS = 2000;
+
+std::string Lowercase(std::string text)
+{
+	for (auto& c : text) {
+		if (c >= 'A' && c <= 'Z')
+			c = (char)(c - 'A' + 'a');
+	}
+	return text;
+}
+
+bool Same(const HeosNowPlayingState& a, const HeosNowPlayingState& b)
+{
+	const HeosNowPlayingMedia& x = a.media;
+	const HeosNowPlayingMedia& y = b.media;
+	return a.playState == b.playState && a.known == b.known && x.type == y.type && x.song == y.song && x.album == y.album
+		&& x.artist == y.artist && x.station == y.station && x.image_url == y.image_url && x.album_id == y.album_id
+		&& x.mid == y.mid && x.sid == y.sid;
+}
+
+} // namespace
+
+bool HeosNowPlayingState::IsInput(const std::string& input) const
+{
+	const std::string prefix = "inputs/";
+	if (media.mid.compare(0, prefix.size(), prefix) == 0) {
+		std::string name = media.mid.substr(prefix.size());
+		return name == input || name.compare(0, input.size() + 1, input + "_") == 0;
+	}
+	// Older firmware only names the input in the song
+	return media.mid.empty() && Lowercase(media.song).find(input) != std::string::npos;
+}
+
+std::string HeosMessageValue(const std::string& line, const std::string& key)
+{
+	size_t at = line.find("\"message\"");
+	at = at == std::string::npos ? at : line.find('"', line.find(':', at) + 1);
+	if (at == std::string::npos)
+		return "";
+	size_t end = line.find('"', ++at);
+	std::string message = "&" + line.substr(at, end == std::string::npos ? std::string::npos : end - at) + "&";
+	size_t found = message.find("&" + key + "=");
+	if (found == std::string::npos)
+		return "";
+	found += key.size() + 2;
+	return message.substr(found, message.find('&', found) - found);
+}
+
+HeosNowPlaying::HeosNowPlaying(Changed changed, int port, int heartbeatMs)
+	: changed(std::move(changed)), heartbeatMs(heartbeatMs), connection(port, TIMEOUT_MS)
+{
+}
+
+HeosNowPlaying::~HeosNowPlaying()
+{
+	Stop();
+}
+
+void HeosNowPlaying::Start(const std::string& ip, const std::string& pid)
+{
+	std::lock_guard<std::mutex> started(control);
+	StopWatching();
+	watchingIp = ip;
+	watchingPid = pid;
+	std::lock_guard<std::mutex> lock(mutex);
+	stopping = false;
+	state = HeosNowPlayingState();
+	thread = std::thread(&HeosNowPlaying::WatchLoop, this, ip, pid);
+}
+
+void HeosNowPlaying::Stop()
+{
+	std::lock_guard<std::mutex> started(control);
+	StopWatching();
+	watchingIp.clear();
+	watchingPid.clear();
+	std::lock_guard<std::mutex> lock(mutex);
+	state = HeosNowPlayingState();
+}
+
+bool HeosNowPlaying::IsWatching(const std::string& ip, const std::string& pid) const
+{
+	std::lock_guard<std::mutex> started(control);
+	return !watchingIp.empty() && watchingIp == ip && watchingPid == pid;
+}
+
+void HeosNowPlaying::StopWatching()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	if (thread.joinable())
+		thread.join();
+}
+
+HeosNowPlayingState HeosNowPlaying::Current() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return state;
+}
+
+void HeosNowPlaying::Update(const std::function<void(HeosNowPlayingState& state)>& change)
+{
+	HeosNowPlayingState updated;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		updated = state;
+		change(updated);
+		if (Same(updated, state))
+			return;
+		state = updated;
+	}
+	if (changed)
+		changed(updated);
+}
+
+bool HeosNowPlaying::Sleep(int ms)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	return !wake.wait_for(lock, std::chrono::milliseconds(ms), [this] { return stopping; });
+}
+
+bool HeosNowPlaying::Refresh(const std::string& ip, const std::string& pid)
+{
+	std::string reply;
+	HeosReply<HeosNowPlayingMedia> decoded;
+	if (!connection.Send(ip, "player/get_now_playing_media?pid=" + pid, reply))
+		return false;
+	if (!Json::decode(reply.data(), reply.data() + reply.size(), decoded, nullptr) || decoded.heos.result != "success")
+		return true; // answered, just not with media; nothing is playing
+	Update([&decoded](HeosNowPlayingState& state) {
+		state.media = decoded.payload;
+		state.known = true;
+		});
+	return true;
+}
+
+bool HeosNowPlaying::Register(const std::string& ip, const std::string& pid)
+{
+	std::string reply;
+	if (!connection.Send(ip, "system/register_for_change_events?enable=on", reply)
+		|| !connection.Send(ip, "player/get_play_state?pid=" + pid, reply))
+		return false;
+	std::string playState = HeosMessageValue(reply, "state");
+	Update([&playState](HeosNowPlayingState& state) { state.playState = playState; });
+	return Refresh(ip, pid);
+}
+
+void HeosNowPlaying::WatchLoop(std::string ip, std::string pid)
+{
+	// Events are handled while the connection is locked, so they only take notes
+	bool refresh = false;
+	connection.OnEvent([this, &pid, &refresh](const std::string& line) {
+		if (HeosMessageValue(line, "pid") != pid)
+			return;
+		std::string name = HeosEventName(line);
+		if (name == "player_now_playing_changed") {
+			refresh = true;
+		}
+		else if (name == "player_state_changed") {
+			std::string playState = HeosMessageValue(line, "state");
+			Update([&playState](HeosNowPlayingState& state) { state.playState = playState; });
+		}
+		});
+
+	size_t registeredOn = 0; // Connects() of the registered connection
+	int idleMs = 0;
+	while (Sleep(0)) {
+		// Registering is per connection; a new one has to do it again
+		if (registeredOn == 0 || connection.Connects() != registeredOn) {
+			if (!Register(ip, pid)) {
+				connection.Close();
+				registeredOn = 0;
+				Sleep(RETRY_MS);
+				continue;
+			}
+			registeredOn = connection.Connects();
+			idleMs = 0;
+		}
+
+		// Also when the change came in while the last refresh was going on
+		if (refresh) {
+			refresh = false;
+			if (!Refresh(ip, pid))
+				registeredOn = 0;
+			continue;
+		}
+
+		if (connection.WaitForEvent(ip, [](const std::string&) { return true; }, WAIT_SLICE_MS)) {
+			idleMs = 0;
+		}
+		else if ((idleMs += WAIT_SLICE_MS) >= heartbeatMs) {
+			// The device drops connections that stay quiet too long
+			std::string reply;
+			if (!connection.Send(ip, "system/heart_beat", reply))
+				registeredOn = 0;
+			idleMs = 0;
+		}
+	}
+
+	connection.OnEvent(nullptr);
+	connection.Close();
+}
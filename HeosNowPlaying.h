@@ -0,0 +1,67 @@
+#pragma once
+
+// What the player is playing, kept current from the device's change events
+// so the UI can read it without asking. The events come in on a connection
+// of its own; the HEOS CLI sends them to every connection registered for
+// them, and the command connection should not have to sort them out.
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "HeosConnection.h"
+#include "HeosModel.h"
+
+struct HeosNowPlayingState {
+	HeosNowPlayingMedia media;
+	std::string playState; // "play", "pause" or "stop"; "" until known
+	bool known = false;    // media has been read since Start()
+
+	// Playing from input, e.g. "optical_in_1", or any optical input for "optical".
+	bool IsInput(const std::string& input) const;
+};
+
+// The value of key in the message of a HEOS reply or event line:
+// "pid=1&state=play" has "play" for "state".
+std::string HeosMessageValue(const std::string& line, const std::string& key);
+
+class HeosNowPlaying {
+public:
+	using Changed = std::function<void(const HeosNowPlayingState& state)>;
+
+	// changed is called on the watcher's thread.
+	explicit HeosNowPlaying(Changed changed, int port = 1255, int heartbeatMs = 30000);
+	~HeosNowPlaying();
+
+	// Watches pid on the device at ip, instead of what it watched before.
+	void Start(const std::string& ip, const std::string& pid);
+	// Nothing is known after.
+	void Stop();
+	// Whether pid on the device at ip is what it watches now.
+	bool IsWatching(const std::string& ip, const std::string& pid) const;
+	HeosNowPlayingState Current() const;
+
+private:
+	void StopWatching();
+	void WatchLoop(std::string ip, std::string pid);
+	// On the watcher's thread
+	bool Register(const std::string& ip, const std::string& pid);
+	bool Refresh(const std::string& ip, const std::string& pid);
+	void Update(const std::function<void(HeosNowPlayingState& state)>& change);
+	bool Sleep(int ms);
+
+	const Changed changed;
+	const int heartbeatMs;
+	HeosConnection connection;
+
+	mutable std::mutex control; // Start() and Stop()
+	std::string watchingIp;     // "" when stopped
+	std::string watchingPid;
+	mutable std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+	HeosNowPlayingState state;
+	std::thread thread;
+};
@@ -0,0 +1,381 @@
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <iphlpapi.h>
+#include <windows.h>
+#pragma comment(lib, "iphlpapi.lib")
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "HeosPrefs.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <utility>
+
+#include <json/json.h>
+
+namespace {
+
+bool IsIPv4(const std::string& text)
+{
+	int parts = 0;
+	size_t pos = 0;
+	while (pos <= text.size()) {
+		size_t end = text.find('.', pos);
+		if (end == std::string::npos)
+			end = text.size();
+		if (end == pos || end - pos > 3)
+			return false;
+		int number = 0;
+		for (size_t i = pos; i < end; ++i) {
+			if (text[i] < '0' || text[i] > '9')
+				return false;
+			number = number * 10 + (text[i] - '0');
+		}
+		if (number > 255)
+			return false;
+		++parts;
+		pos = end + 1;
+	}
+	return parts == 4;
+}
+
+// HEOS player ids are signed 32-bit numbers, sent as strings
+bool IsPlayerID(const std::string& text)
+{
+	size_t start = !text.empty() && text[0] == '-' ? 1 : 0;
+	if (text.size() == start || text.size() - start > 10)
+		return false;
+	for (size_t i = start; i < text.size(); ++i) {
+		if (text[i] < '0' || text[i] > '9')
+			return false;
+	}
+	return true;
+}
+
+// The unversioned and version 1 file
+struct HeosPrefsV1 {
+	std::string ip;
+	std::string pid;
+	std::string name;
+};
+
+} // namespace
+
+namespace Json {
+
+template <> struct Binding<HeosPrefsV1> {
+	static constexpr auto fields() {
+		return std::make_tuple(
+			field("ip", &HeosPrefsV1::ip),
+			field("pid", &HeosPrefsV1::pid),
+			field("name", &HeosPrefsV1::name));
+	}
+};
+
+} // namespace Json
+
+const HeosKnownDevice* HeosFindDevice(const HeosPrefs& prefs, const std::string& network)
+{
+	const HeosKnownDevice* found = nullptr;
+	const HeosKnownDevice* unknown = nullptr;
+	for (const auto& device : prefs.devices) {
+		if (device.network == network && (!found || device.lastSeen > found->lastSeen))
+			found = &device;
+		if (device.network.empty() && (!unknown || device.lastSeen > unknown->lastSeen))
+			unknown = &device;
+	}
+	return found ? found : unknown;
+}
+
+void HeosRememberDevice(HeosPrefs& prefs, const HeosKnownDevice& device)
+{
+	auto& devices = prefs.devices;
+	devices.erase(std::remove_if(devices.begin(), devices.end(), [&](const HeosKnownDevice& known) {
+		return known.network == device.network || (known.network.empty() && known.pid == device.pid);
+		}), devices.end());
+	// Most recent first
+	devices.insert(devices.begin(), device);
+	while (devices.size() > HeosPrefs::MAX_DEVICES) {
+		auto oldest = std::min_element(devices.begin(), devices.end(), [](const HeosKnownDevice& a, const HeosKnownDevice& b) {
+			return a.lastSeen < b.lastSeen;
+			});
+		devices.erase(oldest);
+	}
+}
+
+std::string HeosNetworkFingerprint(const std::vector<unsigned char>& gatewayMac, uint32_t address, uint32_t mask)
+{
+	char buffer[64];
+	if (!gatewayMac.empty()) {
+		std::string fingerprint = "gw";
+		for (size_t i = 0; i < gatewayMac.size(); ++i) {
+			snprintf(buffer, sizeof(buffer), "%c%02x", i == 0 ? '-' : ':', gatewayMac[i]);
+			fingerprint += buffer;
+		}
+		return fingerprint;
+	}
+	if (address == 0)
+		return "";
+	uint32_t network = address & mask;
+	int prefix = 0;
+	for (uint32_t bits = mask; bits & 0x80000000u; bits <<= 1)
+		++prefix;
+	snprintf(buffer, sizeof(buffer), "net-%u.%u.%u.%u/%d", network >> 24, (network >> 16) & 0xff, (network >> 8) & 0xff, network & 0xff, prefix);
+	return buffer;
+}
+
+#ifdef _WIN32
+std::string HeosCurrentNetwork()
+{
+	// The interface that would reach an outside address; nothing is sent
+	IPAddr outside = htonl(0x01010101);
+	DWORD index = 0;
+	if (GetBestInterface(outside, &index) != NO_ERROR)
+		return "";
+
+	std::vector<unsigned char> buffer;
+	ULONG size = 16 * 1024;
+	ULONG result;
+	do {
+		buffer.resize(size);
+		result = GetAdaptersAddresses(AF_INET, GAA_FLAG_INCLUDE_GATEWAYS | GAA_FLAG_SKIP_ANYCAST | GAA_FLAG_SKIP_MULTICAST | GAA_FLAG_SKIP_DNS_SERVER, NULL, (IP_ADAPTER_ADDRESSES*)buffer.data(), &size);
+	} while (result == ERROR_BUFFER_OVERFLOW);
+	if (result != NO_ERROR)
+		return "";
+
+	for (auto adapter = (IP_ADAPTER_ADDRESSES*)buffer.data(); adapter; adapter = adapter->Next) {
+		if (adapter->IfIndex != index)
+			continue;
+
+		uint32_t address = 0;
+		uint32_t mask = 0;
+		for (auto unicast = adapter->FirstUnicastAddress; unicast; unicast = unicast->Next) {
+			if (unicast->Address.lpSockaddr->sa_family == AF_INET) {
+				address = ntohl(((sockaddr_in*)unicast->Address.lpSockaddr)->sin_addr.s_addr);
+				ULONG prefix = unicast->OnLinkPrefixLength;
+				mask = prefix == 0 ? 0 : 0xffffffffu << (32 - std::min<ULONG>(prefix, 32));
+				break;
+			}
+		}
+
+		std::vector<unsigned char> mac;
+		for (auto gateway = adapter->FirstGatewayAddress; gateway; gateway = gateway->Next) {
+			if (gateway->Address.lpSockaddr->sa_family != AF_INET)
+				continue;
+			// Answered from the ARP cache, which practically always has the gateway
+			ULONG physical[2];
+			ULONG length = sizeof(physical);
+			if (SendARP(((sockaddr_in*)gateway->Address.lpSockaddr)->sin_addr.s_addr, 0, physical, &length) == NO_ERROR)
+				mac.assign((unsigned char*)physical, (unsigned char*)physical + length);
+			break;
+		}
+		return HeosNetworkFingerprint(mac, address, mask);
+	}
+	return "";
+}
+#endif
+
+HeosPrefsStore::HeosPrefsStore(std::string path, std::chrono::milliseconds debounce)
+	: path(std::move(path)), debounce(debounce)
+{
+}
+
+HeosPrefsStore::~HeosPrefsStore()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	changed.notify_all();
+	if (writer.joinable())
+		writer.join();
+	Flush();
+}
+
+bool HeosPrefsStore::Load(HeosPrefs& prefs, std::string* errs)
+{
+	std::string error;
+	std::ifstream in(path, std::ios::binary);
+	if (!in)
+		error = "no prefs file";
+
+	std::string data;
+	if (error.empty()) {
+		in.seekg(0, std::ios::end);
+		data.resize((size_t)in.tellg());
+		in.seekg(0, std::ios::beg);
+		if (!in.read(&data[0], (std::streamsize)data.size()))
+			error = "could not read the prefs file";
+	}
+
+	HeosPrefs loaded;
+	if (error.empty() && !Json::decode(data.data(), data.data() + data.size(), loaded, &error))
+		error = "invalid prefs file: " + error;
+	if (error.empty() && loaded.version > HeosPrefs::CURRENT_VERSION)
+		error = "prefs file is from a newer version";
+
+	// Up to version 1 there was just the one device, on an unknown network
+	HeosPrefsV1 legacy;
+	if (error.empty() && loaded.version < 2 && Json::decode(data.data(), data.data() + data.size(), legacy, &error) && !legacy.ip.empty()) {
+		HeosKnownDevice device;
+		device.ip = legacy.ip;
+		device.pid = legacy.pid;
+		device.name = legacy.name;
+		loaded.devices.push_back(device);
+	}
+
+	for (const auto& device : loaded.devices) {
+		if (!error.empty())
+			break;
+		if (!device.ip.empty() && !IsIPv4(device.ip))
+			error = "invalid device address '" + device.ip + "'";
+		else if (!device.pid.empty() && !IsPlayerID(device.pid))
+			error = "invalid player id '" + device.pid + "'";
+	}
+	if (error.empty() && (loaded.apiPort < 0 || loaded.apiPort > 65535))
+		error = "invalid API port " + std::to_string(loaded.apiPort);
+	if (!error.empty()) {
+		if (errs)
+			*errs = error;
+		return false;
+	}
+
+	// An older schema differs from what Save() writes, so the next save
+	// upgrades the file
+	std::lock_guard<std::mutex> lock(mutex);
+	written = data;
+	writtenKnown = true;
+
+	prefs = loaded;
+	prefs.version = HeosPrefs::CURRENT_VERSION;
+	return true;
+}
+
+bool HeosPrefsStore::Save(HeosPrefs prefs)
+{
+	prefs.version = HeosPrefs::CURRENT_VERSION;
+	std::string data = Serialize(prefs);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	const std::string* latest = hasPending ? &pending : writing ? &inFlight : writtenKnown ? &written : nullptr;
+	if (latest && *latest == data)
+		return false;
+	if (!writing && writtenKnown && written == data) {
+		// Changed back before the write happened
+		hasPending = false;
+		return false;
+	}
+	pending = std::move(data);
+	hasPending = true;
+	lastChange = std::chrono::steady_clock::now();
+	if (!writer.joinable() && !stopping)
+		writer = std::thread(&HeosPrefsStore::WriterLoop, this);
+	changed.notify_all();
+	return true;
+}
+
+bool HeosPrefsStore::Flush()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	return WritePending(lock);
+}
+
+std::string HeosPrefsStore::Serialize(const HeosPrefs& prefs)
+{
+	Json::BufferWriter writer;
+	writer.setIndentation("\t");
+	writer.write(Json::toValue(prefs));
+	return std::string(writer.data(), writer.size());
+}
+
+void HeosPrefsStore::WriterLoop()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!stopping) {
+		if (!hasPending) {
+			changed.wait(lock);
+			continue;
+		}
+		// Write behind: wait until changes stop coming in
+		auto due = lastChange + debounce;
+		if (std::chrono::steady_clock::now() < due) {
+			changed.wait_until(lock, due);
+			continue;
+		}
+		WritePending(lock);
+	}
+}
+
+// Called with the lock held; releases it while writing. Writes are
+// serialized, so a slower older write cannot land after a newer one.
+bool HeosPrefsStore::WritePending(std::unique_lock<std::mutex>& lock)
+{
+	while (writing)
+		writeDone.wait(lock);
+	if (!hasPending)
+		return true;
+
+	std::string data = pending;
+	inFlight = data;
+	hasPending = false;
+	writing = true;
+	lock.unlock();
+	bool ok = WriteAtomically(data);
+	lock.lock();
+	writing = false;
+	writeDone.notify_all();
+
+	if (ok) {
+		written = data;
+		writtenKnown = true;
+	}
+	else {
+		std::cout << "Could not write " << path << "\n";
+		if (!hasPending) {
+			// Try again after the next debounce
+			pending = data;
+			hasPending = true;
+			lastChange = std::chrono::steady_clock::now();
+		}
+	}
+	return ok;
+}
+
+// The data goes to a temp file that is flushed to disk and then renamed over
+// the prefs file; the rename replaces it in one step.
+bool HeosPrefsStore::WriteAtomically(const std::string& data)
+{
+	std::string temp = path + ".tmp";
+	bool ok;
+#ifdef _WIN32
+	HANDLE file = CreateFileA(temp.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	DWORD done = 0;
+	ok = WriteFile(file, data.data(), (DWORD)data.size(), &done, NULL) && done == data.size() && FlushFileBuffers(file);
+	CloseHandle(file);
+	ok = ok && MoveFileExA(temp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+	int file = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (file < 0)
+		return false;
+	ok = true;
+	for (size_t done = 0; ok && done < data.size();) {
+		ssize_t count = write(file, data.data() + done, data.size() - done);
+		ok = count > 0;
+		done += ok ? (size_t)count : 0;
+	}
+	ok = ok && fsync(file) == 0;
+	ok = close(file) == 0 && ok;
+	ok = ok && rename(temp.c_str(), path.c_str()) == 0;
+#endif
+	if (!ok)
+		std::remove(temp.c_str());
+	return ok;
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+// prefs.json: the devices we talked to, one per network, so startup can
+// connect to the right one without a full discovery. Writes go to a temp
+// file that is renamed over the real one, so a crash leaves either the old
+// prefs or the new ones, never half a file; they are also debounced and
+// skipped when nothing changed.
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <json/binding.h>
+
+#include "HeosAutomation.h"
+#include "HeosModel.h"
+
+// A device as last seen on one network.
+struct HeosKnownDevice {
+	// HeosNetworkFingerprint() of the network it was found on; empty for a
+	// device carried over from a version 1 file, whose network is unknown.
+	std::string network;
+	std::string ip;
+	std::string pid;
+	std::string name;
+	int64_t lastSeen = 0; // seconds since 1970
+	int rttMs = -1;       // connect and get_players round trip, -1 if not measured
+	std::vector<HeosPlayer> players;
+	std::vector<HeosGroup> groups;
+};
+
+struct HeosPrefs {
+	// Schema of the file. 0 is the unversioned file of older builds, which
+	// had the same members as 1: a single ip, pid and name.
+	int version = 0;
+	std::vector<HeosKnownDevice> devices;
+	// Screen-share rules; none means HeosDefaultAutomationRules().
+	std::vector<HeosAutomationRule> automation;
+	// Local control API on 127.0.0.1; 0 turns it off
+	int apiPort = 8255;
+
+	static const int CURRENT_VERSION = 2;
+	static const size_t MAX_DEVICES = 16;
+};
+
+// The device to try first on network: the one last seen there, else one
+// whose network is unknown. Null if there is neither.
+const HeosKnownDevice* HeosFindDevice(const HeosPrefs& prefs, const std::string& network);
+
+// Adds device, replacing the one known for its network (and the same player
+// carried over without a network). Keeps the MAX_DEVICES most recently seen.
+void HeosRememberDevice(HeosPrefs& prefs, const HeosKnownDevice& device);
+
+// "gw-aa:bb:cc:dd:ee:ff" for the default gateway's MAC address, or
+// "net-192.168.1.0/24" for the subnet if the MAC is not known (empty mac);
+// empty if there is no network. address and mask are in host byte order.
+std::string HeosNetworkFingerprint(const std::vector<unsigned char>& gatewayMac, uint32_t address, uint32_t mask);
+
+#ifdef _WIN32
+// Fingerprint of the network the default route goes to.
+std::string HeosCurrentNetwork();
+#endif
+
+namespace Json {
+
+template <> struct Binding<HeosKnownDevice> {
+	static constexpr auto fields() {
+		return std::make_tuple(
+			field("network", &HeosKnownDevice::network),
+			field("ip", &HeosKnownDevice::ip),
+			field("pid", &HeosKnownDevice::pid),
+			field("name", &HeosKnownDevice::name),
+			field("lastSeen", &HeosKnownDevice::lastSeen),
+			field("rttMs", &HeosKnownDevice::rttMs),
+			field("players", &HeosKnownDevice::players),
+			field("groups", &HeosKnownDevice::groups));
+	}
+};
+
+template <> struct Binding<HeosPrefs> {
+	static constexpr auto fields() {
+		return std::make_tuple(
+			field("version", &HeosPrefs::version),
+			field("devices", &HeosPrefs::devices),
+			field("automation", &HeosPrefs::automation),
+			field("apiPort", &HeosPrefs::apiPort));
+	}
+};
+
+} // namespace Json
+
+class HeosPrefsStore {
+public:
+	explicit HeosPrefsStore(std::string path, std::chrono::milliseconds debounce = std::chrono::milliseconds(500));
+	// Writes anything still pending.
+	~HeosPrefsStore();
+
+	// Reads and validates the file, upgrading older schemas. On failure prefs
+	// is left alone and errs (if not null) says why.
+	bool Load(HeosPrefs& prefs, std::string* errs = nullptr);
+
+	// Queues prefs to be written once no other change came in for the
+	// debounce time. Returns false, and writes nothing, if they equal what is
+	// already on disk or queued.
+	bool Save(HeosPrefs prefs);
+
+	// Writes pending prefs now and waits for it. Returns false if the write
+	// failed (the old file is then still intact).
+	bool Flush();
+
+	// What the writer would put on disk for prefs.
+	static std::string Serialize(const HeosPrefs& prefs);
+
+private:
+	void WriterLoop();
+	bool WritePending(std::unique_lock<std::mutex>& lock);
+	bool WriteAtomically(const std::string& data);
+
+	const std::string path;
+	const std::chrono::milliseconds debounce;
+
+	// Prefs are compared in their serialized form
+	std::mutex mutex;
+	std::condition_variable changed;   // to the writer: new pending prefs, or stopping
+	std::condition_variable writeDone; // between writers
+	std::string written;  // on disk, as far as we know
+	bool writtenKnown = false;
+	std::string inFlight; // being written
+	bool writing = false;
+	std::string pending;
+	bool hasPending = false;
+	std::chrono::steady_clock::time_point lastChange;
+	bool stopping = false;
+	std::thread writer;
+};
@@ -0,0 +1,175 @@
+#ifdef _WIN32
+#include <windows.h>
+#include <timeapi.h>
+#pragma comment(lib, "winmm.lib")
+#endif
+
+#include "HeosRamp.h"
+
+#include <cmath>
+
+namespace {
+
+double ApplyCurve(HeosRampCurve curve, double x)
+{
+	switch (curve) {
+	case HeosRampCurve::Ease:
+		return x * x * (3 - 2 * x);
+	case HeosRampCurve::Exponential:
+		return (std::pow(2.0, 10 * x) - 1) / 1023;
+	case HeosRampCurve::Linear:
+	default:
+		return x;
+	}
+}
+
+} // namespace
+
+bool HeosParseRampCurve(const std::string& name, HeosRampCurve& curve)
+{
+	if (name == "linear")
+		curve = HeosRampCurve::Linear;
+	else if (name == "ease")
+		curve = HeosRampCurve::Ease;
+	else if (name == "exponential")
+		curve = HeosRampCurve::Exponential;
+	else
+		return false;
+	return true;
+}
+
+std::vector<HeosRampStep> HeosPlanRamp(int from, int to, std::chrono::milliseconds duration, HeosRampCurve curve, std::chrono::milliseconds minInterval)
+{
+	std::vector<HeosRampStep> steps;
+	if (from == to)
+		return steps;
+
+	long long total = duration.count() > 0 ? duration.count() : 0;
+	long long interval = minInterval.count() > 0 ? minInterval.count() : 1;
+	int last = from;
+	for (long long at = interval; at <= total - interval; at += interval) {
+		int level = (int)std::lround(from + (to - from) * ApplyCurve(curve, (double)at / total));
+		if (level != last)
+			steps.push_back({ std::chrono::milliseconds(at), level });
+		last = level;
+	}
+	// Unless the curve got there already
+	if (last != to)
+		steps.push_back({ std::chrono::milliseconds(total), to });
+	return steps;
+}
+
+HeosVolumeRamp::HeosVolumeRamp(Send send, std::chrono::milliseconds minInterval)
+	: send(std::move(send)), minInterval(minInterval)
+{
+}
+
+HeosVolumeRamp::~HeosVolumeRamp()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		running = false;
+	}
+	changed.notify_all();
+	if (thread.joinable())
+		thread.join();
+}
+
+void HeosVolumeRamp::Start(int from, int to, std::chrono::milliseconds duration, HeosRampCurve curve)
+{
+	std::vector<HeosRampStep> planned = HeosPlanRamp(from, to, duration, curve, minInterval);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	steps.swap(planned);
+	nextStep = 0;
+	started = Clock::now();
+	++generation;
+	running = !steps.empty();
+	if (running && !thread.joinable())
+		thread = std::thread(&HeosVolumeRamp::RampLoop, this);
+	changed.notify_all();
+}
+
+void HeosVolumeRamp::Cancel()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	++generation;
+	running = false;
+	changed.notify_all();
+}
+
+void HeosVolumeRamp::Wait()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (running)
+		changed.wait(lock);
+}
+
+bool HeosVolumeRamp::IsRunning() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return running;
+}
+
+int HeosVolumeRamp::Level() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return level;
+}
+
+void HeosVolumeRamp::RampLoop()
+{
+#ifdef _WIN32
+	// The default 15.6 ms timer tick would smear the steps
+	bool fineTimer = false;
+#endif
+	Clock::time_point lastSent = Clock::time_point::min();
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!stopping) {
+#ifdef _WIN32
+		if (running != fineTimer) {
+			fineTimer = running;
+			if (fineTimer)
+				timeBeginPeriod(1);
+			else
+				timeEndPeriod(1);
+		}
+#endif
+		if (!running) {
+			changed.wait(lock);
+			continue;
+		}
+
+		// Behind schedule: skip to the latest step that is due
+		auto now = Clock::now();
+		while (nextStep + 1 < steps.size() && started + steps[nextStep + 1].at <= now)
+			++nextStep;
+		// The rate limit also holds across ramps
+		auto due = started + steps[nextStep].at;
+		if (lastSent != Clock::time_point::min() && due < lastSent + minInterval)
+			due = lastSent + minInterval;
+		if (now < due) {
+			changed.wait_until(lock, due);
+			continue;
+		}
+
+		int target = steps[nextStep].level;
+		unsigned current = generation;
+		++nextStep;
+		lastSent = now;
+		lock.unlock();
+		bool sent = send(target);
+		lock.lock();
+		if (sent)
+			level = target;
+		if (generation == current && nextStep >= steps.size()) {
+			running = false;
+			changed.notify_all();
+		}
+	}
+#ifdef _WIN32
+	if (fineTimer)
+		timeEndPeriod(1);
+#endif
+}
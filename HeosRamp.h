@@ -0,0 +1,73 @@
+#pragma once
+
+// Volume ramps: set_volume from one level to another over a duration, along
+// a curve, no faster than the device takes commands. One ramp runs at a
+// time, on its own thread; starting another cancels it.
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class HeosRampCurve {
+	Linear,
+	Ease,        // slow at both ends (smoothstep)
+	Exponential, // slow start, fast end
+};
+
+// "linear", "ease" or "exponential".
+bool HeosParseRampCurve(const std::string& name, HeosRampCurve& curve);
+
+struct HeosRampStep {
+	std::chrono::milliseconds at; // since the start of the ramp
+	int level;
+};
+
+// The set_volume levels to send: at most one per minInterval, none that
+// repeats the previous level, the last one to itself, at duration unless the
+// curve gets there sooner.
+std::vector<HeosRampStep> HeosPlanRamp(int from, int to, std::chrono::milliseconds duration, HeosRampCurve curve, std::chrono::milliseconds minInterval);
+
+class HeosVolumeRamp {
+public:
+	using Clock = std::chrono::steady_clock;
+	// Sends one set_volume and returns once the device answered (or not).
+	using Send = std::function<bool(int level)>;
+
+	// HEOS players start dropping commands when sent more than about ten a
+	// second over one connection.
+	explicit HeosVolumeRamp(Send send, std::chrono::milliseconds minInterval = std::chrono::milliseconds(100));
+	// Cancels the ramp in progress.
+	~HeosVolumeRamp();
+
+	// Ramps from `from` to `to`, cancelling the ramp in progress. A step
+	// that is late because a send was slow is dropped for the latest one due.
+	void Start(int from, int to, std::chrono::milliseconds duration, HeosRampCurve curve);
+	void Cancel();
+	// Waits until the ramp is done or cancelled.
+	void Wait();
+
+	bool IsRunning() const;
+	// The level last sent, -1 before the first.
+	int Level() const;
+
+private:
+	void RampLoop();
+
+	const Send send;
+	const std::chrono::milliseconds minInterval;
+
+	mutable std::mutex mutex;
+	std::condition_variable changed;
+	std::vector<HeosRampStep> steps;
+	size_t nextStep = 0;
+	Clock::time_point started;
+	unsigned generation = 0; // bumped by Start() and Cancel()
+	bool running = false;
+	int level = -1;
+	bool stopping = false;
+	std::thread thread;
+};
@@ -0,0 +1,644 @@
+#include "HeosServer.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+const size_t MAX_HEADER = 16 * 1024;
+const size_t MAX_BODY = 64 * 1024;
+const size_t MAX_BACKLOG = 1024 * 1024; // unsent bytes before a slow client is dropped
+
+uint32_t RotateLeft(uint32_t value, int bits)
+{
+	return (value << bits) | (value >> (32 - bits));
+}
+
+std::string Sha1(const std::string& data)
+{
+	uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+	std::string message(data);
+	uint64_t bits = (uint64_t)data.size() * 8;
+	message.push_back((char)0x80);
+	while (message.size() % 64 != 56)
+		message.push_back(0);
+	for (int i = 7; i >= 0; --i)
+		message.push_back((char)(bits >> (i * 8)));
+
+	for (size_t chunk = 0; chunk < message.size(); chunk += 64) {
+		uint32_t w[80];
+		for (int i = 0; i < 16; ++i) {
+			const unsigned char* p = (const unsigned char*)message.data() + chunk + i * 4;
+			w[i] = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+		}
+		for (int i = 16; i < 80; ++i)
+			w[i] = RotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+		uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+		for (int i = 0; i < 80; ++i) {
+			uint32_t f, k;
+			if (i < 20) { f = (b & c) | (~b & d); k = 0x5A827999; }
+			else if (i < 40) { f = b ^ c ^ d; k = 0x6ED9EBA1; }
+			else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+			else { f = b ^ c ^ d; k = 0xCA62C1D6; }
+			uint32_t temp = RotateLeft(a, 5) + f + e + k + w[i];
+			e = d;
+			d = c;
+			c = RotateLeft(b, 30);
+			b = a;
+			a = temp;
+		}
+		h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+	}
+
+	std::string digest;
+	for (uint32_t word : h) {
+		for (int i = 3; i >= 0; --i)
+			digest.push_back((char)(word >> (i * 8)));
+	}
+	return digest;
+}
+
+std::string Base64(const std::string& data)
+{
+	static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	std::string out;
+	for (size_t i = 0; i < data.size(); i += 3) {
+		uint32_t group = (uint32_t)(unsigned char)data[i] << 16;
+		if (i + 1 < data.size())
+			group |= (uint32_t)(unsigned char)data[i + 1] << 8;
+		if (i + 2 < data.size())
+			group |= (unsigned char)data[i + 2];
+		out.push_back(digits[(group >> 18) & 63]);
+		out.push_back(digits[(group >> 12) & 63]);
+		out.push_back(i + 1 < data.size() ? digits[(group >> 6) & 63] : '=');
+		out.push_back(i + 2 < data.size() ? digits[group & 63] : '=');
+	}
+	return out;
+}
+
+std::string Lowercase(std::string text)
+{
+	for (auto& c : text) {
+		if (c >= 'A' && c <= 'Z')
+			c = (char)(c - 'A' + 'a');
+	}
+	return text;
+}
+
+std::string Trim(const std::string& text)
+{
+	size_t begin = text.find_first_not_of(" \t");
+	if (begin == std::string::npos)
+		return "";
+	return text.substr(begin, text.find_last_not_of(" \t") + 1 - begin);
+}
+
+int HexDigit(char c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+std::string UrlDecode(const std::string& text)
+{
+	std::string out;
+	for (size_t i = 0; i < text.size(); ++i) {
+		if (text[i] == '+') {
+			out.push_back(' ');
+		}
+		else if (text[i] == '%' && i + 2 < text.size() && HexDigit(text[i + 1]) >= 0 && HexDigit(text[i + 2]) >= 0) {
+			out.push_back((char)(HexDigit(text[i + 1]) * 16 + HexDigit(text[i + 2])));
+			i += 2;
+		}
+		else {
+			out.push_back(text[i]);
+		}
+	}
+	return out;
+}
+
+void ParseParams(const std::string& text, std::map<std::string, std::string>& params)
+{
+	size_t pos = 0;
+	while (pos < text.size()) {
+		size_t end = text.find('&', pos);
+		if (end == std::string::npos)
+			end = text.size();
+		std::string pair = text.substr(pos, end - pos);
+		size_t equals = pair.find('=');
+		if (!pair.empty())
+			params[UrlDecode(pair.substr(0, equals))] = equals == std::string::npos ? "" : UrlDecode(pair.substr(equals + 1));
+		pos = end + 1;
+	}
+}
+
+const char* StatusText(int status)
+{
+	switch (status) {
+	case 101: return "Switching Protocols";
+	case 200: return "OK";
+	case 400: return "Bad Request";
+	case 403: return "Forbidden";
+	case 404: return "Not Found";
+	case 405: return "Method Not Allowed";
+	case 413: return "Payload Too Large";
+	case 431: return "Request Header Fields Too Large";
+	case 502: return "Bad Gateway";
+	case 503: return "Service Unavailable";
+	default: return "Error";
+	}
+}
+
+// Unmasked, unfragmented, as servers send them
+std::string WebSocketFrame(int opcode, const std::string& payload)
+{
+	std::string frame;
+	frame.push_back((char)(0x80 | opcode));
+	if (payload.size() < 126) {
+		frame.push_back((char)payload.size());
+	}
+	else if (payload.size() < 65536) {
+		frame.push_back(126);
+		frame.push_back((char)(payload.size() >> 8));
+		frame.push_back((char)payload.size());
+	}
+	else {
+		frame.push_back(127);
+		for (int i = 7; i >= 0; --i)
+			frame.push_back((char)((uint64_t)payload.size() >> (i * 8)));
+	}
+	return frame + payload;
+}
+
+// Browsers send an Origin; only pages served from this machine may use the API
+bool IsLocalOrigin(const std::string& origin)
+{
+	for (const char* prefix : { "http://localhost", "http://127.0.0.1" }) {
+		size_t length = strlen(prefix);
+		if (origin.compare(0, length, prefix) == 0 && (origin.size() == length || origin[length] == ':' || origin[length] == '/'))
+			return true;
+	}
+	return false;
+}
+
+} // namespace
+
+std::string HeosWebSocketAccept(const std::string& key)
+{
+	return Base64(Sha1(key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"));
+}
+
+void HeosServer::Mailbox::Wake()
+{
+	char byte = 0;
+	sendto(waker, &byte, 1, 0, (const sockaddr*)&address, sizeof(address));
+}
+
+HeosServer::HeosServer(Handler handler)
+	: handler(std::move(handler))
+{
+	HeosSocketsUp();
+}
+
+HeosServer::~HeosServer()
+{
+	Stop();
+	HeosSocketsDown();
+}
+
+bool HeosServer::Start(unsigned short wantedPort)
+{
+	if (thread.joinable())
+		return false;
+
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons(wantedPort);
+	listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (listener == HEOS_NO_SOCKET)
+		return false;
+#ifndef _WIN32
+	int reuse = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+#endif
+	socklen_t length = sizeof(address);
+	if (bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0 || !HeosSetNonBlocking(listener)
+		|| getsockname(listener, (sockaddr*)&address, &length) != 0) {
+		HeosCloseSocket(listener);
+		listener = HEOS_NO_SOCKET;
+		return false;
+	}
+	port = ntohs(address.sin_port);
+
+	auto box = std::make_shared<Mailbox>();
+	box->address.sin_family = AF_INET;
+	box->address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	box->waker = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	length = sizeof(box->address);
+	if (box->waker == HEOS_NO_SOCKET || bind(box->waker, (sockaddr*)&box->address, sizeof(box->address)) != 0
+		|| getsockname(box->waker, (sockaddr*)&box->address, &length) != 0 || !HeosSetNonBlocking(box->waker)) {
+		if (box->waker != HEOS_NO_SOCKET)
+			HeosCloseSocket(box->waker);
+		HeosCloseSocket(listener);
+		listener = HEOS_NO_SOCKET;
+		return false;
+	}
+	box->open = true;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		mailbox = box;
+		stopping = false;
+	}
+	thread = std::thread(&HeosServer::ServeLoop, this);
+	return true;
+}
+
+void HeosServer::Stop()
+{
+	if (!thread.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mailbox->mutex);
+		mailbox->Wake();
+	}
+	thread.join();
+
+	for (auto& entry : clients)
+		HeosCloseSocket(entry.second.sock);
+	clients.clear();
+	HeosCloseSocket(listener);
+	listener = HEOS_NO_SOCKET;
+	{
+		std::lock_guard<std::mutex> lock(mailbox->mutex);
+		mailbox->open = false;
+		HeosCloseSocket(mailbox->waker);
+		mailbox->waker = HEOS_NO_SOCKET;
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	mailbox.reset();
+	clientCount = 0;
+}
+
+void HeosServer::PublishState(const std::string& json)
+{
+	std::shared_ptr<Mailbox> box;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (json == state)
+			return;
+		state = json;
+		stateChanged = true;
+		box = mailbox;
+	}
+	if (box) {
+		std::lock_guard<std::mutex> lock(box->mutex);
+		if (box->open)
+			box->Wake();
+	}
+}
+
+std::string HeosServer::State() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return state;
+}
+
+size_t HeosServer::Clients() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return clientCount;
+}
+
+void HeosServer::ServeLoop()
+{
+	std::vector<HeosPollFd> fds;
+	std::vector<uint64_t> ids;
+	std::vector<Completion> done;
+	for (;;) {
+		fds.clear();
+		ids.clear();
+		HeosPollFd fd = {};
+		fd.fd = listener;
+		fd.events = (short)(clients.size() < MAX_CLIENTS ? POLLIN : 0);
+		fds.push_back(fd);
+		fd.fd = mailbox->waker;
+		fd.events = POLLIN;
+		fds.push_back(fd);
+		for (auto& entry : clients) {
+			fd.fd = entry.second.sock;
+			// While a request is being handled its successors wait in the socket
+			fd.events = (short)((entry.second.waiting || entry.second.closing ? 0 : POLLIN) | (entry.second.out.empty() ? 0 : POLLOUT));
+			fds.push_back(fd);
+			ids.push_back(entry.first);
+		}
+		HeosPoll(fds.data(), fds.size(), -1);
+
+		std::string published;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (stopping)
+				return;
+			if (stateChanged)
+				published = state;
+			stateChanged = false;
+		}
+
+		if (fds[1].revents) {
+			char drain[64];
+			while (recv(mailbox->waker, drain, sizeof(drain), 0) > 0) {
+			}
+		}
+		{
+			std::lock_guard<std::mutex> lock(mailbox->mutex);
+			done.swap(mailbox->completions);
+		}
+		for (auto& completion : done) {
+			auto found = clients.find(completion.client);
+			if (found == clients.end())
+				continue; // hung up meanwhile
+			Client& client = found->second;
+			client.waiting = false;
+			Reply(client, completion.response.status, completion.response.body);
+			if (!client.keepAlive)
+				client.closing = true;
+			else
+				ProcessInput(completion.client, client); // pipelined requests
+			Flush(client);
+		}
+		done.clear();
+
+		if (!published.empty()) {
+			std::string frame = WebSocketFrame(1, published);
+			for (auto& entry : clients) {
+				if (entry.second.websocket && !entry.second.closing) {
+					entry.second.out += frame;
+					Flush(entry.second);
+				}
+			}
+		}
+
+		for (size_t i = 0; i < ids.size(); ++i) {
+			short revents = fds[i + 2].revents;
+			auto found = clients.find(ids[i]);
+			if (!revents || found == clients.end())
+				continue;
+			Client& client = found->second;
+			if (revents & (POLLERR | POLLNVAL))
+				client.closed = true;
+			if (!client.closed && (revents & (POLLIN | POLLHUP)))
+				Read(ids[i], client);
+			if (!client.closed && (revents & POLLOUT))
+				Flush(client);
+		}
+
+		if (fds[0].revents & POLLIN)
+			Accept();
+
+		for (auto entry = clients.begin(); entry != clients.end();) {
+			Client& client = entry->second;
+			if (client.out.size() > MAX_BACKLOG)
+				client.closed = true;
+			if (client.closed || (client.closing && client.out.empty())) {
+				HeosCloseSocket(client.sock);
+				entry = clients.erase(entry);
+			}
+			else {
+				++entry;
+			}
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		clientCount = clients.size();
+	}
+}
+
+void HeosServer::Accept()
+{
+	while (clients.size() < MAX_CLIENTS) {
+		HeosSocket sock = accept(listener, NULL, NULL);
+		if (sock == HEOS_NO_SOCKET)
+			return;
+		HeosSetNonBlocking(sock);
+		int noDelay = 1;
+		setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+		clients[nextClient++].sock = sock;
+	}
+}
+
+void HeosServer::Read(uint64_t id, Client& client)
+{
+	char buffer[4096];
+	for (;;) {
+		int count = recv(client.sock, buffer, sizeof(buffer), 0);
+		if (count > 0) {
+			client.in.append(buffer, (size_t)count);
+			if (client.in.size() > MAX_HEADER + MAX_BODY) {
+				// More than one request can hold; the rest waits in the socket
+				break;
+			}
+			continue;
+		}
+		if (count == 0 || !HeosWouldBlock())
+			client.closed = true;
+		break;
+	}
+	if (!client.closed)
+		ProcessInput(id, client);
+}
+
+void HeosServer::Flush(Client& client)
+{
+	while (!client.out.empty()) {
+		int count = send(client.sock, client.out.data(), (int)client.out.size(), HEOS_SEND_FLAGS);
+		if (count > 0) {
+			client.out.erase(0, (size_t)count);
+			continue;
+		}
+		if (count < 0 && !HeosWouldBlock())
+			client.closed = true;
+		return;
+	}
+}
+
+void HeosServer::ProcessInput(uint64_t id, Client& client)
+{
+	if (client.websocket) {
+		while (!client.closing && ProcessFrame(client)) {
+		}
+		return;
+	}
+	while (!client.waiting && !client.closing && ProcessRequest(id, client)) {
+	}
+}
+
+void HeosServer::Reply(Client& client, int status, const std::string& body)
+{
+	char header[256];
+	snprintf(header, sizeof(header), "HTTP/1.1 %d %s\r\nContent-Type: application/json\r\nContent-Length: %u\r\nConnection: %s\r\n\r\n",
+		status, StatusText(status), (unsigned)body.size(), client.keepAlive ? "keep-alive" : "close");
+	client.out += header;
+	client.out += body;
+}
+
+// Returns true if a whole request was taken off client.in.
+bool HeosServer::ProcessRequest(uint64_t id, Client& client)
+{
+	size_t headerEnd = client.in.find("\r\n\r\n");
+	// Too large whether or not its end came in with the same read
+	if ((headerEnd == std::string::npos ? client.in.size() : headerEnd) > MAX_HEADER) {
+		client.keepAlive = false;
+		Reply(client, 431, "{\"error\":\"header too large\"}");
+		client.closing = true;
+		return false;
+	}
+	if (headerEnd == std::string::npos)
+		return false;
+
+	// Request line, then headers
+	size_t lineEnd = client.in.find("\r\n");
+	std::string line = client.in.substr(0, lineEnd);
+	size_t space1 = line.find(' ');
+	size_t space2 = line.rfind(' ');
+	if (space1 == std::string::npos || space2 == space1) {
+		client.keepAlive = false;
+		Reply(client, 400, "{\"error\":\"bad request line\"}");
+		client.closing = true;
+		return false;
+	}
+	HeosApiRequest request;
+	request.method = line.substr(0, space1);
+	std::string target = line.substr(space1 + 1, space2 - space1 - 1);
+	std::string version = line.substr(space2 + 1);
+
+	std::map<std::string, std::string> headers;
+	for (size_t pos = lineEnd + 2; pos < headerEnd;) {
+		size_t end = client.in.find("\r\n", pos);
+		std::string header = client.in.substr(pos, end - pos);
+		size_t colon = header.find(':');
+		if (colon != std::string::npos)
+			headers[Lowercase(Trim(header.substr(0, colon)))] = Trim(header.substr(colon + 1));
+		pos = end + 2;
+	}
+
+	size_t bodyLength = 0;
+	if (headers.count("content-length"))
+		bodyLength = (size_t)strtoul(headers["content-length"].c_str(), NULL, 10);
+	if (bodyLength > MAX_BODY) {
+		client.keepAlive = false;
+		Reply(client, 413, "{\"error\":\"body too large\"}");
+		client.closing = true;
+		return false;
+	}
+	if (client.in.size() < headerEnd + 4 + bodyLength)
+		return false;
+	std::string body = client.in.substr(headerEnd + 4, bodyLength);
+	client.in.erase(0, headerEnd + 4 + bodyLength);
+
+	std::string connection = Lowercase(headers["connection"]);
+	client.keepAlive = version == "HTTP/1.1" ? connection.find("close") == std::string::npos : connection.find("keep-alive") != std::string::npos;
+
+	size_t question = target.find('?');
+	request.path = target.substr(0, question);
+	if (question != std::string::npos)
+		ParseParams(target.substr(question + 1), request.params);
+	if (!body.empty() && Lowercase(headers["content-type"]).find("application/x-www-form-urlencoded") != std::string::npos)
+		ParseParams(body, request.params);
+
+	if (headers.count("origin") && !IsLocalOrigin(headers["origin"])) {
+		Reply(client, 403, "{\"error\":\"origin not allowed\"}");
+		return true;
+	}
+
+	if (request.path == "/events") {
+		if (Lowercase(headers["upgrade"]) != "websocket" || !headers.count("sec-websocket-key")) {
+			Reply(client, 400, "{\"error\":\"WebSocket upgrade expected\"}");
+			return true;
+		}
+		client.out += "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: "
+			+ HeosWebSocketAccept(headers["sec-websocket-key"]) + "\r\n\r\n";
+		client.websocket = true;
+		std::string current;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			current = state;
+		}
+		if (!current.empty())
+			client.out += WebSocketFrame(1, current);
+		while (ProcessFrame(client)) {
+		}
+		return false;
+	}
+
+	client.waiting = true;
+	std::weak_ptr<Mailbox> weak = mailbox;
+	handler(request, [weak, id](HeosApiResponse response) {
+		auto box = weak.lock();
+		if (!box)
+			return;
+		std::lock_guard<std::mutex> lock(box->mutex);
+		if (!box->open)
+			return;
+		box->completions.push_back({ id, std::move(response) });
+		box->Wake();
+		});
+	return true;
+}
+
+// Returns true if a whole frame was taken off client.in.
+bool HeosServer::ProcessFrame(Client& client)
+{
+	const unsigned char* data = (const unsigned char*)client.in.data();
+	size_t size = client.in.size();
+	if (size < 2)
+		return false;
+	int opcode = data[0] & 0x0f;
+	bool masked = (data[1] & 0x80) != 0;
+	uint64_t length = data[1] & 0x7f;
+	size_t header = 2;
+	if (length == 126) {
+		if (size < 4)
+			return false;
+		length = (uint64_t)data[2] << 8 | data[3];
+		header = 4;
+	}
+	else if (length == 127) {
+		if (size < 10)
+			return false;
+		length = 0;
+		for (int i = 0; i < 8; ++i)
+			length = length << 8 | data[2 + i];
+		header = 10;
+	}
+	// Clients must mask their frames
+	if (!masked || length > MAX_BODY) {
+		client.out += WebSocketFrame(8, std::string("\x03\xea", 2)); // 1002, protocol error
+		client.closing = true;
+		return false;
+	}
+	if (size < header + 4 + length)
+		return false;
+
+	const unsigned char* mask = data + header;
+	std::string payload((size_t)length, '\0');
+	for (size_t i = 0; i < length; ++i)
+		payload[i] = (char)(data[header + 4 + i] ^ mask[i % 4]);
+	client.in.erase(0, header + 4 + (size_t)length);
+
+	if (opcode == 8) {
+		client.out += WebSocketFrame(8, payload.substr(0, 2));
+		client.closing = true;
+		return false;
+	}
+	if (opcode == 9)
+		client.out += WebSocketFrame(10, payload);
+	// The stream only goes out; anything else a client sends is ignored
+	return true;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+// Local control API: a small HTTP/1.1 server on 127.0.0.1 with a WebSocket
+// state stream at /events. One thread polls every client socket, so hundreds
+// of scripts and hotkey tools can stay connected; what a request does is up
+// to the handler, which answers when the device has.
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "HeosSocket.h"
+
+struct HeosApiRequest {
+	std::string method; // "GET", "POST", ...
+	std::string path;   // "/mute"
+	// From the query string and an application/x-www-form-urlencoded body
+	std::map<std::string, std::string> params;
+};
+
+struct HeosApiResponse {
+	int status = 200;
+	std::string body; // JSON
+};
+
+// Sec-WebSocket-Accept for a Sec-WebSocket-Key (RFC 6455).
+std::string HeosWebSocketAccept(const std::string& key);
+
+class HeosServer {
+public:
+	// Call once, from any thread.
+	using Respond = std::function<void(HeosApiResponse response)>;
+	// Runs on the server thread, so it must not wait for the device.
+	using Handler = std::function<void(const HeosApiRequest& request, Respond respond)>;
+
+	static const size_t MAX_CLIENTS = 1024;
+
+	explicit HeosServer(Handler handler);
+	~HeosServer();
+
+	// Listens on 127.0.0.1:port (0 picks a free port).
+	bool Start(unsigned short port);
+	void Stop();
+	unsigned short Port() const { return port; }
+
+	// The state as JSON. /events clients get it when they connect and
+	// whenever it changes.
+	void PublishState(const std::string& json);
+	// What was published last
+	std::string State() const;
+	size_t Clients() const;
+
+private:
+	struct Client {
+		HeosSocket sock = HEOS_NO_SOCKET;
+		std::string in;
+		std::string out;
+		bool websocket = false;
+		bool waiting = false;   // for the handler's response
+		bool keepAlive = true;
+		bool closing = false;   // once out is sent
+		bool closed = false;
+	};
+	struct Completion {
+		uint64_t client;
+		HeosApiResponse response;
+	};
+	// Shared with the Respond callbacks, which may outlive the server
+	struct Mailbox {
+		std::mutex mutex;
+		bool open = false;
+		std::vector<Completion> completions;
+		HeosSocket waker = HEOS_NO_SOCKET; // UDP socket that sends to itself
+		sockaddr_in address = {};
+		void Wake();
+	};
+
+	void ServeLoop();
+	void Accept();
+	void Read(uint64_t id, Client& client);
+	void Flush(Client& client);
+	void ProcessInput(uint64_t id, Client& client);
+	bool ProcessRequest(uint64_t id, Client& client);
+	bool ProcessFrame(Client& client);
+	void Reply(Client& client, int status, const std::string& body);
+
+	const Handler handler;
+	unsigned short port = 0;
+	HeosSocket listener = HEOS_NO_SOCKET;
+	std::shared_ptr<Mailbox> mailbox;
+	std::thread thread;
+	std::unordered_map<uint64_t, Client> clients; // server thread only
+	uint64_t nextClient = 1;
+
+	mutable std::mutex mutex;
+	bool stopping = false;
+	std::string state;
+	bool stateChanged = false;
+	size_t clientCount = 0;
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+// The few socket calls that differ between Winsock and POSIX, so the
+// connection and the API server also build (and can be load tested) off
+// Windows.
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <cerrno>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+typedef SOCKET HeosSocket;
+const HeosSocket HEOS_NO_SOCKET = INVALID_SOCKET;
+typedef WSAPOLLFD HeosPollFd;
+const int HEOS_SEND_FLAGS = 0;
+
+inline void HeosSocketsUp() { WSADATA wsaData; WSAStartup(MAKEWORD(2, 2), &wsaData); }
+inline void HeosSocketsDown() { WSACleanup(); }
+inline void HeosCloseSocket(HeosSocket sock) { closesocket(sock); }
+inline bool HeosSetNonBlocking(HeosSocket sock) { u_long mode = 1; return ioctlsocket(sock, FIONBIO, &mode) == 0; }
+inline int HeosPoll(HeosPollFd* fds, size_t count, int timeoutMs) { return WSAPoll(fds, (ULONG)count, timeoutMs); }
+inline bool HeosWouldBlock() { return WSAGetLastError() == WSAEWOULDBLOCK; }
+inline void HeosSetTimeout(HeosSocket sock, int ms)
+{
+	DWORD timeout = (DWORD)ms;
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+	setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (const char*)&timeout, sizeof(timeout));
+}
+#else
+typedef int HeosSocket;
+const HeosSocket HEOS_NO_SOCKET = -1;
+typedef pollfd HeosPollFd;
+const int HEOS_SEND_FLAGS = MSG_NOSIGNAL; // a closed peer is an error, not SIGPIPE
+
+inline void HeosSocketsUp() {}
+inline void HeosSocketsDown() {}
+inline void HeosCloseSocket(HeosSocket sock) { close(sock); }
+inline bool HeosSetNonBlocking(HeosSocket sock) { return fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK) == 0; }
+inline int HeosPoll(HeosPollFd* fds, size_t count, int timeoutMs) { return poll(fds, (nfds_t)count, timeoutMs); }
+inline bool HeosWouldBlock() { return errno == EAGAIN || errno == EWOULDBLOCK; }
+inline void HeosSetTimeout(HeosSocket sock, int ms)
+{
+	timeval timeout = { ms / 1000, (ms % 1000) * 1000 };
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+#endif
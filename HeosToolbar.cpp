@@ -0,0 +1,94 @@
+#include "HeosToolbar.h"
+
+#include <algorithm>
+#include <cstdio>
+
+HeosToolbarLayout HeosLayoutToolbar(const HeosToolbarRect& workArea, int buttonCount, int buttonSize, int margin, int dpi)
+{
+	HeosToolbarLayout layout;
+	if (buttonCount <= 0 || dpi <= 0)
+		return layout;
+
+	// Round to nearest, as MulDiv does
+	int size = (buttonSize * dpi + 48) / 96;
+	int gap = (margin * dpi + 48) / 96;
+	int available = workArea.right - workArea.left - 2 * gap;
+	if (size * buttonCount > available)
+		size = std::max(1, available / buttonCount);
+
+	layout.buttonSize = size;
+	layout.width = size * buttonCount;
+	layout.height = size;
+	layout.x = std::max(workArea.left, workArea.right - layout.width - gap);
+	layout.y = std::max(workArea.top, workArea.bottom - layout.height - gap);
+	return layout;
+}
+
+HeosToolbarState::Action HeosToolbarState::Open(const HeosToolbarLayout& layout)
+{
+	if (visible)
+		return Action::None;
+	visible = true;
+	processingClick = false;
+
+	Action action = Action::Show;
+	if (!created)
+		action = Action::Create;
+	else if (layout.buttonSize != buttonSize)
+		action = Action::Relayout;
+	created = true;
+	buttonSize = layout.buttonSize;
+	return action;
+}
+
+bool HeosToolbarState::Deactivated(bool activatedOwnButton)
+{
+	if (processingClick || activatedOwnButton) {
+		processingClick = false;
+		return false;
+	}
+	visible = false;
+	return true;
+}
+
+void HeosLatencyProbe::Start(Clock::time_point at)
+{
+	started = at;
+	running = true;
+}
+
+bool HeosLatencyProbe::Stop(Clock::time_point at)
+{
+	if (!running)
+		return false;
+	running = false;
+	lastMs = std::chrono::duration<double, std::milli>(at - started).count();
+	if (samples.size() < KEPT_SAMPLES)
+		samples.push_back(lastMs);
+	else
+		samples[count % KEPT_SAMPLES] = lastMs;
+	++count;
+	return true;
+}
+
+double HeosLatencyProbe::MedianMs() const
+{
+	if (samples.empty())
+		return 0;
+	std::vector<double> sorted(samples);
+	auto middle = sorted.begin() + sorted.size() / 2;
+	std::nth_element(sorted.begin(), middle, sorted.end());
+	return *middle;
+}
+
+double HeosLatencyProbe::WorstMs() const
+{
+	return samples.empty() ? 0 : *std::max_element(samples.begin(), samples.end());
+}
+
+std::string HeosLatencyProbe::Report() const
+{
+	char buffer[128];
+	snprintf(buffer, sizeof(buffer), "%.1f ms (median %.1f, worst %.1f, %u samples)", LastMs(), MedianMs(), WorstMs(), (unsigned)samples.size());
+	return buffer;
+}
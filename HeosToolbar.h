@@ -0,0 +1,95 @@
+#pragma once
+
+// The tray toolbar without the Win32 parts: where it goes, what has to
+// happen to the window when it opens or loses focus, and how long opening
+// takes. HEOS.cpp owns the actual window and forwards its messages here.
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+struct HeosToolbarRect {
+	int left = 0;
+	int top = 0;
+	int right = 0;
+	int bottom = 0;
+};
+
+struct HeosToolbarLayout {
+	int x = 0;
+	int y = 0;
+	int width = 0;
+	int height = 0;
+	int buttonSize = 0;
+};
+
+// A row of buttonCount square buttons in the bottom-right corner of the work
+// area, margin away from its edges. Sizes are given at 96 DPI and scaled to
+// dpi; a toolbar too wide for the work area shrinks its buttons to fit.
+HeosToolbarLayout HeosLayoutToolbar(const HeosToolbarRect& workArea, int buttonCount, int buttonSize, int margin, int dpi);
+
+// The toolbar window is built once and then only moved, shown and hidden.
+class HeosToolbarState {
+public:
+	enum class Action {
+		None,     // already showing
+		Create,   // build the window and its buttons, then show it
+		Relayout, // resize the buttons and reload their icons, then show it
+		Show,     // move it into place and show it
+	};
+
+	// The tray icon was clicked.
+	Action Open(const HeosToolbarLayout& layout);
+	// The window was hidden, by Deactivated() or otherwise; HEOS.cpp calls
+	// this from WM_WINDOWPOSCHANGED for every hide.
+	void Hidden() { visible = false; }
+	bool IsVisible() const { return visible; }
+
+	// A button sent WM_COMMAND: the focus change that comes with the click
+	// must not close the toolbar.
+	void ButtonClicked() { processingClick = true; }
+	// Any other message ends the click.
+	void MessageHandled() { processingClick = false; }
+	// The toolbar lost activation, to one of its buttons or not. Returns true
+	// if it should be hidden.
+	bool Deactivated(bool activatedOwnButton);
+
+private:
+	bool created = false;
+	bool visible = false;
+	bool processingClick = false;
+	int buttonSize = 0;
+};
+
+// Times an interaction from Start() to Stop(), e.g. a click to the first
+// paint of the window it opens, and keeps the recent samples.
+class HeosLatencyProbe {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	void Start(Clock::time_point at = Clock::now());
+	// Records a sample if Start() was called since the last Stop(); returns
+	// whether it did.
+	bool Stop(Clock::time_point at = Clock::now());
+	// Drops a Start() that will not be followed by what it was timing.
+	void Cancel() { running = false; }
+	bool IsRunning() const { return running; }
+
+	size_t Count() const { return count; }
+	double LastMs() const { return lastMs; }
+	// Over the most recent samples.
+	double MedianMs() const;
+	double WorstMs() const;
+
+	// "12.3 ms (median 11.8, worst 20.1, 7 samples)"
+	std::string Report() const;
+
+private:
+	static const size_t KEPT_SAMPLES = 64;
+
+	Clock::time_point started;
+	bool running = false;
+	size_t count = 0;
+	double lastMs = 0;
+	std::vector<double> samples; // ring of the last KEPT_SAMPLES
+};
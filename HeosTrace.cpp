@@ -0,0 +1,138 @@
+#include "HeosTrace.h"
+
+#include <cstring>
+#include <fstream>
+
+#include <json/json.h>
+
+HeosTrace::HeosTrace(Clock::time_point origin)
+	: origin(origin)
+{
+	events.reserve(64);
+}
+
+int64_t HeosTrace::Now() const
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - origin).count();
+}
+
+int HeosTrace::ThreadIndex()
+{
+	auto id = std::this_thread::get_id();
+	auto found = threads.find(id);
+	if (found != threads.end())
+		return found->second;
+	int index = (int)threads.size() + 1;
+	threads.emplace(id, index);
+	return index;
+}
+
+void HeosTrace::Begin(const char* name)
+{
+	int64_t now = Now();
+	std::lock_guard<std::mutex> lock(mutex);
+	if (closedAt >= 0)
+		return;
+	int tid = ThreadIndex();
+	open[tid].push_back(events.size());
+	events.push_back({ name, 'X', tid, now, -1 });
+}
+
+void HeosTrace::End()
+{
+	int64_t now = Now();
+	std::lock_guard<std::mutex> lock(mutex);
+	if (closedAt >= 0)
+		return;
+	auto& stack = open[ThreadIndex()];
+	if (stack.empty())
+		return;
+	Event& event = events[stack.back()];
+	event.duration = now - event.start;
+	stack.pop_back();
+}
+
+void HeosTrace::Instant(const char* name)
+{
+	int64_t now = Now();
+	std::lock_guard<std::mutex> lock(mutex);
+	if (closedAt >= 0)
+		return;
+	events.push_back({ name, 'i', ThreadIndex(), now, 0 });
+}
+
+void HeosTrace::NameThread(const char* name)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (closedAt < 0)
+		threadNames[ThreadIndex()] = name;
+}
+
+int64_t HeosTrace::InstantAt(const char* name) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	for (const auto& event : events) {
+		if (event.phase == 'i' && strcmp(event.name, name) == 0)
+			return event.start;
+	}
+	return -1;
+}
+
+void HeosTrace::Close()
+{
+	int64_t now = Now();
+	std::lock_guard<std::mutex> lock(mutex);
+	if (closedAt < 0)
+		closedAt = now;
+}
+
+bool HeosTrace::IsClosed() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return closedAt >= 0;
+}
+
+std::string HeosTrace::ToChromeJson() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	int64_t end = closedAt >= 0 ? closedAt : Now();
+
+	Json::Value trace(Json::objectValue);
+	Json::Value& list = trace["traceEvents"];
+	list = Json::Value(Json::arrayValue);
+	for (const auto& named : threadNames) {
+		Json::Value event(Json::objectValue);
+		event["name"] = "thread_name";
+		event["ph"] = "M";
+		event["pid"] = 1;
+		event["tid"] = named.first;
+		event["args"]["name"] = named.second;
+		list.append(std::move(event));
+	}
+	for (const auto& recorded : events) {
+		Json::Value event(Json::objectValue);
+		event["name"] = recorded.name;
+		event["ph"] = std::string(1, recorded.phase);
+		event["pid"] = 1;
+		event["tid"] = recorded.tid;
+		event["ts"] = (Json::Int64)recorded.start;
+		if (recorded.phase == 'X')
+			event["dur"] = (Json::Int64)(recorded.duration >= 0 ? recorded.duration : end - recorded.start);
+		else
+			event["s"] = "p"; // instant scoped to the process
+		list.append(std::move(event));
+	}
+	trace["displayTimeUnit"] = "ms";
+
+	Json::BufferWriter writer;
+	writer.write(trace);
+	return writer.str();
+}
+
+bool HeosTrace::WriteChromeJson(const std::string& path) const
+{
+	std::string json = ToChromeJson();
+	std::ofstream out(path, std::ios::binary);
+	out.write(json.data(), (std::streamsize)json.size());
+	return (bool)out;
+}
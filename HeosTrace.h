@@ -0,0 +1,72 @@
+#pragma once
+
+// Startup tracing: phases recorded as spans on the monotonic clock, from any
+// thread, and exported in the Chrome trace event format (chrome://tracing or
+// ui.perfetto.dev). Recording takes a lock and appends to a vector, so the
+// trace can stay on in normal runs; Close() stops it once startup is over.
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class HeosTrace {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	explicit HeosTrace(Clock::time_point origin = Clock::now());
+
+	// A phase on the calling thread, until the matching End(). Phases nest.
+	// name must outlive the trace (a string literal).
+	void Begin(const char* name);
+	void End();
+	// A point in time, e.g. "first command possible".
+	void Instant(const char* name);
+	// Names the calling thread in the exported trace.
+	void NameThread(const char* name);
+
+	// Microseconds since the origin.
+	int64_t Now() const;
+	// When the instant called name was recorded, or -1.
+	int64_t InstantAt(const char* name) const;
+
+	// Stops recording; phases still open are exported as ending here.
+	void Close();
+	bool IsClosed() const;
+
+	std::string ToChromeJson() const;
+	bool WriteChromeJson(const std::string& path) const;
+
+	class Scope {
+	public:
+		Scope(HeosTrace& trace, const char* name) : trace(trace) { trace.Begin(name); }
+		~Scope() { trace.End(); }
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+	private:
+		HeosTrace& trace;
+	};
+
+private:
+	struct Event {
+		const char* name;
+		char phase;        // 'X' complete, 'i' instant
+		int tid;
+		int64_t start;     // us since origin
+		int64_t duration;  // -1 while open
+	};
+
+	int ThreadIndex(); // with the lock held
+
+	const Clock::time_point origin;
+	mutable std::mutex mutex;
+	std::vector<Event> events;
+	std::map<std::thread::id, int> threads;
+	std::map<int, std::vector<size_t>> open; // per thread, indices into events
+	std::map<int, std::string> threadNames;
+	int64_t closedAt = -1;
+};
@@ -0,0 +1,442 @@
+// Copyright 2007-2010 Baptiste Lepilleur and The JsonCpp Authors
+// Distributed under MIT license, or public domain if desired and
+// recognized in your jurisdiction.
+// See file LICENSE for detail or copy at http://jsoncpp.sourceforge.net/LICENSE
+
+#ifndef JSON_BINDING_H_INCLUDED
+#define JSON_BINDING_H_INCLUDED
+
+#if !defined(JSON_IS_AMALGAMATION)
+#include "reader.h"
+#include "value.h"
+#include "writer.h"
+#endif // if !defined(JSON_IS_AMALGAMATION)
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/* Typed binding: map JSON objects straight onto C++ structs.
+ *
+ * Describe a struct once by specializing Json::Binding:
+ *   \code
+ *   struct Player { String name; int pid; };
+ *   namespace Json {
+ *   template <> struct Binding<Player> {
+ *     static constexpr auto fields() {
+ *       return std::make_tuple(field("name", &Player::name),
+ *                              field("pid", &Player::pid));
+ *     }
+ *   };
+ *   }
+ *   \endcode
+ * then decode with BindingHandler (or Json::decode()), which fills the
+ * struct from PushParser events without building a Value tree, and encode
+ * with Json::toValue(). Members may be bool, integers, floating point,
+ * String, std::vector of a bindable type or another bound struct. Unknown
+ * keys are skipped, null leaves a member untouched, and String members also
+ * accept numbers and booleans, spelled as Value::asString() would.
+ */
+
+namespace Json {
+
+/// Specialize with a static, constexpr fields() returning a tuple of field().
+template <class T> struct Binding;
+
+template <class Owner, class Member> struct Field {
+  char const* name;
+  size_t length;
+  Member Owner::*member;
+};
+
+template <class Owner, class Member, size_t N>
+constexpr Field<Owner, Member> field(char const (&name)[N],
+                                     Member Owner::*member) {
+  return {name, N - 1, member};
+}
+
+namespace detail {
+
+/* What a decoder may do with one bound type. Entries a type does not support
+ * are null, which the handler reports as a type mismatch.
+ */
+struct TypeOps {
+  enum Kind { scalar, object, array };
+  Kind kind;
+  char const* expected; // for error messages, e.g. "a string"
+  bool (*boolean)(void* target, bool value);
+  bool (*integer)(void* target, LargestInt value);
+  bool (*uinteger)(void* target, LargestUInt value);
+  bool (*real)(void* target, double value);
+  void (*string)(void* target, char const* begin, char const* end);
+  // Objects: the member bound to [begin, end), or null to skip it.
+  void* (*member)(void* target, char const* begin, char const* end,
+                  TypeOps const** ops, char const** name);
+  // Arrays: a new element at the back.
+  void* (*element)(void* target, TypeOps const** ops);
+};
+
+template <class T, class Enable = void> struct Ops;
+
+template <class T> bool assignBool(void* target, bool value) {
+  *static_cast<T*>(target) = value;
+  return true;
+}
+
+template <class T> bool assignInteger(void* target, LargestInt value) {
+  const bool fits =
+      std::is_signed<T>::value
+          ? value >= static_cast<LargestInt>(std::numeric_limits<T>::min()) &&
+                value <= static_cast<LargestInt>(std::numeric_limits<T>::max())
+          : value >= 0 && static_cast<LargestUInt>(value) <=
+                              static_cast<LargestUInt>(
+                                  std::numeric_limits<T>::max());
+  if (fits)
+    *static_cast<T*>(target) = static_cast<T>(value);
+  return fits;
+}
+
+template <class T> bool assignUInteger(void* target, LargestUInt value) {
+  const bool fits =
+      value <= static_cast<LargestUInt>(std::numeric_limits<T>::max());
+  if (fits)
+    *static_cast<T*>(target) = static_cast<T>(value);
+  return fits;
+}
+
+template <class T> bool assignIntegralReal(void* target, double value) {
+  // Only reals that hold an integer in range, such as 3.0 or 1e3.
+  const bool fits =
+      value == std::floor(value) &&
+      value >= static_cast<double>(std::numeric_limits<T>::min()) &&
+      value < static_cast<double>(std::numeric_limits<T>::max()) + 1.0;
+  if (fits)
+    *static_cast<T*>(target) = static_cast<T>(value);
+  return fits;
+}
+
+template <class T> bool assignNumber(void* target, LargestInt value) {
+  *static_cast<T*>(target) = static_cast<T>(value);
+  return true;
+}
+
+template <class T> bool assignUNumber(void* target, LargestUInt value) {
+  *static_cast<T*>(target) = static_cast<T>(value);
+  return true;
+}
+
+template <class T> bool assignReal(void* target, double value) {
+  *static_cast<T*>(target) = static_cast<T>(value);
+  return true;
+}
+
+template <> struct Ops<bool> {
+  static TypeOps const* get() {
+    static const TypeOps ops = {TypeOps::scalar, "a boolean", &assignBool<bool>,
+                                nullptr, nullptr, nullptr, nullptr, nullptr,
+                                nullptr};
+    return &ops;
+  }
+  static Value toValue(bool value) { return Value(value); }
+};
+
+template <class T>
+struct Ops<T, typename std::enable_if<std::is_integral<T>::value &&
+                                      !std::is_same<T, bool>::value>::type> {
+  static TypeOps const* get() {
+    static const TypeOps ops = {
+        TypeOps::scalar,      "an integer",          nullptr,
+        &assignInteger<T>,    &assignUInteger<T>,    &assignIntegralReal<T>,
+        nullptr,              nullptr,               nullptr};
+    return &ops;
+  }
+  static Value toValue(T value) {
+    return std::is_signed<T>::value ? Value(static_cast<LargestInt>(value))
+                                    : Value(static_cast<LargestUInt>(value));
+  }
+};
+
+template <class T>
+struct Ops<T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+  static TypeOps const* get() {
+    static const TypeOps ops = {
+        TypeOps::scalar,   "a number",         nullptr, &assignNumber<T>,
+        &assignUNumber<T>, &assignReal<T>,     nullptr, nullptr,
+        nullptr};
+    return &ops;
+  }
+  static Value toValue(T value) { return Value(static_cast<double>(value)); }
+};
+
+template <> struct Ops<String> {
+  static bool fromBool(void* target, bool value) {
+    *static_cast<String*>(target) = value ? "true" : "false";
+    return true;
+  }
+  static bool fromInteger(void* target, LargestInt value) {
+    *static_cast<String*>(target) = valueToString(value);
+    return true;
+  }
+  static bool fromUInteger(void* target, LargestUInt value) {
+    *static_cast<String*>(target) = valueToString(value);
+    return true;
+  }
+  static bool fromReal(void* target, double value) {
+    *static_cast<String*>(target) = valueToString(value);
+    return true;
+  }
+  static void fromString(void* target, char const* begin, char const* end) {
+    static_cast<String*>(target)->assign(begin, end);
+  }
+  static TypeOps const* get() {
+    static const TypeOps ops = {
+        TypeOps::scalar, "a string", &fromBool, &fromInteger, &fromUInteger,
+        &fromReal,       &fromString, nullptr,  nullptr};
+    return &ops;
+  }
+  static Value toValue(String const& value) { return Value(value); }
+};
+
+template <class T> struct Ops<std::vector<T>> {
+  static void* element(void* target, TypeOps const** ops) {
+    auto& elements = *static_cast<std::vector<T>*>(target);
+    elements.emplace_back();
+    *ops = Ops<T>::get();
+    return &elements.back();
+  }
+  static TypeOps const* get() {
+    static const TypeOps ops = {TypeOps::array, "an array", nullptr, nullptr,
+                                nullptr,        nullptr,    nullptr, nullptr,
+                                &element};
+    return &ops;
+  }
+  static Value toValue(std::vector<T> const& elements) {
+    Value result(arrayValue);
+    result.resize(static_cast<ArrayIndex>(elements.size()));
+    ArrayIndex index = 0;
+    for (auto const& element : elements)
+      result[index++] = Ops<T>::toValue(element);
+    return result;
+  }
+};
+
+// Bound structs: anything with a Binding specialization.
+template <class T> struct Ops<T, decltype(void(Binding<T>::fields()))> {
+  template <class Member>
+  static bool match(Field<T, Member> const& field, T& object,
+                    char const* begin, size_t length, void** member,
+                    TypeOps const** ops, char const** name) {
+    if (field.length != length || memcmp(field.name, begin, length) != 0)
+      return false;
+    *member = &(object.*field.member);
+    *ops = Ops<Member>::get();
+    *name = field.name;
+    return true;
+  }
+
+  template <class Fields, size_t... I>
+  static void* find(Fields const& fields, T& object, char const* begin,
+                    size_t length, TypeOps const** ops, char const** name,
+                    std::index_sequence<I...>) {
+    void* member = nullptr;
+    bool found = false;
+    using expand = int[];
+    (void)expand{0, (found = found || match(std::get<I>(fields), object, begin,
+                                            length, &member, ops, name),
+                     0)...};
+    return member;
+  }
+
+  static void* member(void* target, char const* begin, char const* end,
+                      TypeOps const** ops, char const** name) {
+    const auto fields = Binding<T>::fields();
+    return find(fields, *static_cast<T*>(target), begin,
+                static_cast<size_t>(end - begin), ops, name,
+                std::make_index_sequence<
+                    std::tuple_size<decltype(fields)>::value>());
+  }
+
+  static TypeOps const* get() {
+    static const TypeOps ops = {TypeOps::object, "an object", nullptr, nullptr,
+                                nullptr,         nullptr,     nullptr, &member,
+                                nullptr};
+    return &ops;
+  }
+
+  template <class Fields, size_t... I>
+  static void store(Fields const& fields, T const& object, Value& result,
+                    std::index_sequence<I...>) {
+    using expand = int[];
+    (void)expand{0, (result[StaticString(std::get<I>(fields).name)] =
+                         Ops<typename std::decay<decltype(
+                             object.*(std::get<I>(fields).member))>::type>::
+                             toValue(object.*(std::get<I>(fields).member)),
+                     0)...};
+  }
+
+  static Value toValue(T const& object) {
+    const auto fields = Binding<T>::fields();
+    Value result(objectValue);
+    store(fields, object, result,
+          std::make_index_sequence<
+              std::tuple_size<decltype(fields)>::value>());
+    return result;
+  }
+};
+
+} // namespace detail
+
+/** \brief A ParseHandler that fills a bound struct, vector or scalar.
+ *
+ * Nothing is built besides the target itself; skipped members cost only the
+ * parse. Feed it with a PushParser, or use Json::decode().
+ */
+template <class T> class BindingHandler : public ParseHandler {
+public:
+  explicit BindingHandler(T& root) : root_(&root) {}
+
+  bool null() override {
+    Slot slot = next();
+    return slot.ok;
+  }
+  bool boolean(bool value) override {
+    Slot slot = next();
+    return slot.ok && (!slot.target || check(slot, slot.ops->boolean &&
+                                                       slot.ops->boolean(
+                                                           slot.target, value)));
+  }
+  bool integer(LargestInt value) override {
+    Slot slot = next();
+    return slot.ok && (!slot.target || check(slot, slot.ops->integer &&
+                                                       slot.ops->integer(
+                                                           slot.target, value)));
+  }
+  bool uinteger(LargestUInt value) override {
+    Slot slot = next();
+    return slot.ok &&
+           (!slot.target ||
+            check(slot, slot.ops->uinteger &&
+                            slot.ops->uinteger(slot.target, value)));
+  }
+  bool real(double value) override {
+    Slot slot = next();
+    return slot.ok && (!slot.target ||
+                       check(slot, slot.ops->real &&
+                                       slot.ops->real(slot.target, value)));
+  }
+  bool string(char const* begin, char const* end) override {
+    Slot slot = next();
+    if (!slot.ok || !slot.target)
+      return slot.ok;
+    if (!slot.ops->string)
+      return check(slot, false);
+    slot.ops->string(slot.target, begin, end);
+    return true;
+  }
+  bool startObject() override { return open(detail::TypeOps::object); }
+  bool key(char const* begin, char const* end) override {
+    Frame& frame = stack_.back();
+    if (frame.target)
+      frame.member = frame.ops->member(frame.target, begin, end,
+                                       &frame.memberOps, &frame.memberName);
+    return true;
+  }
+  bool endObject() override {
+    stack_.pop_back();
+    return true;
+  }
+  bool startArray() override { return open(detail::TypeOps::array); }
+  bool endArray() override {
+    stack_.pop_back();
+    return true;
+  }
+  String errorMessage() const override { return error_; }
+
+private:
+  struct Frame {
+    void* target; // null while skipping
+    detail::TypeOps const* ops;
+    void* member;
+    detail::TypeOps const* memberOps;
+    char const* memberName;
+  };
+  struct Slot {
+    bool ok;
+    void* target; // null to skip the value
+    detail::TypeOps const* ops;
+    char const* name;
+  };
+
+  Slot next() {
+    if (stack_.empty()) {
+      if (rootDone_)
+        return {false, nullptr, nullptr, nullptr};
+      rootDone_ = true;
+      return {true, root_, detail::Ops<T>::get(), nullptr};
+    }
+    Frame& frame = stack_.back();
+    if (!frame.target)
+      return {true, nullptr, nullptr, nullptr};
+    if (frame.ops->kind == detail::TypeOps::array) {
+      detail::TypeOps const* ops;
+      void* element = frame.ops->element(frame.target, &ops);
+      return {true, element, ops, frame.memberName};
+    }
+    return {true, frame.member, frame.memberOps, frame.memberName};
+  }
+
+  bool check(Slot const& slot, bool ok) {
+    if (!ok) {
+      error_ = slot.name ? "'" + String(slot.name) + "': expected "
+                         : String("expected ");
+      error_ += slot.ops->expected;
+    }
+    return ok;
+  }
+
+  bool open(detail::TypeOps::Kind kind) {
+    Slot slot = next();
+    if (!slot.ok)
+      return false;
+    if (slot.target && slot.ops->kind != kind)
+      return check(slot, false);
+    stack_.push_back({slot.target, slot.ops, nullptr, nullptr, slot.name});
+    return true;
+  }
+
+  T* root_;
+  std::vector<Frame> stack_;
+  String error_;
+  bool rootDone_ = false;
+};
+
+/** Decode [begin, end) into \p out.
+ * \return false and set \p errs (if not null) on malformed input or when a
+ *         value does not fit its member.
+ */
+template <class T>
+bool decode(char const* begin, char const* end, T& out, String* errs) {
+  BindingHandler<T> handler(out);
+  PushParser parser(handler);
+  PushParser::Status status =
+      parser.feed(begin, static_cast<size_t>(end - begin));
+  if (status == PushParser::needMoreInput)
+    status = parser.finish();
+  if (status == PushParser::complete)
+    return true;
+  if (errs)
+    *errs = parser.getFormattedErrorMessages();
+  return false;
+}
+
+/// A Value holding \p object, ready for any writer.
+template <class T> Value toValue(T const& object) {
+  return detail::Ops<T>::toValue(object);
+}
+
+} // namespace Json
+
+#endif // JSON_BINDING_H_INCLUDED
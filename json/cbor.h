@@ -0,0 +1,102 @@
+// Copyright 2007-2010 Baptiste Lepilleur and The JsonCpp Authors
+// Distributed under MIT license, or public domain if desired and
+// recognized in your jurisdiction.
+// See file LICENSE for detail or copy at http://jsoncpp.sourceforge.net/LICENSE
+
+#ifndef JSON_CBOR_H_INCLUDED
+#define JSON_CBOR_H_INCLUDED
+
+#if !defined(JSON_IS_AMALGAMATION)
+#include "value.h"
+#endif // if !defined(JSON_IS_AMALGAMATION)
+#include <iosfwd>
+
+// Disable warning C4251: <data member>: <type> needs to have dll-interface to
+// be used by...
+#if defined(JSONCPP_DISABLE_DLL_INTERFACE_WARNING) && defined(_MSC_VER)
+#pragma warning(push)
+#pragma warning(disable : 4251)
+#endif // if defined(JSONCPP_DISABLE_DLL_INTERFACE_WARNING)
+
+#pragma pack(push)
+#pragma pack()
+
+namespace Json {
+
+/** \brief Serialize a Value as CBOR (RFC 8949), a compact binary form of
+ * the same data model.
+ *
+ * Integers and lengths take the shortest head, and reals the shortest of
+ * half, single or double precision that holds them exactly. Comments are
+ * not kept. Decoding with CborReader gives back an equal Value, with the
+ * integer/real distinction intact.
+ *
+ * Usage:
+ *   \code
+ *   Json::CborWriter writer;
+ *   std::ofstream out("cache.cbor", std::ios::binary);
+ *   writer.write(cache, out);
+ *   \endcode
+ */
+class JSON_API CborWriter {
+public:
+  CborWriter();
+
+  /** Produce the deterministic encoding of RFC 8949 section 4.2.1: object
+   * members are sorted by their encoded key, so equal Values always encode
+   * to the same bytes (e.g. for hashing or comparing snapshots). Off by
+   * default, which writes members in Value order and is a little faster.
+   */
+  void setCanonical(bool canonical) { canonical_ = canonical; }
+
+  /// Replace \p out with the encoding of \p root.
+  void write(Value const& root, String& out) const;
+  /** Encode \p root to \p sout in chunks, without holding the whole
+   * encoding in memory.
+   * \return false if the stream failed.
+   */
+  bool write(Value const& root, OStream& sout) const;
+
+private:
+  bool canonical_;
+};
+
+/** \brief Deserialize CBOR (RFC 8949) into a Value.
+ *
+ * Accepts everything CborWriter produces, plus indefinite lengths, tags
+ * (which are skipped), byte strings (read as strings) and "undefined" (read
+ * as null). Object keys must be strings. Duplicate keys keep the last value,
+ * as the text reader does.
+ */
+class JSON_API CborReader {
+public:
+  CborReader();
+
+  /// Maximum nesting depth, as the text reader's "stackLimit".
+  void setStackLimit(unsigned int stackLimit) { stackLimit_ = stackLimit; }
+
+  /** Decode the item at the start of [begin, end).
+   * \param consumed If not null, receives the number of bytes the item used,
+   *        so a CBOR sequence can be read one item after the other.
+   * \return false and set \p errs (if not null) on malformed input.
+   */
+  bool parse(char const* begin, char const* end, Value* root, String* errs,
+             size_t* consumed = nullptr) const;
+  /** Decode one item from \p sin, reading exactly the bytes it needs; call
+   * again for the next item of a sequence.
+   */
+  bool parse(IStream& sin, Value* root, String* errs) const;
+
+private:
+  unsigned int stackLimit_;
+};
+
+} // namespace Json
+
+#pragma pack(pop)
+
+#if defined(JSONCPP_DISABLE_DLL_INTERFACE_WARNING)
+#pragma warning(pop)
+#endif // if defined(JSONCPP_DISABLE_DLL_INTERFACE_WARNING)
+
+#endif // JSON_CBOR_H_INCLUDED
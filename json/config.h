@@ -25,6 +25,24 @@
 #define JSON_USE_NULLREF 1
 #endif
 
+// If non-zero, Value keeps comments and source offsets in a side table rather
+// than in every node, which brings sizeof(Value) down to 16 bytes on 64-bit
+// targets. Nodes that carry neither pay nothing; nodes that do take a lock to
+// reach their entry, so readers should be built with "storeOffsets" off.
+#ifndef JSONCPP_COMPACT_VALUE
+#define JSONCPP_COMPACT_VALUE 0
+#endif
+
+// If non-zero, copies of an array or object share its elements until one of
+// them is modified, so copying a tree is O(1) and a write clones only the
+// containers on the path to the changed node. Shared trees may be read from
+// several threads at once. As with any copy-on-write type, a reference or
+// iterator obtained through a non-const accessor must not be used after the
+// value has been copied; look it up again instead.
+#ifndef JSONCPP_SHARED_VALUE
+#define JSONCPP_SHARED_VALUE 0
+#endif
+
 /// If defined, indicates that the source file is amalgamated
 /// to prevent private header inclusion.
 /// Remarks: it is automatically defined in the generated amalgamated header.
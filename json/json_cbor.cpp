@@ -0,0 +1,629 @@
+// Copyright 2007-2010 Baptiste Lepilleur and The JsonCpp Authors
+// Distributed under MIT license, or public domain if desired and
+// recognized in your jurisdiction.
+// See file LICENSE for detail or copy at http://jsoncpp.sourceforge.net/LICENSE
+
+#if !defined(JSON_IS_AMALGAMATION)
+#include <json/cbor.h>
+#include <json/writer.h>
+#endif // if !defined(JSON_IS_AMALGAMATION)
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <vector>
+
+namespace Json {
+
+namespace {
+
+// Major types, in the top three bits of the initial byte.
+enum Major : unsigned char {
+  majorUnsigned = 0,
+  majorNegative = 1,
+  majorBytes = 2,
+  majorText = 3,
+  majorArray = 4,
+  majorMap = 5,
+  majorTag = 6,
+  majorSimple = 7
+};
+
+const unsigned char cborFalse = 0xf4;
+const unsigned char cborTrue = 0xf5;
+const unsigned char cborNull = 0xf6;
+const unsigned char cborUndefined = 0xf7;
+const unsigned char cborHalf = 0xf9;
+const unsigned char cborSingle = 0xfa;
+const unsigned char cborDouble = 0xfb;
+const unsigned char indefinite = 31;
+
+// Half precision for a float, if it can be stored without loss.
+bool toHalf(float value, uint16_t* half) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  const auto sign = static_cast<uint16_t>((bits >> 16) & 0x8000U);
+  const int exponent = static_cast<int>((bits >> 23) & 0xff);
+  const uint32_t mantissa = bits & 0x7fffffU;
+  if (exponent == 0xff) {
+    if (mantissa)
+      return false; // NaN is written by the caller
+    *half = static_cast<uint16_t>(sign | 0x7c00U);
+    return true;
+  }
+  if (exponent == 0 && mantissa == 0) {
+    *half = sign;
+    return true;
+  }
+  const int halfExponent = exponent - 127 + 15;
+  if (halfExponent >= 31)
+    return false;
+  if (halfExponent >= 1) {
+    if (mantissa & 0x1fffU)
+      return false;
+    *half = static_cast<uint16_t>(sign | (halfExponent << 10) |
+                                  (mantissa >> 13));
+    return true;
+  }
+  // Subnormal half: the whole significand shifted right.
+  if (halfExponent < -10)
+    return false;
+  const uint32_t significand = mantissa | 0x800000U;
+  const int shift = 14 - halfExponent;
+  if (significand & ((1U << shift) - 1))
+    return false;
+  *half = static_cast<uint16_t>(sign | (significand >> shift));
+  return true;
+}
+
+double fromHalf(uint16_t half) {
+  const int exponent = (half >> 10) & 0x1f;
+  const int mantissa = half & 0x3ff;
+  double value;
+  if (exponent == 0)
+    value = std::ldexp(mantissa, -24);
+  else if (exponent != 31)
+    value = std::ldexp(mantissa + 1024, exponent - 25);
+  else
+    value = mantissa == 0 ? std::numeric_limits<double>::infinity()
+                          : std::numeric_limits<double>::quiet_NaN();
+  return (half & 0x8000) ? -value : value;
+}
+
+class Encoder {
+public:
+  Encoder(String& out, OStream* sout, bool canonical)
+      : out_(out), sout_(sout), canonical_(canonical) {}
+
+  void value(Value const& value);
+  bool flush();
+
+private:
+  struct Member {
+    char const* key;
+    char const* end;
+    Value const* value;
+  };
+
+  void head(unsigned char major, uint64_t argument);
+  void bytes(char const* data, size_t length);
+  void real(double value);
+
+  String& out_;
+  OStream* sout_;
+  bool canonical_;
+  std::vector<Member> members_;
+};
+
+// Streamed output goes out in chunks of about this size.
+const size_t chunkSize = 64 * 1024;
+
+void Encoder::head(unsigned char major, uint64_t argument) {
+  char buffer[9];
+  const auto initial = static_cast<unsigned char>(major << 5);
+  size_t length;
+  if (argument < 24) {
+    buffer[0] = static_cast<char>(initial | argument);
+    length = 1;
+  } else if (argument <= 0xff) {
+    buffer[0] = static_cast<char>(initial | 24);
+    length = 2;
+  } else if (argument <= 0xffff) {
+    buffer[0] = static_cast<char>(initial | 25);
+    length = 3;
+  } else if (argument <= 0xffffffffU) {
+    buffer[0] = static_cast<char>(initial | 26);
+    length = 5;
+  } else {
+    buffer[0] = static_cast<char>(initial | 27);
+    length = 9;
+  }
+  for (size_t i = length - 1; i > 0; --i, argument >>= 8)
+    buffer[i] = static_cast<char>(argument & 0xff);
+  out_.append(buffer, length);
+}
+
+void Encoder::bytes(char const* data, size_t length) {
+  out_.append(data, length);
+  if (sout_ && out_.size() >= chunkSize)
+    flush();
+}
+
+void Encoder::real(double value) {
+  char buffer[9];
+  if (std::isnan(value)) {
+    static const char nan[] = {static_cast<char>(cborHalf), 0x7e, 0x00};
+    out_.append(nan, sizeof(nan));
+    return;
+  }
+  const auto single = static_cast<float>(value);
+  if (static_cast<double>(single) == value || std::isinf(value)) {
+    uint16_t half;
+    if (toHalf(single, &half)) {
+      buffer[0] = static_cast<char>(cborHalf);
+      buffer[1] = static_cast<char>(half >> 8);
+      buffer[2] = static_cast<char>(half & 0xff);
+      out_.append(buffer, 3);
+      return;
+    }
+    uint32_t bits;
+    memcpy(&bits, &single, sizeof(bits));
+    buffer[0] = static_cast<char>(cborSingle);
+    for (int i = 4; i > 0; --i, bits >>= 8)
+      buffer[i] = static_cast<char>(bits & 0xff);
+    out_.append(buffer, 5);
+    return;
+  }
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  buffer[0] = static_cast<char>(cborDouble);
+  for (int i = 8; i > 0; --i, bits >>= 8)
+    buffer[i] = static_cast<char>(bits & 0xff);
+  out_.append(buffer, 9);
+}
+
+void Encoder::value(Value const& value) {
+  switch (value.type()) {
+  case nullValue:
+    out_ += static_cast<char>(cborNull);
+    break;
+  case booleanValue:
+    out_ += static_cast<char>(value.asBool() ? cborTrue : cborFalse);
+    break;
+  case intValue: {
+    const LargestInt number = value.asLargestInt();
+    if (number >= 0)
+      head(majorUnsigned, static_cast<uint64_t>(number));
+    else
+      head(majorNegative, ~static_cast<uint64_t>(number)); // -1 - number
+    break;
+  }
+  case uintValue:
+    head(majorUnsigned, value.asLargestUInt());
+    break;
+  case realValue:
+    real(value.asDouble());
+    break;
+  case stringValue: {
+    char const* begin = "";
+    char const* end = begin;
+    value.getString(&begin, &end);
+    head(majorText, static_cast<uint64_t>(end - begin));
+    bytes(begin, static_cast<size_t>(end - begin));
+    break;
+  }
+  case arrayValue: {
+    const ArrayIndex size = value.size();
+    head(majorArray, size);
+    for (ArrayIndex index = 0; index < size; ++index)
+      this->value(value[index]);
+    break;
+  }
+  case objectValue: {
+    head(majorMap, value.size());
+    if (!canonical_) {
+      for (auto it = value.begin(); it != value.end(); ++it) {
+        char const* end;
+        char const* key = it.memberName(&end);
+        head(majorText, static_cast<uint64_t>(end - key));
+        bytes(key, static_cast<size_t>(end - key));
+        this->value(*it);
+      }
+      break;
+    }
+    // Encoded keys compare bytewise: shorter keys first, then by content.
+    const size_t first = members_.size();
+    for (auto it = value.begin(); it != value.end(); ++it) {
+      Member member;
+      member.key = it.memberName(&member.end);
+      member.value = &*it;
+      members_.push_back(member);
+    }
+    std::sort(members_.begin() + static_cast<ptrdiff_t>(first), members_.end(),
+              [](Member const& a, Member const& b) {
+                const auto lengthA = a.end - a.key;
+                const auto lengthB = b.end - b.key;
+                if (lengthA != lengthB)
+                  return lengthA < lengthB;
+                return memcmp(a.key, b.key, static_cast<size_t>(lengthA)) < 0;
+              });
+    for (size_t i = first; i < members_.size(); ++i) {
+      const Member member = members_[i];
+      head(majorText, static_cast<uint64_t>(member.end - member.key));
+      bytes(member.key, static_cast<size_t>(member.end - member.key));
+      this->value(*member.value);
+    }
+    members_.resize(first);
+    break;
+  }
+  }
+  if (sout_ && out_.size() >= chunkSize)
+    flush();
+}
+
+bool Encoder::flush() {
+  sout_->write(out_.data(), static_cast<std::streamsize>(out_.size()));
+  out_.clear();
+  return sout_->good();
+}
+
+// Input from memory: bytes are handed out in place.
+class MemorySource {
+public:
+  MemorySource(char const* begin, char const* end)
+      : begin_(begin), current_(begin), end_(end) {}
+
+  bool take(size_t length, char const** bytes) {
+    if (static_cast<size_t>(end_ - current_) < length)
+      return false;
+    *bytes = current_;
+    current_ += length;
+    return true;
+  }
+  // Every element takes at least a byte, so a count beyond what is left is
+  // corrupt; checking up front avoids reserving for it.
+  bool mayHold(uint64_t count) const {
+    return count <= static_cast<uint64_t>(end_ - current_);
+  }
+  size_t offset() const { return static_cast<size_t>(current_ - begin_); }
+
+private:
+  char const* begin_;
+  char const* current_;
+  char const* end_;
+};
+
+// Input from a stream: exactly the requested bytes are read.
+class StreamSource {
+public:
+  explicit StreamSource(IStream& sin) : buffer_(sin.rdbuf()) {}
+
+  bool take(size_t length, char const** bytes) {
+    if (!buffer_)
+      return false;
+    if (length == 1) {
+      // Heads are read a byte at a time; sbumpc() stays inline.
+      const auto c = buffer_->sbumpc();
+      if (c == std::char_traits<char>::eof())
+        return false;
+      small_[0] = static_cast<char>(c);
+      *bytes = small_;
+    } else if (length <= sizeof(small_)) {
+      if (buffer_->sgetn(small_, static_cast<std::streamsize>(length)) !=
+          static_cast<std::streamsize>(length))
+        return false;
+      *bytes = small_;
+    } else {
+      scratch_.resize(length);
+      if (buffer_->sgetn(&scratch_[0], static_cast<std::streamsize>(length)) !=
+          static_cast<std::streamsize>(length))
+        return false;
+      *bytes = scratch_.data();
+    }
+    offset_ += length;
+    return true;
+  }
+  bool mayHold(uint64_t /*count*/) const { return true; }
+  size_t offset() const { return offset_; }
+
+private:
+  std::streambuf* buffer_;
+  char small_[16];
+  String scratch_;
+  size_t offset_ = 0;
+};
+
+template <class Source> class Decoder {
+public:
+  Decoder(Source& source, unsigned int stackLimit)
+      : source_(source), stackLimit_(stackLimit) {}
+
+  bool item(Value& value, unsigned int depth);
+  String const& error() const { return error_; }
+
+private:
+  struct Head {
+    unsigned char major;
+    unsigned char info;
+    uint64_t argument;
+    bool isBreak() const { return major == majorSimple && info == indefinite; }
+  };
+
+  bool head(Head* head);
+  bool body(Value& value, Head const& head, unsigned int depth);
+  bool string(Head const& head, String* text, char const** begin,
+              char const** end);
+  bool real(Value& value, Head const& head);
+  bool fail(char const* message);
+
+  Source& source_;
+  unsigned int stackLimit_;
+  String error_;
+};
+
+template <class Source> bool Decoder<Source>::fail(char const* message) {
+  if (error_.empty())
+    error_ = "Offset " + valueToString(LargestUInt(source_.offset())) + ": " +
+             message;
+  return false;
+}
+
+template <class Source> bool Decoder<Source>::head(Head* head) {
+  char const* bytes;
+  if (!source_.take(1, &bytes))
+    return fail("unexpected end of input");
+  const auto initial = static_cast<unsigned char>(*bytes);
+  head->major = static_cast<unsigned char>(initial >> 5);
+  head->info = static_cast<unsigned char>(initial & 0x1f);
+  if (head->info < 24) {
+    head->argument = head->info;
+    return true;
+  }
+  if (head->info == indefinite) {
+    head->argument = 0;
+    return true;
+  }
+  if (head->info > 27)
+    return fail("reserved additional information");
+  const size_t length = size_t(1) << (head->info - 24);
+  if (!source_.take(length, &bytes))
+    return fail("unexpected end of input");
+  uint64_t number = 0;
+  for (size_t i = 0; i < length; ++i)
+    number = (number << 8) | static_cast<unsigned char>(bytes[i]);
+  head->argument = number;
+  return true;
+}
+
+// Reads a text or byte string into [begin, end), which stays valid until the
+// next read: a definite string is not copied, chunks are joined in *text.
+template <class Source>
+bool Decoder<Source>::string(Head const& head, String* text,
+                             char const** begin, char const** end) {
+  if (head.info != indefinite) {
+    if (!source_.mayHold(head.argument) ||
+        head.argument > std::numeric_limits<size_t>::max() / 2)
+      return fail("string longer than the input");
+    char const* bytes = "";
+    const auto length = static_cast<size_t>(head.argument);
+    if (length && !source_.take(length, &bytes))
+      return fail("unexpected end of input");
+    *begin = bytes;
+    *end = bytes + length;
+    return true;
+  }
+  text->clear();
+  for (;;) {
+    Head chunk;
+    if (!this->head(&chunk))
+      return false;
+    if (chunk.isBreak())
+      break;
+    if (chunk.major != head.major || chunk.info == indefinite)
+      return fail("invalid chunk in indefinite-length string");
+    if (!source_.mayHold(chunk.argument) ||
+        chunk.argument > std::numeric_limits<size_t>::max() / 2)
+      return fail("string longer than the input");
+    char const* bytes = "";
+    const auto length = static_cast<size_t>(chunk.argument);
+    if (length && !source_.take(length, &bytes))
+      return fail("unexpected end of input");
+    text->append(bytes, length);
+  }
+  *begin = text->data();
+  *end = text->data() + text->size();
+  return true;
+}
+
+template <class Source>
+bool Decoder<Source>::real(Value& value, Head const& head) {
+  switch (head.info) {
+  case 25:
+    value = fromHalf(static_cast<uint16_t>(head.argument));
+    return true;
+  case 26: {
+    const auto bits = static_cast<uint32_t>(head.argument);
+    float single;
+    memcpy(&single, &bits, sizeof(single));
+    value = static_cast<double>(single);
+    return true;
+  }
+  case 27: {
+    const uint64_t bits = head.argument;
+    double number;
+    memcpy(&number, &bits, sizeof(number));
+    value = number;
+    return true;
+  }
+  default:
+    return fail("unsupported simple value");
+  }
+}
+
+template <class Source>
+bool Decoder<Source>::item(Value& value, unsigned int depth) {
+  Head head;
+  if (!this->head(&head))
+    return false;
+  if (head.isBreak())
+    return fail("unexpected break");
+  return body(value, head, depth);
+}
+
+template <class Source>
+bool Decoder<Source>::body(Value& value, Head const& head, unsigned int depth) {
+  if (depth > stackLimit_)
+    return fail("exceeded stackLimit");
+  const bool isIndefinite = head.info == indefinite;
+  switch (head.major) {
+  case majorUnsigned:
+  case majorNegative:
+    if (isIndefinite)
+      return fail("integer with indefinite length");
+    // The same types the text reader gives these numbers.
+    if (head.argument <= static_cast<uint64_t>(Value::maxLargestInt))
+      value = head.major == majorUnsigned
+                  ? static_cast<LargestInt>(head.argument)
+                  : -1 - static_cast<LargestInt>(head.argument);
+    else if (head.major == majorUnsigned)
+      value = static_cast<LargestUInt>(head.argument);
+    else
+      value = -1.0 - static_cast<double>(head.argument);
+    return true;
+  case majorBytes:
+  case majorText: {
+    String text;
+    char const* begin;
+    char const* end;
+    if (!string(head, &text, &begin, &end))
+      return false;
+    value = Value(begin, end);
+    return true;
+  }
+  case majorArray: {
+    if (!isIndefinite && !source_.mayHold(head.argument))
+      return fail("array longer than the input");
+    value = Value(arrayValue);
+    for (uint64_t index = 0; isIndefinite || index < head.argument; ++index) {
+      Head element;
+      if (!this->head(&element))
+        return false;
+      if (element.isBreak()) {
+        if (isIndefinite)
+          break;
+        return fail("unexpected break");
+      }
+      if (!body(value.append(Value()), element, depth + 1))
+        return false;
+    }
+    return true;
+  }
+  case majorMap: {
+    if (!isIndefinite && !source_.mayHold(head.argument))
+      return fail("map longer than the input");
+    value = Value(objectValue);
+    String text;
+    for (uint64_t index = 0; isIndefinite || index < head.argument; ++index) {
+      Head key;
+      if (!this->head(&key))
+        return false;
+      if (key.isBreak()) {
+        if (isIndefinite)
+          break;
+        return fail("unexpected break");
+      }
+      if (key.major != majorText && key.major != majorBytes)
+        return fail("object key must be a string");
+      char const* begin;
+      char const* end;
+      if (!string(key, &text, &begin, &end))
+        return false;
+      if (!item(*value.demand(begin, end), depth + 1))
+        return false;
+    }
+    return true;
+  }
+  case majorTag:
+    // Tags only qualify their content (dates, bignums...); keep the content.
+    if (isIndefinite)
+      return fail("tag with indefinite length");
+    return item(value, depth + 1);
+  default:
+    break;
+  }
+  switch (head.info) {
+  case cborFalse & 0x1f:
+    value = false;
+    return true;
+  case cborTrue & 0x1f:
+    value = true;
+    return true;
+  case cborNull & 0x1f:
+  case cborUndefined & 0x1f:
+    value = Value();
+    return true;
+  default:
+    return real(value, head);
+  }
+}
+
+template <class Source>
+bool decode(Source& source, unsigned int stackLimit, Value* root,
+            String* errs) {
+  Decoder<Source> decoder(source, stackLimit);
+  Value value;
+  if (!decoder.item(value, 0)) {
+    if (errs)
+      *errs = decoder.error();
+    return false;
+  }
+  root->swap(value);
+  return true;
+}
+
+} // namespace
+
+// class CborWriter
+// //////////////////////////////////////////////////////////////////
+
+CborWriter::CborWriter() : canonical_(false) {}
+
+void CborWriter::write(Value const& root, String& out) const {
+  out.clear();
+  Encoder(out, nullptr, canonical_).value(root);
+}
+
+bool CborWriter::write(Value const& root, OStream& sout) const {
+  String buffer;
+  buffer.reserve(chunkSize + 16);
+  Encoder encoder(buffer, &sout, canonical_);
+  encoder.value(root);
+  return encoder.flush();
+}
+
+// class CborReader
+// //////////////////////////////////////////////////////////////////
+
+CborReader::CborReader() : stackLimit_(1000) {}
+
+bool CborReader::parse(char const* begin, char const* end, Value* root,
+                       String* errs, size_t* consumed) const {
+  MemorySource source(begin, end);
+  const bool ok = decode(source, stackLimit_, root, errs);
+  if (consumed)
+    *consumed = source.offset();
+  return ok;
+}
+
+bool CborReader::parse(IStream& sin, Value* root, String* errs) const {
+  StreamSource source(sin);
+  if (decode(source, stackLimit_, root, errs))
+    return true;
+  sin.setstate(std::ios::failbit);
+  return false;
+}
+
+} // namespace Json
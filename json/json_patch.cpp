@@ -0,0 +1,528 @@
+// Copyright 2007-2010 Baptiste Lepilleur and The JsonCpp Authors
+// Distributed under MIT license, or public domain if desired and
+// recognized in your jurisdiction.
+// See file LICENSE for detail or copy at http://jsoncpp.sourceforge.net/LICENSE
+
+#if !defined(JSON_IS_AMALGAMATION)
+#include <json/assertions.h>
+#include <json/patch.h>
+#include <json/writer.h>
+#endif // if !defined(JSON_IS_AMALGAMATION)
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Json {
+
+namespace {
+
+// RFC 6901: '~' is written "~0" and '/' "~1".
+void appendToken(String& pointer, char const* begin, char const* end) {
+  pointer += '/';
+  for (; begin != end; ++begin) {
+    if (*begin == '~')
+      pointer += "~0";
+    else if (*begin == '/')
+      pointer += "~1";
+    else
+      pointer += *begin;
+  }
+}
+
+void appendIndex(String& pointer, ArrayIndex index) {
+  pointer += '/';
+  pointer += valueToString(LargestUInt(index));
+}
+
+void combine(size_t& seed, size_t value) {
+  seed ^= value + static_cast<size_t>(0x9e3779b9U) + (seed << 6) + (seed >> 2);
+}
+
+// Equal values hash alike, so arrays can be matched without comparing every
+// pair of elements.
+size_t hashValue(Value const& value) {
+  size_t seed = static_cast<size_t>(value.type());
+  switch (value.type()) {
+  case nullValue:
+    break;
+  case intValue:
+    combine(seed, std::hash<LargestInt>()(value.asLargestInt()));
+    break;
+  case uintValue:
+    combine(seed, std::hash<LargestUInt>()(value.asLargestUInt()));
+    break;
+  case realValue:
+    combine(seed, std::hash<double>()(value.asDouble()));
+    break;
+  case booleanValue:
+    combine(seed, value.asBool() ? 1U : 0U);
+    break;
+  case stringValue: {
+    char const* begin;
+    char const* end;
+    if (value.getString(&begin, &end))
+      for (; begin != end; ++begin)
+        combine(seed, static_cast<unsigned char>(*begin));
+    break;
+  }
+  case arrayValue:
+    for (auto const& element : value)
+      combine(seed, hashValue(element));
+    break;
+  case objectValue:
+    for (auto it = value.begin(); it != value.end(); ++it) {
+      char const* end;
+      for (char const* key = it.memberName(&end); key != end; ++key)
+        combine(seed, static_cast<unsigned char>(*key));
+      combine(seed, hashValue(*it));
+    }
+    break;
+  }
+  return seed;
+}
+
+class Differ {
+public:
+  explicit Differ(Value& patch) : patch_(patch) {}
+
+  void compare(Value const& from, Value const& to);
+
+private:
+  void compareObjects(Value const& from, Value const& to);
+  void compareArrays(Value const& from, Value const& to);
+  Value& operation(char const* op);
+
+  Value& patch_;
+  // Pointer to the values being compared; children append and truncate.
+  String path_;
+};
+
+Value& Differ::operation(char const* op) {
+  Value& operation = patch_.append(Value(objectValue));
+  operation[StaticString("op")] = StaticString(op);
+  operation[StaticString("path")] = path_;
+  return operation;
+}
+
+void Differ::compare(Value const& from, Value const& to) {
+  if (from.isObject() && to.isObject())
+    compareObjects(from, to);
+  else if (from.isArray() && to.isArray())
+    compareArrays(from, to);
+  else if (!(from == to))
+    operation("replace")[StaticString("value")] = to;
+}
+
+void Differ::compareObjects(Value const& from, Value const& to) {
+  const size_t length = path_.size();
+  for (auto it = from.begin(); it != from.end(); ++it) {
+    char const* end;
+    char const* key = it.memberName(&end);
+    Value const* other = to.find(key, end);
+    appendToken(path_, key, end);
+    if (!other)
+      operation("remove");
+    else
+      compare(*it, *other);
+    path_.resize(length);
+  }
+  for (auto it = to.begin(); it != to.end(); ++it) {
+    char const* end;
+    char const* key = it.memberName(&end);
+    if (from.find(key, end))
+      continue;
+    appendToken(path_, key, end);
+    operation("add")[StaticString("value")] = *it;
+    path_.resize(length);
+  }
+}
+
+void Differ::compareArrays(Value const& from, Value const& to) {
+  const ArrayIndex n = from.size();
+  const ArrayIndex m = to.size();
+  const ArrayIndex none = std::numeric_limits<ArrayIndex>::max();
+  const size_t length = path_.size();
+  // Cheaper than hashing, and most arrays of a state update are unchanged.
+  if (n == m && from == to)
+    return;
+
+  // Match equal elements, duplicates in order of appearance.
+  struct Bucket {
+    std::vector<ArrayIndex> indices;
+    size_t next = 0; // indices before this one are all matched
+  };
+  std::unordered_map<size_t, Bucket> buckets;
+  for (ArrayIndex j = 0; j < m; ++j)
+    buckets[hashValue(to[j])].indices.push_back(j);
+  std::vector<ArrayIndex> matchTo(n, none);
+  std::vector<ArrayIndex> matchFrom(m, none);
+  for (ArrayIndex i = 0; i < n; ++i) {
+    auto found = buckets.find(hashValue(from[i]));
+    if (found == buckets.end())
+      continue;
+    Bucket& bucket = found->second;
+    while (bucket.next < bucket.indices.size() &&
+           matchFrom[bucket.indices[bucket.next]] != none)
+      ++bucket.next;
+    for (size_t k = bucket.next; k < bucket.indices.size(); ++k) {
+      const ArrayIndex j = bucket.indices[k];
+      if (matchFrom[j] == none && from[i] == to[j]) {
+        matchTo[i] = j;
+        matchFrom[j] = i;
+        break;
+      }
+    }
+  }
+
+  // The longest run of matches still in order stays where it is; the
+  // others are moved. Patience sorting on the target indices.
+  std::vector<bool> stays(n, false);
+  {
+    std::vector<ArrayIndex> tails; // from index ending each run length
+    std::vector<ArrayIndex> previous(n, none);
+    for (ArrayIndex i = 0; i < n; ++i) {
+      if (matchTo[i] == none)
+        continue;
+      auto slot = std::lower_bound(
+          tails.begin(), tails.end(), matchTo[i],
+          [&](ArrayIndex tail, ArrayIndex j) { return matchTo[tail] < j; });
+      previous[i] = slot == tails.begin() ? none : *(slot - 1);
+      if (slot == tails.end())
+        tails.push_back(i);
+      else
+        *slot = i;
+    }
+    for (ArrayIndex i = tails.empty() ? none : tails.back(); i != none;
+         i = previous[i])
+      stays[i] = true;
+  }
+
+  // Unmatched elements between the same two staying ones replace each
+  // other: they are diffed pairwise instead of removed and added.
+  std::vector<ArrayIndex> pairTo(n, none);
+  std::vector<ArrayIndex> pairFrom(m, none);
+  {
+    ArrayIndex i = 0;
+    ArrayIndex j = 0;
+    while (i < n || j < m) {
+      while (i < n && !stays[i] && matchTo[i] != none)
+        ++i;
+      while (j < m && matchFrom[j] != none && !stays[matchFrom[j]])
+        ++j;
+      if (i < n && j < m && matchTo[i] == none && matchFrom[j] == none) {
+        pairTo[i] = j;
+        pairFrom[j] = i;
+        ++i;
+        ++j;
+      } else if (i < n && matchTo[i] == none) {
+        ++i;
+      } else if (j < m && matchFrom[j] == none) {
+        ++j;
+      } else {
+        // Both sides reached the same staying element, or the end.
+        ++i;
+        ++j;
+      }
+    }
+  }
+
+  // Replay the operations on a list of element ids, from indices for
+  // elements of 'from' and n + j for the element added at j.
+  std::vector<ArrayIndex> current;
+  current.reserve(std::max(n, m));
+  for (ArrayIndex i = 0; i < n; ++i)
+    if (matchTo[i] != none || pairTo[i] != none)
+      current.push_back(i);
+  for (ArrayIndex i = n; i-- > 0;) {
+    if (matchTo[i] == none && pairTo[i] == none) {
+      appendIndex(path_, i);
+      operation("remove");
+      path_.resize(length);
+    }
+  }
+
+  auto idOf = [&](ArrayIndex j) {
+    if (matchFrom[j] != none)
+      return matchFrom[j];
+    if (pairFrom[j] != none)
+      return pairFrom[j];
+    return n + j;
+  };
+  auto positionOf = [&](ArrayIndex id) {
+    return static_cast<ArrayIndex>(
+        std::find(current.begin(), current.end(), id) - current.begin());
+  };
+  for (ArrayIndex j = 0; j < m; ++j) {
+    const ArrayIndex source = matchFrom[j];
+    if (pairFrom[j] != none || (source != none && stays[source]))
+      continue;
+    // Place the element right after the one that precedes it in 'to',
+    // which is already in its final place.
+    const ArrayIndex before = j == 0 ? none : positionOf(idOf(j - 1));
+    if (source == none) {
+      const ArrayIndex target = before == none ? 0 : before + 1;
+      appendIndex(path_, target);
+      operation("add")[StaticString("value")] = to[j];
+      path_.resize(length);
+      current.insert(current.begin() + target, n + j);
+      continue;
+    }
+    const ArrayIndex position = positionOf(source);
+    const ArrayIndex target =
+        before == none ? 0 : (position < before ? before : before + 1);
+    if (target == position)
+      continue;
+    String fromPath = path_;
+    appendIndex(fromPath, position);
+    appendIndex(path_, target);
+    operation("move")[StaticString("from")] = fromPath;
+    path_.resize(length);
+    current.erase(current.begin() + position);
+    current.insert(current.begin() + target, source);
+  }
+  JSON_ASSERT(current.size() == m);
+
+  // Everything is in its final place now.
+  for (ArrayIndex j = 0; j < m; ++j) {
+    if (pairFrom[j] == none)
+      continue;
+    appendIndex(path_, j);
+    compare(from[pairFrom[j]], to[j]);
+    path_.resize(length);
+  }
+}
+
+using Tokens = std::vector<String>;
+
+bool parsePointer(String const& pointer, Tokens& tokens, String& error) {
+  tokens.clear();
+  if (pointer.empty())
+    return true;
+  if (pointer[0] != '/') {
+    error = "pointer must start with '/': '" + pointer + "'";
+    return false;
+  }
+  for (size_t i = 0; i < pointer.size(); ++i) {
+    if (pointer[i] == '/') {
+      tokens.emplace_back();
+      continue;
+    }
+    if (pointer[i] != '~') {
+      tokens.back() += pointer[i];
+      continue;
+    }
+    const char escaped = i + 1 < pointer.size() ? pointer[++i] : '\0';
+    if (escaped != '0' && escaped != '1') {
+      error = "invalid escape in pointer '" + pointer + "'";
+      return false;
+    }
+    tokens.back() += escaped == '0' ? '~' : '/';
+  }
+  return true;
+}
+
+// Array index per RFC 6901: no sign, no leading zero. "-" is one past the
+// end, valid only where an element may be added.
+bool parseIndex(String const& token, ArrayIndex size, bool allowEnd,
+                ArrayIndex& index) {
+  if (token == "-") {
+    index = size;
+    return allowEnd;
+  }
+  if (token.empty() || token.size() > 10 || (token[0] == '0' && token != "0"))
+    return false;
+  LargestUInt value = 0;
+  for (char c : token) {
+    if (c < '0' || c > '9')
+      return false;
+    value = value * 10 + static_cast<LargestUInt>(c - '0');
+  }
+  if (value > (allowEnd ? size : size - 1) || (!allowEnd && size == 0))
+    return false;
+  index = static_cast<ArrayIndex>(value);
+  return true;
+}
+
+// The node reached by the first 'count' tokens, or null.
+Value* resolve(Value& root, Tokens const& tokens, size_t count) {
+  Value* node = &root;
+  for (size_t k = 0; k < count; ++k) {
+    String const& token = tokens[k];
+    if (node->isObject()) {
+      if (!node->find(token.data(), token.data() + token.size()))
+        return nullptr;
+      node = node->demand(token.data(), token.data() + token.size());
+    } else if (node->isArray()) {
+      ArrayIndex index;
+      if (!parseIndex(token, node->size(), false, index))
+        return nullptr;
+      node = &(*node)[index];
+    } else {
+      return nullptr;
+    }
+  }
+  return node;
+}
+
+bool addValue(Value& root, Tokens const& tokens, Value value, String& error) {
+  if (tokens.empty()) {
+    root = std::move(value);
+    return true;
+  }
+  Value* parent = resolve(root, tokens, tokens.size() - 1);
+  String const& last = tokens.back();
+  if (parent && parent->isObject()) {
+    *parent->demand(last.data(), last.data() + last.size()) = std::move(value);
+    return true;
+  }
+  ArrayIndex index;
+  if (parent && parent->isArray() &&
+      parseIndex(last, parent->size(), true, index)) {
+    if (index == parent->size())
+      parent->append(std::move(value));
+    else
+      parent->insert(index, std::move(value));
+    return true;
+  }
+  error = "no place to add the value";
+  return false;
+}
+
+bool removeValue(Value& root, Tokens const& tokens, Value* removed,
+                 String& error) {
+  if (tokens.empty()) {
+    error = "cannot remove the whole document";
+    return false;
+  }
+  Value* parent = resolve(root, tokens, tokens.size() - 1);
+  String const& last = tokens.back();
+  if (parent && parent->isObject() &&
+      parent->removeMember(last.data(), last.data() + last.size(), removed))
+    return true;
+  ArrayIndex index;
+  if (parent && parent->isArray() &&
+      parseIndex(last, parent->size(), false, index) &&
+      parent->removeIndex(index, removed))
+    return true;
+  error = "no value to remove";
+  return false;
+}
+
+bool applyOperation(Value& target, Value const& operation, String& error) {
+  if (!operation.isObject()) {
+    error = "operation must be an object";
+    return false;
+  }
+  Value const& op = operation["op"];
+  Value const& path = operation["path"];
+  if (!op.isString() || !path.isString()) {
+    error = "operation needs string members \"op\" and \"path\"";
+    return false;
+  }
+  const String name = op.asString();
+  Tokens tokens;
+  if (!parsePointer(path.asString(), tokens, error))
+    return false;
+
+  Value const* value =
+      operation.isMember("value") ? &operation["value"] : nullptr;
+  if (!value && (name == "add" || name == "replace" || name == "test")) {
+    error = "\"" + name + "\" needs a \"value\"";
+    return false;
+  }
+  Tokens fromTokens;
+  if (name == "move" || name == "copy") {
+    Value const& from = operation["from"];
+    if (!from.isString()) {
+      error = "\"" + name + "\" needs a string \"from\"";
+      return false;
+    }
+    if (!parsePointer(from.asString(), fromTokens, error))
+      return false;
+  }
+
+  if (name == "add")
+    return addValue(target, tokens, *value, error);
+  if (name == "remove")
+    return removeValue(target, tokens, nullptr, error);
+  if (name == "replace") {
+    Value* node = resolve(target, tokens, tokens.size());
+    if (!node) {
+      error = "no value to replace";
+      return false;
+    }
+    *node = *value;
+    return true;
+  }
+  if (name == "test") {
+    Value* node = resolve(target, tokens, tokens.size());
+    if (!node || !(*node == *value)) {
+      error = "test failed";
+      return false;
+    }
+    return true;
+  }
+  if (name == "copy") {
+    Value* node = resolve(target, fromTokens, fromTokens.size());
+    if (!node) {
+      error = "no value to copy";
+      return false;
+    }
+    return addValue(target, tokens, *node, error);
+  }
+  if (name == "move") {
+    if (fromTokens.size() < tokens.size() &&
+        std::equal(fromTokens.begin(), fromTokens.end(), tokens.begin())) {
+      error = "cannot move a value into itself";
+      return false;
+    }
+    if (fromTokens == tokens) {
+      if (resolve(target, tokens, tokens.size()))
+        return true;
+      error = "no value to move";
+      return false;
+    }
+    Value moved;
+    if (!removeValue(target, fromTokens, &moved, error))
+      return false;
+    if (addValue(target, tokens, moved, error))
+      return true;
+    // Put it back so that a failed move changes nothing.
+    String ignored;
+    addValue(target, fromTokens, std::move(moved), ignored);
+    return false;
+  }
+  error = "unknown operation \"" + name + "\"";
+  return false;
+}
+
+} // namespace
+
+Value diff(Value const& from, Value const& to) {
+  Value patch(arrayValue);
+  Differ(patch).compare(from, to);
+  return patch;
+}
+
+bool applyPatch(Value& target, Value const& patch, String* errs) {
+  if (!patch.isArray()) {
+    if (errs)
+      *errs = "A JSON Patch must be an array of operations";
+    return false;
+  }
+  for (ArrayIndex k = 0; k < patch.size(); ++k) {
+    String error;
+    if (!applyOperation(target, patch[k], error)) {
+      if (errs)
+        *errs = "Operation " + valueToString(LargestUInt(k)) + ": " + error;
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace Json
@@ -5,6 +5,7 @@
 // See file LICENSE for detail or copy at http://jsoncpp.sourceforge.net/LICENSE
 
 #if !defined(JSON_IS_AMALGAMATION)
+#include "json_simd.h"
 #include "json_tool.h"
 #include <json/assertions.h>
 #include <json/reader.h>
@@ -64,6 +65,21 @@ Features Features::strictMode() {
   return features;
 }
 
+// A compact Value keeps its offsets in a process-wide side table behind one
+// lock, which every parsed node would take. CharReader only stores them there
+// when asked; Reader, which has no setting for it, does not store them.
+static const bool storeOffsetsByDefault = !JSONCPP_COMPACT_VALUE;
+
+static void setReaderOffsetStart(Value& value, ptrdiff_t start) {
+  if (storeOffsetsByDefault)
+    value.setOffsetStart(start);
+}
+
+static void setReaderOffsetLimit(Value& value, ptrdiff_t limit) {
+  if (storeOffsetsByDefault)
+    value.setOffsetLimit(limit);
+}
+
 // Implementation of class Reader
 // ////////////////////////////////
 
@@ -157,11 +173,11 @@ bool Reader::readValue() {
   switch (token.type_) {
   case tokenObjectBegin:
     successful = readObject(token);
-    currentValue().setOffsetLimit(current_ - begin_);
+    setReaderOffsetLimit(currentValue(), current_ - begin_);
     break;
   case tokenArrayBegin:
     successful = readArray(token);
-    currentValue().setOffsetLimit(current_ - begin_);
+    setReaderOffsetLimit(currentValue(), current_ - begin_);
     break;
   case tokenNumber:
     successful = decodeNumber(token);
@@ -172,20 +188,20 @@ bool Reader::readValue() {
   case tokenTrue: {
     Value v(true);
     currentValue().swapPayload(v);
-    currentValue().setOffsetStart(token.start_ - begin_);
-    currentValue().setOffsetLimit(token.end_ - begin_);
+    setReaderOffsetStart(currentValue(), token.start_ - begin_);
+    setReaderOffsetLimit(currentValue(), token.end_ - begin_);
   } break;
   case tokenFalse: {
     Value v(false);
     currentValue().swapPayload(v);
-    currentValue().setOffsetStart(token.start_ - begin_);
-    currentValue().setOffsetLimit(token.end_ - begin_);
+    setReaderOffsetStart(currentValue(), token.start_ - begin_);
+    setReaderOffsetLimit(currentValue(), token.end_ - begin_);
   } break;
   case tokenNull: {
     Value v;
     currentValue().swapPayload(v);
-    currentValue().setOffsetStart(token.start_ - begin_);
-    currentValue().setOffsetLimit(token.end_ - begin_);
+    setReaderOffsetStart(currentValue(), token.start_ - begin_);
+    setReaderOffsetLimit(currentValue(), token.end_ - begin_);
   } break;
   case tokenArraySeparator:
   case tokenObjectEnd:
@@ -196,13 +212,13 @@ bool Reader::readValue() {
       current_--;
       Value v;
       currentValue().swapPayload(v);
-      currentValue().setOffsetStart(current_ - begin_ - 1);
-      currentValue().setOffsetLimit(current_ - begin_);
+      setReaderOffsetStart(currentValue(), current_ - begin_ - 1);
+      setReaderOffsetLimit(currentValue(), current_ - begin_);
       break;
     } // Else, fall through...
   default:
-    currentValue().setOffsetStart(token.start_ - begin_);
-    currentValue().setOffsetLimit(token.end_ - begin_);
+    setReaderOffsetStart(currentValue(), token.start_ - begin_);
+    setReaderOffsetLimit(currentValue(), token.end_ - begin_);
     return addError("Syntax error: value, object or array expected.", token);
   }
 
@@ -296,13 +312,7 @@ bool Reader::readToken(Token& token) {
 }
 
 void Reader::skipSpaces() {
-  while (current_ != end_) {
-    Char c = *current_;
-    if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
-      ++current_;
-    else
-      break;
-  }
+  current_ = simd::skipWhitespace(current_, end_);
 }
 
 bool Reader::match(const Char* pattern, int patternLength) {
@@ -374,9 +384,11 @@ bool Reader::readCStyleComment() {
   while ((current_ + 1) < end_) {
     Char c = getNextChar();
     if (c == '*' && *current_ == '/')
-      break;
+      return getNextChar() == '/';
   }
-  return getNextChar() == '/';
+  // Unterminated: a lone '/' as the last byte does not close the comment.
+  getNextChar();
+  return false;
 }
 
 bool Reader::readCppStyleComment() {
@@ -418,15 +430,18 @@ void Reader::readNumber() {
 }
 
 bool Reader::readString() {
-  Char c = '\0';
+  // Jump to the next quote or backslash; everything in between is part of
+  // the string body and is validated later by decodeString().
   while (current_ != end_) {
-    c = getNextChar();
-    if (c == '\\')
-      getNextChar();
-    else if (c == '"')
+    current_ = simd::findQuoteOrBackslash(current_, end_, '"');
+    if (current_ == end_)
       break;
+    if (*current_++ == '"')
+      return true;
+    if (current_ != end_)
+      ++current_; // skip the escaped character
   }
-  return c == '"';
+  return false;
 }
 
 bool Reader::readObject(Token& token) {
@@ -434,7 +449,7 @@ bool Reader::readObject(Token& token) {
   String name;
   Value init(objectValue);
   currentValue().swapPayload(init);
-  currentValue().setOffsetStart(token.start_ - begin_);
+  setReaderOffsetStart(currentValue(), token.start_ - begin_);
   while (readTokenSkippingComments(tokenName)) {
     if (tokenName.type_ == tokenObjectEnd && name.empty()) // empty object
       return true;
@@ -479,7 +494,7 @@ bool Reader::readObject(Token& token) {
 bool Reader::readArray(Token& token) {
   Value init(arrayValue);
   currentValue().swapPayload(init);
-  currentValue().setOffsetStart(token.start_ - begin_);
+  setReaderOffsetStart(currentValue(), token.start_ - begin_);
   skipSpaces();
   if (current_ != end_ && *current_ == ']') // empty array
   {
@@ -516,8 +531,8 @@ bool Reader::decodeNumber(Token& token) {
   if (!decodeNumber(token, decoded))
     return false;
   currentValue().swapPayload(decoded);
-  currentValue().setOffsetStart(token.start_ - begin_);
-  currentValue().setOffsetLimit(token.end_ - begin_);
+  setReaderOffsetStart(currentValue(), token.start_ - begin_);
+  setReaderOffsetLimit(currentValue(), token.end_ - begin_);
   return true;
 }
 
@@ -569,23 +584,16 @@ bool Reader::decodeDouble(Token& token) {
   if (!decodeDouble(token, decoded))
     return false;
   currentValue().swapPayload(decoded);
-  currentValue().setOffsetStart(token.start_ - begin_);
-  currentValue().setOffsetLimit(token.end_ - begin_);
+  setReaderOffsetStart(currentValue(), token.start_ - begin_);
+  setReaderOffsetLimit(currentValue(), token.end_ - begin_);
   return true;
 }
 
 bool Reader::decodeDouble(Token& token, Value& decoded) {
   double value = 0;
-  IStringStream is(String(token.start_, token.end_));
-  if (!(is >> value)) {
-    if (value == std::numeric_limits<double>::max())
-      value = std::numeric_limits<double>::infinity();
-    else if (value == std::numeric_limits<double>::lowest())
-      value = -std::numeric_limits<double>::infinity();
-    else if (!std::isinf(value))
-      return addError(
-          "'" + String(token.start_, token.end_) + "' is not a number.", token);
-  }
+  if (!decodeDoubleToken(token.start_, token.end_, &value))
+    return addError(
+        "'" + String(token.start_, token.end_) + "' is not a number.", token);
   decoded = value;
   return true;
 }
@@ -596,8 +604,8 @@ bool Reader::decodeString(Token& token) {
     return false;
   Value decoded(decoded_string);
   currentValue().swapPayload(decoded);
-  currentValue().setOffsetStart(token.start_ - begin_);
-  currentValue().setOffsetLimit(token.end_ - begin_);
+  setReaderOffsetStart(currentValue(), token.start_ - begin_);
+  setReaderOffsetLimit(currentValue(), token.end_ - begin_);
   return true;
 }
 
@@ -852,7 +860,9 @@ public:
   bool rejectDupKeys_;
   bool allowSpecialFloats_;
   bool skipBom_;
+  bool storeOffsets_;
   size_t stackLimit_;
+  KeyPool const* keyPool_;
 }; // OurFeatures
 
 OurFeatures OurFeatures::all() { return {}; }
@@ -943,6 +953,8 @@ private:
                           TokenType skipUntilToken);
   void skipUntilSpace();
   Value& currentValue();
+  void setOffsetStart(ptrdiff_t start);
+  void setOffsetLimit(ptrdiff_t limit);
   Char getNextChar();
   void getLocationLineAndColumn(Location location, int& line,
                                 int& column) const;
@@ -964,6 +976,11 @@ private:
   Value* lastValue_ = nullptr;
   bool lastValueHasAComment_ = false;
   String commentsBefore_{};
+  // Start of every line break before lineBreaksScanned_, filled in as
+  // locations are looked up so that reporting many errors does not rescan
+  // the document for each of them.
+  mutable std::vector<Location> lineBreaks_{};
+  mutable Location lineBreaksScanned_ = nullptr;
 
   OurFeatures const features_;
   bool collectComments_ = false;
@@ -992,6 +1009,8 @@ bool OurReader::parse(const char* beginDoc, const char* endDoc, Value& root,
   lastValue_ = nullptr;
   commentsBefore_.clear();
   errors_.clear();
+  lineBreaks_.clear();
+  lineBreaksScanned_ = begin_;
   while (!nodes_.empty())
     nodes_.pop();
   nodes_.push(&root);
@@ -1040,11 +1059,11 @@ bool OurReader::readValue() {
   switch (token.type_) {
   case tokenObjectBegin:
     successful = readObject(token);
-    currentValue().setOffsetLimit(current_ - begin_);
+    setOffsetLimit(current_ - begin_);
     break;
   case tokenArrayBegin:
     successful = readArray(token);
-    currentValue().setOffsetLimit(current_ - begin_);
+    setOffsetLimit(current_ - begin_);
     break;
   case tokenNumber:
     successful = decodeNumber(token);
@@ -1055,38 +1074,38 @@ bool OurReader::readValue() {
   case tokenTrue: {
     Value v(true);
     currentValue().swapPayload(v);
-    currentValue().setOffsetStart(token.start_ - begin_);
-    currentValue().setOffsetLimit(token.end_ - begin_);
+    setOffsetStart(token.start_ - begin_);
+    setOffsetLimit(token.end_ - begin_);
   } break;
   case tokenFalse: {
     Value v(false);
     currentValue().swapPayload(v);
-    currentValue().setOffsetStart(token.start_ - begin_);
-    currentValue().setOffsetLimit(token.end_ - begin_);
+    setOffsetStart(token.start_ - begin_);
+    setOffsetLimit(token.end_ - begin_);
   } break;
   case tokenNull: {
     Value v;
     currentValue().swapPayload(v);
-    currentValue().setOffsetStart(token.start_ - begin_);
-    currentValue().setOffsetLimit(token.end_ - begin_);
+    setOffsetStart(token.start_ - begin_);
+    setOffsetLimit(token.end_ - begin_);
   } break;
   case tokenNaN: {
     Value v(std::numeric_limits<double>::quiet_NaN());
     currentValue().swapPayload(v);
-    currentValue().setOffsetStart(token.start_ - begin_);
-    currentValue().setOffsetLimit(token.end_ - begin_);
+    setOffsetStart(token.start_ - begin_);
+    setOffsetLimit(token.end_ - begin_);
   } break;
   case tokenPosInf: {
     Value v(std::numeric_limits<double>::infinity());
     currentValue().swapPayload(v);
-    currentValue().setOffsetStart(token.start_ - begin_);
-    currentValue().setOffsetLimit(token.end_ - begin_);
+    setOffsetStart(token.start_ - begin_);
+    setOffsetLimit(token.end_ - begin_);
   } break;
   case tokenNegInf: {
     Value v(-std::numeric_limits<double>::infinity());
     currentValue().swapPayload(v);
-    currentValue().setOffsetStart(token.start_ - begin_);
-    currentValue().setOffsetLimit(token.end_ - begin_);
+    setOffsetStart(token.start_ - begin_);
+    setOffsetLimit(token.end_ - begin_);
   } break;
   case tokenArraySeparator:
   case tokenObjectEnd:
@@ -1097,13 +1116,13 @@ bool OurReader::readValue() {
       current_--;
       Value v;
       currentValue().swapPayload(v);
-      currentValue().setOffsetStart(current_ - begin_ - 1);
-      currentValue().setOffsetLimit(current_ - begin_);
+      setOffsetStart(current_ - begin_ - 1);
+      setOffsetLimit(current_ - begin_);
       break;
     } // else, fall through ...
   default:
-    currentValue().setOffsetStart(token.start_ - begin_);
-    currentValue().setOffsetLimit(token.end_ - begin_);
+    setOffsetStart(token.start_ - begin_);
+    setOffsetLimit(token.end_ - begin_);
     return addError("Syntax error: value, object or array expected.", token);
   }
 
@@ -1238,13 +1257,7 @@ bool OurReader::readToken(Token& token) {
 }
 
 void OurReader::skipSpaces() {
-  while (current_ != end_) {
-    Char c = *current_;
-    if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
-      ++current_;
-    else
-      break;
-  }
+  current_ = simd::skipWhitespace(current_, end_);
 }
 
 void OurReader::skipBom(bool skipBom) {
@@ -1340,12 +1353,14 @@ bool OurReader::readCStyleComment(bool* containsNewLineResult) {
   while ((current_ + 1) < end_) {
     Char c = getNextChar();
     if (c == '*' && *current_ == '/')
-      break;
+      return getNextChar() == '/';
     if (c == '\n')
       *containsNewLineResult = true;
   }
 
-  return getNextChar() == '/';
+  // Unterminated: a lone '/' as the last byte does not close the comment.
+  getNextChar();
+  return false;
 }
 
 bool OurReader::readCppStyleComment() {
@@ -1391,43 +1406,54 @@ bool OurReader::readNumber(bool checkInf) {
   return true;
 }
 bool OurReader::readString() {
-  Char c = 0;
+  // Jump to the next quote or backslash; everything in between is part of
+  // the string body and is validated later by decodeString().
   while (current_ != end_) {
-    c = getNextChar();
-    if (c == '\\')
-      getNextChar();
-    else if (c == '"')
+    current_ = simd::findQuoteOrBackslash(current_, end_, '"');
+    if (current_ == end_)
       break;
+    if (*current_++ == '"')
+      return true;
+    if (current_ != end_)
+      ++current_; // skip the escaped character
   }
-  return c == '"';
+  return false;
 }
 
 bool OurReader::readStringSingleQuote() {
-  Char c = 0;
   while (current_ != end_) {
-    c = getNextChar();
-    if (c == '\\')
-      getNextChar();
-    else if (c == '\'')
+    current_ = simd::findQuoteOrBackslash(current_, end_, '\'');
+    if (current_ == end_)
       break;
+    if (*current_++ == '\'')
+      return true;
+    if (current_ != end_)
+      ++current_; // skip the escaped character
   }
-  return c == '\'';
+  return false;
 }
 
 bool OurReader::readObject(Token& token) {
   Token tokenName;
   String name;
+  bool noName = true; // no member yet, or the last one had an empty name
   Value init(objectValue);
   currentValue().swapPayload(init);
-  currentValue().setOffsetStart(token.start_ - begin_);
+  setOffsetStart(token.start_ - begin_);
   while (readTokenSkippingComments(tokenName)) {
     if (tokenName.type_ == tokenObjectEnd &&
-        (name.empty() ||
+        (noName ||
          features_.allowTrailingCommas_)) // empty object or trailing comma
       return true;
     name.clear();
+    // A pooled key is used straight from the token: it has no escapes, so
+    // the raw bytes are the name and nothing needs decoding or copying.
+    char const* pooledName = nullptr;
     if (tokenName.type_ == tokenString) {
-      if (!decodeString(tokenName, name))
+      if (features_.keyPool_)
+        pooledName =
+            features_.keyPool_->find(tokenName.start_ + 1, tokenName.end_ - 1);
+      if (!pooledName && !decodeString(tokenName, name))
         return recoverFromError(tokenObjectEnd);
     } else if (tokenName.type_ == tokenNumber && features_.allowNumericKeys_) {
       Value numberName;
@@ -1437,11 +1463,22 @@ bool OurReader::readObject(Token& token) {
     } else {
       break;
     }
-    if (name.length() >= (1U << 30))
-      throwRuntimeError("keylength >= 2^30");
-    if (features_.rejectDupKeys_ && currentValue().isMember(name)) {
-      String msg = "Duplicate key: '" + name + "'";
-      return addErrorAndRecover(msg, tokenName, tokenObjectEnd);
+    if (pooledName) {
+      noName = tokenName.end_ - tokenName.start_ == 2;
+      if (features_.rejectDupKeys_ &&
+          currentValue().find(tokenName.start_ + 1, tokenName.end_ - 1)) {
+        String msg = "Duplicate key: '" +
+                     String(tokenName.start_ + 1, tokenName.end_ - 1) + "'";
+        return addErrorAndRecover(msg, tokenName, tokenObjectEnd);
+      }
+    } else {
+      noName = name.empty();
+      if (name.length() >= (1U << 30))
+        throwRuntimeError("keylength >= 2^30");
+      if (features_.rejectDupKeys_ && currentValue().isMember(name)) {
+        String msg = "Duplicate key: '" + name + "'";
+        return addErrorAndRecover(msg, tokenName, tokenObjectEnd);
+      }
     }
 
     Token colon;
@@ -1449,7 +1486,8 @@ bool OurReader::readObject(Token& token) {
       return addErrorAndRecover("Missing ':' after object member name", colon,
                                 tokenObjectEnd);
     }
-    Value& value = currentValue()[name];
+    Value& value = pooledName ? currentValue()[StaticString(pooledName)]
+                              : currentValue()[name];
     nodes_.push(&value);
     bool ok = readValue();
     nodes_.pop();
@@ -1472,7 +1510,7 @@ bool OurReader::readObject(Token& token) {
 bool OurReader::readArray(Token& token) {
   Value init(arrayValue);
   currentValue().swapPayload(init);
-  currentValue().setOffsetStart(token.start_ - begin_);
+  setOffsetStart(token.start_ - begin_);
   int index = 0;
   for (;;) {
     skipSpaces();
@@ -1513,8 +1551,8 @@ bool OurReader::decodeNumber(Token& token) {
   if (!decodeNumber(token, decoded))
     return false;
   currentValue().swapPayload(decoded);
-  currentValue().setOffsetStart(token.start_ - begin_);
-  currentValue().setOffsetLimit(token.end_ - begin_);
+  setOffsetStart(token.start_ - begin_);
+  setOffsetLimit(token.end_ - begin_);
   return true;
 }
 
@@ -1603,23 +1641,16 @@ bool OurReader::decodeDouble(Token& token) {
   if (!decodeDouble(token, decoded))
     return false;
   currentValue().swapPayload(decoded);
-  currentValue().setOffsetStart(token.start_ - begin_);
-  currentValue().setOffsetLimit(token.end_ - begin_);
+  setOffsetStart(token.start_ - begin_);
+  setOffsetLimit(token.end_ - begin_);
   return true;
 }
 
 bool OurReader::decodeDouble(Token& token, Value& decoded) {
   double value = 0;
-  IStringStream is(String(token.start_, token.end_));
-  if (!(is >> value)) {
-    if (value == std::numeric_limits<double>::max())
-      value = std::numeric_limits<double>::infinity();
-    else if (value == std::numeric_limits<double>::lowest())
-      value = -std::numeric_limits<double>::infinity();
-    else if (!std::isinf(value))
-      return addError(
-          "'" + String(token.start_, token.end_) + "' is not a number.", token);
-  }
+  if (!decodeDoubleToken(token.start_, token.end_, &value))
+    return addError(
+        "'" + String(token.start_, token.end_) + "' is not a number.", token);
   decoded = value;
   return true;
 }
@@ -1630,8 +1661,8 @@ bool OurReader::decodeString(Token& token) {
     return false;
   Value decoded(decoded_string);
   currentValue().swapPayload(decoded);
-  currentValue().setOffsetStart(token.start_ - begin_);
-  currentValue().setOffsetLimit(token.end_ - begin_);
+  setOffsetStart(token.start_ - begin_);
+  setOffsetLimit(token.end_ - begin_);
   return true;
 }
 
@@ -1769,6 +1800,16 @@ bool OurReader::addErrorAndRecover(const String& message, Token& token,
 
 Value& OurReader::currentValue() { return *(nodes_.top()); }
 
+void OurReader::setOffsetStart(ptrdiff_t start) {
+  if (features_.storeOffsets_)
+    currentValue().setOffsetStart(start);
+}
+
+void OurReader::setOffsetLimit(ptrdiff_t limit) {
+  if (features_.storeOffsets_)
+    currentValue().setOffsetLimit(limit);
+}
+
 OurReader::Char OurReader::getNextChar() {
   if (current_ == end_)
     return 0;
@@ -1777,24 +1818,27 @@ OurReader::Char OurReader::getNextChar() {
 
 void OurReader::getLocationLineAndColumn(Location location, int& line,
                                          int& column) const {
-  Location current = begin_;
-  Location lastLineStart = current;
-  line = 0;
-  while (current < location && current != end_) {
-    Char c = *current++;
-    if (c == '\r') {
-      if (current != end_ && *current == '\n')
+  Location& current = lineBreaksScanned_;
+  for (; current < location && current != end_; ++current) {
+    if (*current == '\n' || *current == '\r') {
+      lineBreaks_.push_back(current);
+      if (*current == '\r' && current + 1 != end_ && current[1] == '\n')
         ++current;
-      lastLineStart = current;
-      ++line;
-    } else if (c == '\n') {
-      lastLineStart = current;
-      ++line;
     }
   }
+  // Count the breaks that start before location; "\r\n" is a single one.
+  auto const passed =
+      std::lower_bound(lineBreaks_.begin(), lineBreaks_.end(), location);
+  Location lastLineStart = begin_;
+  if (passed != lineBreaks_.begin()) {
+    Location const lineBreak = *(passed - 1);
+    lastLineStart = lineBreak + 1;
+    if (*lineBreak == '\r' && lastLineStart != end_ && *lastLineStart == '\n')
+      ++lastLineStart;
+  }
   // column & line start at 1
+  line = int(passed - lineBreaks_.begin()) + 1;
   column = int(location - lastLineStart) + 1;
-  ++line;
 }
 
 String OurReader::getLocationLineAndColumn(Location location) const {
@@ -1864,6 +1908,67 @@ protected:
   };
 };
 
+//////////////////////////////////
+// KeyPool
+
+static inline size_t hashKey(char const* begin, char const* end) {
+  // FNV-1a; keys are short, so anything fancier costs more than it saves.
+  size_t hash = 2166136261U;
+  for (; begin != end; ++begin)
+    hash = (hash ^ static_cast<unsigned char>(*begin)) * 16777619U;
+  return hash;
+}
+
+KeyPool::KeyPool(std::initializer_list<char const*> keys) {
+  for (char const* key : keys)
+    add(key);
+}
+
+bool KeyPool::add(String const& key) {
+  for (char c : key) {
+    // A raw token only equals the decoded key when it has no escapes.
+    if (c == '"' || c == '\\' || static_cast<unsigned char>(c) < 0x20)
+      return false;
+  }
+  if (find(key.data(), key.data() + key.size()))
+    return true;
+  if ((keys_.size() + 1) * 2 > slots_.size())
+    rehash(slots_.empty() ? 32 : slots_.size() * 2);
+  keys_.push_back(key);
+  const size_t mask = slots_.size() - 1;
+  size_t slot = hashKey(key.data(), key.data() + key.size()) & mask;
+  while (slots_[slot])
+    slot = (slot + 1) & mask;
+  slots_[slot] = static_cast<unsigned>(keys_.size());
+  return true;
+}
+
+char const* KeyPool::find(char const* begin, char const* end) const {
+  if (slots_.empty())
+    return nullptr;
+  const size_t length = static_cast<size_t>(end - begin);
+  const size_t mask = slots_.size() - 1;
+  for (size_t slot = hashKey(begin, end) & mask; slots_[slot];
+       slot = (slot + 1) & mask) {
+    String const& key = keys_[slots_[slot] - 1];
+    if (key.size() == length && memcmp(key.data(), begin, length) == 0)
+      return key.c_str();
+  }
+  return nullptr;
+}
+
+void KeyPool::rehash(size_t capacity) {
+  slots_.assign(capacity, 0);
+  const size_t mask = capacity - 1;
+  for (size_t i = 0; i < keys_.size(); ++i) {
+    String const& key = keys_[i];
+    size_t slot = hashKey(key.data(), key.data() + key.size()) & mask;
+    while (slots_[slot])
+      slot = (slot + 1) & mask;
+    slots_[slot] = static_cast<unsigned>(i + 1);
+  }
+}
+
 CharReaderBuilder::CharReaderBuilder() { setDefaults(&settings_); }
 CharReaderBuilder::~CharReaderBuilder() = default;
 CharReader* CharReaderBuilder::newCharReader() const {
@@ -1884,6 +1989,8 @@ CharReader* CharReaderBuilder::newCharReader() const {
   features.rejectDupKeys_ = settings_["rejectDupKeys"].asBool();
   features.allowSpecialFloats_ = settings_["allowSpecialFloats"].asBool();
   features.skipBom_ = settings_["skipBom"].asBool();
+  features.storeOffsets_ = settings_["storeOffsets"].asBool();
+  features.keyPool_ = keyPool_;
   return new OurCharReader(collectComments, features);
 }
 
@@ -1901,6 +2008,7 @@ bool CharReaderBuilder::validate(Json::Value* invalid) const {
       "rejectDupKeys",
       "allowSpecialFloats",
       "skipBom",
+      "storeOffsets",
   };
   for (auto si = settings_.begin(); si != settings_.end(); ++si) {
     auto key = si.name();
@@ -1931,6 +2039,7 @@ void CharReaderBuilder::strictMode(Json::Value* settings) {
   (*settings)["rejectDupKeys"] = true;
   (*settings)["allowSpecialFloats"] = false;
   (*settings)["skipBom"] = true;
+  (*settings)["storeOffsets"] = storeOffsetsByDefault;
   //! [CharReaderBuilderStrictMode]
 }
 // static
@@ -1948,6 +2057,7 @@ void CharReaderBuilder::setDefaults(Json::Value* settings) {
   (*settings)["rejectDupKeys"] = false;
   (*settings)["allowSpecialFloats"] = false;
   (*settings)["skipBom"] = true;
+  (*settings)["storeOffsets"] = storeOffsetsByDefault;
   //! [CharReaderBuilderDefaults]
 }
 // static
@@ -1964,6 +2074,7 @@ void CharReaderBuilder::ecma404Mode(Json::Value* settings) {
   (*settings)["rejectDupKeys"] = false;
   (*settings)["allowSpecialFloats"] = false;
   (*settings)["skipBom"] = false;
+  (*settings)["storeOffsets"] = storeOffsetsByDefault;
   //! [CharReaderBuilderECMA404Mode]
 }
 
@@ -1977,6 +2088,1006 @@ bool CharReader::parse(char const* beginDoc, char const* endDoc, Value* root,
   return _impl->parse(beginDoc, endDoc, root, errs);
 }
 
+//////////////////////////////////
+// ParseHandler
+
+ParseHandler::~ParseHandler() = default;
+bool ParseHandler::null() { return true; }
+bool ParseHandler::boolean(bool /*value*/) { return true; }
+bool ParseHandler::integer(LargestInt /*value*/) { return true; }
+bool ParseHandler::uinteger(LargestUInt /*value*/) { return true; }
+bool ParseHandler::real(double /*value*/) { return true; }
+bool ParseHandler::string(char const* /*begin*/, char const* /*end*/) {
+  return true;
+}
+bool ParseHandler::startObject() { return true; }
+bool ParseHandler::key(char const* /*begin*/, char const* /*end*/) {
+  return true;
+}
+bool ParseHandler::endObject() { return true; }
+bool ParseHandler::startArray() { return true; }
+bool ParseHandler::endArray() { return true; }
+String ParseHandler::errorMessage() const { return String(); }
+
+//////////////////////////////////
+// ValueHandler
+
+ValueHandler::ValueHandler(Value& root, bool rejectDupKeys)
+    : root_(&root), member_(nullptr), rejectDupKeys_(rejectDupKeys) {}
+
+void ValueHandler::reset(Value& root) {
+  root_ = &root;
+  member_ = nullptr;
+  stack_.clear();
+  error_.clear();
+}
+
+Value& ValueHandler::target() {
+  if (stack_.empty())
+    return *root_;
+  Value& container = *stack_.back();
+  if (container.isArray())
+    return container.append(Value());
+  return *member_;
+}
+
+bool ValueHandler::null() {
+  target() = Value();
+  return true;
+}
+bool ValueHandler::boolean(bool value) {
+  target() = value;
+  return true;
+}
+bool ValueHandler::integer(LargestInt value) {
+  target() = value;
+  return true;
+}
+bool ValueHandler::uinteger(LargestUInt value) {
+  target() = value;
+  return true;
+}
+bool ValueHandler::real(double value) {
+  target() = value;
+  return true;
+}
+bool ValueHandler::string(char const* begin, char const* end) {
+  target() = Value(begin, end);
+  return true;
+}
+bool ValueHandler::startObject() {
+  Value& value = target();
+  value = Value(objectValue);
+  stack_.push_back(&value);
+  return true;
+}
+bool ValueHandler::key(char const* begin, char const* end) {
+  Value& object = *stack_.back();
+  if (static_cast<size_t>(end - begin) >= (1U << 30))
+    throwRuntimeError("keylength >= 2^30");
+  if (rejectDupKeys_ && object.find(begin, end)) {
+    error_ = "Duplicate key: '" + String(begin, end) + "'";
+    return false;
+  }
+  char const* pooled = keyPool_ ? keyPool_->find(begin, end) : nullptr;
+  member_ = pooled ? &object[StaticString(pooled)] : object.demand(begin, end);
+  return true;
+}
+bool ValueHandler::endObject() {
+  stack_.pop_back();
+  return true;
+}
+bool ValueHandler::startArray() {
+  Value& value = target();
+  value = Value(arrayValue);
+  stack_.push_back(&value);
+  return true;
+}
+bool ValueHandler::endArray() {
+  stack_.pop_back();
+  return true;
+}
+String ValueHandler::errorMessage() const { return error_; }
+
+//////////////////////////////////
+// QueryHandler
+
+QueryHandler::QueryHandler(Query const& query) : query_(&query) {}
+
+void QueryHandler::reset() {
+  active_.clear();
+  stack_.clear();
+  builders_.clear();
+  captures_.clear();
+  slot_ = 0;
+  skip_ = 0;
+}
+
+// Activates the trie nodes matching the next value at active_[slot_, size())
+// and tells whether any path ends there.
+bool QueryHandler::next() {
+  if (stack_.empty()) {
+    active_.assign(1, 0);
+    slot_ = 0;
+  } else {
+    Frame& frame = stack_.back();
+    if (frame.isArray) {
+      active_.resize(frame.end);
+      for (size_t i = frame.begin; i < frame.end; ++i) {
+        const Query::Node& node = query_->node(active_[i]);
+        for (const auto& entry : node.indices)
+          if (entry.first == frame.index)
+            active_.push_back(entry.second);
+        if (node.anyIndex)
+          active_.push_back(node.anyIndex);
+      }
+      ++frame.index;
+    }
+    slot_ = frame.end;
+  }
+  for (size_t i = slot_; i < active_.size(); ++i)
+    if (!query_->node(active_[i]).fields.empty())
+      return true;
+  return false;
+}
+
+void QueryHandler::store(Value const& value) {
+  for (size_t i = slot_; i < active_.size(); ++i)
+    for (ArrayIndex field : query_->node(active_[i]).fields)
+      captures_.push_back({field, value});
+}
+
+bool QueryHandler::null() {
+  if (skip_)
+    return true;
+  for (auto& builder : builders_)
+    builder.handler.null();
+  if (next())
+    store(Value());
+  return true;
+}
+bool QueryHandler::boolean(bool value) {
+  if (skip_)
+    return true;
+  for (auto& builder : builders_)
+    builder.handler.boolean(value);
+  if (next())
+    store(Value(value));
+  return true;
+}
+bool QueryHandler::integer(LargestInt value) {
+  if (skip_)
+    return true;
+  for (auto& builder : builders_)
+    builder.handler.integer(value);
+  if (next())
+    store(Value(value));
+  return true;
+}
+bool QueryHandler::uinteger(LargestUInt value) {
+  if (skip_)
+    return true;
+  for (auto& builder : builders_)
+    builder.handler.uinteger(value);
+  if (next())
+    store(Value(value));
+  return true;
+}
+bool QueryHandler::real(double value) {
+  if (skip_)
+    return true;
+  for (auto& builder : builders_)
+    builder.handler.real(value);
+  if (next())
+    store(Value(value));
+  return true;
+}
+bool QueryHandler::string(char const* begin, char const* end) {
+  if (skip_)
+    return true;
+  for (auto& builder : builders_)
+    builder.handler.string(begin, end);
+  if (next())
+    store(Value(begin, end));
+  return true;
+}
+
+bool QueryHandler::open(bool isArray) {
+  if (skip_) {
+    ++skip_;
+    return true;
+  }
+  for (auto& builder : builders_) {
+    ++builder.depth;
+    if (isArray)
+      builder.handler.startArray();
+    else
+      builder.handler.startObject();
+  }
+  if (next()) {
+    for (size_t i = slot_; i < active_.size(); ++i) {
+      for (ArrayIndex field : query_->node(active_[i]).fields) {
+        captures_.push_back({field, Value()});
+        builders_.push_back({1, ValueHandler(captures_.back().value)});
+        if (isArray)
+          builders_.back().handler.startArray();
+        else
+          builders_.back().handler.startObject();
+      }
+    }
+  }
+  // Nothing below can match and nothing is being built: skip the subtree.
+  if (slot_ == active_.size() && builders_.empty()) {
+    skip_ = 1;
+    return true;
+  }
+  stack_.push_back({slot_, active_.size(), 0, isArray});
+  return true;
+}
+bool QueryHandler::close(bool isArray) {
+  if (skip_) {
+    --skip_;
+    return true;
+  }
+  for (auto& builder : builders_) {
+    --builder.depth;
+    if (isArray)
+      builder.handler.endArray();
+    else
+      builder.handler.endObject();
+  }
+  while (!builders_.empty() && builders_.back().depth == 0)
+    builders_.pop_back();
+  active_.resize(stack_.back().begin);
+  stack_.pop_back();
+  return true;
+}
+
+bool QueryHandler::startObject() { return open(false); }
+bool QueryHandler::key(char const* begin, char const* end) {
+  if (skip_)
+    return true;
+  for (auto& builder : builders_)
+    builder.handler.key(begin, end);
+  const Frame& frame = stack_.back();
+  const size_t length = static_cast<size_t>(end - begin);
+  active_.resize(frame.end);
+  for (size_t i = frame.begin; i < frame.end; ++i) {
+    const Query::Node& node = query_->node(active_[i]);
+    for (const auto& entry : node.keys) {
+      if (entry.first.size() == length &&
+          memcmp(entry.first.data(), begin, length) == 0) {
+        active_.push_back(entry.second);
+        break;
+      }
+    }
+    if (node.anyKey)
+      active_.push_back(node.anyKey);
+  }
+  return true;
+}
+bool QueryHandler::endObject() { return close(false); }
+bool QueryHandler::startArray() { return open(true); }
+bool QueryHandler::endArray() { return close(true); }
+
+//////////////////////////////////
+// PushParser
+
+/* The parser is a pair of state machines. The lexer (mode_) knows whether we
+ * are between tokens or inside a string, number, literal, comment or BOM; the
+ * grammar (expect_ plus the container stack) knows what may come next. Both
+ * survive across feed() calls, so a chunk may end anywhere.
+ */
+class PushParser::Impl {
+public:
+  Impl(ParseHandler& handler, Value const& settings);
+
+  Status feed(char const* data, size_t length);
+  Status finish();
+  void reset();
+
+  Status status_;
+  size_t consumed_;
+  String error_;
+
+private:
+  enum class Mode : unsigned char {
+    bom,
+    between,
+    string,
+    number,
+    literal,
+    commentStart,
+    blockComment,
+    blockCommentStar,
+    lineComment
+  };
+  enum class Expect : unsigned char {
+    value,
+    valueOrArrayEnd,
+    key,
+    keyOrObjectEnd,
+    colon,
+    commaOrEnd,
+    done
+  };
+  enum class Escape : unsigned char { none, backslash, unicode };
+
+  bool expectsValue() const {
+    return expect_ == Expect::value || expect_ == Expect::valueOrArrayEnd;
+  }
+  bool expectsKey() const {
+    return expect_ == Expect::key || expect_ == Expect::keyOrObjectEnd;
+  }
+
+  char const* between(char const* p, char const* end);
+  char const* scanString(char const* p, char const* end);
+  char const* scanNumber(char const* p, char const* end);
+  char const* scanLiteral(char const* p, char const* end);
+  char const* scanComment(char const* p, char const* end);
+
+  bool beginValue(char const* at, bool isContainer);
+  bool openContainer(char const* at, char kind);
+  bool closeContainer(char const* at);
+  bool valueDone();
+  bool emitString(char const* at, char const* begin, char const* end);
+  bool emitNumber(char const* at, char const* begin, char const* end);
+  bool handlerResult(char const* at, bool ok);
+  void countLines(char const* begin, char const* end);
+  bool fail(char const* at, const char* message);
+  bool fail(char const* at, const String& message);
+
+  ParseHandler& handler_;
+  bool allowComments_;
+  bool allowTrailingCommas_;
+  bool strictRoot_;
+  bool failIfExtra_;
+  bool skipBom_;
+  size_t stackLimit_;
+
+  Mode mode_;
+  Expect expect_;
+  std::vector<char> stack_; // '{' or '['
+  bool started_;
+
+  // Token that straddles chunks. tokenStart_ points into the current chunk
+  // while the token has not been copied to text_ yet.
+  String text_;
+  char const* tokenStart_;
+  bool isKey_;
+  Escape escape_;
+  unsigned int unicode_;
+  unsigned int hexDigits_;
+  unsigned int highSurrogate_;
+  char numberPhase_;
+  char const* literal_;
+  unsigned int literalIndex_;
+
+  // Position, for error messages.
+  char const* chunk_;
+  size_t chunkOffset_;
+  size_t line_;
+  size_t lineStart_;
+};
+
+PushParser::Impl::Impl(ParseHandler& handler, Value const& settings)
+    : handler_(handler),
+      allowComments_(settings["allowComments"].asBool()),
+      allowTrailingCommas_(settings["allowTrailingCommas"].asBool()),
+      strictRoot_(settings["strictRoot"].asBool()),
+      failIfExtra_(settings["failIfExtra"].asBool()),
+      skipBom_(settings["skipBom"].asBool()),
+      stackLimit_(static_cast<size_t>(settings["stackLimit"].asUInt())) {
+  reset();
+}
+
+void PushParser::Impl::reset() {
+  status_ = needMoreInput;
+  consumed_ = 0;
+  error_.clear();
+  mode_ = skipBom_ ? Mode::bom : Mode::between;
+  expect_ = Expect::value;
+  stack_.clear();
+  started_ = false;
+  text_.clear();
+  tokenStart_ = nullptr;
+  isKey_ = false;
+  escape_ = Escape::none;
+  unicode_ = hexDigits_ = highSurrogate_ = 0;
+  numberPhase_ = 0;
+  literal_ = nullptr;
+  literalIndex_ = 0;
+  chunk_ = nullptr;
+  chunkOffset_ = 0;
+  line_ = 1;
+  lineStart_ = 0;
+}
+
+void PushParser::Impl::countLines(char const* begin, char const* end) {
+  while ((begin = static_cast<char const*>(
+              memchr(begin, '\n', static_cast<size_t>(end - begin)))) !=
+         nullptr) {
+    ++line_;
+    lineStart_ = chunkOffset_ + static_cast<size_t>(++begin - chunk_);
+  }
+}
+
+bool PushParser::Impl::fail(char const* at, const String& message) {
+  const size_t column =
+      chunkOffset_ + static_cast<size_t>(at - chunk_) - lineStart_ + 1;
+  error_ = "* Line " + std::to_string(line_) + ", Column " +
+           std::to_string(column) + "\n  " + message + "\n";
+  status_ = error;
+  return false;
+}
+
+bool PushParser::Impl::fail(char const* at, const char* message) {
+  return fail(at, String(message));
+}
+
+bool PushParser::Impl::handlerResult(char const* at, bool ok) {
+  if (ok)
+    return true;
+  String message = handler_.errorMessage();
+  if (message.empty()) {
+    status_ = stopped;
+    return false;
+  }
+  return fail(at, message);
+}
+
+PushParser::Status PushParser::Impl::feed(char const* data, size_t length) {
+  if (status_ == stopped || status_ == error)
+    return status_;
+  if (status_ == complete && !failIfExtra_) {
+    consumed_ = 0;
+    return status_;
+  }
+  if (chunk_)
+    chunkOffset_ += consumed_;
+  chunk_ = data;
+  consumed_ = length;
+  // A token started in the previous chunk is already copied to text_.
+  tokenStart_ = nullptr;
+
+  char const* p = data;
+  char const* const end = data + length;
+  while (p != end && p != nullptr) {
+    switch (mode_) {
+    case Mode::bom: {
+      static const char bom[] = "\xEF\xBB\xBF";
+      if (literalIndex_ == 0 && *p != bom[0]) {
+        mode_ = Mode::between;
+        break;
+      }
+      if (*p != bom[literalIndex_]) {
+        fail(p, "Syntax error: value, object or array expected.");
+        return status_;
+      }
+      ++p;
+      if (++literalIndex_ == 3) {
+        literalIndex_ = 0;
+        mode_ = Mode::between;
+      }
+    } break;
+    case Mode::between:
+      p = between(p, end);
+      break;
+    case Mode::string:
+      p = scanString(p, end);
+      break;
+    case Mode::number:
+      p = scanNumber(p, end);
+      break;
+    case Mode::literal:
+      p = scanLiteral(p, end);
+      break;
+    case Mode::commentStart:
+    case Mode::blockComment:
+    case Mode::blockCommentStar:
+    case Mode::lineComment:
+      p = scanComment(p, end);
+      break;
+    }
+    if (status_ == complete && !failIfExtra_ && p != nullptr) {
+      // Leave whatever follows the document to the caller.
+      consumed_ = static_cast<size_t>(p - data);
+      return status_;
+    }
+  }
+  if (p == nullptr)
+    return status_;
+  // Keep the unfinished token; the chunk is about to go away.
+  if (tokenStart_) {
+    text_.assign(tokenStart_, end);
+    tokenStart_ = nullptr;
+  }
+  return status_;
+}
+
+PushParser::Status PushParser::Impl::finish() {
+  const char* at = chunk_ ? chunk_ + consumed_ : nullptr;
+  if (status_ == complete && failIfExtra_ && mode_ != Mode::between &&
+      mode_ != Mode::lineComment) {
+    // The input ended inside a comment after the value, which CharReader
+    // rejects as well. A line comment is closed by the end of input.
+    fail(at, "Extra non-whitespace after JSON value.");
+    return status_;
+  }
+  if (status_ != needMoreInput)
+    return status_;
+  if (mode_ == Mode::number && stack_.empty()) {
+    // A top-level number is only terminated by the end of input.
+    mode_ = Mode::between;
+    emitNumber(at, text_.data(), text_.data() + text_.size());
+    text_.clear();
+    return status_;
+  }
+  if (!started_)
+    fail(at, "Syntax error: value, object or array expected.");
+  else
+    fail(at, "Unexpected end of input.");
+  return status_;
+}
+
+char const* PushParser::Impl::between(char const* p, char const* end) {
+  char const* next = simd::skipWhitespace(p, end);
+  countLines(p, next);
+  p = next;
+  if (p == end)
+    return p;
+
+  const char c = *p;
+  if (expect_ == Expect::done) {
+    // Only reached with failIfExtra; feed() stops at the value otherwise.
+    if (c == '/' && allowComments_) {
+      mode_ = Mode::commentStart;
+      return p + 1;
+    }
+    fail(p, "Extra non-whitespace after JSON value.");
+    return nullptr;
+  }
+
+  switch (c) {
+  case '{':
+  case '[':
+    if (!expectsValue())
+      break;
+    return openContainer(p, c) ? p + 1 : nullptr;
+  case '}':
+    if (expect_ == Expect::keyOrObjectEnd ||
+        (expect_ == Expect::commaOrEnd && stack_.back() == '{'))
+      return closeContainer(p) ? p + 1 : nullptr;
+    break;
+  case ']':
+    if (expect_ == Expect::valueOrArrayEnd ||
+        (expect_ == Expect::commaOrEnd && stack_.back() == '['))
+      return closeContainer(p) ? p + 1 : nullptr;
+    break;
+  case ',':
+    if (expect_ != Expect::commaOrEnd)
+      break;
+    if (stack_.back() == '[')
+      expect_ = allowTrailingCommas_ ? Expect::valueOrArrayEnd : Expect::value;
+    else
+      expect_ = allowTrailingCommas_ ? Expect::keyOrObjectEnd : Expect::key;
+    return p + 1;
+  case ':':
+    if (expect_ != Expect::colon)
+      break;
+    expect_ = Expect::value;
+    return p + 1;
+  case '"':
+    if (expectsKey()) {
+      isKey_ = true;
+    } else if (expectsValue()) {
+      if (!beginValue(p, false))
+        return nullptr;
+      isKey_ = false;
+    } else {
+      break;
+    }
+    mode_ = Mode::string;
+    tokenStart_ = p + 1;
+    return p + 1;
+  case '/':
+    // As in OurReader: no comment before a colon, and none between '[' or a
+    // trailing comma and the ']' (readArray() looks for it past whitespace
+    // only, then wants a value).
+    if (!allowComments_ || expect_ == Expect::colon)
+      break;
+    if (expect_ == Expect::valueOrArrayEnd)
+      expect_ = Expect::value;
+    mode_ = Mode::commentStart;
+    return p + 1;
+  case '-':
+  case '0':
+  case '1':
+  case '2':
+  case '3':
+  case '4':
+  case '5':
+  case '6':
+  case '7':
+  case '8':
+  case '9':
+    if (!expectsValue())
+      break;
+    if (!beginValue(p, false))
+      return nullptr;
+    mode_ = Mode::number;
+    numberPhase_ = 'i';
+    tokenStart_ = p;
+    return p + 1;
+  case 't':
+  case 'f':
+  case 'n':
+    if (!expectsValue())
+      break;
+    if (!beginValue(p, false))
+      return nullptr;
+    mode_ = Mode::literal;
+    literal_ = c == 't' ? "true" : c == 'f' ? "false" : "null";
+    literalIndex_ = 1;
+    return p + 1;
+  default:
+    break;
+  }
+
+  switch (expect_) {
+  case Expect::key:
+  case Expect::keyOrObjectEnd:
+    fail(p, "Missing '}' or object member name");
+    break;
+  case Expect::colon:
+    fail(p, "Missing ':' after object member name");
+    break;
+  case Expect::commaOrEnd:
+    fail(p, stack_.back() == '{' ? "Missing ',' or '}' in object declaration"
+                                 : "Missing ',' or ']' in array declaration");
+    break;
+  default:
+    fail(p, "Syntax error: value, object or array expected.");
+    break;
+  }
+  return nullptr;
+}
+
+bool PushParser::Impl::beginValue(char const* at, bool isContainer) {
+  if (stack_.size() + 1 > stackLimit_)
+    return fail(at, "Exceeded stackLimit in readValue().");
+  if (!started_) {
+    started_ = true;
+    if (strictRoot_ && !isContainer)
+      return fail(at, "A valid JSON document must be either an array or an "
+                      "object value.");
+  }
+  return true;
+}
+
+bool PushParser::Impl::openContainer(char const* at, char kind) {
+  if (!beginValue(at, true))
+    return false;
+  stack_.push_back(kind);
+  if (kind == '{') {
+    expect_ = Expect::keyOrObjectEnd;
+    return handlerResult(at, handler_.startObject());
+  }
+  expect_ = Expect::valueOrArrayEnd;
+  return handlerResult(at, handler_.startArray());
+}
+
+bool PushParser::Impl::closeContainer(char const* at) {
+  const char kind = stack_.back();
+  stack_.pop_back();
+  if (!handlerResult(at, kind == '{' ? handler_.endObject()
+                                     : handler_.endArray()))
+    return false;
+  return valueDone();
+}
+
+bool PushParser::Impl::valueDone() {
+  if (!stack_.empty()) {
+    expect_ = Expect::commaOrEnd;
+    return true;
+  }
+  expect_ = Expect::done;
+  status_ = complete;
+  return true;
+}
+
+bool PushParser::Impl::emitString(char const* at, char const* begin,
+                                  char const* end) {
+  if (isKey_) {
+    expect_ = Expect::colon;
+    return handlerResult(at, handler_.key(begin, end));
+  }
+  return handlerResult(at, handler_.string(begin, end)) && valueDone();
+}
+
+char const* PushParser::Impl::scanString(char const* p, char const* end) {
+  while (p != end) {
+    if (escape_ == Escape::none) {
+      char const* stop = simd::findQuoteOrBackslash(p, end, '"');
+      if (highSurrogate_ && (stop != p || *stop != '\\')) {
+        fail(p, "expecting another \\u token to begin the second half of a "
+                "unicode surrogate pair");
+        return nullptr;
+      }
+      countLines(p, stop);
+      if (stop == end) {
+        if (!tokenStart_)
+          text_.append(p, end);
+        break;
+      }
+      if (*stop == '"') {
+        mode_ = Mode::between;
+        bool ok;
+        if (tokenStart_) {
+          // Whole string in this chunk, no escapes: hand out the input.
+          ok = emitString(stop, tokenStart_, stop);
+          tokenStart_ = nullptr;
+        } else {
+          text_.append(p, stop);
+          ok = emitString(stop, text_.data(), text_.data() + text_.size());
+          text_.clear();
+        }
+        return ok ? stop + 1 : nullptr;
+      }
+      if (tokenStart_) {
+        text_.assign(tokenStart_, stop);
+        tokenStart_ = nullptr;
+      } else {
+        text_.append(p, stop);
+      }
+      escape_ = Escape::backslash;
+      p = stop + 1;
+      continue;
+    }
+
+    const char c = *p++;
+    if (escape_ == Escape::backslash) {
+      if (highSurrogate_ && c != 'u') {
+        fail(p - 1, "expecting another \\u token to begin the second half of "
+                    "a unicode surrogate pair");
+        return nullptr;
+      }
+      escape_ = Escape::none;
+      switch (c) {
+      case '"':
+        text_ += '"';
+        break;
+      case '/':
+        text_ += '/';
+        break;
+      case '\\':
+        text_ += '\\';
+        break;
+      case 'b':
+        text_ += '\b';
+        break;
+      case 'f':
+        text_ += '\f';
+        break;
+      case 'n':
+        text_ += '\n';
+        break;
+      case 'r':
+        text_ += '\r';
+        break;
+      case 't':
+        text_ += '\t';
+        break;
+      case 'u':
+        escape_ = Escape::unicode;
+        unicode_ = 0;
+        hexDigits_ = 0;
+        break;
+      default:
+        fail(p - 1, "Bad escape sequence in string");
+        return nullptr;
+      }
+      continue;
+    }
+
+    // Escape::unicode
+    unsigned int digit;
+    if (c >= '0' && c <= '9')
+      digit = static_cast<unsigned int>(c - '0');
+    else if (c >= 'a' && c <= 'f')
+      digit = static_cast<unsigned int>(c - 'a' + 10);
+    else if (c >= 'A' && c <= 'F')
+      digit = static_cast<unsigned int>(c - 'A' + 10);
+    else {
+      fail(p - 1,
+           "Bad unicode escape sequence in string: hexadecimal digit expected.");
+      return nullptr;
+    }
+    unicode_ = unicode_ * 16 + digit;
+    if (++hexDigits_ < 4)
+      continue;
+    escape_ = Escape::none;
+    if (highSurrogate_) {
+      text_ += codePointToUTF8(0x10000 + ((highSurrogate_ & 0x3FF) << 10) +
+                               (unicode_ & 0x3FF));
+      highSurrogate_ = 0;
+    } else if (unicode_ >= 0xD800 && unicode_ <= 0xDBFF) {
+      highSurrogate_ = unicode_;
+    } else {
+      text_ += codePointToUTF8(unicode_);
+    }
+  }
+  return end;
+}
+
+bool PushParser::Impl::emitNumber(char const* at, char const* begin,
+                                  char const* end) {
+  // Same rules as OurReader::decodeNumber: integers that fit stay integers.
+  char const* current = begin;
+  const bool isNegative = current != end && *current == '-';
+  if (isNegative)
+    ++current;
+  const LargestUInt limit = isNegative
+                                ? LargestUInt(Value::maxLargestInt) + 1
+                                : Value::maxLargestUInt;
+  LargestUInt value = 0;
+  bool isIntegral = true;
+  for (; current != end; ++current) {
+    const char c = *current;
+    if (c < '0' || c > '9') {
+      isIntegral = false;
+      break;
+    }
+    const auto digit = static_cast<unsigned int>(c - '0');
+    if (value > (limit - digit) / 10) {
+      isIntegral = false;
+      break;
+    }
+    value = value * 10 + digit;
+  }
+  bool ok;
+  if (isIntegral) {
+    if (isNegative)
+      ok = handler_.integer(value == limit ? Value::minLargestInt
+                                           : -LargestInt(value));
+    else if (value <= LargestUInt(Value::maxLargestInt))
+      ok = handler_.integer(LargestInt(value));
+    else
+      ok = handler_.uinteger(value);
+  } else {
+    double real;
+    if (!decodeDoubleToken(begin, end, &real))
+      return fail(at, "'" + String(begin, end) + "' is not a number.");
+    ok = handler_.real(real);
+  }
+  return handlerResult(at, ok) && valueDone();
+}
+
+char const* PushParser::Impl::scanNumber(char const* p, char const* end) {
+  // Accept what OurReader::readNumber accepts:
+  // [-] digits* [. digits*] [(e|E) [+|-] digits*]
+  for (; p != end; ++p) {
+    const char c = *p;
+    if (c >= '0' && c <= '9') {
+      if (numberPhase_ == 's')
+        numberPhase_ = 'e';
+      continue;
+    }
+    if (c == '.' && numberPhase_ == 'i') {
+      numberPhase_ = 'f';
+      continue;
+    }
+    if ((c == 'e' || c == 'E') && (numberPhase_ == 'i' || numberPhase_ == 'f')) {
+      numberPhase_ = 's';
+      continue;
+    }
+    if ((c == '+' || c == '-') && numberPhase_ == 's') {
+      numberPhase_ = 'e';
+      continue;
+    }
+    break;
+  }
+  if (p == end) {
+    // A number carried over from an earlier chunk resumes at the start of
+    // this one; feed() copies a number that started here.
+    if (!tokenStart_)
+      text_.append(chunk_, end);
+    return end;
+  }
+  mode_ = Mode::between;
+  bool ok;
+  if (tokenStart_) {
+    ok = emitNumber(p, tokenStart_, p);
+    tokenStart_ = nullptr;
+  } else {
+    text_.append(chunk_, p);
+    ok = emitNumber(p, text_.data(), text_.data() + text_.size());
+    text_.clear();
+  }
+  return ok ? p : nullptr;
+}
+
+char const* PushParser::Impl::scanLiteral(char const* p, char const* end) {
+  for (; p != end; ++p) {
+    if (literal_[literalIndex_] == '\0')
+      break;
+    if (*p != literal_[literalIndex_]) {
+      fail(p, "Syntax error: value, object or array expected.");
+      return nullptr;
+    }
+    ++literalIndex_;
+  }
+  if (literal_[literalIndex_] != '\0')
+    return end;
+  mode_ = Mode::between;
+  bool ok;
+  if (literal_[0] == 'n')
+    ok = handler_.null();
+  else
+    ok = handler_.boolean(literal_[0] == 't');
+  return handlerResult(p, ok) && valueDone() ? p : nullptr;
+}
+
+char const* PushParser::Impl::scanComment(char const* p, char const* end) {
+  while (p != end) {
+    const char c = *p++;
+    switch (mode_) {
+    case Mode::commentStart:
+      if (c == '*') {
+        mode_ = Mode::blockComment;
+      } else if (c == '/') {
+        mode_ = Mode::lineComment;
+      } else {
+        fail(p - 1, "Syntax error: value, object or array expected.");
+        return nullptr;
+      }
+      break;
+    case Mode::blockComment:
+    case Mode::blockCommentStar:
+      if (c == '/' && mode_ == Mode::blockCommentStar) {
+        mode_ = Mode::between;
+        return p;
+      }
+      mode_ = c == '*' ? Mode::blockCommentStar : Mode::blockComment;
+      if (c == '\n')
+        countLines(p - 1, p);
+      break;
+    default: // Mode::lineComment
+      if (c == '\n' || c == '\r') {
+        mode_ = Mode::between;
+        return p - 1; // let between() count the line
+      }
+      break;
+    }
+  }
+  return end;
+}
+
+PushParser::PushParser(ParseHandler& handler) {
+  Value settings;
+  CharReaderBuilder::setDefaults(&settings);
+  impl_.reset(new Impl(handler, settings));
+}
+
+PushParser::PushParser(ParseHandler& handler, Value const& settings)
+    : impl_(new Impl(handler, settings)) {}
+
+PushParser::~PushParser() = default;
+
+PushParser::Status PushParser::feed(char const* data, size_t length) {
+  return impl_->feed(data, length);
+}
+
+PushParser::Status PushParser::finish() { return impl_->finish(); }
+
+void PushParser::reset() { impl_->reset(); }
+
+PushParser::Status PushParser::status() const { return impl_->status_; }
+
+size_t PushParser::consumed() const { return impl_->consumed_; }
+
+String PushParser::getFormattedErrorMessages() const { return impl_->error_; }
+
 //////////////////////////////////
 // global functions
 
@@ -0,0 +1,246 @@
+// Copyright 2007-2010 Baptiste Lepilleur and The JsonCpp Authors
+// Distributed under MIT license, or public domain if desired and
+// recognized in your jurisdiction.
+// See file LICENSE for detail or copy at http://jsoncpp.sourceforge.net/LICENSE
+
+#ifndef LIB_JSONCPP_JSON_SIMD_H_INCLUDED
+#define LIB_JSONCPP_JSON_SIMD_H_INCLUDED
+
+#if !defined(JSON_IS_AMALGAMATION)
+#include <json/config.h>
+#endif
+
+/* This header provides vectorized character-class scanners used by the reader
+ * and the writer: skipping whitespace and finding the next byte of interest in
+ * a string body. Each scanner has an SSE2 path (16 bytes per step), an AVX2
+ * path (32 bytes per step) selected at runtime, and a scalar fallback that is
+ * used for the tail and on other architectures.
+ *
+ * Define JSONCPP_NO_SIMD to force the scalar code.
+ *
+ * It is an internal header that must not be exposed.
+ */
+
+#if !defined(JSONCPP_NO_SIMD)
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) ||              \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define JSONCPP_SIMD_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(JSONCPP_SIMD_SSE2)
+#if defined(_MSC_VER) && !defined(__clang__)
+#define JSONCPP_SIMD_AVX2 1
+#define JSONCPP_TARGET_AVX2
+#include <immintrin.h>
+#include <intrin.h>
+#elif (defined(__GNUC__) || defined(__clang__)) &&                             \
+    (defined(__x86_64__) || defined(__i386__))
+#define JSONCPP_SIMD_AVX2 1
+#define JSONCPP_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+#endif // if defined(JSONCPP_SIMD_SSE2)
+#endif // if !defined(JSONCPP_NO_SIMD)
+
+namespace Json {
+namespace simd {
+
+static inline bool isSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/// \c true for bytes that must be escaped in a JSON string literal.
+static inline bool requiresEscape(unsigned char c, bool emitUTF8) {
+  return c == '"' || c == '\\' || c < 0x20 || (!emitUTF8 && c > 0x7F);
+}
+
+#if defined(JSONCPP_SIMD_SSE2)
+static inline unsigned countTrailingZeros(unsigned mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return static_cast<unsigned>(index);
+#else
+  return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+#endif // if defined(JSONCPP_SIMD_SSE2)
+
+#if defined(JSONCPP_SIMD_AVX2)
+static inline bool detectAVX2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7)
+    return false;
+  __cpuid(info, 1);
+  // OSXSAVE and AVX, then make sure the OS saves the YMM state.
+  if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+    return false;
+  if ((_xgetbv(0) & 0x6) != 0x6)
+    return false;
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+static inline bool hasAVX2() {
+  static const bool has = detectAVX2();
+  return has;
+}
+
+JSONCPP_TARGET_AVX2 static inline const char*
+skipWhitespaceAVX2(const char* p, const char* end) {
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i tab = _mm256_set1_epi8('\t');
+  const __m256i cr = _mm256_set1_epi8('\r');
+  const __m256i lf = _mm256_set1_epi8('\n');
+  for (; end - p >= 32; p += 32) {
+    const __m256i chunk =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    const __m256i ws = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(chunk, space),
+                        _mm256_cmpeq_epi8(chunk, tab)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(chunk, cr),
+                        _mm256_cmpeq_epi8(chunk, lf)));
+    const unsigned mask = ~static_cast<unsigned>(_mm256_movemask_epi8(ws));
+    if (mask != 0)
+      return p + countTrailingZeros(mask);
+  }
+  return p;
+}
+
+JSONCPP_TARGET_AVX2 static inline const char*
+findQuoteOrBackslashAVX2(const char* p, const char* end, char quote) {
+  const __m256i q = _mm256_set1_epi8(quote);
+  const __m256i bs = _mm256_set1_epi8('\\');
+  for (; end - p >= 32; p += 32) {
+    const __m256i chunk =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    const unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+        _mm256_or_si256(_mm256_cmpeq_epi8(chunk, q),
+                        _mm256_cmpeq_epi8(chunk, bs))));
+    if (mask != 0)
+      return p + countTrailingZeros(mask);
+  }
+  return p;
+}
+
+JSONCPP_TARGET_AVX2 static inline const char*
+findEscapeAVX2(const char* p, const char* end, bool emitUTF8) {
+  const __m256i q = _mm256_set1_epi8('"');
+  const __m256i bs = _mm256_set1_epi8('\\');
+  const __m256i ctrl = _mm256_set1_epi8(0x1F);
+  for (; end - p >= 32; p += 32) {
+    const __m256i chunk =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    const __m256i special = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(chunk, q),
+                        _mm256_cmpeq_epi8(chunk, bs)),
+        _mm256_cmpeq_epi8(_mm256_max_epu8(chunk, ctrl), ctrl));
+    unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(special));
+    if (!emitUTF8)
+      mask |= static_cast<unsigned>(_mm256_movemask_epi8(chunk));
+    if (mask != 0)
+      return p + countTrailingZeros(mask);
+  }
+  return p;
+}
+#endif // if defined(JSONCPP_SIMD_AVX2)
+
+/** Return the first byte of [p, end) that is not JSON whitespace, or end.
+ */
+static inline const char* skipWhitespace(const char* p, const char* end) {
+  // Most tokens are separated by at most one space; don't pay for a vector
+  // load in that case.
+  if (p == end || !isSpace(*p))
+    return p;
+  if (++p == end || !isSpace(*p))
+    return p;
+#if defined(JSONCPP_SIMD_AVX2)
+  if (end - p >= 32 && hasAVX2())
+    p = skipWhitespaceAVX2(p, end);
+#endif
+#if defined(JSONCPP_SIMD_SSE2)
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i lf = _mm_set1_epi8('\n');
+  for (; end - p >= 16; p += 16) {
+    const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    const __m128i ws =
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, space),
+                                  _mm_cmpeq_epi8(chunk, tab)),
+                     _mm_or_si128(_mm_cmpeq_epi8(chunk, cr),
+                                  _mm_cmpeq_epi8(chunk, lf)));
+    const unsigned mask = ~static_cast<unsigned>(_mm_movemask_epi8(ws)) & 0xFFFF;
+    if (mask != 0)
+      return p + countTrailingZeros(mask);
+  }
+#endif
+  while (p != end && isSpace(*p))
+    ++p;
+  return p;
+}
+
+/** Return the first occurrence of \c quote or '\\' in [p, end), or end.
+ */
+static inline const char* findQuoteOrBackslash(const char* p, const char* end,
+                                               char quote) {
+#if defined(JSONCPP_SIMD_AVX2)
+  if (end - p >= 32 && hasAVX2())
+    p = findQuoteOrBackslashAVX2(p, end, quote);
+#endif
+#if defined(JSONCPP_SIMD_SSE2)
+  const __m128i q = _mm_set1_epi8(quote);
+  const __m128i bs = _mm_set1_epi8('\\');
+  for (; end - p >= 16; p += 16) {
+    const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(chunk, q), _mm_cmpeq_epi8(chunk, bs))));
+    if (mask != 0)
+      return p + countTrailingZeros(mask);
+  }
+#endif
+  while (p != end && *p != quote && *p != '\\')
+    ++p;
+  return p;
+}
+
+/** Return the first byte of [p, end) for which requiresEscape() holds, or end.
+ */
+static inline const char* findEscape(const char* p, const char* end,
+                                     bool emitUTF8) {
+#if defined(JSONCPP_SIMD_AVX2)
+  if (end - p >= 32 && hasAVX2())
+    p = findEscapeAVX2(p, end, emitUTF8);
+#endif
+#if defined(JSONCPP_SIMD_SSE2)
+  const __m128i q = _mm_set1_epi8('"');
+  const __m128i bs = _mm_set1_epi8('\\');
+  const __m128i ctrl = _mm_set1_epi8(0x1F);
+  for (; end - p >= 16; p += 16) {
+    const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    const __m128i special =
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, q),
+                                  _mm_cmpeq_epi8(chunk, bs)),
+                     _mm_cmpeq_epi8(_mm_max_epu8(chunk, ctrl), ctrl));
+    unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(special));
+    if (!emitUTF8)
+      mask |= static_cast<unsigned>(_mm_movemask_epi8(chunk));
+    if (mask != 0)
+      return p + countTrailingZeros(mask);
+  }
+#endif
+  while (p != end && !requiresEscape(static_cast<unsigned char>(*p), emitUTF8))
+    ++p;
+  return p;
+}
+
+} // namespace simd
+} // namespace Json
+
+#endif // LIB_JSONCPP_JSON_SIMD_H_INCLUDED
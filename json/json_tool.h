@@ -18,6 +18,8 @@
 #ifndef JSONCPP_NO_LOCALE_SUPPORT
 #include <clocale>
 #endif
+#include <cstdlib>
+#include <cstring>
 
 /* This header provides common string manipulation support, such as UTF-8,
  * portable conversion from/to string...
@@ -79,11 +81,38 @@ using UIntToStringBuffer = char[uintToStringBufferSize];
  *        Must have at least uintToStringBufferSize chars free.
  */
 static inline void uintToString(LargestUInt value, char*& current) {
+  static const char digitPairs[] = "00010203040506070809"
+                                   "10111213141516171819"
+                                   "20212223242526272829"
+                                   "30313233343536373839"
+                                   "40414243444546474849"
+                                   "50515253545556575859"
+                                   "60616263646566676869"
+                                   "70717273747576777879"
+                                   "80818283848586878889"
+                                   "90919293949596979899";
   *--current = 0;
-  do {
-    *--current = static_cast<char>(value % 10U + static_cast<unsigned>('0'));
-    value /= 10;
-  } while (value != 0);
+  // Emit two digits per division, and switch to 32-bit arithmetic as soon as
+  // possible: 64-bit division is a library call on 32-bit targets.
+  while (value > 0xFFFFFFFFu) {
+    const auto pair = static_cast<unsigned>(value % 100U) * 2;
+    value /= 100;
+    *--current = digitPairs[pair + 1];
+    *--current = digitPairs[pair];
+  }
+  auto small = static_cast<UInt>(value);
+  while (small >= 100) {
+    const unsigned pair = (small % 100U) * 2;
+    small /= 100;
+    *--current = digitPairs[pair + 1];
+    *--current = digitPairs[pair];
+  }
+  if (small >= 10) {
+    *--current = digitPairs[small * 2 + 1];
+    *--current = digitPairs[small * 2];
+  } else {
+    *--current = static_cast<char>(small + static_cast<unsigned>('0'));
+  }
 }
 
 /** Change ',' to '.' everywhere in buffer.
@@ -112,6 +141,124 @@ template <typename Iter> void fixNumericLocaleInput(Iter begin, Iter end) {
   }
 }
 
+/** Converts a number token to a double without going through a stream.
+ *
+ * Accepts <tt>-?digits*(.digits*)?([eE][+-]?digits+)?</tt> with at least one
+ * mantissa digit, i.e. everything the readers' readNumber() may produce.
+ * Results that are exactly representable from a mantissa of at most 2^53 and
+ * a power of ten of at most 10^22 are computed directly (Clinger's fast path,
+ * correctly rounded); anything else goes through strtod() on a stack copy of
+ * the token. Out of range values become +/-infinity.
+ * @return false if the token is malformed.
+ */
+static inline bool decodeDoubleToken(const char* begin, const char* end,
+                                     double* result) {
+  static const double powersOf10[] = {
+      1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  const int maxExactPower = 22;
+  const LargestUInt maxExactMantissa = LargestUInt(1) << 53;
+
+  const char* p = begin;
+  const bool isNegative = p != end && *p == '-';
+  if (isNegative)
+    ++p;
+
+  LargestUInt mantissa = 0;
+  int significantDigits = 0; // digits in mantissa, leading zeros excluded
+  int exponent = 0;
+  bool truncated = false; // a non-zero digit did not fit in mantissa
+  bool hasDigits = false;
+  for (; p != end && *p >= '0' && *p <= '9'; ++p) {
+    hasDigits = true;
+    if (significantDigits < 19) {
+      mantissa = mantissa * 10 + static_cast<unsigned>(*p - '0');
+      if (mantissa != 0)
+        ++significantDigits;
+    } else {
+      ++exponent;
+      truncated |= *p != '0';
+    }
+  }
+  if (p != end && *p == '.') {
+    for (++p; p != end && *p >= '0' && *p <= '9'; ++p) {
+      hasDigits = true;
+      if (significantDigits < 19) {
+        mantissa = mantissa * 10 + static_cast<unsigned>(*p - '0');
+        if (mantissa != 0)
+          ++significantDigits;
+        --exponent;
+      } else {
+        truncated |= *p != '0';
+      }
+    }
+  }
+  if (!hasDigits)
+    return false;
+  if (p != end && (*p == 'e' || *p == 'E')) {
+    ++p;
+    const bool isNegativeExponent = p != end && *p == '-';
+    if (p != end && (*p == '-' || *p == '+'))
+      ++p;
+    if (p == end)
+      return false;
+    int explicitExponent = 0;
+    for (; p != end && *p >= '0' && *p <= '9'; ++p) {
+      // Saturate; anything this large is out of range either way.
+      if (explicitExponent < 100000)
+        explicitExponent = explicitExponent * 10 + (*p - '0');
+    }
+    exponent += isNegativeExponent ? -explicitExponent : explicitExponent;
+  }
+  if (p != end)
+    return false;
+
+  if (!truncated && mantissa <= maxExactMantissa) {
+    double value = static_cast<double>(mantissa);
+    bool exact = true;
+    if (mantissa == 0) {
+      // 0eN is zero for any N.
+    } else if (exponent < 0 && exponent >= -maxExactPower) {
+      value /= powersOf10[-exponent];
+    } else if (exponent >= 0 && exponent <= maxExactPower) {
+      value *= powersOf10[exponent];
+    } else if (exponent > maxExactPower &&
+               exponent <= maxExactPower + 15) {
+      // Shift surplus powers into the mantissa while it stays exact.
+      LargestUInt shifted = mantissa;
+      for (int i = maxExactPower; i < exponent && exact; ++i) {
+        shifted *= 10;
+        exact = shifted <= maxExactMantissa;
+      }
+      if (exact)
+        value = static_cast<double>(shifted) * powersOf10[maxExactPower];
+    } else {
+      exact = false;
+    }
+    if (exact) {
+      *result = isNegative ? -value : value;
+      return true;
+    }
+  }
+
+  // Slow path: strtod is correctly rounded but wants a terminated buffer in
+  // the C locale's notation. Tokens that do not fit are copied to the heap.
+  char buffer[64];
+  const size_t length = static_cast<size_t>(end - begin);
+  String heapBuffer;
+  char* text = buffer;
+  if (length >= sizeof(buffer)) {
+    heapBuffer.assign(begin, end);
+    text = &heapBuffer[0];
+  } else {
+    std::memcpy(buffer, begin, length);
+    buffer[length] = '\0';
+  }
+  fixNumericLocaleInput(text, text + length);
+  *result = std::strtod(text, nullptr);
+  return true;
+}
+
 /**
  * Return iterator that would be the new end of the range [begin,end), if we
  * were to delete zeros in the end of string, but not the last zero before '.'.
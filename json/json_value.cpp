@@ -21,6 +21,15 @@
 #include <string_view>
 #endif
 
+#if JSONCPP_COMPACT_VALUE
+#include <mutex>
+#include <unordered_map>
+#endif
+
+#if JSONCPP_SHARED_VALUE
+#include <atomic>
+#endif
+
 // Provide implementation equivalent of std::snprintf for older _MSC compilers
 #if defined(_MSC_VER) && _MSC_VER < 1900
 #include <stdarg.h>
@@ -189,6 +198,18 @@ static inline void releasePrefixedStringValue(char* value) { free(value); }
 static inline void releaseStringValue(char* value, unsigned) { free(value); }
 #endif // JSONCPP_USE_SECURE_MEMORY
 
+/* Strings up to this many chars are kept inside the Value or CZString rather
+ * than in a heap block. Secure memory wipes what it frees, so it keeps every
+ * string on the heap.
+ */
+#if JSONCPP_USE_SECURE_MEMORY
+static const unsigned inlineValueCapacity = 0;
+static const unsigned inlineKeyCapacity = 0;
+#else
+static const unsigned inlineValueCapacity = sizeof(LargestUInt) - 1;
+static const unsigned inlineKeyCapacity = sizeof(char const*) - 1;
+#endif
+
 } // namespace Json
 
 // //////////////////////////////////////////////////////////////////
@@ -250,6 +271,16 @@ Value::CZString::CZString(char const* str, unsigned length,
 }
 
 Value::CZString::CZString(const CZString& other) {
+  // An inlined key must not look like an index, so it needs a non-zero byte.
+  if (other.storage_.policy_ != noDuplication && other.cstr_ != nullptr &&
+      other.storage_.length_ <= inlineKeyCapacity &&
+      other.storage_.length_ != 0 && other.data()[0] != '\0') {
+    cstr_ = nullptr;
+    memcpy(inline_, other.data(), other.storage_.length_);
+    storage_.policy_ = inlined;
+    storage_.length_ = other.storage_.length_;
+    return;
+  }
   cstr_ = (other.storage_.policy_ != noDuplication && other.cstr_ != nullptr
                ? duplicateStringValue(other.cstr_, other.storage_.length_)
                : other.cstr_);
@@ -307,7 +338,7 @@ bool Value::CZString::operator<(const CZString& other) const {
   unsigned other_len = other.storage_.length_;
   unsigned min_len = std::min<unsigned>(this_len, other_len);
   JSON_ASSERT(this->cstr_ && other.cstr_);
-  int comp = memcmp(this->cstr_, other.cstr_, min_len);
+  int comp = memcmp(this->data(), other.data(), min_len);
   if (comp < 0)
     return true;
   if (comp > 0)
@@ -325,14 +356,18 @@ bool Value::CZString::operator==(const CZString& other) const {
   if (this_len != other_len)
     return false;
   JSON_ASSERT(this->cstr_ && other.cstr_);
-  int comp = memcmp(this->cstr_, other.cstr_, this_len);
+  int comp = memcmp(this->data(), other.data(), this_len);
   return comp == 0;
 }
 
 ArrayIndex Value::CZString::index() const { return index_; }
 
 // const char* Value::CZString::c_str() const { return cstr_; }
-const char* Value::CZString::data() const { return cstr_; }
+const char* Value::CZString::data() const {
+  if (cstr_ && storage_.policy_ == inlined)
+    return inline_;
+  return cstr_;
+}
 unsigned Value::CZString::length() const { return storage_.length_; }
 bool Value::CZString::isStaticString() const {
   return storage_.policy_ == noDuplication;
@@ -346,6 +381,14 @@ bool Value::CZString::isStaticString() const {
 // //////////////////////////////////////////////////////////////////
 // //////////////////////////////////////////////////////////////////
 
+#if JSONCPP_SHARED_VALUE
+struct Value::SharedValues : ObjectValues {
+  SharedValues() = default;
+  explicit SharedValues(const ObjectValues& values) : ObjectValues(values) {}
+  std::atomic<unsigned> refs{1};
+};
+#endif
+
 /*! \internal Default constructor initialization must be equivalent to:
  * memset( this, 0, sizeof(Value) )
  * This optimization is used in ValueInternalMap fast allocator.
@@ -369,7 +412,11 @@ Value::Value(ValueType type) {
     break;
   case arrayValue:
   case objectValue:
+#if JSONCPP_SHARED_VALUE
+    value_.map_ = new SharedValues();
+#else
     value_.map_ = new ObjectValues();
+#endif
     break;
   case booleanValue:
     value_.bool_ = false;
@@ -405,30 +452,22 @@ Value::Value(double value) {
 }
 
 Value::Value(const char* value) {
-  initBasic(stringValue, true);
   JSON_ASSERT_MESSAGE(value != nullptr,
                       "Null Value Passed to Value Constructor");
-  value_.string_ = duplicateAndPrefixStringValue(
-      value, static_cast<unsigned>(strlen(value)));
+  initString(value, static_cast<unsigned>(strlen(value)));
 }
 
 Value::Value(const char* begin, const char* end) {
-  initBasic(stringValue, true);
-  value_.string_ =
-      duplicateAndPrefixStringValue(begin, static_cast<unsigned>(end - begin));
+  initString(begin, static_cast<unsigned>(end - begin));
 }
 
 Value::Value(const String& value) {
-  initBasic(stringValue, true);
-  value_.string_ = duplicateAndPrefixStringValue(
-      value.data(), static_cast<unsigned>(value.length()));
+  initString(value.data(), static_cast<unsigned>(value.length()));
 }
 
 #ifdef JSONCPP_HAS_STRING_VIEW
 Value::Value(std::string_view value) {
-  initBasic(stringValue, true);
-  value_.string_ = duplicateAndPrefixStringValue(
-      value.data(), static_cast<unsigned>(value.length()));
+  initString(value.data(), static_cast<unsigned>(value.length()));
 }
 #endif
 
@@ -443,6 +482,9 @@ Value::Value(bool value) {
 }
 
 Value::Value(const Value& other) {
+#if JSONCPP_COMPACT_VALUE
+  bits_.hasMeta_ = 0;
+#endif
   dupPayload(other);
   dupMeta(other);
 }
@@ -454,6 +496,9 @@ Value::Value(Value&& other) noexcept {
 
 Value::~Value() {
   releasePayload();
+#if JSONCPP_COMPACT_VALUE
+  releaseMeta();
+#endif
   value_.uint_ = 0;
 }
 
@@ -468,7 +513,15 @@ Value& Value::operator=(Value&& other) noexcept {
 }
 
 void Value::swapPayload(Value& other) {
+#if JSONCPP_COMPACT_VALUE
+  const unsigned int hasMeta = bits_.hasMeta_;
+  const unsigned int otherHasMeta = other.bits_.hasMeta_;
+  std::swap(bits_, other.bits_);
+  bits_.hasMeta_ = hasMeta;
+  other.bits_.hasMeta_ = otherHasMeta;
+#else
   std::swap(bits_, other.bits_);
+#endif
   std::swap(value_, other.value_);
 }
 
@@ -479,9 +532,13 @@ void Value::copyPayload(const Value& other) {
 
 void Value::swap(Value& other) {
   swapPayload(other);
+#if JSONCPP_COMPACT_VALUE
+  swapMeta(other);
+#else
   std::swap(comments_, other.comments_);
   std::swap(start_, other.start_);
   std::swap(limit_, other.limit_);
+#endif
 }
 
 void Value::copy(const Value& other) {
@@ -517,17 +574,13 @@ bool Value::operator<(const Value& other) const {
   case booleanValue:
     return value_.bool_ < other.value_.bool_;
   case stringValue: {
-    if ((value_.string_ == nullptr) || (other.value_.string_ == nullptr)) {
-      return other.value_.string_ != nullptr;
-    }
     unsigned this_len;
     unsigned other_len;
-    char const* this_str;
-    char const* other_str;
-    decodePrefixedString(this->isAllocated(), this->value_.string_, &this_len,
-                         &this_str);
-    decodePrefixedString(other.isAllocated(), other.value_.string_, &other_len,
-                         &other_str);
+    char const* this_str = stringPayload(&this_len);
+    char const* other_str = other.stringPayload(&other_len);
+    if ((this_str == nullptr) || (other_str == nullptr)) {
+      return other_str != nullptr;
+    }
     unsigned min_len = std::min<unsigned>(this_len, other_len);
     JSON_ASSERT(this_str && other_str);
     int comp = memcmp(this_str, other_str, min_len);
@@ -572,17 +625,13 @@ bool Value::operator==(const Value& other) const {
   case booleanValue:
     return value_.bool_ == other.value_.bool_;
   case stringValue: {
-    if ((value_.string_ == nullptr) || (other.value_.string_ == nullptr)) {
-      return (value_.string_ == other.value_.string_);
-    }
     unsigned this_len;
     unsigned other_len;
-    char const* this_str;
-    char const* other_str;
-    decodePrefixedString(this->isAllocated(), this->value_.string_, &this_len,
-                         &this_str);
-    decodePrefixedString(other.isAllocated(), other.value_.string_, &other_len,
-                         &other_str);
+    char const* this_str = stringPayload(&this_len);
+    char const* other_str = other.stringPayload(&other_len);
+    if ((this_str == nullptr) || (other_str == nullptr)) {
+      return (this_str == other_str);
+    }
     if (this_len != other_len)
       return false;
     JSON_ASSERT(this_str && other_str);
@@ -591,6 +640,10 @@ bool Value::operator==(const Value& other) const {
   }
   case arrayValue:
   case objectValue:
+#if JSONCPP_SHARED_VALUE
+    if (value_.map_ == other.value_.map_)
+      return true;
+#endif
     return value_.map_->size() == other.value_.map_->size() &&
            (*value_.map_) == (*other.value_.map_);
   default:
@@ -604,25 +657,16 @@ bool Value::operator!=(const Value& other) const { return !(*this == other); }
 const char* Value::asCString() const {
   JSON_ASSERT_MESSAGE(type() == stringValue,
                       "in Json::Value::asCString(): requires stringValue");
-  if (value_.string_ == nullptr)
-    return nullptr;
   unsigned this_len;
-  char const* this_str;
-  decodePrefixedString(this->isAllocated(), this->value_.string_, &this_len,
-                       &this_str);
-  return this_str;
+  return stringPayload(&this_len);
 }
 
 #if JSONCPP_USE_SECURE_MEMORY
 unsigned Value::getCStringLength() const {
   JSON_ASSERT_MESSAGE(type() == stringValue,
                       "in Json::Value::asCString(): requires stringValue");
-  if (value_.string_ == 0)
-    return 0;
   unsigned this_len;
-  char const* this_str;
-  decodePrefixedString(this->isAllocated(), this->value_.string_, &this_len,
-                       &this_str);
+  stringPayload(&this_len);
   return this_len;
 }
 #endif
@@ -630,11 +674,10 @@ unsigned Value::getCStringLength() const {
 bool Value::getString(char const** begin, char const** end) const {
   if (type() != stringValue)
     return false;
-  if (value_.string_ == nullptr)
-    return false;
   unsigned length;
-  decodePrefixedString(this->isAllocated(), this->value_.string_, &length,
-                       begin);
+  *begin = stringPayload(&length);
+  if (*begin == nullptr)
+    return false;
   *end = *begin + length;
   return true;
 }
@@ -643,12 +686,10 @@ bool Value::getString(char const** begin, char const** end) const {
 bool Value::getString(std::string_view* str) const {
   if (type() != stringValue)
     return false;
-  if (value_.string_ == nullptr)
-    return false;
-  const char* begin;
   unsigned length;
-  decodePrefixedString(this->isAllocated(), this->value_.string_, &length,
-                       &begin);
+  const char* begin = stringPayload(&length);
+  if (begin == nullptr)
+    return false;
   *str = std::string_view(begin, length);
   return true;
 }
@@ -659,12 +700,10 @@ String Value::asString() const {
   case nullValue:
     return "";
   case stringValue: {
-    if (value_.string_ == nullptr)
-      return "";
     unsigned this_len;
-    char const* this_str;
-    decodePrefixedString(this->isAllocated(), this->value_.string_, &this_len,
-                         &this_str);
+    char const* this_str = stringPayload(&this_len);
+    if (this_str == nullptr)
+      return "";
     return String(this_str, this_len);
   }
   case booleanValue:
@@ -925,11 +964,12 @@ void Value::clear() {
   JSON_ASSERT_MESSAGE(type() == nullValue || type() == arrayValue ||
                           type() == objectValue,
                       "in Json::Value::clear(): requires complex value");
-  start_ = 0;
-  limit_ = 0;
+  setOffsetStart(0);
+  setOffsetLimit(0);
   switch (type()) {
   case arrayValue:
   case objectValue:
+    detach();
     value_.map_->clear();
     break;
   default:
@@ -949,6 +989,7 @@ void Value::resize(ArrayIndex newSize) {
     for (ArrayIndex i = oldSize; i < newSize; ++i)
       (*this)[i];
   else {
+    detach();
     for (ArrayIndex index = newSize; index < oldSize; ++index) {
       value_.map_->erase(index);
     }
@@ -962,6 +1003,7 @@ Value& Value::operator[](ArrayIndex index) {
       "in Json::Value::operator[](ArrayIndex): requires arrayValue");
   if (type() == nullValue)
     *this = Value(arrayValue);
+  detach();
   CZString key(index);
   auto it = value_.map_->lower_bound(key);
   if (it != value_.map_->end() && (*it).first == key)
@@ -999,17 +1041,119 @@ const Value& Value::operator[](int index) const {
   return (*this)[ArrayIndex(index)];
 }
 
+#if JSONCPP_COMPACT_VALUE
+struct Value::Meta {
+  Comments comments;
+  ptrdiff_t start = 0;
+  ptrdiff_t limit = 0;
+
+  // Map nodes don't move when the table rehashes, so a node may use its entry
+  // outside the lock; only that node ever touches it.
+  using Table = std::unordered_map<const Value*, Meta>;
+  static std::mutex& mutex() {
+    static std::mutex instance;
+    return instance;
+  }
+  static Table& table() {
+    static Table instance;
+    return instance;
+  }
+};
+
+Value::Meta* Value::findMeta() const {
+  if (!bits_.hasMeta_)
+    return nullptr;
+  std::lock_guard<std::mutex> lock(Meta::mutex());
+  return &Meta::table().find(this)->second;
+}
+
+Value::Meta& Value::demandMeta() {
+  if (bits_.hasMeta_)
+    return *findMeta();
+  std::lock_guard<std::mutex> lock(Meta::mutex());
+  bits_.hasMeta_ = 1;
+  return Meta::table()[this];
+}
+
+void Value::releaseMeta() {
+  if (!bits_.hasMeta_)
+    return;
+  std::lock_guard<std::mutex> lock(Meta::mutex());
+  Meta::table().erase(this);
+  bits_.hasMeta_ = 0;
+}
+
+void Value::swapMeta(Value& other) {
+  if (!bits_.hasMeta_ && !other.bits_.hasMeta_)
+    return;
+  std::lock_guard<std::mutex> lock(Meta::mutex());
+  Meta::Table& table = Meta::table();
+  Meta mine, theirs;
+  if (bits_.hasMeta_) {
+    auto it = table.find(this);
+    mine = std::move(it->second);
+    table.erase(it);
+  }
+  if (other.bits_.hasMeta_) {
+    auto it = table.find(&other);
+    theirs = std::move(it->second);
+    table.erase(it);
+  }
+  const unsigned int hasMeta = bits_.hasMeta_;
+  bits_.hasMeta_ = other.bits_.hasMeta_;
+  other.bits_.hasMeta_ = hasMeta;
+  if (bits_.hasMeta_)
+    table.emplace(this, std::move(theirs));
+  if (other.bits_.hasMeta_)
+    table.emplace(&other, std::move(mine));
+}
+#endif // if JSONCPP_COMPACT_VALUE
+
 void Value::initBasic(ValueType type, bool allocated) {
   setType(type);
   setIsAllocated(allocated);
+  bits_.inlined_ = 0;
+#if JSONCPP_COMPACT_VALUE
+  bits_.hasMeta_ = 0;
+#else
   comments_ = Comments{};
   start_ = 0;
   limit_ = 0;
+#endif
+}
+
+void Value::initString(char const* str, unsigned length) {
+  if (length > inlineValueCapacity) {
+    initBasic(stringValue, true);
+    value_.string_ = duplicateAndPrefixStringValue(str, length);
+    return;
+  }
+  initBasic(stringValue);
+  bits_.inlined_ = 1;
+  bits_.inlineLength_ = length;
+  memcpy(value_.inline_, str, length);
+  value_.inline_[length] = 0;
+}
+
+char const* Value::stringPayload(unsigned* length) const {
+  if (bits_.inlined_) {
+    *length = bits_.inlineLength_;
+    return value_.inline_;
+  }
+  if (value_.string_ == nullptr) {
+    *length = 0;
+    return nullptr;
+  }
+  char const* str;
+  decodePrefixedString(isAllocated(), value_.string_, length, &str);
+  return str;
 }
 
 void Value::dupPayload(const Value& other) {
   setType(other.type());
   setIsAllocated(false);
+  bits_.inlined_ = other.bits_.inlined_;
+  bits_.inlineLength_ = other.bits_.inlineLength_;
   switch (type()) {
   case nullValue:
   case intValue:
@@ -1019,7 +1163,7 @@ void Value::dupPayload(const Value& other) {
     value_ = other.value_;
     break;
   case stringValue:
-    if (other.value_.string_ && other.isAllocated()) {
+    if (!other.bits_.inlined_ && other.value_.string_ && other.isAllocated()) {
       unsigned len;
       char const* str;
       decodePrefixedString(other.isAllocated(), other.value_.string_, &len,
@@ -1027,12 +1171,18 @@ void Value::dupPayload(const Value& other) {
       value_.string_ = duplicateAndPrefixStringValue(str, len);
       setIsAllocated(true);
     } else {
-      value_.string_ = other.value_.string_;
+      value_ = other.value_;
     }
     break;
   case arrayValue:
   case objectValue:
+#if JSONCPP_SHARED_VALUE
+    static_cast<SharedValues*>(other.value_.map_)
+        ->refs.fetch_add(1, std::memory_order_relaxed);
+    value_.map_ = other.value_.map_;
+#else
     value_.map_ = new ObjectValues(*other.value_.map_);
+#endif
     break;
   default:
     JSON_ASSERT_UNREACHABLE;
@@ -1053,17 +1203,47 @@ void Value::releasePayload() {
     break;
   case arrayValue:
   case objectValue:
+#if JSONCPP_SHARED_VALUE
+    if (static_cast<SharedValues*>(value_.map_)
+            ->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      delete static_cast<SharedValues*>(value_.map_);
+#else
     delete value_.map_;
+#endif
     break;
   default:
     JSON_ASSERT_UNREACHABLE;
   }
 }
 
+#if JSONCPP_SHARED_VALUE
+void Value::detach() {
+  if (type() != arrayValue && type() != objectValue)
+    return;
+  if (static_cast<SharedValues*>(value_.map_)
+          ->refs.load(std::memory_order_acquire) == 1)
+    return;
+  // Copying the elements shares their own containers in turn, so only this
+  // level is duplicated.
+  ObjectValues* copy = new SharedValues(*value_.map_);
+  releasePayload();
+  value_.map_ = copy;
+}
+#endif
+
 void Value::dupMeta(const Value& other) {
+#if JSONCPP_COMPACT_VALUE
+  if (other.bits_.hasMeta_) {
+    Meta meta = *other.findMeta();
+    demandMeta() = std::move(meta);
+  } else {
+    releaseMeta();
+  }
+#else
   comments_ = other.comments_;
   start_ = other.start_;
   limit_ = other.limit_;
+#endif
 }
 
 // Access an object value by name, create a null member if it does not exist.
@@ -1075,6 +1255,7 @@ Value& Value::resolveReference(const char* key) {
       "in Json::Value::resolveReference(): requires objectValue");
   if (type() == nullValue)
     *this = Value(objectValue);
+  detach();
   CZString actualKey(key, static_cast<unsigned>(strlen(key)),
                      CZString::noDuplication); // NOTE!
   auto it = value_.map_->lower_bound(actualKey);
@@ -1094,16 +1275,23 @@ Value& Value::resolveReference(char const* key, char const* end) {
       "in Json::Value::resolveReference(key, end): requires objectValue");
   if (type() == nullValue)
     *this = Value(objectValue);
+  detach();
   CZString actualKey(key, static_cast<unsigned>(end - key),
                      CZString::duplicateOnCopy);
-  auto it = value_.map_->lower_bound(actualKey);
-  if (it != value_.map_->end() && (*it).first == actualKey)
-    return (*it).second;
+  // Readers mostly see members in the order a writer put them out, which is
+  // the map's: check the back before searching.
+  auto it = value_.map_->end();
+  if (value_.map_->empty() || !((--it)->first < actualKey)) {
+    it = value_.map_->lower_bound(actualKey);
+    if (it != value_.map_->end() && (*it).first == actualKey)
+      return (*it).second;
+  } else {
+    ++it;
+  }
 
-  ObjectValues::value_type defaultValue(actualKey, nullSingleton());
-  it = value_.map_->insert(it, defaultValue);
-  Value& value = (*it).second;
-  return value;
+  // Only the key is copied, into the node; the value starts out null there.
+  it = value_.map_->emplace_hint(it, actualKey, Value());
+  return (*it).second;
 }
 
 Value Value::get(ArrayIndex index, const Value& defaultValue) const {
@@ -1218,7 +1406,10 @@ Value& Value::append(Value&& value) {
   if (type() == nullValue) {
     *this = Value(arrayValue);
   }
-  return this->value_.map_->emplace(size(), std::move(value)).first->second;
+  detach();
+  return this->value_.map_
+      ->emplace_hint(this->value_.map_->end(), size(), std::move(value))
+      ->second;
 }
 
 bool Value::insert(ArrayIndex index, const Value& newValue) {
@@ -1266,6 +1457,8 @@ bool Value::removeMember(const char* begin, const char* end, Value* removed) {
   auto it = value_.map_->find(actualKey);
   if (it == value_.map_->end())
     return false;
+  detach();
+  it = value_.map_->find(actualKey);
   if (removed)
     *removed = std::move(it->second);
   value_.map_->erase(it);
@@ -1293,6 +1486,7 @@ void Value::removeMember(std::string_view key) {
 
   CZString actualKey(key.data(), unsigned(key.length()),
                      CZString::noDuplication);
+  detach();
   value_.map_->erase(actualKey);
 }
 #else
@@ -1303,6 +1497,7 @@ void Value::removeMember(const char* key) {
     return;
 
   CZString actualKey(key, unsigned(strlen(key)), CZString::noDuplication);
+  detach();
   value_.map_->erase(actualKey);
 }
 void Value::removeMember(const String& key) { removeMember(key.c_str()); }
@@ -1317,13 +1512,15 @@ bool Value::removeIndex(ArrayIndex index, Value* removed) {
   if (it == value_.map_->end()) {
     return false;
   }
+  detach();
+  it = value_.map_->find(key);
   if (removed)
     *removed = std::move(it->second);
   ArrayIndex oldSize = size();
   // shift left all items left, into the place of the "removed"
   for (ArrayIndex i = index; i < (oldSize - 1); ++i) {
     CZString keey(i);
-    (*value_.map_)[keey] = (*this)[i + 1];
+    (*value_.map_)[keey] = std::move((*value_.map_)[CZString(i + 1)]);
   }
   // erase the last one ("leftover")
   CZString keyLast(oldSize - 1);
@@ -1540,9 +1737,44 @@ void Value::setComment(String comment, CommentPlacement placement) {
   JSON_ASSERT_MESSAGE(
       comment.empty() || comment[0] == '/',
       "in Json::Value::setComment(): Comments must start with /");
+#if JSONCPP_COMPACT_VALUE
+  demandMeta().comments.set(placement, std::move(comment));
+#else
   comments_.set(placement, std::move(comment));
+#endif
+}
+
+#if JSONCPP_COMPACT_VALUE
+bool Value::hasComment(CommentPlacement placement) const {
+  Meta const* meta = findMeta();
+  return meta && meta->comments.has(placement);
+}
+
+String Value::getComment(CommentPlacement placement) const {
+  Meta const* meta = findMeta();
+  return meta ? meta->comments.get(placement) : String();
 }
 
+void Value::setOffsetStart(ptrdiff_t start) {
+  if (start != 0 || bits_.hasMeta_)
+    demandMeta().start = start;
+}
+
+void Value::setOffsetLimit(ptrdiff_t limit) {
+  if (limit != 0 || bits_.hasMeta_)
+    demandMeta().limit = limit;
+}
+
+ptrdiff_t Value::getOffsetStart() const {
+  Meta const* meta = findMeta();
+  return meta ? meta->start : 0;
+}
+
+ptrdiff_t Value::getOffsetLimit() const {
+  Meta const* meta = findMeta();
+  return meta ? meta->limit : 0;
+}
+#else
 bool Value::hasComment(CommentPlacement placement) const {
   return comments_.has(placement);
 }
@@ -1558,6 +1790,7 @@ void Value::setOffsetLimit(ptrdiff_t limit) { limit_ = limit; }
 ptrdiff_t Value::getOffsetStart() const { return start_; }
 
 ptrdiff_t Value::getOffsetLimit() const { return limit_; }
+#endif
 
 String Value::toStyledString() const {
   StreamWriterBuilder builder;
@@ -1599,6 +1832,7 @@ Value::iterator Value::begin() {
   switch (type()) {
   case arrayValue:
   case objectValue:
+    detach();
     if (value_.map_)
       return iterator(value_.map_->begin());
     break;
@@ -1612,6 +1846,7 @@ Value::iterator Value::end() {
   switch (type()) {
   case arrayValue:
   case objectValue:
+    detach();
     if (value_.map_)
       return iterator(value_.map_->end());
     break;
@@ -1757,4 +1992,116 @@ Value& Path::make(Value& root) const {
   return *node;
 }
 
+// class Query
+// //////////////////////////////////////////////////////////////////
+
+Query::Query(std::vector<String> const& paths) : nodes_(1) {
+  for (const auto& path : paths)
+    compile(path, fields_++);
+}
+
+void Query::compile(String const& path, ArrayIndex field) {
+  const char* current = path.c_str();
+  const char* end = current + path.length();
+  ArrayIndex node = 0;
+  while (current != end) {
+    if (*current == '[') {
+      ++current;
+      if (current != end && *current == '*') {
+        ++current;
+        if (!nodes_[node].anyIndex) {
+          nodes_[node].anyIndex = ArrayIndex(nodes_.size());
+          nodes_.emplace_back();
+        }
+        node = nodes_[node].anyIndex;
+      } else {
+        const char* digits = current;
+        ArrayIndex index = 0;
+        for (; current != end && *current >= '0' && *current <= '9';
+             ++current) {
+          const ArrayIndex digit = ArrayIndex(*current - '0');
+          if (index > (Value::maxUInt - digit) / 10)
+            throwLogicError("Query: index out of range in path '" + path +
+                            "'");
+          index = index * 10 + digit;
+        }
+        if (current == digits)
+          throwLogicError("Query: invalid index in path '" + path + "'");
+        node = indexChild(node, index);
+      }
+      if (current == end || *current != ']')
+        throwLogicError("Query: missing ']' in path '" + path + "'");
+      ++current;
+    } else if (*current == '.') {
+      ++current;
+      if (current == end || *current == '.')
+        throwLogicError("Query: empty member name in path '" + path + "'");
+    } else {
+      const char* beginName = current;
+      while (current != end && *current != '.' && *current != '[')
+        ++current;
+      if (current - beginName == 1 && *beginName == '*') {
+        if (!nodes_[node].anyKey) {
+          nodes_[node].anyKey = ArrayIndex(nodes_.size());
+          nodes_.emplace_back();
+        }
+        node = nodes_[node].anyKey;
+      } else {
+        node = keyChild(node, String(beginName, current));
+      }
+    }
+  }
+  nodes_[node].fields.push_back(field);
+}
+
+ArrayIndex Query::keyChild(ArrayIndex parent, String key) {
+  for (const auto& entry : nodes_[parent].keys)
+    if (entry.first == key)
+      return entry.second;
+  const auto created = ArrayIndex(nodes_.size());
+  nodes_[parent].keys.emplace_back(std::move(key), created);
+  nodes_.emplace_back();
+  return created;
+}
+
+ArrayIndex Query::indexChild(ArrayIndex parent, ArrayIndex index) {
+  for (const auto& entry : nodes_[parent].indices)
+    if (entry.first == index)
+      return entry.second;
+  const auto created = ArrayIndex(nodes_.size());
+  nodes_[parent].indices.emplace_back(index, created);
+  nodes_.emplace_back();
+  return created;
+}
+
+void Query::select(Value const& root, std::vector<Hit>& hits) const {
+  visit(0, root, hits);
+}
+
+void Query::visit(ArrayIndex node, Value const& value,
+                  std::vector<Hit>& hits) const {
+  const Node& current = nodes_[node];
+  for (ArrayIndex field : current.fields)
+    hits.push_back({field, &value});
+  if (value.isObject()) {
+    // Named members are looked up directly; only a wildcard iterates.
+    for (const auto& entry : current.keys) {
+      const String& key = entry.first;
+      if (Value const* member = value.find(key.data(), key.data() + key.size()))
+        visit(entry.second, *member, hits);
+    }
+    if (current.anyKey)
+      for (const auto& member : value)
+        visit(current.anyKey, member, hits);
+  } else if (value.isArray()) {
+    const ArrayIndex size = value.size();
+    for (const auto& entry : current.indices)
+      if (entry.first < size)
+        visit(entry.second, value[entry.first], hits);
+    if (current.anyIndex)
+      for (ArrayIndex index = 0; index < size; ++index)
+        visit(current.anyIndex, value[index], hits);
+  }
+}
+
 } // namespace Json
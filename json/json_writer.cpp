@@ -4,6 +4,7 @@
 // See file LICENSE for detail or copy at http://jsoncpp.sourceforge.net/LICENSE
 
 #if !defined(JSON_IS_AMALGAMATION)
+#include "json_simd.h"
 #include "json_tool.h"
 #include <json/writer.h>
 #endif // if !defined(JSON_IS_AMALGAMATION)
@@ -61,50 +62,388 @@ String valueToString(UInt value) { return valueToString(LargestUInt(value)); }
 #endif // # if defined(JSON_HAS_INT64)
 
 namespace {
-String valueToString(double value, bool useSpecialFloats,
-                     unsigned int precision, PrecisionType precisionType) {
+/* Shortest round-trip formatting of doubles, after Florian Loitsch,
+ * "Printing Floating-Point Numbers Quickly and Accurately with Integers"
+ * (Grisu2). The digits produced always read back to the same double and are
+ * the shortest such digits in all but about 0.1% of cases, where the
+ * shortest candidate is too close to the rounding boundary to be proven
+ * safe and a longer one, up to 17 digits, is written. Never longer than
+ * "%.17g".
+ */
+namespace grisu {
+
+struct DiyFp {
+  UInt64 f;
+  int e;
+};
+
+static DiyFp subtract(DiyFp x, DiyFp y) { return {x.f - y.f, x.e}; }
+
+// Rounded upper 64 bits of the 128-bit product, portable to 32-bit targets.
+static DiyFp multiply(DiyFp x, DiyFp y) {
+  const UInt64 xLo = x.f & 0xFFFFFFFFu, xHi = x.f >> 32;
+  const UInt64 yLo = y.f & 0xFFFFFFFFu, yHi = y.f >> 32;
+  const UInt64 p0 = xLo * yLo, p1 = xLo * yHi;
+  const UInt64 p2 = xHi * yLo, p3 = xHi * yHi;
+  UInt64 mid = (p0 >> 32) + (p1 & 0xFFFFFFFFu) + (p2 & 0xFFFFFFFFu);
+  mid += UInt64(1) << 31; // round
+  return {p3 + (p1 >> 32) + (p2 >> 32) + (mid >> 32), x.e + y.e + 64};
+}
+
+static DiyFp normalize(DiyFp x) {
+  while ((x.f >> 63) == 0) {
+    x.f <<= 1;
+    --x.e;
+  }
+  return x;
+}
+
+struct CachedPower {
+  UInt64 f;
+  int e;
+  int k;
+};
+
+// c_k = 10^k normalized to 64 bits, for k = -300, -292, ..., 324.
+static const CachedPower cachedPowers[] = {
+      {0xAB70FE17C79AC6CA, -1060, -300},
+      {0xFF77B1FCBEBCDC4F, -1034, -292},
+      {0xBE5691EF416BD60C, -1007, -284},
+      {0x8DD01FAD907FFC3C, -980, -276},
+      {0xD3515C2831559A83, -954, -268},
+      {0x9D71AC8FADA6C9B5, -927, -260},
+      {0xEA9C227723EE8BCB, -901, -252},
+      {0xAECC49914078536D, -874, -244},
+      {0x823C12795DB6CE57, -847, -236},
+      {0xC21094364DFB5637, -821, -228},
+      {0x9096EA6F3848984F, -794, -220},
+      {0xD77485CB25823AC7, -768, -212},
+      {0xA086CFCD97BF97F4, -741, -204},
+      {0xEF340A98172AACE5, -715, -196},
+      {0xB23867FB2A35B28E, -688, -188},
+      {0x84C8D4DFD2C63F3B, -661, -180},
+      {0xC5DD44271AD3CDBA, -635, -172},
+      {0x936B9FCEBB25C996, -608, -164},
+      {0xDBAC6C247D62A584, -582, -156},
+      {0xA3AB66580D5FDAF6, -555, -148},
+      {0xF3E2F893DEC3F126, -529, -140},
+      {0xB5B5ADA8AAFF80B8, -502, -132},
+      {0x87625F056C7C4A8B, -475, -124},
+      {0xC9BCFF6034C13053, -449, -116},
+      {0x964E858C91BA2655, -422, -108},
+      {0xDFF9772470297EBD, -396, -100},
+      {0xA6DFBD9FB8E5B88F, -369, -92},
+      {0xF8A95FCF88747D94, -343, -84},
+      {0xB94470938FA89BCF, -316, -76},
+      {0x8A08F0F8BF0F156B, -289, -68},
+      {0xCDB02555653131B6, -263, -60},
+      {0x993FE2C6D07B7FAC, -236, -52},
+      {0xE45C10C42A2B3B06, -210, -44},
+      {0xAA242499697392D3, -183, -36},
+      {0xFD87B5F28300CA0E, -157, -28},
+      {0xBCE5086492111AEB, -130, -20},
+      {0x8CBCCC096F5088CC, -103, -12},
+      {0xD1B71758E219652C, -77, -4},
+      {0x9C40000000000000, -50, 4},
+      {0xE8D4A51000000000, -24, 12},
+      {0xAD78EBC5AC620000, 3, 20},
+      {0x813F3978F8940984, 30, 28},
+      {0xC097CE7BC90715B3, 56, 36},
+      {0x8F7E32CE7BEA5C70, 83, 44},
+      {0xD5D238A4ABE98068, 109, 52},
+      {0x9F4F2726179A2245, 136, 60},
+      {0xED63A231D4C4FB27, 162, 68},
+      {0xB0DE65388CC8ADA8, 189, 76},
+      {0x83C7088E1AAB65DB, 216, 84},
+      {0xC45D1DF942711D9A, 242, 92},
+      {0x924D692CA61BE758, 269, 100},
+      {0xDA01EE641A708DEA, 295, 108},
+      {0xA26DA3999AEF774A, 322, 116},
+      {0xF209787BB47D6B85, 348, 124},
+      {0xB454E4A179DD1877, 375, 132},
+      {0x865B86925B9BC5C2, 402, 140},
+      {0xC83553C5C8965D3D, 428, 148},
+      {0x952AB45CFA97A0B3, 455, 156},
+      {0xDE469FBD99A05FE3, 481, 164},
+      {0xA59BC234DB398C25, 508, 172},
+      {0xF6C69A72A3989F5C, 534, 180},
+      {0xB7DCBF5354E9BECE, 561, 188},
+      {0x88FCF317F22241E2, 588, 196},
+      {0xCC20CE9BD35C78A5, 614, 204},
+      {0x98165AF37B2153DF, 641, 212},
+      {0xE2A0B5DC971F303A, 667, 220},
+      {0xA8D9D1535CE3B396, 694, 228},
+      {0xFB9B7CD9A4A7443C, 720, 236},
+      {0xBB764C4CA7A44410, 747, 244},
+      {0x8BAB8EEFB6409C1A, 774, 252},
+      {0xD01FEF10A657842C, 800, 260},
+      {0x9B10A4E5E9913129, 827, 268},
+      {0xE7109BFBA19C0C9D, 853, 276},
+      {0xAC2820D9623BF429, 880, 284},
+      {0x80444B5E7AA7CF85, 907, 292},
+      {0xBF21E44003ACDD2D, 933, 300},
+      {0x8E679C2F5E44FF8F, 960, 308},
+      {0xD433179D9C8CB841, 986, 316},
+      {0x9E19DB92B4E31BA9, 1013, 324},
+
+};
+
+// Pick c_k such that the scaled boundaries have a binary exponent in
+// [alpha, gamma], so the integral part of the product fits in 32 bits.
+static CachedPower cachedPowerForBinaryExponent(int e) {
+  const int alpha = -60;
+  const int minDecimalExponent = -300;
+  const int decimalStep = 8;
+  const int f = alpha - e - 1;
+  const int k = (f * 78913) / (1 << 18) + (f > 0);
+  const int index = (-minDecimalExponent + k + (decimalStep - 1)) / decimalStep;
+  assert(index >= 0 &&
+         static_cast<size_t>(index) <
+             sizeof(cachedPowers) / sizeof(cachedPowers[0]));
+  return cachedPowers[index];
+}
+
+static int largestPowerOf10(UInt n, UInt& powerOf10) {
+  static const UInt powers[] = {1,      10,      100,      1000,
+                                    10000,  100000,  1000000,  10000000,
+                                    100000000, 1000000000};
+  int digits = 10;
+  while (n < powers[digits - 1])
+    --digits;
+  powerOf10 = powers[digits - 1];
+  return digits;
+}
+
+static void roundWeed(char* buffer, int length, UInt64 distance,
+                      UInt64 delta, UInt64 rest, UInt64 tenKappa) {
+  // Move the last digit towards w while staying inside the rounding interval.
+  while (rest < distance && delta - rest >= tenKappa &&
+         (rest + tenKappa < distance ||
+          distance - rest > rest + tenKappa - distance)) {
+    --buffer[length - 1];
+    rest += tenKappa;
+  }
+}
+
+static void generateDigits(char* buffer, int& length, int& decimalExponent,
+                           DiyFp mMinus, DiyFp w, DiyFp mPlus) {
+  UInt64 delta = subtract(mPlus, mMinus).f;
+  UInt64 distance = subtract(mPlus, w).f;
+  const int shift = -mPlus.e;
+  const UInt64 one = UInt64(1) << shift;
+  auto p1 = static_cast<UInt>(mPlus.f >> shift);
+  UInt64 p2 = mPlus.f & (one - 1);
+
+  UInt powerOf10;
+  int n = largestPowerOf10(p1, powerOf10);
+  while (n > 0) {
+    const UInt digit = p1 / powerOf10;
+    p1 %= powerOf10;
+    buffer[length++] = static_cast<char>('0' + digit);
+    --n;
+    const UInt64 rest = (UInt64(p1) << shift) + p2;
+    if (rest <= delta) {
+      decimalExponent += n;
+      roundWeed(buffer, length, distance, delta, rest,
+                UInt64(powerOf10) << shift);
+      return;
+    }
+    powerOf10 /= 10;
+  }
+  int m = 0;
+  for (;;) {
+    p2 *= 10;
+    buffer[length++] = static_cast<char>('0' + (p2 >> shift));
+    p2 &= one - 1;
+    ++m;
+    delta *= 10;
+    distance *= 10;
+    if (p2 <= delta)
+      break;
+  }
+  decimalExponent -= m;
+  roundWeed(buffer, length, distance, delta, p2, one);
+}
+
+/** Produce digits d such that d * 10^decimalExponent reads back as value.
+ * \pre value is finite and positive. buffer holds at least 17 chars.
+ */
+static void shortestDigits(char* buffer, int& length, int& decimalExponent,
+                           double value) {
+  const UInt64 hiddenBit = UInt64(1) << 52;
+  const int exponentBias = 1023 + 52;
+  UInt64 bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  const auto biasedExponent = static_cast<int>(bits >> 52);
+  const UInt64 fraction = bits & (hiddenBit - 1);
+
+  const DiyFp v = biasedExponent == 0
+                      ? DiyFp{fraction, 1 - exponentBias}
+                      : DiyFp{fraction + hiddenBit, biasedExponent - exponentBias};
+  // The gap below v is half as wide at a power of two.
+  const bool lowerBoundaryIsCloser = fraction == 0 && biasedExponent > 1;
+  const DiyFp plus = normalize(DiyFp{2 * v.f + 1, v.e - 1});
+  DiyFp minus = lowerBoundaryIsCloser ? DiyFp{4 * v.f - 1, v.e - 2}
+                                      : DiyFp{2 * v.f - 1, v.e - 1};
+  minus.f <<= minus.e - plus.e;
+  minus.e = plus.e;
+
+  const CachedPower cached = cachedPowerForBinaryExponent(plus.e);
+  const DiyFp c{cached.f, cached.e};
+  const DiyFp w = multiply(normalize(v), c);
+  const DiyFp wMinus = multiply(minus, c);
+  const DiyFp wPlus = multiply(plus, c);
+  // Shrink the interval by one unit on both ends to stay conservative.
+  length = 0;
+  decimalExponent = -cached.k;
+  generateDigits(buffer, length, decimalExponent, DiyFp{wMinus.f + 1, wMinus.e},
+                 w, DiyFp{wPlus.f - 1, wPlus.e});
+}
+
+} // namespace grisu
+
+enum {
+  /// Enough for "%.17g" of any double, and for the output of formatShortest().
+  doubleToStringBufferSize = 32
+};
+
+/** Format a finite value like "%.17g" would, but with the shortest digits
+ * that round-trip. Returns the end of the written text.
+ */
+char* formatShortest(char* out, double value) {
+  if (std::signbit(value)) {
+    *out++ = '-';
+    value = -value;
+  }
+  if (value == 0) {
+    *out++ = '0';
+    return out;
+  }
+  char digits[20];
+  int length;
+  int decimalExponent;
+  grisu::shortestDigits(digits, length, decimalExponent, value);
+  while (length > 1 && digits[length - 1] == '0') {
+    --length;
+    ++decimalExponent;
+  }
+
+  // %g: scientific iff the exponent X of d.ddd * 10^X is < -4 or >= P.
+  const int precision = Value::defaultRealPrecision;
+  if (length >= precision) {
+    // No shorter form exists. Let printf pick the correctly rounded digits so
+    // that ties come out exactly as they always have.
+    const int len = jsoncpp_snprintf(out, doubleToStringBufferSize - 1,
+                                     "%.*g", precision, value);
+    assert(len > 0 && len < doubleToStringBufferSize - 1);
+    return fixNumericLocale(out, out + len);
+  }
+  const int exponent = length + decimalExponent - 1;
+  if (exponent < -4 || exponent >= precision) {
+    *out++ = digits[0];
+    if (length > 1) {
+      *out++ = '.';
+      std::memcpy(out, digits + 1, static_cast<size_t>(length - 1));
+      out += length - 1;
+    }
+    *out++ = 'e';
+    *out++ = exponent < 0 ? '-' : '+';
+    int magnitude = exponent < 0 ? -exponent : exponent;
+    if (magnitude >= 100) {
+      *out++ = static_cast<char>('0' + magnitude / 100);
+      magnitude %= 100;
+    }
+    *out++ = static_cast<char>('0' + magnitude / 10);
+    *out++ = static_cast<char>('0' + magnitude % 10);
+  } else if (exponent < 0) {
+    *out++ = '0';
+    *out++ = '.';
+    for (int i = exponent + 1; i < 0; ++i)
+      *out++ = '0';
+    std::memcpy(out, digits, static_cast<size_t>(length));
+    out += length;
+  } else {
+    const int integralDigits = exponent + 1;
+    if (length <= integralDigits) {
+      std::memcpy(out, digits, static_cast<size_t>(length));
+      out += length;
+      for (int i = length; i < integralDigits; ++i)
+        *out++ = '0';
+    } else {
+      std::memcpy(out, digits, static_cast<size_t>(integralDigits));
+      out += integralDigits;
+      *out++ = '.';
+      std::memcpy(out, digits + integralDigits,
+                  static_cast<size_t>(length - integralDigits));
+      out += length - integralDigits;
+    }
+  }
+  return out;
+}
+
+template <typename Output>
+void appendDouble(Output& out, double value, bool useSpecialFloats,
+                  unsigned int precision, PrecisionType precisionType) {
   // Print into the buffer. We need not request the alternative representation
   // that always has a decimal point because JSON doesn't distinguish the
   // concepts of reals and integers.
   if (!std::isfinite(value)) {
+    const char* text;
     if (std::isnan(value))
-      return useSpecialFloats ? "NaN" : "null";
-    if (value < 0)
-      return useSpecialFloats ? "-Infinity" : "-1e+9999";
-    return useSpecialFloats ? "Infinity" : "1e+9999";
+      text = useSpecialFloats ? "NaN" : "null";
+    else if (value < 0)
+      text = useSpecialFloats ? "-Infinity" : "-1e+9999";
+    else
+      text = useSpecialFloats ? "Infinity" : "1e+9999";
+    out.append(text, strlen(text));
+    return;
   }
 
-  String buffer(size_t(36), '\0');
-  while (true) {
-    int len = jsoncpp_snprintf(
-        &*buffer.begin(), buffer.size(),
-        (precisionType == PrecisionType::significantDigits) ? "%.*g" : "%.*f",
-        precision, value);
+  char buffer[doubleToStringBufferSize + 2];
+  String heapBuffer;
+  char* begin = buffer;
+  char* end;
+  if (precisionType == PrecisionType::significantDigits &&
+      precision == Value::defaultRealPrecision) {
+    // 17 significant digits only exist to guarantee a round-trip; the
+    // shortest digits that do so are always at least as good.
+    end = formatShortest(buffer, value);
+  } else {
+    const char* format =
+        (precisionType == PrecisionType::significantDigits) ? "%.*g" : "%.*f";
+    int len = jsoncpp_snprintf(buffer, doubleToStringBufferSize, format,
+                               precision, value);
     assert(len >= 0);
     auto wouldPrint = static_cast<size_t>(len);
-    if (wouldPrint >= buffer.size()) {
-      buffer.resize(wouldPrint + 1);
-      continue;
+    if (wouldPrint >= doubleToStringBufferSize) {
+      // Huge fixed-point values or precisions; leave room for ".0".
+      heapBuffer.resize(wouldPrint + 3);
+      begin = &*heapBuffer.begin();
+      jsoncpp_snprintf(begin, wouldPrint + 1, format, precision, value);
     }
-    buffer.resize(wouldPrint);
-    break;
+    end = fixNumericLocale(begin, begin + wouldPrint);
   }
 
-  buffer.erase(fixNumericLocale(buffer.begin(), buffer.end()), buffer.end());
-
   // try to ensure we preserve the fact that this was given to us as a double on
   // input
-  if (buffer.find('.') == buffer.npos && buffer.find('e') == buffer.npos) {
-    buffer += ".0";
+  if (std::find(begin, end, '.') == end && std::find(begin, end, 'e') == end) {
+    *end++ = '.';
+    *end++ = '0';
   }
 
   // strip the zero padding from the right
   if (precisionType == PrecisionType::decimalPlaces) {
-    buffer.erase(fixZerosInTheEnd(buffer.begin(), buffer.end(), precision),
-                 buffer.end());
+    end = fixZerosInTheEnd(begin, end, precision);
   }
 
-  return buffer;
+  out.append(begin, static_cast<size_t>(end - begin));
+}
+
+String valueToString(double value, bool useSpecialFloats,
+                     unsigned int precision, PrecisionType precisionType) {
+  String result;
+  appendDouble(result, value, useSpecialFloats, precision, precisionType);
+  return result;
 }
 } // namespace
 
@@ -115,14 +454,6 @@ String valueToString(double value, unsigned int precision,
 
 String valueToString(bool value) { return value ? "true" : "false"; }
 
-static bool doesAnyCharRequireEscaping(char const* s, size_t n) {
-  assert(s || !n);
-
-  return std::any_of(s, s + n, [](unsigned char c) {
-    return c == '\\' || c == '"' || c < 0x20 || c > 0x7F;
-  });
-}
-
 static unsigned int utf8ToCodepoint(const char*& s, const char* e) {
   const unsigned int REPLACEMENT_CHARACTER = 0xFFFD;
 
@@ -191,62 +522,56 @@ static const char hex2[] = "000102030405060708090a0b0c0d0e0f"
                            "e0e1e2e3e4e5e6e7e8e9eaebecedeeef"
                            "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
 
-static String toHex16Bit(unsigned int x) {
-  const unsigned int hi = (x >> 8) & 0xff;
-  const unsigned int lo = x & 0xff;
-  String result(4, ' ');
-  result[0] = hex2[2 * hi];
-  result[1] = hex2[2 * hi + 1];
-  result[2] = hex2[2 * lo];
-  result[3] = hex2[2 * lo + 1];
-  return result;
-}
-
-static void appendRaw(String& result, unsigned ch) {
-  result += static_cast<char>(ch);
+template <typename Output> static void appendRaw(Output& result, unsigned ch) {
+  result.push_back(static_cast<char>(ch));
 }
 
-static void appendHex(String& result, unsigned ch) {
-  result.append("\\u").append(toHex16Bit(ch));
+template <typename Output> static void appendHex(Output& result, unsigned ch) {
+  const unsigned int hi = (ch >> 8) & 0xff;
+  const unsigned int lo = ch & 0xff;
+  const char escape[6] = {'\\',          'u',
+                          hex2[2 * hi], hex2[2 * hi + 1],
+                          hex2[2 * lo], hex2[2 * lo + 1]};
+  result.append(escape, sizeof(escape));
 }
 
-static String valueToQuotedStringN(const char* value, size_t length,
-                                   bool emitUTF8 = false) {
-  if (value == nullptr)
-    return "";
-
-  if (!doesAnyCharRequireEscaping(value, length))
-    return String("\"") + value + "\"";
-  // We have to walk value and escape any special characters.
-  // Appending to String is not efficient, but this should be rare.
-  // (Note: forward slashes are *not* rare, but I am not escaping them.)
-  String::size_type maxsize = length * 2 + 3; // allescaped+quotes+NULL
-  String result;
-  result.reserve(maxsize); // to avoid lots of mallocs
-  result += "\"";
+/** Append the quoted and escaped form of [value, value + length).
+ * Clean runs are found a vector at a time and copied in bulk; only the bytes
+ * that need escaping go through the switch below.
+ * (Note: forward slashes are *not* rare, but I am not escaping them.)
+ */
+template <typename Output>
+static void appendQuotedString(Output& result, const char* value,
+                               size_t length, bool emitUTF8) {
   char const* end = value + length;
-  for (const char* c = value; c != end; ++c) {
+  const char* run = simd::findEscape(value, end, emitUTF8);
+  result.push_back('"');
+  for (const char* c = value;;) {
+    result.append(c, static_cast<size_t>(run - c));
+    c = run;
+    if (c == end)
+      break;
     switch (*c) {
     case '\"':
-      result += "\\\"";
+      result.append("\\\"", 2);
       break;
     case '\\':
-      result += "\\\\";
+      result.append("\\\\", 2);
       break;
     case '\b':
-      result += "\\b";
+      result.append("\\b", 2);
       break;
     case '\f':
-      result += "\\f";
+      result.append("\\f", 2);
       break;
     case '\n':
-      result += "\\n";
+      result.append("\\n", 2);
       break;
     case '\r':
-      result += "\\r";
+      result.append("\\r", 2);
       break;
     case '\t':
-      result += "\\t";
+      result.append("\\t", 2);
       break;
     // case '/':
     // Even though \/ is considered a legal escape in JSON, a bare
@@ -282,8 +607,18 @@ static String valueToQuotedStringN(const char* value, size_t length,
       }
     } break;
     }
+    run = simd::findEscape(++c, end, emitUTF8);
   }
-  result += "\"";
+  result.push_back('"');
+}
+
+static String valueToQuotedStringN(const char* value, size_t length,
+                                   bool emitUTF8 = false) {
+  if (value == nullptr)
+    return "";
+  String result;
+  result.reserve(length + 2);
+  appendQuotedString(result, value, length, emitUTF8);
   return result;
 }
 
@@ -1184,6 +1519,221 @@ void StreamWriterBuilder::setDefaults(Json::Value* settings) {
   //! [StreamWriterBuilderDefaults]
 }
 
+///////////////
+// BufferWriter
+
+BufferWriter::BufferWriter()
+    : data_(nullptr), capacity_(0), size_(0), growable_(true), depth_(0),
+      indented_(false), emitUTF8_(false), useSpecialFloats_(false),
+      precision_(Value::defaultRealPrecision),
+      precisionType_(PrecisionType::significantDigits) {}
+
+BufferWriter::BufferWriter(char* buffer, size_t capacity)
+    : data_(buffer), capacity_(capacity), size_(0), growable_(false),
+      depth_(0), indented_(false), emitUTF8_(false), useSpecialFloats_(false),
+      precision_(Value::defaultRealPrecision),
+      precisionType_(PrecisionType::significantDigits) {}
+
+void BufferWriter::setIndentation(String indentation) {
+  indentation_ = std::move(indentation);
+}
+void BufferWriter::setEmitUTF8(bool emitUTF8) { emitUTF8_ = emitUTF8; }
+void BufferWriter::setUseSpecialFloats(bool useSpecialFloats) {
+  useSpecialFloats_ = useSpecialFloats;
+}
+void BufferWriter::setPrecision(unsigned int precision,
+                                PrecisionType precisionType) {
+  precision_ = precision > 17 ? 17 : precision;
+  precisionType_ = precisionType;
+}
+
+bool BufferWriter::write(Value const& root) {
+  clear();
+  depth_ = 0;
+  indented_ = true;
+  writeValue(root);
+  return !overflowed();
+}
+
+void BufferWriter::clear() { size_ = 0; }
+
+void BufferWriter::reserve(size_t capacity) {
+  size_t grown = capacity_ < 256 ? 256 : capacity_ * 2;
+  if (grown < capacity)
+    grown = capacity;
+  storage_.resize(grown);
+  data_ = &*storage_.begin();
+  capacity_ = grown;
+}
+
+void BufferWriter::append(char const* data, size_t length) {
+  if (size_ + length > capacity_) {
+    if (growable_) {
+      reserve(size_ + length);
+    } else {
+      // Keep counting so the caller learns how much room it needs.
+      if (size_ < capacity_)
+        memcpy(data_ + size_, data, capacity_ - size_);
+      size_ += length;
+      return;
+    }
+  }
+  if (length != 0)
+    memcpy(data_ + size_, data, length);
+  size_ += length;
+}
+
+void BufferWriter::push_back(char c) {
+  if (size_ < capacity_)
+    data_[size_++] = c;
+  else
+    append(&c, 1);
+}
+
+String BufferWriter::str() const {
+  return String(data_, overflowed() ? capacity_ : size_);
+}
+
+void BufferWriter::writeIndent() {
+  if (indentation_.empty())
+    return;
+  push_back('\n');
+  for (unsigned int level = 0; level < depth_; ++level)
+    append(indentation_.data(), indentation_.size());
+}
+
+void BufferWriter::writeWithIndent(char const* text, size_t length) {
+  if (!indented_)
+    writeIndent();
+  append(text, length);
+  indented_ = false;
+}
+
+void BufferWriter::writeValue(Value const& value) {
+  switch (value.type()) {
+  case nullValue:
+    append("null", 4);
+    break;
+  case intValue: {
+    UIntToStringBuffer buffer;
+    char* current = buffer + sizeof(buffer);
+    const LargestInt number = value.asLargestInt();
+    if (number == Value::minLargestInt) {
+      uintToString(LargestUInt(Value::maxLargestInt) + 1, current);
+      *--current = '-';
+    } else if (number < 0) {
+      uintToString(LargestUInt(-number), current);
+      *--current = '-';
+    } else {
+      uintToString(LargestUInt(number), current);
+    }
+    append(current, strlen(current));
+  } break;
+  case uintValue: {
+    UIntToStringBuffer buffer;
+    char* current = buffer + sizeof(buffer);
+    uintToString(value.asLargestUInt(), current);
+    append(current, strlen(current));
+  } break;
+  case realValue:
+    appendDouble(*this, value.asDouble(), useSpecialFloats_, precision_,
+                 precisionType_);
+    break;
+  case stringValue: {
+    char const* str;
+    char const* end;
+    if (value.getString(&str, &end))
+      appendQuotedString(*this, str, static_cast<size_t>(end - str),
+                         emitUTF8_);
+    break;
+  }
+  case booleanValue:
+    if (value.asBool())
+      append("true", 4);
+    else
+      append("false", 5);
+    break;
+  case arrayValue:
+    writeArrayValue(value);
+    break;
+  case objectValue: {
+    if (value.empty()) {
+      append("{}", 2);
+      break;
+    }
+    const bool compact = indentation_.empty();
+    writeWithIndent("{", 1);
+    ++depth_;
+    // Map order is member-name order, the same as getMemberNames().
+    const auto begin = value.begin(), end = value.end();
+    for (auto it = begin; it != end; ++it) {
+      if (it != begin)
+        push_back(',');
+      char const* nameEnd;
+      char const* name = it.memberName(&nameEnd);
+      if (!indented_)
+        writeIndent();
+      appendQuotedString(*this, name, static_cast<size_t>(nameEnd - name),
+                         emitUTF8_);
+      indented_ = false;
+      if (compact)
+        push_back(':');
+      else
+        append(" : ", 3);
+      writeValue(*it);
+    }
+    --depth_;
+    writeWithIndent("}", 1);
+  } break;
+  }
+}
+
+void BufferWriter::writeArrayValue(Value const& value) {
+  // Mirrors BuiltStyledStreamWriter: short arrays of scalars go on one line.
+  const unsigned int rightMargin = 74;
+  const ArrayIndex size = value.size();
+  if (size == 0) {
+    append("[]", 2);
+    return;
+  }
+  const auto begin = value.begin(), end = value.end();
+  bool isMultiLine = size * 3 >= rightMargin;
+  for (auto it = begin; it != end && !isMultiLine; ++it) {
+    isMultiLine = ((it->isArray() || it->isObject()) && !it->empty()) ||
+                  it->hasComment(commentBefore) ||
+                  it->hasComment(commentAfterOnSameLine) ||
+                  it->hasComment(commentAfter);
+  }
+  if (!isMultiLine) {
+    const bool compact = indentation_.empty();
+    const size_t start = size_;
+    append(compact ? "[" : "[ ", compact ? 1 : 2);
+    for (auto it = begin; it != end; ++it) {
+      if (it != begin)
+        append(compact ? "," : ", ", compact ? 1 : 2);
+      writeValue(*it);
+    }
+    append(compact ? "]" : " ]", compact ? 1 : 2);
+    // Compact output looks the same either way.
+    if (compact || size_ - start < rightMargin)
+      return;
+    size_ = start;
+  }
+  writeWithIndent("[", 1);
+  ++depth_;
+  for (auto it = begin; it != end; ++it) {
+    if (it != begin)
+      push_back(',');
+    if (!indented_)
+      writeIndent();
+    indented_ = true;
+    writeValue(*it);
+    indented_ = false;
+  }
+  --depth_;
+  writeWithIndent("]", 1);
+}
+
 String writeString(StreamWriter::Factory const& factory, Value const& root) {
   OStringStream sout;
   StreamWriterPtr const writer(factory.newStreamWriter());
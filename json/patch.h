@@ -0,0 +1,66 @@
+// Copyright 2007-2010 Baptiste Lepilleur and The JsonCpp Authors
+// Distributed under MIT license, or public domain if desired and
+// recognized in your jurisdiction.
+// See file LICENSE for detail or copy at http://jsoncpp.sourceforge.net/LICENSE
+
+#ifndef JSON_PATCH_H_INCLUDED
+#define JSON_PATCH_H_INCLUDED
+
+#if !defined(JSON_IS_AMALGAMATION)
+#include "value.h"
+#endif // if !defined(JSON_IS_AMALGAMATION)
+
+// Disable warning C4251: <data member>: <type> needs to have dll-interface to
+// be used by...
+#if defined(JSONCPP_DISABLE_DLL_INTERFACE_WARNING) && defined(_MSC_VER)
+#pragma warning(push)
+#pragma warning(disable : 4251)
+#endif // if defined(JSONCPP_DISABLE_DLL_INTERFACE_WARNING)
+
+#pragma pack(push)
+#pragma pack()
+
+namespace Json {
+
+/** \brief Compute an RFC 6902 JSON Patch that turns \p from into \p to.
+ *
+ * The result is an array of operations, empty when the values are equal:
+ *   \code
+ *   [{"op": "replace", "path": "/payload/song", "value": "Intro"},
+ *    {"op": "move", "from": "/payload/queue/7", "path": "/payload/queue/0"}]
+ *   \endcode
+ *
+ * Objects are compared member by member and only the differences are
+ * reported. Array elements are matched by content: the longest run of
+ * matched elements that kept their order stays put, other matched elements
+ * are moved, and an unmatched element that takes the place of another is
+ * diffed against it rather than removed and added again. A reordered or
+ * edited queue therefore costs a handful of operations. Matching takes
+ * O(n log n) in the length of the array, plus O(n) to place each moved or
+ * added element.
+ *
+ * Never emits "copy" or "test".
+ */
+Value JSON_API diff(Value const& from, Value const& to);
+
+/** \brief Apply an RFC 6902 JSON Patch to \p target, in place.
+ *
+ * Supports all six operations; paths are RFC 6901 JSON Pointers.
+ * \return false and set \p errs (if not null) if the patch is malformed or
+ *         an operation fails, e.g. a "test" mismatch or a missing member.
+ *         Operations before the failing one remain applied; for
+ *         all-or-nothing, patch a copy and swap it in on success (cheap
+ *         with JSONCPP_SHARED_VALUE, where only the touched containers
+ *         get duplicated).
+ */
+bool JSON_API applyPatch(Value& target, Value const& patch, String* errs);
+
+} // namespace Json
+
+#pragma pack(pop)
+
+#if defined(JSONCPP_DISABLE_DLL_INTERFACE_WARNING)
+#pragma warning(pop)
+#endif // if defined(JSONCPP_DISABLE_DLL_INTERFACE_WARNING)
+
+#endif // JSON_PATCH_H_INCLUDED
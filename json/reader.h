@@ -11,6 +11,7 @@
 #include "value.h"
 #endif // if !defined(JSON_IS_AMALGAMATION)
 #include <deque>
+#include <initializer_list>
 #include <iosfwd>
 #include <istream>
 #include <stack>
@@ -31,6 +32,10 @@ namespace Json {
 /** \brief Unserialize a <a HREF="http://www.json.org">JSON</a> document into a
  * Value.
  *
+ * With JSONCPP_COMPACT_VALUE it records no offsets: the parsed values report
+ * 0 from Value::getOffsetStart(), and pushError() points at the start of the
+ * document. CharReader has the "storeOffsets" setting for that.
+ *
  * \deprecated Use CharReader and CharReaderBuilder.
  */
 
@@ -299,6 +304,33 @@ private:
   std::unique_ptr<Impl> _impl;
 }; // CharReader
 
+/** \brief A fixed vocabulary of object keys shared between parses.
+ *
+ * A reader that is given a pool looks up each object key by its raw bytes.
+ * A key found there is stored in the Value as a static string (see
+ * StaticString), so neither decoding nor storing it allocates. Values point
+ * into the pool, which must therefore outlive every Value parsed with it.
+ * Readers only look keys up, so once filled a pool may be shared by readers
+ * on several threads.
+ */
+class JSON_API KeyPool {
+public:
+  KeyPool() = default;
+  KeyPool(std::initializer_list<char const*> keys);
+
+  /// Keys that JSON would need to escape are not pooled; returns false.
+  bool add(String const& key);
+  /// The pooled, zero-terminated copy of [begin, end), or nullptr.
+  char const* find(char const* begin, char const* end) const;
+  size_t size() const { return keys_.size(); }
+
+private:
+  void rehash(size_t capacity);
+
+  std::deque<String> keys_; // a deque never moves its elements
+  std::vector<unsigned> slots_; // index into keys_ plus one, 0 when empty
+};
+
 /** \brief Build a CharReader implementation.
  *
  * Usage:
@@ -352,6 +384,12 @@ public:
    * - `"skipBom": false or true`
    *   - If true, if the input starts with the Unicode byte order mark (BOM),
    *     it is skipped.
+   * - `"storeOffsets": false or true`
+   *   - If true, each value records the [start, limit) byte range it was
+   *     parsed from (see Value::getOffsetStart()). Turn it off when nobody
+   *     asks. With JSONCPP_COMPACT_VALUE the offsets cost a side-table entry
+   *     per value, taken under a process-wide lock, so there it defaults to
+   *     false.
    *
    * You can examine 'settings_` yourself to see the defaults. You can also
    * write and read them just like any JSON Value.
@@ -364,6 +402,11 @@ public:
 
   CharReader* newCharReader() const override;
 
+  /** Readers created from now on intern object keys found in \p pool.
+   * Pass nullptr to stop. The pool must outlive the values they parse.
+   */
+  void setKeyPool(KeyPool const* pool) { keyPool_ = pool; }
+
   /** \return true if 'settings' are legal and consistent;
    *   otherwise, indicate bad settings via 'invalid'.
    */
@@ -391,6 +434,208 @@ public:
    * \snippet src/lib_json/json_reader.cpp CharReaderBuilderECMA404Mode
    */
   static void ecma404Mode(Json::Value* settings);
+
+private:
+  KeyPool const* keyPool_ = nullptr;
+};
+
+/** \brief Receives the events produced by a PushParser.
+ *
+ * Strings and keys arrive decoded, as [begin, end) ranges that are only valid
+ * for the duration of the call. When a string lies entirely in one chunk and
+ * has no escapes, the range points straight into the caller's input.
+ *
+ * Every callback returns \c true to continue. Returning \c false stops the
+ * parser; if errorMessage() is then non-empty the stop is reported as a parse
+ * error at the current location, otherwise as PushParser::stopped.
+ */
+class JSON_API ParseHandler {
+public:
+  virtual ~ParseHandler();
+
+  virtual bool null();
+  virtual bool boolean(bool value);
+  virtual bool integer(LargestInt value);
+  virtual bool uinteger(LargestUInt value);
+  virtual bool real(double value);
+  virtual bool string(char const* begin, char const* end);
+  virtual bool startObject();
+  virtual bool key(char const* begin, char const* end);
+  virtual bool endObject();
+  virtual bool startArray();
+  virtual bool endArray();
+
+  virtual String errorMessage() const;
+};
+
+/** \brief A ParseHandler that builds a Value, like CharReader does.
+ */
+class JSON_API ValueHandler : public ParseHandler {
+public:
+  explicit ValueHandler(Value& root, bool rejectDupKeys = false);
+  /// Start over with a new root, e.g. for the next document on a connection.
+  void reset(Value& root);
+  /// Intern keys found in \p pool, as CharReaderBuilder::setKeyPool() does.
+  void setKeyPool(KeyPool const* pool) { keyPool_ = pool; }
+
+  bool null() override;
+  bool boolean(bool value) override;
+  bool integer(LargestInt value) override;
+  bool uinteger(LargestUInt value) override;
+  bool real(double value) override;
+  bool string(char const* begin, char const* end) override;
+  bool startObject() override;
+  bool key(char const* begin, char const* end) override;
+  bool endObject() override;
+  bool startArray() override;
+  bool endArray() override;
+  String errorMessage() const override;
+
+private:
+  Value& target();
+
+  Value* root_;
+  Value* member_;
+  std::vector<Value*> stack_;
+  String error_;
+  KeyPool const* keyPool_ = nullptr;
+  bool rejectDupKeys_;
+};
+
+/** \brief A ParseHandler that extracts the fields of a Query while parsing.
+ *
+ * Only the matched values are built, each as its own Value; the rest of the
+ * document streams past without allocating. Feed it with a PushParser:
+ *   \code
+ *   static const Json::Query query({"heos.message", "payload[*].pid"});
+ *   Json::QueryHandler handler(query);
+ *   Json::PushParser parser(handler);
+ *   // feed...
+ *   for (auto const& capture : handler.captures())
+ *     use(capture.field, capture.value);
+ *   \endcode
+ * Captures come in document order. The Query must outlive the handler.
+ */
+class JSON_API QueryHandler : public ParseHandler {
+public:
+  struct Capture {
+    ArrayIndex field; ///< Index of the matching path.
+    Value value;
+  };
+
+  explicit QueryHandler(Query const& query);
+  /// Drop the captures and start over, e.g. for the next document.
+  void reset();
+  std::deque<Capture> const& captures() const { return captures_; }
+
+  bool null() override;
+  bool boolean(bool value) override;
+  bool integer(LargestInt value) override;
+  bool uinteger(LargestUInt value) override;
+  bool real(double value) override;
+  bool string(char const* begin, char const* end) override;
+  bool startObject() override;
+  bool key(char const* begin, char const* end) override;
+  bool endObject() override;
+  bool startArray() override;
+  bool endArray() override;
+
+private:
+  // Trie nodes of the container are active_[begin, end); those of its
+  // current member or element follow.
+  struct Frame {
+    size_t begin;
+    size_t end;
+    ArrayIndex index;
+    bool isArray;
+  };
+  // Builds a captured object or array until its depth drops back to 0.
+  struct Builder {
+    unsigned depth;
+    ValueHandler handler;
+  };
+
+  bool next();
+  void store(Value const& value);
+  bool open(bool isArray);
+  bool close(bool isArray);
+
+  Query const* query_;
+  std::vector<ArrayIndex> active_;
+  std::vector<Frame> stack_;
+  std::vector<Builder> builders_;
+  std::deque<Capture> captures_;
+  size_t slot_ = 0;
+  size_t skip_ = 0;
+};
+
+/** \brief Incremental JSON parser that accepts input in arbitrary chunks.
+ *
+ * Bytes are pushed as they arrive (e.g. straight from recv()); the parser
+ * keeps its state between calls and reports events to a ParseHandler. Only a
+ * token that straddles two chunks is buffered, so no reassembly copy of the
+ * document is made.
+ *
+ * Usage:
+ *   \code
+ *   Json::Value root;
+ *   Json::ValueHandler handler(root);
+ *   Json::PushParser parser(handler);
+ *   Json::PushParser::Status status = Json::PushParser::needMoreInput;
+ *   while (status == Json::PushParser::needMoreInput) {
+ *     int n = recv(sock, buffer, sizeof(buffer), 0);
+ *     status = n > 0 ? parser.feed(buffer, size_t(n)) : parser.finish();
+ *   }
+ *   \endcode
+ *
+ * Once the root value closes, feed() returns \c complete and consumed() tells
+ * how many bytes of that chunk belonged to the document; the rest can be fed
+ * to the next document after reset(). With "failIfExtra", trailing bytes
+ * other than whitespace (and comments, if allowed) are an error instead.
+ * feed() then still returns \c complete as soon as the root value closes,
+ * but only finish() can tell that nothing but whitespace and whole comments
+ * followed it: under "failIfExtra", keep feeding until the end of input even
+ * after \c complete, then call finish() and go by what it returns.
+ *
+ * Honors these CharReaderBuilder settings: allowComments,
+ * allowTrailingCommas, strictRoot, stackLimit, failIfExtra and skipBom.
+ * rejectDupKeys belongs to the handler (see ValueHandler). Comments are
+ * skipped, never collected, and values carry no offsets.
+ */
+class JSON_API PushParser {
+public:
+  enum Status {
+    needMoreInput, ///< The document is not closed yet.
+    complete,      ///< The root value was read.
+    stopped,       ///< A handler callback returned false.
+    error          ///< Malformed input; see getFormattedErrorMessages().
+  };
+
+  /// Uses CharReaderBuilder's default settings.
+  explicit PushParser(ParseHandler& handler);
+  /// \param settings As in CharReaderBuilder::settings_.
+  PushParser(ParseHandler& handler, Value const& settings);
+  ~PushParser();
+
+  PushParser(PushParser const&) = delete;
+  PushParser& operator=(PushParser const&) = delete;
+
+  /// Parse the next \c length bytes of the document.
+  Status feed(char const* data, size_t length);
+  /// Signal end of input; completes a top-level number, or reports a
+  /// truncated document.
+  Status finish();
+  /// Forget the current document and start expecting a new one.
+  void reset();
+
+  Status status() const;
+  /// Number of bytes of the last feed() that were used.
+  size_t consumed() const;
+  String getFormattedErrorMessages() const;
+
+private:
+  class Impl;
+  std::unique_ptr<Impl> impl_;
 };
 
 /** Consume entire stream and use its begin/end.
@@ -268,7 +268,13 @@ private:
 #ifndef JSONCPP_DOC_EXCLUDE_IMPLEMENTATION
   class CZString {
   public:
-    enum DuplicationPolicy { noDuplication = 0, duplicate, duplicateOnCopy };
+    // inlined is never passed in; copies of short keys end up with it.
+    enum DuplicationPolicy {
+      noDuplication = 0,
+      duplicate,
+      duplicateOnCopy,
+      inlined
+    };
     CZString(ArrayIndex index);
     CZString(char const* str, unsigned length, DuplicationPolicy allocate);
     CZString(CZString const& other);
@@ -293,7 +299,10 @@ private:
       unsigned length_ : 30; // 1GB max
     };
 
-    char const* cstr_; // actually, a prefixed string, unless policy is noDup
+    union {
+      char const* cstr_; // actually, a prefixed string, unless policy is noDup
+      char inline_[sizeof(char const*)]; // zero-terminated, if policy inlined
+    };
     union {
       ArrayIndex index_;
       StringStorage storage_;
@@ -693,8 +702,18 @@ private:
   void setIsAllocated(bool v) { bits_.allocated_ = v; }
 
   void initBasic(ValueType type, bool allocated = false);
+  void initString(char const* str, unsigned length);
+  char const* stringPayload(unsigned* length) const;
   void dupPayload(const Value& other);
   void releasePayload();
+#if JSONCPP_SHARED_VALUE
+  // Array and object storage, with a count of the values sharing it.
+  struct SharedValues;
+  // Make this value the sole owner of its elements before writing to them.
+  void detach();
+#else
+  void detach() {}
+#endif
   void dupMeta(const Value& other);
 
   Value& resolveReference(const char* key);
@@ -716,6 +735,7 @@ private:
     bool bool_;
     char* string_; // if allocated_, ptr to { unsigned, char[] }.
     ObjectValues* map_;
+    char inline_[sizeof(LargestUInt)]; // if inlined_, zero-terminated.
   } value_;
 
   struct {
@@ -723,6 +743,14 @@ private:
     unsigned int value_type_ : 8;
     // Unless allocated_, string_ must be null-terminated.
     unsigned int allocated_ : 1;
+    // Short strings are stored in value_.inline_ instead of on the heap.
+    unsigned int inlined_ : 1;
+    unsigned int inlineLength_ : 3;
+#if JSONCPP_COMPACT_VALUE
+    // This node has an entry in the side table. Belongs to the node, not to
+    // the payload: swapPayload() leaves it alone.
+    unsigned int hasMeta_ : 1;
+#endif
   } bits_;
 
   class Comments {
@@ -740,12 +768,22 @@ private:
     using Array = std::array<String, numberOfCommentPlacement>;
     std::unique_ptr<Array> ptr_;
   };
+
+#if JSONCPP_COMPACT_VALUE
+  // Comments and offsets live in a table keyed by node address.
+  struct Meta;
+  Meta* findMeta() const;
+  Meta& demandMeta();
+  void releaseMeta();
+  void swapMeta(Value& other);
+#else
   Comments comments_;
 
   // [start, limit) byte offsets in the source JSON text from which this Value
   // was extracted.
   ptrdiff_t start_;
   ptrdiff_t limit_;
+#endif
 };
 
 template <> inline bool Value::as<bool>() const { return asBool(); }
@@ -834,6 +872,68 @@ private:
   Args args_;
 };
 
+/** \brief A set of paths compiled once and resolved together.
+ *
+ * Path resolves one path to one node per call. Query merges all its paths
+ * into a trie, so a single walk extracts every field, shared prefixes (e.g.
+ * "heos.command" and "heos.message") are looked up once, and a wildcard
+ * visits every member or element:
+ *   \code
+ *   Json::Query query({"heos.message", "payload[*].pid", "payload[*].name"});
+ *   std::vector<Json::Query::Hit> hits;
+ *   query.select(root, hits);
+ *   for (auto const& hit : hits)
+ *     use(hit.field, *hit.value); // field is the index of the path
+ *   \endcode
+ *
+ * Syntax is that of Path, without the '%' arguments, plus:
+ * - ".*" => every member of an object
+ * - "[*]" => every element of an array
+ * The leading '.' is optional.
+ *
+ * To extract the same fields while parsing, without building the document,
+ * see QueryHandler in reader.h.
+ * \throw LogicError on a malformed path.
+ */
+class JSON_API Query {
+public:
+  struct Hit {
+    ArrayIndex field; ///< Index of the matching path.
+    Value const* value;
+  };
+
+  Query(std::vector<String> const& paths);
+
+  /// Number of paths.
+  ArrayIndex size() const { return fields_; }
+
+  /** Append a Hit for every node of \p root matched by one of the paths.
+   * Hits of one node come in path order; \p hits is not cleared, so one
+   * vector can be reused across documents without reallocating.
+   */
+  void select(Value const& root, std::vector<Hit>& hits) const;
+
+  /// Node reached by a path: the trie is a vector of these, the root first.
+  struct Node {
+    std::vector<std::pair<String, ArrayIndex>> keys;
+    std::vector<std::pair<ArrayIndex, ArrayIndex>> indices;
+    ArrayIndex anyKey = 0;   ///< Child for ".*", or 0 for none.
+    ArrayIndex anyIndex = 0; ///< Child for "[*]", or 0 for none.
+    std::vector<ArrayIndex> fields; ///< Paths that end here.
+  };
+  Node const& node(ArrayIndex index) const { return nodes_[index]; }
+
+private:
+  void compile(String const& path, ArrayIndex field);
+  ArrayIndex keyChild(ArrayIndex parent, String key);
+  ArrayIndex indexChild(ArrayIndex parent, ArrayIndex index);
+  void visit(ArrayIndex node, Value const& value,
+             std::vector<Hit>& hits) const;
+
+  std::vector<Node> nodes_;
+  ArrayIndex fields_ = 0;
+};
+
 /** \brief base class for Value iterators.
  *
  */
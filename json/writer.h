@@ -145,6 +145,84 @@ public:
   static void setDefaults(Json::Value* settings);
 };
 
+/** \brief Serialize a Value into a byte buffer, without iostreams.
+ *
+ * The output is the same as StreamWriterBuilder produces with
+ * "commentStyle" set to "None" and the same indentation, emitUTF8,
+ * useSpecialFloats and precision settings. By default it is compact.
+ *
+ * The writer either owns a growable buffer that is reused by every write(),
+ * so it stops allocating once it has seen the largest document, or writes
+ * into a fixed span supplied by the caller. Nothing is allocated per node.
+ *
+ * Usage:
+ *   \code
+ *   Json::BufferWriter writer;            // growable, keep it around
+ *   writer.write(state);
+ *   send(sock, writer.data(), int(writer.size()), 0);
+ *
+ *   char span[512];
+ *   Json::BufferWriter fixed(span, sizeof(span));
+ *   if (!fixed.write(state))
+ *     ; // fixed.size() bytes would have been needed
+ *   \endcode
+ */
+class JSON_API BufferWriter {
+public:
+  /// Write into an internal buffer that grows as needed.
+  BufferWriter();
+  /// Write into [buffer, buffer + capacity); never grows.
+  BufferWriter(char* buffer, size_t capacity);
+
+  BufferWriter(BufferWriter const&) = delete;
+  BufferWriter& operator=(BufferWriter const&) = delete;
+
+  /// Like StreamWriterBuilder's "indentation"; empty (the default) is
+  /// compact output without newlines.
+  void setIndentation(String indentation);
+  void setEmitUTF8(bool emitUTF8);
+  void setUseSpecialFloats(bool useSpecialFloats);
+  void setPrecision(unsigned int precision,
+                    PrecisionType precisionType = significantDigits);
+
+  /** Replace the buffer contents with the serialization of \c root.
+   * \return false if a fixed span was too small. The span then holds a
+   * truncated prefix and size() is the number of bytes that were needed.
+   */
+  bool write(Value const& root);
+
+  /// Discard the contents; keeps the allocated capacity.
+  void clear();
+  /// Append raw bytes, e.g. to frame the document.
+  void append(char const* data, size_t length);
+  void push_back(char c);
+
+  char const* data() const { return data_; }
+  size_t size() const { return size_; }
+  bool overflowed() const { return size_ > capacity_; }
+  String str() const;
+
+private:
+  void reserve(size_t capacity);
+  void writeValue(Value const& value);
+  void writeArrayValue(Value const& value);
+  void writeIndent();
+  void writeWithIndent(char const* text, size_t length);
+
+  String storage_;
+  char* data_;
+  size_t capacity_;
+  size_t size_;
+  bool growable_;
+  String indentation_;
+  unsigned int depth_;
+  bool indented_;
+  bool emitUTF8_;
+  bool useSpecialFloats_;
+  unsigned int precision_;
+  PrecisionType precisionType_;
+};
+
 /** \brief Abstract class for writers.
  * \deprecated Use StreamWriter. (And really, this is an implementation detail.)
  */
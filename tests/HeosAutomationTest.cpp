@@ -0,0 +1,195 @@
+// Screen-share automation on synthetic window titles: the matcher against a
+// plain substring search, and the rules' on and off delays step by step on
+// a clock the test sets.
+
+#include "HeosAutomation.h"
+#include "HeosTest.h"
+
+#include <random>
+#include <utility>
+
+namespace {
+
+typedef HeosAutomation::Clock Clock;
+
+std::string Fold(std::string text)
+{
+	for (auto& c : text) {
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+	}
+	return text;
+}
+
+std::string RandomText(std::mt19937& random, size_t length, const std::string& alphabet)
+{
+	std::string text;
+	for (size_t i = 0; i < length; ++i)
+		text += alphabet[random() % alphabet.size()];
+	return text;
+}
+
+// What the rules did, in order.
+struct Log {
+	std::vector<std::pair<std::string, bool>> actions;
+
+	HeosAutomation::Action Recorder()
+	{
+		return [this](const HeosAutomationRule& rule, bool active) { actions.push_back({ rule.name, active }); };
+	}
+};
+
+} // namespace
+
+TEST(MatcherAgreesWithFind)
+{
+	// Small alphabets, so patterns overlap and share prefixes and suffixes;
+	// bytes above 0x7f pass through unfolded
+	const std::string alphabet = "abAB\xc3";
+	std::mt19937 random(HeosTestSeed());
+	for (int round = 0; round < 2000 * HeosTestScale(); ++round) {
+		std::vector<std::string> patterns;
+		for (int n = 1 + random() % 8; n > 0; --n)
+			patterns.push_back(RandomText(random, random() % 4, alphabet));
+		HeosTitleMatcher matcher(patterns);
+		std::string title = RandomText(random, random() % 30, alphabet + "c");
+
+		std::vector<int> found(patterns.size(), 0);
+		matcher.Scan(title, [&](size_t pattern) { ++found[pattern]; });
+		for (size_t i = 0; i < patterns.size(); ++i) {
+			int expected = !patterns[i].empty() && Fold(title).find(Fold(patterns[i])) != std::string::npos;
+			if (found[i] != expected) {
+				FAIL("'" + patterns[i] + "' in '" + title + "' found " + std::to_string(found[i]) + " times");
+				return;
+			}
+		}
+	}
+}
+
+TEST(SlackRuleFollowsTitles)
+{
+	Log log;
+	HeosAutomation automation(HeosDefaultAutomationRules(), log.Recorder());
+	Clock::time_point t0;
+	auto at = [&](int ms) { return t0 + std::chrono::milliseconds(ms); };
+
+	automation.TitleChanged(1, "Inbox - Outlook", at(0));
+	CHECK(log.actions.empty());
+	CHECK(automation.NextDue() == Clock::time_point::max());
+
+	// Both words, in any case: on at once, as onDelayMs is 0
+	automation.TitleChanged(2, "slack | screen sharing", at(0));
+	CHECK_EQUAL(1u, log.actions.size());
+	CHECK(automation.IsActive(0));
+
+	// Sharing stops, and flaps back within the off delay: nothing happens
+	automation.TitleChanged(2, "Slack | general", at(100));
+	CHECK(automation.NextDue() == at(2100));
+	automation.TitleChanged(2, "Slack | Screen Sharing - general", at(1000));
+	CHECK(automation.NextDue() == Clock::time_point::max());
+	automation.Update(at(5000));
+	CHECK_EQUAL(1u, log.actions.size());
+
+	// The window closes: off once the delay is over, not before
+	automation.WindowClosed(2, at(6000));
+	automation.Update(at(7999));
+	CHECK_EQUAL(1u, log.actions.size());
+	automation.Update(at(8000));
+	CHECK_EQUAL(2u, log.actions.size());
+	if (log.actions.size() == 2) {
+		CHECK_EQUAL("Slack screen sharing", log.actions[1].first);
+		CHECK(!log.actions[1].second);
+	}
+	CHECK(!automation.IsActive(0));
+}
+
+TEST(OnDelayAndSeveralWindows)
+{
+	Log log;
+	HeosAutomationRule zoom;
+	zoom.name = "zoom";
+	zoom.match = { "zoom meeting" };
+	zoom.action = "duck";
+	zoom.onDelayMs = 500;
+	zoom.offDelayMs = 1000;
+	HeosAutomation automation({ zoom }, log.Recorder());
+	Clock::time_point t0;
+	auto at = [&](int ms) { return t0 + std::chrono::milliseconds(ms); };
+
+	// A title that matches for less than the on delay does nothing
+	automation.TitleChanged(3, "Zoom Meeting", at(0));
+	CHECK(automation.NextDue() == at(500));
+	automation.Update(at(300));
+	automation.TitleChanged(3, "Zoom", at(400));
+	automation.Update(at(1000));
+	CHECK(log.actions.empty());
+
+	// Two matching windows: the rule stays on until both are gone
+	automation.TitleChanged(3, "Zoom Meeting", at(2000));
+	automation.TitleChanged(4, "zoom meeting 2", at(2100));
+	automation.Update(at(2500));
+	CHECK_EQUAL(1u, log.actions.size());
+	CHECK_EQUAL(2, automation.MatchingWindows(0));
+	automation.WindowClosed(3, at(3000));
+	automation.Update(at(10000));
+	CHECK_EQUAL(1u, log.actions.size());
+	CHECK_EQUAL(1, automation.MatchingWindows(0));
+	automation.WindowClosed(4, at(11000));
+	automation.Update(at(11999));
+	CHECK_EQUAL(1u, log.actions.size());
+	automation.Update(at(12000));
+	CHECK_EQUAL(2u, log.actions.size());
+	CHECK_EQUAL(0, automation.MatchingWindows(0));
+
+	// Closing a window it never saw is harmless
+	automation.WindowClosed(99, at(13000));
+	CHECK_EQUAL(2u, log.actions.size());
+}
+
+TEST(ManyRulesStayConsistent)
+{
+	// Random titles over a few windows, checked against counting the
+	// matching windows by hand; with no delays, a rule is active exactly
+	// while one of them matches
+	std::mt19937 random(HeosTestSeed());
+	std::vector<HeosAutomationRule> rules;
+	for (int i = 0; i < 20; ++i) {
+		HeosAutomationRule rule;
+		rule.name = "r" + std::to_string(i);
+		rule.match = { "app" + std::to_string(i), i % 2 ? "sharing" : "call" };
+		rule.offDelayMs = 0;
+		rules.push_back(rule);
+	}
+	int changes = 0;
+	HeosAutomation automation(rules, [&](const HeosAutomationRule&, bool) { ++changes; });
+	std::vector<std::string> titles(8);
+	Clock::time_point t0;
+	for (int step = 0; step < 5000 * HeosTestScale(); ++step) {
+		size_t window = random() % titles.size();
+		std::string title = RandomText(random, random() % 20, "xyz -");
+		if (random() % 3 == 0)
+			title += " App" + std::to_string(random() % 25) + (random() % 2 ? " Sharing" : " call");
+		if (random() % 10 == 0) {
+			titles[window].clear();
+			automation.WindowClosed(window, t0 + std::chrono::milliseconds(step));
+		}
+		else {
+			titles[window] = title;
+			automation.TitleChanged(window, title, t0 + std::chrono::milliseconds(step));
+		}
+		automation.Update(t0 + std::chrono::milliseconds(step));
+
+		for (size_t r = 0; r < rules.size(); ++r) {
+			int windows = 0;
+			for (const auto& open : titles) {
+				std::string folded = Fold(open);
+				windows += folded.find(rules[r].match[0]) != std::string::npos && folded.find(rules[r].match[1]) != std::string::npos;
+			}
+			if (automation.MatchingWindows(r) != windows || automation.IsActive(r) != (windows > 0)) {
+				FAIL("rule " + rules[r].name + " at step " + std::to_string(step));
+				return;
+			}
+		}
+	}
+	CHECK(changes > 0);
+}
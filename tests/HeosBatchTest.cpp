@@ -0,0 +1,244 @@
+// Batch scripts: what each line turns into, the mistakes that are refused,
+// and a run against a stand-in device that keeps a volume level and sends
+// change events.
+
+#include "HeosBatch.h"
+#include "HeosStandIn.h"
+#include "HeosTest.h"
+
+#include <cstdlib>
+#include <sstream>
+
+namespace {
+
+bool Parse(const std::string& script, std::vector<HeosBatchStep>& steps, std::string& errs)
+{
+	std::istringstream in(script);
+	steps.clear();
+	errs.clear();
+	return HeosParseBatch(in, "-42", steps, &errs);
+}
+
+// "30" for level in "pid=1&level=30".
+std::string Param(const std::string& query, const std::string& key)
+{
+	std::string text = "&" + query + "&";
+	size_t at = text.find("&" + key + "=");
+	if (at == std::string::npos)
+		return "";
+	at += key.size() + 2;
+	return text.substr(at, text.find('&', at) - at);
+}
+
+// A player with a volume level, which fails play_input for unknown inputs
+// and play_next without spaces in its JSON, and once registered, follows a
+// volume change with its event.
+class Player {
+public:
+	Player() : device([this](const std::string& command) { return Reply(command); }) {}
+
+	int Port() const { return device.Port(); }
+	int Level()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return level;
+	}
+	std::vector<std::string> Commands()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return commands;
+	}
+
+private:
+	std::string Reply(const std::string& line)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		commands.push_back(line);
+		size_t query = line.find('?');
+		std::string command = line.substr(0, query);
+		std::string message = query == std::string::npos ? "" : line.substr(query + 1);
+		std::string result = "success";
+		std::string event;
+		if (command == "system/register_for_change_events") {
+			events = true;
+		}
+		else if (command == "player/set_volume") {
+			level = atoi(Param(message, "level").c_str());
+			event = "player_volume_changed";
+		}
+		else if (command == "player/volume_up" || command == "player/volume_down") {
+			int step = atoi(Param(message, "step").c_str());
+			level += command == "player/volume_up" ? step : -step;
+			event = "player_volume_changed";
+		}
+		else if (command == "player/get_volume") {
+			message += "&level=" + std::to_string(level);
+		}
+		else if (command == "player/play_input" && Param(message, "input") != "inputs/optical_in_1") {
+			result = "fail";
+			message = "eid=9&text=Parameter out of range";
+		}
+		else if (command == "player/play_next") {
+			return "{\"heos\":{\"command\":\"" + command + "\",\"result\":\"fail\",\"message\":\"eid=2&text=Nothing queued\"}}\r\n";
+		}
+		std::string lines = HeosStandInReply(command, result, message);
+		if (events && !event.empty())
+			lines += "{\"heos\": {\"command\": \"event/" + event + "\", \"message\": \"pid=-42&level=" + std::to_string(level) + "&mute=off\"}}\r\n";
+		return lines;
+	}
+
+	std::mutex mutex;
+	std::vector<std::string> commands;
+	bool events = false;
+	int level = 20;
+	HeosStandIn device; // last, so it stops before the rest goes
+};
+
+} // namespace
+
+TEST(StepsBecomeCommands)
+{
+	std::vector<HeosBatchStep> steps;
+	std::string errs;
+	CHECK(Parse(
+		"# comment\n"
+		"mute on\r\n"
+		"  mute toggle\n"
+		"\n"
+		"volume 30\n"
+		"volume +15\n"
+		"volume -3\n"
+		"input optical_in_1\n"
+		"send player/get_volume?pid={pid}&x={pid}\n"
+		"wait event player_volume_changed 500\n"
+		"wait event player_now_playing_changed\n"
+		"sleep 50\n", steps, errs));
+	CHECK_EQUAL("", errs);
+	CHECK_EQUAL(10u, steps.size());
+	if (steps.size() != 10)
+		return;
+	CHECK_EQUAL(2, steps[0].line);
+	CHECK_EQUAL("mute on", steps[0].text);
+	CHECK_EQUAL("player/set_mute?pid=-42&state=on", steps[0].commands.at(0));
+	CHECK_EQUAL("mute toggle", steps[1].text);
+	CHECK_EQUAL("player/toggle_mute?pid=-42", steps[1].commands.at(0));
+	CHECK_EQUAL(5, steps[2].line);
+	CHECK_EQUAL("player/set_volume?pid=-42&level=30", steps[2].commands.at(0));
+	// The device steps at most 10 at a time
+	CHECK_EQUAL(2u, steps[3].commands.size());
+	CHECK_EQUAL("player/volume_up?pid=-42&step=10", steps[3].commands.at(0));
+	CHECK_EQUAL("player/volume_up?pid=-42&step=5", steps[3].commands.at(1));
+	CHECK_EQUAL("player/volume_down?pid=-42&step=3", steps[4].commands.at(0));
+	CHECK_EQUAL("player/play_input?pid=-42&input=inputs/optical_in_1", steps[5].commands.at(0));
+	CHECK_EQUAL("player/get_volume?pid=-42&x=-42", steps[6].commands.at(0));
+	CHECK(steps[7].commands.empty());
+	CHECK_EQUAL("player_volume_changed", steps[7].event);
+	CHECK_EQUAL(500, steps[7].waitMs);
+	CHECK_EQUAL(5000, steps[8].waitMs);
+	CHECK(steps[9].commands.empty() && steps[9].event.empty());
+	CHECK_EQUAL(50, steps[9].waitMs);
+}
+
+TEST(MistakesAreRefused)
+{
+	for (const char* bad : {
+		"mute maybe",
+		"mute",
+		"volume 101",
+		"volume +101",
+		"volume +x",
+		"volume 5 6",
+		"input Bad-Name",
+		"input",
+		"send",
+		"wait for x",
+		"wait event",
+		"wait event x soon",
+		"sleep",
+		"sleep -5",
+		"frobnicate" }) {
+		std::vector<HeosBatchStep> steps;
+		std::string errs;
+		if (Parse(std::string("mute on\n") + bad + "\n", steps, errs))
+			FAIL(std::string("parsed ") + bad);
+		else if (errs.compare(0, 8, "line 2: ") != 0)
+			FAIL(std::string("no line number for ") + bad + ": " + errs);
+	}
+}
+
+TEST(RunsAgainstStandIn)
+{
+	Player player;
+	std::vector<HeosBatchStep> steps;
+	std::string errs;
+	CHECK(Parse(
+		"mute on\n"
+		"volume 30\n"
+		"volume +15\n"
+		"volume -3\n"
+		"input optical_in_1\n"
+		"input bogus\n"
+		"send player/get_volume?pid={pid}\n"
+		"send player/play_next?pid={pid}\n"
+		"wait event player_volume_changed 2000\n"
+		"sleep 20\n"
+		"volume 10\n"
+		"wait event player_volume_changed\n"
+		"wait event player_now_playing_changed 100\n", steps, errs));
+
+	HeosConnection connection(player.Port(), 2000);
+	std::ostringstream log;
+	HeosBatchResult result = HeosRunBatch(connection, "127.0.0.1", steps, log);
+	// input bogus, play_next, and the event that never comes
+	CHECK_EQUAL(steps.size(), result.steps);
+	CHECK_EQUAL(3u, result.failed);
+	CHECK_EQUAL(10, player.Level());
+	CHECK_EQUAL(1u, connection.Connects());
+	CHECK(log.str().find("Parameter out of range") != std::string::npos);
+	CHECK(log.str().find("timeout") != std::string::npos);
+	CHECK(log.str().find("Nothing queued") != std::string::npos);
+	CHECK(log.str().find("13 steps, 3 failed") != std::string::npos);
+
+	// Registered first, then the commands in script order
+	std::vector<std::string> commands = player.Commands();
+	CHECK(!commands.empty() && commands[0] == "system/register_for_change_events?enable=on");
+	CHECK_EQUAL(11u, commands.size());
+	if (commands.size() == 11)
+		CHECK_EQUAL("player/volume_up?pid=-42&step=5", commands[4]);
+}
+
+TEST(PipelinedBurst)
+{
+	Player player;
+	std::string script;
+	for (int i = 0; i < 200; ++i)
+		script += "volume " + std::to_string(i % 100) + "\n";
+	std::vector<HeosBatchStep> steps;
+	std::string errs;
+	CHECK(Parse(script, steps, errs));
+
+	HeosConnection connection(player.Port(), 2000);
+	std::ostringstream log;
+	HeosBatchResult result = HeosRunBatch(connection, "127.0.0.1", steps, log);
+	CHECK_EQUAL(0u, result.failed);
+	CHECK_EQUAL(99, player.Level());
+	CHECK_EQUAL(200u, player.Commands().size());
+	CHECK_EQUAL(200u, connection.Commands());
+}
+
+TEST(DeviceGoneFailsEveryStep)
+{
+	int port;
+	{
+		Player gone;
+		port = gone.Port();
+	}
+	std::vector<HeosBatchStep> steps;
+	std::string errs;
+	CHECK(Parse("mute on\nvolume 30\n", steps, errs));
+	HeosConnection connection(port, 500);
+	std::ostringstream log;
+	HeosBatchResult result = HeosRunBatch(connection, "127.0.0.1", steps, log);
+	CHECK_EQUAL(2u, result.failed);
+	CHECK(log.str().find("noreply") != std::string::npos);
+}
@@ -0,0 +1,62 @@
+// Decoding the shipped icons and scaling them to the sizes the tray and the
+// toolbar ask for, as HeosGetIcon does on first use of each size. Not part
+// of ctest; run it by hand after touching HeosIcons.cpp:
+//   ./HeosIconsBench [seconds per case]
+
+#include "HeosIcons.h"
+#include "json/json_bench.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace {
+
+using JsonBench::measure;
+
+std::vector<unsigned char> ReadIco(const char* name)
+{
+	std::ifstream in(std::string(HEOS_SOURCE_DIR "/") + name, std::ios::binary);
+	return std::vector<unsigned char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+void Run(const char* name, double seconds)
+{
+	std::vector<unsigned char> data = ReadIco(name);
+	HeosImage image;
+	if (!HeosDecodeIco(data.data(), data.size(), 16, image)) {
+		printf("%s: cannot decode\n", name);
+		return;
+	}
+	printf("%s: %zu bytes, %dx%d\n", name, data.size(), image.width, image.height);
+
+	measure("decode", seconds, [&] {
+		HeosImage decoded;
+		HeosDecodeIco(data.data(), data.size(), 16, decoded);
+		return data.size();
+	});
+	for (int size : { 16, 24, 32 }) {
+		std::string title = "fit to " + std::to_string(size);
+		measure(title.c_str(), seconds, [&] {
+			return HeosFitImage(image, size).pixels.size() * sizeof(uint32_t);
+		});
+	}
+	measure("decode and fit to 16", seconds, [&] {
+		HeosImage decoded;
+		HeosDecodeIco(data.data(), data.size(), 16, decoded);
+		return HeosFitImage(decoded, 16).pixels.size() * sizeof(uint32_t);
+	});
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	double seconds = JsonBench::seconds(argc, argv);
+	for (const char* name : { "tray.ico", "tray_muted.ico", "HEOS.ico", "play.ico", "pause.ico",
+			"mute.ico", "voldown.ico", "volup.ico", "optical.ico" })
+		Run(name, seconds);
+	return 0;
+}
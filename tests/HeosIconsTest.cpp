@@ -0,0 +1,437 @@
+// The shipped icons, decoded and scaled as the tray and toolbar use them; and
+// PNG decoding through the inflater, with streams written here to hit block
+// sequences that the shipped icons happen not to: stored blocks after
+// Huffman blocks, empty stored blocks as a sync flush leaves them, and (with
+// zlib at hand) what zlib itself makes of flat and noisy image bands.
+
+#include "HeosIcons.h"
+#include "HeosTest.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+
+#ifdef HEOS_TEST_ZLIB
+#include <zlib.h>
+#endif
+
+namespace {
+
+typedef std::vector<unsigned char> Bytes;
+
+// DEFLATE bits go out least significant first; Huffman codes most
+// significant first.
+class BitWriter {
+public:
+	Bytes bytes;
+
+	void Bits(uint32_t value, int count)
+	{
+		for (int i = 0; i < count; ++i) {
+			if (used == 0)
+				bytes.push_back(0);
+			bytes.back() |= (unsigned char)(((value >> i) & 1) << used);
+			used = (used + 1) & 7;
+		}
+	}
+
+	void Code(uint32_t code, int length)
+	{
+		for (int i = length - 1; i >= 0; --i)
+			Bits((code >> i) & 1, 1);
+	}
+
+	void Align() { used = 0; }
+
+private:
+	int used = 0; // bits of bytes.back() taken
+};
+
+void FixedSymbol(BitWriter& out, int symbol)
+{
+	if (symbol < 144)
+		out.Code(0x30 + symbol, 8);
+	else if (symbol < 256)
+		out.Code(0x190 + symbol - 144, 9);
+	else if (symbol < 280)
+		out.Code(symbol - 256, 7);
+	else
+		out.Code(0xc0 + symbol - 280, 8);
+}
+
+// Literals only, so the end code lands on whatever bit the data puts it.
+void FixedBlock(BitWriter& out, const unsigned char* data, size_t size, bool last)
+{
+	out.Bits(last, 1);
+	out.Bits(1, 2);
+	for (size_t i = 0; i < size; ++i)
+		FixedSymbol(out, data[i]);
+	FixedSymbol(out, 256);
+}
+
+// A length of 0 is what Z_SYNC_FLUSH emits.
+void StoredBlock(BitWriter& out, const unsigned char* data, size_t size, bool last)
+{
+	out.Bits(last, 1);
+	out.Bits(0, 2);
+	out.Align();
+	out.Bits((uint32_t)size, 16);
+	out.Bits(~(uint32_t)size & 0xffff, 16);
+	out.bytes.insert(out.bytes.end(), data, data + size);
+}
+
+uint32_t Adler32(const Bytes& data)
+{
+	uint32_t a = 1, b = 0;
+	for (unsigned char c : data) {
+		a = (a + c) % 65521;
+		b = (b + a) % 65521;
+	}
+	return b << 16 | a;
+}
+
+Bytes ZlibFrame(const Bytes& deflated, const Bytes& raw)
+{
+	Bytes out = { 0x78, 0x01 };
+	out.insert(out.end(), deflated.begin(), deflated.end());
+	uint32_t adler = Adler32(raw);
+	for (int shift = 24; shift >= 0; shift -= 8)
+		out.push_back((unsigned char)(adler >> shift));
+	return out;
+}
+
+uint32_t Crc32(const unsigned char* data, size_t size, uint32_t crc = 0)
+{
+	crc = ~crc;
+	for (size_t i = 0; i < size; ++i) {
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; ++bit)
+			crc = (crc >> 1) ^ (0xedb88320u & (0 - (crc & 1)));
+	}
+	return ~crc;
+}
+
+void BigEndian(Bytes& out, uint32_t value)
+{
+	for (int shift = 24; shift >= 0; shift -= 8)
+		out.push_back((unsigned char)(value >> shift));
+}
+
+void Chunk(Bytes& png, const char* type, const Bytes& data)
+{
+	BigEndian(png, (uint32_t)data.size());
+	size_t start = png.size();
+	png.insert(png.end(), type, type + 4);
+	png.insert(png.end(), data.begin(), data.end());
+	BigEndian(png, Crc32(&png[start], png.size() - start));
+}
+
+// An 8-bit RGBA PNG of the zlib stream, split over IDAT chunks at splits.
+Bytes Png(int width, int height, const Bytes& zlib, std::vector<size_t> splits = {})
+{
+	static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	Bytes png(signature, signature + 8);
+	Bytes header;
+	BigEndian(header, (uint32_t)width);
+	BigEndian(header, (uint32_t)height);
+	header.insert(header.end(), { 8, 6, 0, 0, 0 });
+	Chunk(png, "IHDR", header);
+	splits.push_back(zlib.size());
+	size_t from = 0;
+	for (size_t to : splits) {
+		Chunk(png, "IDAT", Bytes(zlib.begin() + from, zlib.begin() + to));
+		from = to;
+	}
+	Chunk(png, "IEND", Bytes());
+	return png;
+}
+
+// Rows of RGBA pixels behind filter byte 0, in eight bands: flat ones that
+// compress to almost nothing and noisy ones that do not compress at all.
+Bytes Banded(std::mt19937& random, int width, int height)
+{
+	Bytes raw;
+	int band = std::max(1, height / 8);
+	for (int y = 0; y < height; ++y) {
+		raw.push_back(0);
+		bool noisy = (y / band) % 2 == 1;
+		for (int x = 0; x < width * 4; ++x)
+			raw.push_back(noisy ? (unsigned char)random() : (unsigned char)(y * 16 + x % 4));
+	}
+	return raw;
+}
+
+// The pixels raw should decode to.
+std::vector<uint32_t> Pixels(const Bytes& raw, int width, int height)
+{
+	std::vector<uint32_t> pixels;
+	for (int y = 0; y < height; ++y) {
+		const unsigned char* row = &raw[(size_t)y * (width * 4 + 1) + 1];
+		for (int x = 0; x < width; ++x) {
+			const unsigned char* p = row + x * 4;
+			pixels.push_back((uint32_t)p[3] << 24 | p[0] << 16 | p[1] << 8 | p[2]);
+		}
+	}
+	return pixels;
+}
+
+bool Decodes(const Bytes& png, const Bytes& raw, int width, int height)
+{
+	HeosImage image;
+	return HeosDecodePng(png.data(), png.size(), image) && image.width == width && image.height == height
+		&& image.pixels == Pixels(raw, width, height);
+}
+
+} // namespace
+
+TEST(StoredBlockAfterHuffmanBlock)
+{
+	// Every split of the data into fixed, stored, empty stored (a sync
+	// flush) and fixed blocks, so the stored headers start at every bit
+	// offset with the bit buffer holding 0 to 3 bytes read ahead.
+	std::mt19937 random(HeosTestSeed());
+	const int width = 4, height = 4;
+	Bytes raw = Banded(random, width, height);
+	for (size_t first = 0; first <= raw.size(); ++first) {
+		for (size_t second = first; second <= raw.size(); second += 1 + random() % 7) {
+			BitWriter out;
+			FixedBlock(out, raw.data(), first, false);
+			StoredBlock(out, raw.data() + first, second - first, false);
+			StoredBlock(out, nullptr, 0, false);
+			FixedBlock(out, raw.data() + second, raw.size() - second, false);
+			StoredBlock(out, nullptr, 0, true);
+			Bytes zlib = ZlibFrame(out.bytes, raw);
+			if (!Decodes(Png(width, height, zlib, { zlib.size() / 2 }), raw, width, height)) {
+				FAIL("blocks split at " + std::to_string(first) + " and " + std::to_string(second));
+				return;
+			}
+		}
+	}
+}
+
+TEST(StoredBlocksBackToBack)
+{
+	std::mt19937 random(HeosTestSeed());
+	const int width = 8, height = 8;
+	Bytes raw = Banded(random, width, height);
+	BitWriter out;
+	size_t at = 0;
+	while (at < raw.size()) {
+		size_t length = std::min<size_t>(1 + random() % 50, raw.size() - at);
+		if (random() % 2)
+			StoredBlock(out, raw.data() + at, length, false);
+		else
+			FixedBlock(out, raw.data() + at, length, false);
+		at += length;
+	}
+	StoredBlock(out, nullptr, 0, true);
+	CHECK(Decodes(Png(width, height, ZlibFrame(out.bytes, raw)), raw, width, height));
+}
+
+TEST(TruncatedStreamsFail)
+{
+	std::mt19937 random(HeosTestSeed());
+	const int width = 4, height = 4;
+	Bytes raw = Banded(random, width, height);
+	BitWriter out;
+	FixedBlock(out, raw.data(), 20, false);
+	StoredBlock(out, raw.data() + 20, raw.size() - 20, true);
+	Bytes zlib = ZlibFrame(out.bytes, raw);
+	for (size_t length = 0; length + 4 < zlib.size(); ++length) {
+		HeosImage image;
+		Bytes png = Png(width, height, Bytes(zlib.begin(), zlib.begin() + length));
+		if (HeosDecodePng(png.data(), png.size(), image))
+			FAIL("decoded a stream cut at " + std::to_string(length));
+	}
+}
+
+#ifdef HEOS_TEST_ZLIB
+TEST(ZlibBandsWithSyncFlush)
+{
+	// Noisy bands of 16 rows of 128 RGBA pixels are 8 KB of incompressible
+	// literals; zlib at level 6 stores those blocks, between Huffman coded
+	// ones for the flat bands.
+	std::mt19937 random(HeosTestSeed());
+	const int width = 128, height = 128;
+	Bytes raw = Banded(random, width, height);
+	for (int flushes = 0; flushes <= 5; ++flushes) {
+		z_stream stream = {};
+		CHECK_EQUAL(Z_OK, deflateInit(&stream, 6));
+		Bytes zlib(deflateBound(&stream, (uLong)raw.size()) + 64 * flushes);
+		stream.next_out = zlib.data();
+		stream.avail_out = (uInt)zlib.size();
+		std::vector<size_t> splits;
+		size_t from = 0;
+		for (int part = 0; part <= flushes; ++part) {
+			size_t to = part == flushes ? raw.size() : raw.size() * (part + 1) / (flushes + 1) + random() % 100;
+			stream.next_in = raw.data() + from;
+			stream.avail_in = (uInt)(to - from);
+			int result = deflate(&stream, part == flushes ? Z_FINISH : part % 2 ? Z_FULL_FLUSH : Z_SYNC_FLUSH);
+			CHECK_EQUAL(part == flushes ? Z_STREAM_END : Z_OK, result);
+			splits.push_back(stream.total_out); // an IDAT per flushed part
+			from = to;
+		}
+		splits.pop_back();
+		zlib.resize(stream.total_out);
+		deflateEnd(&stream);
+		if (!Decodes(Png(width, height, zlib, splits), raw, width, height))
+			FAIL("zlib stream with " + std::to_string(flushes) + " flushes");
+	}
+}
+#endif
+
+TEST(ScalingKeepsFlatColor)
+{
+	HeosImage image;
+	image.width = 37;
+	image.height = 21;
+	image.pixels.assign(37 * 21, 0xff336699u);
+	for (int size : { 1, 16, 20, 48, 64 }) {
+		HeosImage scaled = HeosScaleImage(image, size, size);
+		CHECK_EQUAL(size, scaled.width);
+		CHECK_EQUAL((size_t)size * size, scaled.pixels.size());
+		for (uint32_t pixel : scaled.pixels) {
+			if (pixel != 0xff336699u) {
+				FAIL("scaled to " + std::to_string(size) + " gives " + std::to_string(pixel));
+				break;
+			}
+		}
+		HeosImage fitted = HeosFitImage(image, size);
+		CHECK_EQUAL(size, fitted.width);
+		CHECK(fitted.height <= size && fitted.height >= 1);
+	}
+}
+
+namespace {
+
+// The .ico files HEOS.rc builds in, next to the sources.
+Bytes ReadIco(const char* name)
+{
+	std::ifstream in(std::string(HEOS_SOURCE_DIR "/") + name, std::ios::binary);
+	return Bytes(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+struct AlphaCounts {
+	size_t transparent = 0;
+	size_t partial = 0;
+	size_t opaque = 0;
+};
+
+AlphaCounts CountAlpha(const HeosImage& image)
+{
+	AlphaCounts counts;
+	for (uint32_t pixel : image.pixels) {
+		uint32_t alpha = pixel >> 24;
+		if (alpha == 0)
+			++counts.transparent;
+		else if (alpha == 255)
+			++counts.opaque;
+		else
+			++counts.partial;
+	}
+	return counts;
+}
+
+uint32_t Alpha(const HeosImage& image, int x, int y)
+{
+	return image.pixels[(size_t)y * image.width + x] >> 24;
+}
+
+} // namespace
+
+TEST(ShippedIconsDecode)
+{
+	struct Icon {
+		const char* name;
+		int size;
+		bool shaped; // alpha with transparent corners, else opaque throughout
+	};
+	static const Icon shipped[] = {
+		{ "HEOS.ico", 190, true },      // 32-bit BMP
+		{ "tray.ico", 190, true },      // PNG
+		{ "tray_muted.ico", 32, true }, // PNG
+		{ "play.ico", 64, false },      // 24-bit BMP and an empty AND mask
+		{ "pause.ico", 64, false },
+		{ "mute.ico", 64, false },
+		{ "voldown.ico", 64, false },
+		{ "volup.ico", 64, false },
+		{ "optical.ico", 64, false },
+	};
+	for (const Icon& icon : shipped) {
+		Bytes data = ReadIco(icon.name);
+		if (data.empty()) {
+			FAIL(std::string("cannot read ") + icon.name);
+			continue;
+		}
+		// One entry each, so every wanted size picks it
+		for (int wanted : { 16, 32, 256 }) {
+			HeosImage image;
+			if (!HeosDecodeIco(data.data(), data.size(), wanted, image)) {
+				FAIL(std::string("cannot decode ") + icon.name);
+				break;
+			}
+			CHECK_EQUAL(icon.size, image.width);
+			CHECK_EQUAL(icon.size, image.height);
+			CHECK_EQUAL((size_t)icon.size * icon.size, image.pixels.size());
+
+			AlphaCounts counts = CountAlpha(image);
+			if (icon.shaped) {
+				// Transparent corners, an opaque middle, soft edges between
+				CHECK(counts.transparent > 0);
+				CHECK(counts.partial > 0);
+				CHECK(counts.opaque > counts.transparent + counts.partial);
+				CHECK_EQUAL(0u, Alpha(image, 0, 0));
+				CHECK_EQUAL(0u, Alpha(image, icon.size - 1, icon.size - 1));
+				CHECK_EQUAL(255u, Alpha(image, icon.size / 2, icon.size / 2));
+			}
+			else {
+				CHECK_EQUAL((size_t)icon.size * icon.size, counts.opaque);
+			}
+		}
+
+		// At the sizes the tray and toolbar ask for, square and still shaped
+		HeosImage image;
+		HeosDecodeIco(data.data(), data.size(), 16, image);
+		for (int size : { 16, 20, 24, 32, 48 }) {
+			HeosImage fitted = HeosFitImage(image, size);
+			CHECK_EQUAL(size, fitted.width);
+			CHECK_EQUAL(size, fitted.height);
+			// Averaging pulls the soft edge into the corner pixels
+			if (icon.shaped)
+				CHECK(Alpha(fitted, 0, 0) < 128);
+			else
+				CHECK_EQUAL(255u, Alpha(fitted, 0, 0));
+			CHECK_EQUAL(255u, Alpha(fitted, size / 2, size / 2));
+		}
+	}
+
+	// The app icon and the tray icon are the same artwork, once as a 32-bit
+	// BMP and once as a PNG: their alpha must agree pixel for pixel
+	HeosImage bmp, png;
+	Bytes app = ReadIco("HEOS.ico");
+	Bytes tray = ReadIco("tray.ico");
+	CHECK(HeosDecodeIco(app.data(), app.size(), 190, bmp));
+	CHECK(HeosDecodeIco(tray.data(), tray.size(), 190, png));
+	size_t differ = 0;
+	for (size_t i = 0; i < bmp.pixels.size() && i < png.pixels.size(); ++i)
+		differ += (bmp.pixels[i] >> 24) != (png.pixels[i] >> 24);
+	CHECK_EQUAL(0u, differ);
+}
+
+TEST(FittingKeepsTheAspectRatio)
+{
+	// A wide entry must not be stretched to a square
+	HeosImage wide;
+	wide.width = 64;
+	wide.height = 32;
+	wide.pixels.assign(64 * 32, 0xff000000u);
+	HeosImage fitted = HeosFitImage(wide, 16);
+	CHECK_EQUAL(16, fitted.width);
+	CHECK_EQUAL(8, fitted.height);
+	HeosImage tall = HeosFitImage(HeosImage{ 10, 40, std::vector<uint32_t>(400, 0xffffffffu) }, 20);
+	CHECK_EQUAL(5, tall.width);
+	CHECK_EQUAL(20, tall.height);
+}
@@ -0,0 +1,390 @@
+// Now playing against a stand-in device that changes track and play state
+// and drops its connections, and the art cache against a stand-in image host
+// (the API server, answering with PNGs) and a counted in-process fetch.
+
+#include "HeosArtCache.h"
+#include "HeosNowPlaying.h"
+#include "HeosServer.h"
+#include "HeosStandIn.h"
+#include "HeosTest.h"
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Polls until done() or 3 seconds passed; returns done().
+template <class Done>
+bool WaitFor(Done done)
+{
+	auto until = Clock::now() + std::chrono::seconds(3);
+	while (!done() && Clock::now() < until)
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	return done();
+}
+
+// Player 7, playing track after track.
+class Player {
+public:
+	Player() : device([this](const std::string& command) { return Reply(command); }) {}
+
+	void Play(int next)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		track = next;
+	}
+
+	void SetPlayState(const std::string& next)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		playState = next;
+	}
+
+	int Count(const std::string& command)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		int count = 0;
+		for (const auto& sent : commands)
+			count += sent.compare(0, command.size(), command) == 0;
+		return count;
+	}
+
+private:
+	std::string Reply(const std::string& line)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		commands.push_back(line);
+		std::string command = line.substr(0, line.find('?'));
+		if (command == "player/get_now_playing_media") {
+			std::string number = std::to_string(track);
+			return HeosStandInReply(command, "success", "pid=7",
+				"{\"type\": \"song\", \"song\": \"Song " + number + "\", \"album\": \"A\", \"artist\": \"B\", \"image_url\": \"http://127.0.0.1/art/"
+				+ number + "\", \"album_id\": \"\", \"mid\": \"m" + number + "\", \"qid\": 1, \"sid\": 13}");
+		}
+		if (command == "player/get_play_state")
+			return HeosStandInReply(command, "success", "pid=7&state=" + playState);
+		return HeosStandInReply(command, "success", "");
+	}
+
+	std::mutex mutex;
+	std::vector<std::string> commands;
+	int track = 1;
+	std::string playState = "play";
+
+public:
+	HeosStandIn device; // last, so it stops before the rest goes
+};
+
+std::string Event(const std::string& name, const std::string& message)
+{
+	return "{\"heos\": {\"command\": \"event/" + name + "\", \"message\": \"" + message + "\"}}\r\n";
+}
+
+// --- Images
+
+void BigEndian(std::string& out, uint32_t value)
+{
+	for (int shift = 24; shift >= 0; shift -= 8)
+		out.push_back((char)(value >> shift));
+}
+
+uint32_t Crc32(const std::string& data)
+{
+	uint32_t crc = ~0u;
+	for (unsigned char c : data) {
+		crc ^= c;
+		for (int bit = 0; bit < 8; ++bit)
+			crc = (crc >> 1) ^ (0xedb88320u & (0 - (crc & 1)));
+	}
+	return ~crc;
+}
+
+void Chunk(std::string& png, const char* type, const std::string& data)
+{
+	BigEndian(png, (uint32_t)data.size());
+	std::string typed = type + data;
+	png += typed;
+	BigEndian(png, Crc32(typed));
+}
+
+// An 8-bit RGB PNG of width x 200 in stored deflate blocks, different for
+// every id.
+std::string Png(int width, int id)
+{
+	const int height = 200;
+	std::string raw;
+	for (int y = 0; y < height; ++y) {
+		raw.push_back(0);
+		for (int x = 0; x < width; ++x) {
+			raw.push_back((char)(x * id));
+			raw.push_back((char)(y + id));
+			raw.push_back((char)(x ^ y));
+		}
+	}
+	std::string zlib = "\x78\x01";
+	for (size_t at = 0; at < raw.size();) {
+		size_t length = std::min<size_t>(65535, raw.size() - at);
+		zlib.push_back(at + length == raw.size() ? 1 : 0);
+		zlib.push_back((char)length);
+		zlib.push_back((char)(length >> 8));
+		zlib.push_back((char)~length);
+		zlib.push_back((char)(~length >> 8));
+		zlib += raw.substr(at, length);
+		at += length;
+	}
+	uint32_t a = 1, b = 0;
+	for (unsigned char c : raw) {
+		a = (a + c) % 65521;
+		b = (b + a) % 65521;
+	}
+	BigEndian(zlib, b << 16 | a);
+
+	std::string png = "\x89PNG\r\n\x1a\n";
+	std::string header;
+	BigEndian(header, (uint32_t)width);
+	BigEndian(header, (uint32_t)height);
+	header += std::string("\x08\x02\x00\x00\x00", 5);
+	Chunk(png, "IHDR", header);
+	Chunk(png, "IDAT", zlib);
+	Chunk(png, "IEND", "");
+	return png;
+}
+
+// ".../art/5" is a 305 x 200 PNG.
+int ArtId(const std::string& url)
+{
+	size_t at = url.rfind("/art/");
+	return at == std::string::npos ? -1 : atoi(url.c_str() + at + 5);
+}
+
+// Counts the fetches, which never fail for /art/ URLs.
+class ImageHost {
+public:
+	HeosArtCache::Fetch Fetcher()
+	{
+		return [this](const std::string& url, std::string& body) {
+			++fetches;
+			int id = ArtId(url);
+			body = id < 0 ? "" : Png(300 + id, id + 1);
+			return id >= 0;
+		};
+	}
+
+	std::atomic<int> fetches{ 0 };
+};
+
+// Leaves no cache directory behind, nor finds one from an earlier run.
+void RemoveCache(const std::string& directory)
+{
+	std::ifstream in(directory + "/index.json", std::ios::binary);
+	std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	in.close();
+	HeosArtIndex index;
+	if (Json::decode(data.data(), data.data() + data.size(), index, nullptr)) {
+		for (const auto& file : index.files)
+			std::remove((directory + "/" + file.file).c_str());
+	}
+	std::remove((directory + "/index.json").c_str());
+#ifdef _WIN32
+	_rmdir(directory.c_str());
+#else
+	rmdir(directory.c_str());
+#endif
+}
+
+const char* const CACHE = "HeosNowPlayingTest.art";
+
+std::string ArtUrl(int id)
+{
+	return "http://127.0.0.1/art/" + std::to_string(id);
+}
+
+} // namespace
+
+TEST(MessageValues)
+{
+	const std::string line = "{\"heos\": {\"command\": \"event/player_state_changed\", \"message\": \"pid=7&state=pause&level=\"}}";
+	CHECK_EQUAL("7", HeosMessageValue(line, "pid"));
+	CHECK_EQUAL("pause", HeosMessageValue(line, "state"));
+	CHECK_EQUAL("", HeosMessageValue(line, "level"));
+	CHECK_EQUAL("", HeosMessageValue(line, "id")); // not the end of "pid"
+	CHECK_EQUAL("", HeosMessageValue("{\"heos\": {}}", "pid"));
+	CHECK_EQUAL("player_state_changed", HeosEventName(line));
+	CHECK_EQUAL("", HeosEventName("{\"heos\": {\"command\": \"player/get_play_state\"}}"));
+
+	HeosNowPlayingState state;
+	state.media.mid = "inputs/optical_in_1";
+	CHECK(state.IsInput("optical"));
+	CHECK(state.IsInput("optical_in_1"));
+	CHECK(!state.IsInput("optical_in_2"));
+	CHECK(!state.IsInput("aux"));
+	state.media.mid = "m1";
+	CHECK(!state.IsInput("optical"));
+}
+
+TEST(FollowsTheDevice)
+{
+	Player player;
+	std::mutex mutex;
+	std::vector<HeosNowPlayingState> changes;
+	HeosNowPlaying nowPlaying([&](const HeosNowPlayingState& state) {
+		std::lock_guard<std::mutex> lock(mutex);
+		changes.push_back(state);
+		}, player.device.Port(), 400);
+	CHECK(!nowPlaying.Current().known);
+
+	nowPlaying.Start("127.0.0.1", "7");
+	CHECK(WaitFor([&] { return nowPlaying.Current().known; }));
+	HeosNowPlayingState current = nowPlaying.Current();
+	CHECK_EQUAL("Song 1", current.media.song);
+	CHECK_EQUAL("13", current.media.sid);
+	CHECK_EQUAL("play", current.playState);
+	CHECK_EQUAL(1, player.device.Registrations());
+
+	// Track changes come as events, which lead to a refresh
+	for (int track = 2; track <= 4; ++track) {
+		player.Play(track);
+		player.device.Push(Event("player_now_playing_changed", "pid=7"));
+		std::string song = "Song " + std::to_string(track);
+		if (!WaitFor([&] { return nowPlaying.Current().media.song == song; }))
+			FAIL("missed " + song);
+	}
+
+	// Another player's events are not ours; play state comes with the event
+	player.device.Push(Event("player_state_changed", "pid=8&state=stop"));
+	player.device.Push(Event("player_state_changed", "pid=7&state=pause"));
+	CHECK(WaitFor([&] { return nowPlaying.Current().playState == "pause"; }));
+
+	// The device restarts: register again and catch up on what changed
+	player.Play(5);
+	player.device.DropConnections();
+	CHECK(WaitFor([&] { return player.device.Registrations() == 2 && nowPlaying.Current().media.song == "Song 5"; }));
+
+	// Nothing happening: heartbeats keep the connection
+	CHECK(WaitFor([&] { return player.Count("system/heart_beat") > 0; }));
+
+	auto stopping = Clock::now();
+	nowPlaying.Stop();
+	CHECK(Clock::now() - stopping < std::chrono::seconds(2));
+	std::lock_guard<std::mutex> lock(mutex);
+	CHECK(!changes.empty() && changes.back().media.song == "Song 5");
+}
+
+TEST(StartAgainStartsOver)
+{
+	Player player;
+	HeosNowPlaying nowPlaying(nullptr, player.device.Port());
+	nowPlaying.Start("127.0.0.1", "7");
+	CHECK(WaitFor([&] { return nowPlaying.Current().known; }));
+
+	// Another player: nothing known until it was read
+	player.SetPlayState("stop");
+	nowPlaying.Start("127.0.0.1", "7");
+	CHECK(WaitFor([&] { return nowPlaying.Current().playState == "stop"; }));
+	CHECK_EQUAL(2, player.Count("player/get_play_state"));
+	CHECK(nowPlaying.IsWatching("127.0.0.1", "7"));
+	CHECK(!nowPlaying.IsWatching("127.0.0.1", "8"));
+
+	// Stopped: watching nothing, and nothing known
+	nowPlaying.Stop();
+	CHECK(!nowPlaying.IsWatching("127.0.0.1", "7"));
+	CHECK(!nowPlaying.Current().known);
+
+	// No device there: nothing known, and Stop() still returns promptly
+	int gone;
+	{
+		Player other;
+		gone = other.device.Port();
+	}
+	HeosNowPlaying nowhere(nullptr, gone);
+	nowhere.Start("127.0.0.1", "7");
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	CHECK(!nowhere.Current().known);
+	auto stopping = Clock::now();
+	nowhere.Stop();
+	CHECK(Clock::now() - stopping < std::chrono::seconds(2));
+}
+
+TEST(HttpGetFromStandIn)
+{
+	HeosServer host([](const HeosApiRequest& request, HeosServer::Respond respond) {
+		int id = ArtId(request.path);
+		respond(id < 0 ? HeosApiResponse{ 404, "{}" } : HeosApiResponse{ 200, Png(300 + id, id + 1) });
+		});
+	CHECK(host.Start(0));
+	std::string base = "http://127.0.0.1:" + std::to_string(host.Port());
+
+	std::string body;
+	HeosImage image;
+	CHECK(HeosHttpGet(base + "/art/5", body));
+	CHECK(HeosDecodeArt(body, image));
+	CHECK_EQUAL(305, image.width);
+	CHECK_EQUAL(200, image.height);
+	CHECK(!HeosHttpGet(base + "/nothing", body));
+	CHECK(!HeosDecodeArt("not an image", image));
+}
+
+TEST(ArtCacheKeepsToItsLimits)
+{
+	RemoveCache(CACHE);
+	const size_t memoryLimit = 3 * 64 * 64 * 4; // three thumbnails
+	const size_t diskLimit = 3 * Png(300, 1).size();
+	ImageHost host;
+	{
+		HeosArtCache art(CACHE, 64, memoryLimit, diskLimit, host.Fetcher());
+		std::atomic<int> ready(0);
+		art.OnReady([&](const std::string&) { ++ready; });
+		HeosImage thumbnail;
+		CHECK(!art.Get(ArtUrl(1), thumbnail)); // Get() does not fetch
+
+		for (int id = 1; id <= 6; ++id)
+			art.Prefetch(ArtUrl(id));
+		art.Prefetch(ArtUrl(6)); // already queued
+		art.Wait();
+		CHECK_EQUAL(6, ready.load());
+		CHECK_EQUAL(6, host.fetches.load());
+		CHECK(art.Get(ArtUrl(6), thumbnail));
+		CHECK_EQUAL(64, thumbnail.width);
+		CHECK_EQUAL(64 * 200 / 306, thumbnail.height);
+		CHECK(art.MemoryBytes() <= memoryLimit);
+		CHECK(art.DiskBytes() <= diskLimit);
+		CHECK(!art.Get(ArtUrl(1), thumbnail)); // the least recently used went
+
+		// Known art is not fetched again
+		art.Prefetch(ArtUrl(6));
+		art.Wait();
+		CHECK_EQUAL(6, host.fetches.load());
+	}
+
+	// After a restart, what is on disk needs no fetch
+	ImageHost offline;
+	{
+		HeosArtCache art(CACHE, 64, memoryLimit, diskLimit, offline.Fetcher());
+		art.Prefetch(ArtUrl(6));
+		art.Prefetch(ArtUrl(5));
+		art.Wait();
+		HeosImage thumbnail;
+		CHECK(art.Get(ArtUrl(6), thumbnail));
+		CHECK(art.Get(ArtUrl(5), thumbnail));
+		CHECK_EQUAL(0, offline.fetches.load());
+		art.Prefetch(ArtUrl(1));
+		art.Wait();
+		CHECK_EQUAL(1, offline.fetches.load());
+
+		// A failed fetch is not art
+		art.Prefetch("http://127.0.0.1/missing");
+		art.Wait();
+		CHECK(!art.Get("http://127.0.0.1/missing", thumbnail));
+	}
+	RemoveCache(CACHE);
+}
@@ -0,0 +1,327 @@
+// prefs.json: older files are upgraded, a write that fails leaves the old
+// file alone, and so does a writer killed halfway; saves are debounced and
+// skipped when nothing changed, and each network gets the device last seen
+// on it.
+
+#include "HeosPrefs.h"
+#include "HeosTest.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <thread>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <csignal>
+#include <random>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// In the directory the test runs in, which ctest makes the build directory.
+const char* const PATH = "HeosPrefsTest.json";
+
+void WriteFile(const std::string& path, const std::string& data)
+{
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	out << data;
+}
+
+std::string ReadFile(const std::string& path)
+{
+	std::ifstream in(path, std::ios::binary);
+	return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+bool MakeDirectory(const std::string& path)
+{
+#ifdef _WIN32
+	return _mkdir(path.c_str()) == 0;
+#else
+	return mkdir(path.c_str(), 0755) == 0;
+#endif
+}
+
+bool RemoveDirectory(const std::string& path)
+{
+#ifdef _WIN32
+	return _rmdir(path.c_str()) == 0;
+#else
+	return rmdir(path.c_str()) == 0;
+#endif
+}
+
+HeosKnownDevice Device(const std::string& network, const std::string& ip, const std::string& pid, int64_t lastSeen)
+{
+	HeosKnownDevice device;
+	device.network = network;
+	device.ip = ip;
+	device.pid = pid;
+	device.name = "Player " + pid;
+	device.lastSeen = lastSeen;
+	return device;
+}
+
+} // namespace
+
+TEST(LegacyFilesUpgrade)
+{
+	// Version 0 had no version member, version 1 the same members with one
+	for (const char* legacy : {
+		"{\"ip\": \"192.168.1.10\", \"pid\": \"-12345\", \"name\": \"Kitchen\"}",
+		"{\"version\": 1, \"ip\": \"192.168.1.10\", \"pid\": \"-12345\", \"name\": \"Kitchen\"}" }) {
+		WriteFile(PATH, legacy);
+		HeosPrefsStore store(PATH, std::chrono::milliseconds(0));
+		HeosPrefs prefs;
+		std::string errs;
+		CHECK(store.Load(prefs, &errs));
+		CHECK_EQUAL("", errs);
+		CHECK_EQUAL((int)HeosPrefs::CURRENT_VERSION, prefs.version);
+		CHECK_EQUAL(1u, prefs.devices.size());
+		if (prefs.devices.size() != 1)
+			continue;
+		CHECK_EQUAL("", prefs.devices[0].network);
+		CHECK_EQUAL("192.168.1.10", prefs.devices[0].ip);
+		CHECK_EQUAL("-12345", prefs.devices[0].pid);
+		CHECK_EQUAL("Kitchen", prefs.devices[0].name);
+		CHECK_EQUAL(8255, prefs.apiPort);
+
+		// The first save writes the new schema, which then loads as it is
+		CHECK(store.Save(prefs));
+		CHECK(store.Flush());
+		CHECK_EQUAL(HeosPrefsStore::Serialize(prefs), ReadFile(PATH));
+		HeosPrefsStore reopened(PATH);
+		HeosPrefs again;
+		CHECK(reopened.Load(again));
+		CHECK(!reopened.Save(again));
+	}
+	std::remove(PATH);
+}
+
+TEST(BadFilesAreRefused)
+{
+	for (const char* bad : {
+		"",
+		"{\"ip\":",
+		"{\"ip\": \"1.2.3\"}",
+		"{\"ip\": \"192.168.1.300\"}",
+		"{\"ip\": \"10.0.0.1\", \"pid\": \"x\"}",
+		"{\"version\": 9}",
+		"{\"version\": 2, \"devices\": [{\"ip\": \"10.0.0.1\", \"pid\": \"1 2\"}]}",
+		"{\"version\": 2, \"apiPort\": 70000}" }) {
+		WriteFile(PATH, bad);
+		HeosPrefsStore store(PATH);
+		HeosPrefs prefs;
+		prefs.apiPort = 1;
+		std::string errs;
+		if (store.Load(prefs, &errs))
+			FAIL(std::string("loaded ") + bad);
+		CHECK(!errs.empty());
+		CHECK_EQUAL(1, prefs.apiPort); // left alone
+	}
+	std::remove(PATH);
+
+	HeosPrefsStore missing(PATH);
+	HeosPrefs prefs;
+	std::string errs;
+	CHECK(!missing.Load(prefs, &errs));
+	CHECK_EQUAL("no prefs file", errs);
+}
+
+TEST(FailedWriteKeepsOldFile)
+{
+	HeosPrefs prefs;
+	prefs.devices.push_back(Device("", "10.0.0.1", "1", 100));
+	{
+		HeosPrefsStore store(PATH, std::chrono::milliseconds(0));
+		CHECK(store.Save(prefs));
+		CHECK(store.Flush());
+	}
+	const std::string before = ReadFile(PATH);
+
+	// With a directory where the temp file goes, the write cannot happen
+	const std::string temp = std::string(PATH) + ".tmp";
+	CHECK(MakeDirectory(temp));
+	{
+		HeosPrefsStore store(PATH, std::chrono::hours(1));
+		HeosPrefs loaded;
+		CHECK(store.Load(loaded));
+		loaded.devices[0].name = "Renamed";
+		CHECK(store.Save(loaded));
+		CHECK(!store.Flush());
+		CHECK_EQUAL(before, ReadFile(PATH));
+
+		// The failed write stays pending, and goes through once it can
+		CHECK(!store.Save(loaded));
+		CHECK(RemoveDirectory(temp));
+		CHECK(store.Flush());
+		CHECK_EQUAL(HeosPrefsStore::Serialize(loaded), ReadFile(PATH));
+	}
+	RemoveDirectory(temp);
+	std::remove(PATH);
+}
+
+TEST(SavesAreDebouncedAndSkipped)
+{
+	std::remove(PATH);
+	HeosPrefs prefs;
+	prefs.version = HeosPrefs::CURRENT_VERSION; // as Save() writes it
+	prefs.devices.push_back(Device("", "10.0.0.1", "1", 100));
+	{
+		HeosPrefsStore store(PATH, std::chrono::milliseconds(200));
+		CHECK(store.Save(prefs));
+		CHECK(!store.Save(prefs)); // already pending
+
+		// A burst of changes: nothing is written until it is over
+		for (int i = 0; i < 50; ++i) {
+			prefs.devices[0].name = "n" + std::to_string(i);
+			CHECK(store.Save(prefs));
+		}
+		CHECK_EQUAL("", ReadFile(PATH));
+		auto waited = std::chrono::steady_clock::now();
+		while (ReadFile(PATH).empty() && std::chrono::steady_clock::now() - waited < std::chrono::seconds(5))
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		CHECK_EQUAL(HeosPrefsStore::Serialize(prefs), ReadFile(PATH));
+		CHECK(!store.Save(prefs));
+
+		// Changed and changed back before the write: nothing to do
+		HeosPrefs changed = prefs;
+		changed.apiPort = 0;
+		CHECK(store.Save(changed));
+		CHECK(!store.Save(prefs));
+		CHECK(store.Flush());
+		CHECK_EQUAL(HeosPrefsStore::Serialize(prefs), ReadFile(PATH));
+
+		// Pending on destruction: written then
+		prefs.devices[0].name = "last";
+		CHECK(store.Save(prefs));
+	}
+	CHECK_EQUAL(HeosPrefsStore::Serialize(prefs), ReadFile(PATH));
+	std::remove(PATH);
+}
+
+#ifndef _WIN32
+TEST(KilledWriterLeavesLoadableFile)
+{
+	// Big enough that a kill often lands inside a write
+	HeosPrefs prefs;
+	prefs.version = HeosPrefs::CURRENT_VERSION;
+	for (int i = 0; i < (int)HeosPrefs::MAX_DEVICES; ++i)
+		prefs.devices.push_back(Device("net-" + std::to_string(i), "10.0.0." + std::to_string(i + 1), std::to_string(i + 1), 100 + i));
+	{
+		HeosPrefsStore store(PATH, std::chrono::milliseconds(0));
+		store.Save(prefs);
+		CHECK(store.Flush());
+	}
+
+	std::mt19937 random(HeosTestSeed());
+	const int rounds = 20 * HeosTestScale();
+	for (int round = 0; round < rounds; ++round) {
+		pid_t child = fork();
+		if (child < 0) {
+			FAIL("fork failed");
+			break;
+		}
+		if (child == 0) {
+			// Rewrite the file, different each time, until killed
+			HeosPrefsStore store(PATH, std::chrono::milliseconds(0));
+			for (int64_t n = 0;; ++n) {
+				for (HeosKnownDevice& device : prefs.devices)
+					device.name = std::string(2000 + (size_t)(n % 1000), (char)('a' + n % 26));
+				store.Save(prefs);
+				store.Flush();
+			}
+		}
+
+		std::this_thread::sleep_for(std::chrono::microseconds(random() % 20000));
+		kill(child, SIGKILL);
+		int status = 0;
+		waitpid(child, &status, 0);
+		CHECK(WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL);
+
+		// Whatever write was cut short, the file is a whole one
+		HeosPrefsStore store(PATH);
+		HeosPrefs loaded;
+		std::string errs;
+		if (!store.Load(loaded, &errs)) {
+			FAIL("round " + std::to_string(round) + ": " + errs);
+			break;
+		}
+		CHECK_EQUAL((size_t)HeosPrefs::MAX_DEVICES, loaded.devices.size());
+		CHECK_EQUAL(HeosPrefsStore::Serialize(loaded), ReadFile(PATH));
+	}
+	std::remove((std::string(PATH) + ".tmp").c_str());
+	std::remove(PATH);
+}
+#endif
+
+TEST(NetworkFingerprints)
+{
+	CHECK_EQUAL("gw-aa:bb:cc:01:02:03", HeosNetworkFingerprint({ 0xaa, 0xbb, 0xcc, 0x01, 0x02, 0x03 }, 0x0a000105, 0xffffff00));
+	CHECK_EQUAL("net-10.0.1.0/24", HeosNetworkFingerprint({}, 0x0a000105, 0xffffff00));
+	CHECK_EQUAL("net-172.16.0.0/12", HeosNetworkFingerprint({}, 0xac1f0001, 0xfff00000));
+	CHECK_EQUAL("", HeosNetworkFingerprint({}, 0, 0));
+}
+
+TEST(NetworkSwitchFindsItsDevice)
+{
+	const std::string home = HeosNetworkFingerprint({ 0xaa, 0xbb, 0xcc, 0x01, 0x02, 0x03 }, 0, 0);
+	const std::string office = HeosNetworkFingerprint({}, 0x0a000105, 0xffffff00);
+	WriteFile(PATH, "{\"ip\": \"192.168.1.10\", \"pid\": \"-12345\", \"name\": \"Bar\"}");
+	HeosPrefsStore store(PATH, std::chrono::milliseconds(0));
+	HeosPrefs prefs;
+	CHECK(store.Load(prefs));
+
+	// At home, the device carried over from version 1 is the guess
+	const HeosKnownDevice* found = HeosFindDevice(prefs, home);
+	CHECK(found && found->ip == "192.168.1.10");
+	if (!found)
+		return;
+	HeosKnownDevice seen = *found;
+	seen.network = home;
+	seen.lastSeen = 100;
+	seen.rttMs = 12;
+	HeosGroup group;
+	group.name = "All";
+	group.gid = "1";
+	group.players.push_back({ "Bar", "-12345", "leader" });
+	seen.groups.push_back(group);
+	HeosRememberDevice(prefs, seen);
+	CHECK_EQUAL(1u, prefs.devices.size());
+	CHECK_EQUAL(home, prefs.devices[0].network);
+
+	// At the office nothing is known, until discovery found a device there
+	CHECK(!HeosFindDevice(prefs, office));
+	HeosRememberDevice(prefs, Device(office, "10.0.1.20", "77", 200));
+	CHECK_EQUAL("10.0.1.20", HeosFindDevice(prefs, office)->ip);
+	CHECK_EQUAL("192.168.1.10", HeosFindDevice(prefs, home)->ip);
+
+	// Back home, with the player at a new address
+	HeosRememberDevice(prefs, Device(home, "192.168.1.11", "-12345", 300));
+	CHECK_EQUAL(2u, prefs.devices.size());
+	CHECK_EQUAL("192.168.1.11", HeosFindDevice(prefs, home)->ip);
+	CHECK(store.Save(prefs));
+	CHECK(store.Flush());
+
+	HeosPrefsStore reopened(PATH);
+	HeosPrefs loaded;
+	CHECK(reopened.Load(loaded));
+	CHECK_EQUAL(HeosPrefsStore::Serialize(prefs), HeosPrefsStore::Serialize(loaded));
+	std::remove(PATH);
+}
+
+TEST(OldestDevicesAreForgotten)
+{
+	HeosPrefs prefs;
+	for (int i = 0; i < 40; ++i)
+		HeosRememberDevice(prefs, Device("net-" + std::to_string(i), "10.0.0.1", std::to_string(i), 1000 + (i * 7) % 40));
+	CHECK_EQUAL((size_t)HeosPrefs::MAX_DEVICES, prefs.devices.size());
+	for (const auto& device : prefs.devices)
+		CHECK(device.lastSeen >= 1000 + 40 - (int64_t)HeosPrefs::MAX_DEVICES);
+	CHECK_EQUAL("net-39", prefs.devices[0].network); // most recent first
+}
@@ -0,0 +1,260 @@
+// Volume ramps: the planned steps for every curve, then the ramp thread
+// against a send function that records when each level went out, and
+// through a HeosConnection to a stand-in device that records when each
+// level arrived.
+
+#include "HeosConnection.h"
+#include "HeosRamp.h"
+#include "HeosStandIn.h"
+#include "HeosTest.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <random>
+#include <thread>
+
+namespace {
+
+typedef HeosVolumeRamp::Clock Clock;
+
+struct Sent {
+	Clock::time_point at;
+	int level;
+};
+
+// Records the levels sent, taking delay for each.
+class FakeDevice {
+public:
+	explicit FakeDevice(std::chrono::milliseconds delay = std::chrono::milliseconds(0)) : delay(delay) {}
+
+	HeosVolumeRamp::Send Sender()
+	{
+		return [this](int level) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				sent.push_back({ Clock::now(), level });
+			}
+			std::this_thread::sleep_for(delay);
+			return true;
+		};
+	}
+
+	std::vector<Sent> Levels()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return sent;
+	}
+
+private:
+	const std::chrono::milliseconds delay;
+	std::mutex mutex;
+	std::vector<Sent> sent;
+};
+
+double Milliseconds(Clock::duration duration)
+{
+	return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+// Sends may come a little early by the measure of the recorder's clock, as
+// it reads it after the ramp thread did.
+const double SLACK_MS = 5;
+
+} // namespace
+
+TEST(CurvesParse)
+{
+	HeosRampCurve curve = HeosRampCurve::Linear;
+	CHECK(HeosParseRampCurve("ease", curve) && curve == HeosRampCurve::Ease);
+	CHECK(HeosParseRampCurve("exponential", curve) && curve == HeosRampCurve::Exponential);
+	CHECK(HeosParseRampCurve("linear", curve) && curve == HeosRampCurve::Linear);
+	CHECK(!HeosParseRampCurve("Linear", curve));
+	CHECK(!HeosParseRampCurve("", curve));
+}
+
+TEST(PlansKeepTheRateAndEndOnTarget)
+{
+	std::mt19937 random(HeosTestSeed());
+	const HeosRampCurve curves[] = { HeosRampCurve::Linear, HeosRampCurve::Ease, HeosRampCurve::Exponential };
+	for (int i = 0; i < 20000 * HeosTestScale(); ++i) {
+		int from = random() % 101;
+		int to = random() % 101;
+		std::chrono::milliseconds duration(random() % 5000);
+		std::chrono::milliseconds interval(1 + random() % 300);
+		HeosRampCurve curve = curves[random() % 3];
+		std::vector<HeosRampStep> steps = HeosPlanRamp(from, to, duration, curve, interval);
+
+		bool ok = from == to ? steps.empty() : !steps.empty() && steps.back().level == to && steps.back().at <= duration;
+		int previous = from;
+		for (size_t n = 0; ok && n < steps.size(); ++n) {
+			// Toward the target, never back, never the same level twice, and
+			// never faster than interval (a ramp shorter than that is one step)
+			const HeosRampStep& step = steps[n];
+			ok = (to > from ? step.level > previous : step.level < previous) && std::min(from, to) <= step.level
+				&& step.level <= std::max(from, to)
+				&& step.at >= (n ? steps[n - 1].at + interval : std::min<std::chrono::milliseconds>(interval, duration));
+			previous = step.level;
+		}
+		if (!ok) {
+			FAIL("ramp " + std::to_string(from) + " to " + std::to_string(to) + " over " + std::to_string(duration.count())
+				+ " ms every " + std::to_string(interval.count()) + " ms, curve " + std::to_string((int)curve));
+			return;
+		}
+	}
+}
+
+TEST(CurvesShapeThePlan)
+{
+	auto levelAt = [](HeosRampCurve curve, int ms) {
+		int level = 60;
+		for (const auto& step : HeosPlanRamp(60, 10, std::chrono::milliseconds(1000), curve, std::chrono::milliseconds(100))) {
+			if (step.at.count() <= ms)
+				level = step.level;
+		}
+		return level;
+	};
+	CHECK_EQUAL(35, levelAt(HeosRampCurve::Linear, 500));
+	CHECK_EQUAL(35, levelAt(HeosRampCurve::Ease, 500));
+	// Ease starts slower than linear, exponential slower still
+	CHECK(levelAt(HeosRampCurve::Ease, 200) > levelAt(HeosRampCurve::Linear, 200));
+	CHECK(levelAt(HeosRampCurve::Exponential, 500) > levelAt(HeosRampCurve::Ease, 500));
+	CHECK_EQUAL(10, levelAt(HeosRampCurve::Exponential, 1000));
+
+	// Ease gets to the target before the end, and then stops there
+	std::vector<HeosRampStep> eased = HeosPlanRamp(60, 10, std::chrono::milliseconds(1000), HeosRampCurve::Ease, std::chrono::milliseconds(10));
+	CHECK(!eased.empty() && eased.back().level == 10 && eased.back().at < std::chrono::milliseconds(1000));
+	CHECK(eased.size() < 2 || eased[eased.size() - 2].level != 10);
+}
+
+TEST(RampSendsOnSchedule)
+{
+	FakeDevice device;
+	HeosVolumeRamp ramp(device.Sender());
+	CHECK_EQUAL(-1, ramp.Level());
+	std::vector<HeosRampStep> plan = HeosPlanRamp(60, 10, std::chrono::milliseconds(600), HeosRampCurve::Linear, std::chrono::milliseconds(100));
+	auto started = Clock::now();
+	ramp.Start(60, 10, std::chrono::milliseconds(600), HeosRampCurve::Linear);
+	CHECK(ramp.IsRunning());
+	ramp.Wait();
+	CHECK(!ramp.IsRunning());
+	CHECK_EQUAL(10, ramp.Level());
+
+	// A loaded machine may run late and drop steps, but never early or fast
+	std::vector<Sent> sent = device.Levels();
+	CHECK(!sent.empty() && sent.size() <= plan.size());
+	CHECK(!sent.empty() && sent.back().level == 10);
+	for (size_t n = 0; n < sent.size(); ++n) {
+		auto step = std::find_if(plan.begin(), plan.end(), [&](const HeosRampStep& step) { return step.level == sent[n].level; });
+		CHECK(step != plan.end() && Milliseconds(sent[n].at - started) >= step->at.count() - SLACK_MS);
+		if (n)
+			CHECK(Milliseconds(sent[n].at - sent[n - 1].at) >= 100 - SLACK_MS);
+	}
+
+	// Nothing to do
+	ramp.Start(10, 10, std::chrono::milliseconds(600), HeosRampCurve::Linear);
+	CHECK(!ramp.IsRunning());
+	CHECK_EQUAL(sent.size(), device.Levels().size());
+}
+
+TEST(StartReplacesTheRunningRamp)
+{
+	FakeDevice device;
+	HeosVolumeRamp ramp(device.Sender());
+	ramp.Start(60, 10, std::chrono::milliseconds(1000), HeosRampCurve::Linear);
+	std::this_thread::sleep_for(std::chrono::milliseconds(350));
+	int middle = ramp.Level();
+	CHECK(middle < 60 && middle > 10);
+	ramp.Start(middle, 80, std::chrono::milliseconds(300), HeosRampCurve::Linear);
+	ramp.Wait();
+	CHECK_EQUAL(80, ramp.Level());
+
+	// Down to where the first ramp was, then only up; the rate limit holds
+	// across the switch
+	std::vector<Sent> sent = device.Levels();
+	size_t turn = 0;
+	while (turn + 1 < sent.size() && sent[turn + 1].level < sent[turn].level)
+		++turn;
+	for (size_t n = turn + 1; n < sent.size(); ++n)
+		CHECK(sent[n].level > sent[n - 1].level);
+	for (size_t n = 1; n < sent.size(); ++n)
+		CHECK(Milliseconds(sent[n].at - sent[n - 1].at) >= 100 - SLACK_MS);
+
+	// Cancel stops it where it is
+	ramp.Start(80, 0, std::chrono::milliseconds(2000), HeosRampCurve::Linear);
+	std::this_thread::sleep_for(std::chrono::milliseconds(250));
+	ramp.Cancel();
+	ramp.Wait();
+	size_t count = device.Levels().size();
+	std::this_thread::sleep_for(std::chrono::milliseconds(250));
+	CHECK_EQUAL(count, device.Levels().size());
+	CHECK(ramp.Level() > 0);
+}
+
+TEST(SlowDeviceSkipsToTheLatestStep)
+{
+	// Each send takes 250 ms: the steps that fall due meanwhile are dropped
+	// for the latest, and the ramp still ends on its target
+	FakeDevice device(std::chrono::milliseconds(250));
+	HeosVolumeRamp ramp(device.Sender());
+	auto started = Clock::now();
+	ramp.Start(60, 10, std::chrono::milliseconds(1000), HeosRampCurve::Linear);
+	ramp.Wait();
+	std::vector<Sent> sent = device.Levels();
+	CHECK(sent.size() <= 6);
+	CHECK(!sent.empty() && sent.back().level == 10);
+	CHECK_EQUAL(10, ramp.Level());
+	CHECK(Milliseconds(Clock::now() - started) < 2000);
+}
+
+TEST(RampReachesTheDeviceOnSchedule)
+{
+	// As the app sends them: set_volume over the one connection, waiting
+	// for each reply. The times are taken where the commands arrive.
+	std::mutex mutex;
+	std::vector<Sent> arrived;
+	HeosStandIn player([&](const std::string& command) {
+		const std::string prefix = "player/set_volume?pid=1&level=";
+		if (command.compare(0, prefix.size(), prefix) != 0)
+			return HeosStandInReply(command, "fail", "eid=1&text=Unknown command");
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			arrived.push_back({ Clock::now(), atoi(command.c_str() + prefix.size()) });
+		}
+		return HeosStandInReply("player/set_volume", "success", command.substr(command.find('?') + 1));
+	});
+	HeosConnection connection(player.Port(), 2000);
+	HeosVolumeRamp ramp([&](int level) {
+		std::string reply;
+		return connection.Send("127.0.0.1", "player/set_volume?pid=1&level=" + std::to_string(level), reply) && !reply.empty();
+	});
+
+	const std::chrono::milliseconds duration(800);
+	std::vector<HeosRampStep> plan = HeosPlanRamp(60, 10, duration, HeosRampCurve::Ease, std::chrono::milliseconds(100));
+	auto started = Clock::now();
+	ramp.Start(60, 10, duration, HeosRampCurve::Ease);
+	ramp.Wait();
+	CHECK_EQUAL(10, ramp.Level());
+	CHECK_EQUAL(1u, connection.Connects());
+
+	// Planned levels only, each once, toward the target and ending on it;
+	// none before its time and none closer than the rate limit
+	std::vector<Sent> levels;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		levels = arrived;
+	}
+	CHECK(!levels.empty() && levels.size() <= plan.size());
+	CHECK(!levels.empty() && levels.back().level == 10);
+	for (size_t n = 0; n < levels.size(); ++n) {
+		auto step = std::find_if(plan.begin(), plan.end(), [&](const HeosRampStep& step) { return step.level == levels[n].level; });
+		CHECK(step != plan.end() && Milliseconds(levels[n].at - started) >= step->at.count() - SLACK_MS);
+		if (n) {
+			CHECK(levels[n].level < levels[n - 1].level);
+			CHECK(Milliseconds(levels[n].at - levels[n - 1].at) >= 100 - SLACK_MS);
+		}
+	}
+	// And nothing after the end
+	std::this_thread::sleep_for(std::chrono::milliseconds(150));
+	std::lock_guard<std::mutex> lock(mutex);
+	CHECK_EQUAL(levels.size(), arrived.size());
+}
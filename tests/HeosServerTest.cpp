@@ -0,0 +1,373 @@
+// The local control API over real sockets: requests and their parameters,
+// the origin check and size limits, the /events WebSocket stream, and many
+// clients at once with the handler answering through a stand-in device.
+
+#include "HeosConnection.h"
+#include "HeosServer.h"
+#include "HeosStandIn.h"
+#include "HeosTest.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <thread>
+
+namespace {
+
+const char* const KEY = "dGhlIHNhbXBsZSBub25jZQ==";
+const char* const ACCEPT = "s3pPLMBiTxaQ9kYGzzhZRbK+xOo="; // RFC 6455, 1.3
+
+// A blocking client with a receive timeout, so a test that goes wrong fails
+// instead of hanging.
+class Client {
+public:
+	explicit Client(unsigned short port)
+	{
+		sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		address.sin_port = htons(port);
+		if (connect(sock, (sockaddr*)&address, sizeof(address)) != 0) {
+			HeosCloseSocket(sock);
+			sock = HEOS_NO_SOCKET;
+			return;
+		}
+		HeosSetTimeout(sock, 5000);
+	}
+
+	~Client()
+	{
+		if (sock != HEOS_NO_SOCKET)
+			HeosCloseSocket(sock);
+	}
+
+	bool Connected() const { return sock != HEOS_NO_SOCKET; }
+
+	bool Send(const std::string& data)
+	{
+		return send(sock, data.data(), (int)data.size(), HEOS_SEND_FLAGS) == (int)data.size();
+	}
+
+	// One HTTP response, headers and body; empty if the connection ended.
+	std::string Response()
+	{
+		for (;;) {
+			size_t end = buffer.find("\r\n\r\n");
+			if (end != std::string::npos) {
+				size_t length = 0;
+				size_t at = buffer.find("Content-Length: ");
+				if (at != std::string::npos && at < end)
+					length = (size_t)atoi(buffer.c_str() + at + 16);
+				if (buffer.size() >= end + 4 + length) {
+					std::string response = buffer.substr(0, end + 4 + length);
+					buffer.erase(0, end + 4 + length);
+					return response;
+				}
+			}
+			if (!Receive())
+				return "";
+		}
+	}
+
+	// The payload of one unmasked frame of less than 64 KB; false if the
+	// connection ended first.
+	bool Frame(int& opcode, std::string& payload)
+	{
+		for (;;) {
+			if (buffer.size() >= 2) {
+				size_t length = (unsigned char)buffer[1] & 0x7f;
+				size_t header = length == 126 ? 4 : 2;
+				if (length == 126 && buffer.size() >= 4)
+					length = (size_t)(unsigned char)buffer[2] << 8 | (unsigned char)buffer[3];
+				if (length != 127 && buffer.size() >= header + length) {
+					opcode = buffer[0] & 0x0f;
+					payload = buffer.substr(header, length);
+					buffer.erase(0, header + length);
+					return true;
+				}
+			}
+			if (!Receive())
+				return false;
+		}
+	}
+
+	// Upgrades to the /events stream; returns the 101 response.
+	std::string Upgrade(const std::string& origin = "")
+	{
+		Send("GET /events HTTP/1.1\r\nHost: 127.0.0.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: "
+			+ std::string(KEY) + "\r\nSec-WebSocket-Version: 13\r\n" + (origin.empty() ? "" : "Origin: " + origin + "\r\n") + "\r\n");
+		return Response();
+	}
+
+	// Masked, as clients must send them.
+	bool SendFrame(int opcode, const std::string& payload)
+	{
+		std::string frame;
+		frame.push_back((char)(0x80 | opcode));
+		frame.push_back((char)(0x80 | payload.size()));
+		const char mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+		frame.append(mask, 4);
+		for (size_t i = 0; i < payload.size(); ++i)
+			frame.push_back(payload[i] ^ mask[i % 4]);
+		return Send(frame);
+	}
+
+private:
+	bool Receive()
+	{
+		char data[4096];
+		int count = recv(sock, data, sizeof(data), 0);
+		if (count <= 0)
+			return false;
+		buffer.append(data, (size_t)count);
+		return true;
+	}
+
+	HeosSocket sock = HEOS_NO_SOCKET;
+	std::string buffer; // received past what was returned
+};
+
+std::string Request(const std::string& method, const std::string& target, const std::string& headers = "", const std::string& body = "")
+{
+	return method + " " + target + " HTTP/1.1\r\nHost: 127.0.0.1\r\n" + headers
+		+ (body.empty() ? "" : "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: " + std::to_string(body.size()) + "\r\n")
+		+ "\r\n" + body;
+}
+
+bool HasStatus(const std::string& response, int status)
+{
+	return response.compare(0, 13, "HTTP/1.1 " + std::to_string(status) + " ") == 0;
+}
+
+std::string Body(const std::string& response)
+{
+	size_t end = response.find("\r\n\r\n");
+	return end == std::string::npos ? "" : response.substr(end + 4);
+}
+
+// Answers with the path and parameters it got, as a JSON object.
+void Echo(const HeosApiRequest& request, HeosServer::Respond respond)
+{
+	std::string body = "{\"method\":\"" + request.method + "\",\"path\":\"" + request.path + "\"";
+	for (const auto& param : request.params)
+		body += ",\"" + param.first + "\":\"" + param.second + "\"";
+	respond({ 200, body + "}" });
+}
+
+} // namespace
+
+TEST(WebSocketAcceptMatchesRfc)
+{
+	CHECK_EQUAL(ACCEPT, HeosWebSocketAccept(KEY));
+}
+
+TEST(RequestsReachTheHandler)
+{
+	HeosServer server(Echo);
+	CHECK(server.Start(0));
+	CHECK(server.Port() != 0);
+	Client client(server.Port());
+	CHECK(client.Connected());
+
+	// Query string and form body, URL encoded, pipelined on one connection
+	client.Send(Request("GET", "/volume?level=30&name=Living%20Room") + Request("POST", "/mute?x=1", "", "state=on&note=a+b"));
+	std::string first = client.Response();
+	std::string second = client.Response();
+	CHECK(HasStatus(first, 200));
+	CHECK(first.find("Connection: keep-alive") != std::string::npos);
+	CHECK_EQUAL("{\"method\":\"GET\",\"path\":\"/volume\",\"level\":\"30\",\"name\":\"Living Room\"}", Body(first));
+	CHECK_EQUAL("{\"method\":\"POST\",\"path\":\"/mute\",\"note\":\"a b\",\"state\":\"on\",\"x\":\"1\"}", Body(second));
+
+	// Connection: close is honored
+	client.Send(Request("GET", "/state", "Connection: close\r\n"));
+	CHECK(client.Response().find("Connection: close") != std::string::npos);
+	CHECK_EQUAL("", client.Response());
+	server.Stop();
+}
+
+TEST(ForeignOriginsAreRefused)
+{
+	HeosServer server(Echo);
+	CHECK(server.Start(0));
+	for (const char* origin : { "http://evil.com", "http://localhost.evil.com", "http://127.0.0.1.evil.com:80", "null" }) {
+		Client client(server.Port());
+		client.Send(Request("GET", "/mute", "Origin: " + std::string(origin) + "\r\n"));
+		if (!HasStatus(client.Response(), 403))
+			FAIL(std::string("allowed ") + origin);
+		Client websocket(server.Port());
+		CHECK(HasStatus(websocket.Upgrade(origin), 403));
+	}
+	for (const char* origin : { "http://localhost", "http://localhost:3000", "http://127.0.0.1:8080/" }) {
+		Client client(server.Port());
+		client.Send(Request("GET", "/mute", "Origin: " + std::string(origin) + "\r\n"));
+		if (!HasStatus(client.Response(), 200))
+			FAIL(std::string("refused ") + origin);
+	}
+	// Tools that are not browsers send none
+	Client client(server.Port());
+	client.Send(Request("GET", "/mute"));
+	CHECK(HasStatus(client.Response(), 200));
+}
+
+TEST(MalformedRequestsAreRefused)
+{
+	HeosServer server(Echo);
+	CHECK(server.Start(0));
+	{
+		Client client(server.Port());
+		client.Send("POST /volume HTTP/1.1\r\nContent-Length: 9999999\r\n\r\n");
+		CHECK(HasStatus(client.Response(), 413));
+		CHECK_EQUAL("", client.Response());
+	}
+	{
+		Client client(server.Port());
+		client.Send("NONSENSE\r\n\r\n");
+		CHECK(HasStatus(client.Response(), 400));
+	}
+	{
+		Client client(server.Port());
+		client.Send("GET /x HTTP/1.1\r\nX-Filler: " + std::string(20000, 'a') + "\r\n\r\n");
+		CHECK(HasStatus(client.Response(), 431));
+	}
+	{
+		Client client(server.Port());
+		client.Send(Request("GET", "/events"));
+		CHECK(HasStatus(client.Response(), 400));
+	}
+	// The server is still fine
+	Client client(server.Port());
+	client.Send(Request("GET", "/state"));
+	CHECK(HasStatus(client.Response(), 200));
+}
+
+TEST(EventsStreamTheState)
+{
+	HeosServer server(Echo);
+	CHECK(server.Start(0));
+	server.PublishState("{\"volume\":20}");
+	CHECK_EQUAL("{\"volume\":20}", server.State());
+
+	Client client(server.Port());
+	std::string upgrade = client.Upgrade("http://localhost:3000");
+	CHECK(HasStatus(upgrade, 101));
+	CHECK(upgrade.find(std::string("Sec-WebSocket-Accept: ") + ACCEPT + "\r\n") != std::string::npos);
+
+	// The current state at once, then each change
+	int opcode = 0;
+	std::string payload;
+	CHECK(client.Frame(opcode, payload));
+	CHECK_EQUAL(1, opcode);
+	CHECK_EQUAL("{\"volume\":20}", payload);
+	std::string large = "{\"queue\":\"" + std::string(1000, 'q') + "\"}";
+	server.PublishState(large);
+	CHECK(client.Frame(opcode, payload));
+	CHECK_EQUAL(large, payload);
+
+	// Ping, then a close that is echoed
+	client.SendFrame(9, "hi");
+	CHECK(client.Frame(opcode, payload));
+	CHECK_EQUAL(10, opcode);
+	CHECK_EQUAL("hi", payload);
+	client.SendFrame(8, std::string("\x03\xe8", 2));
+	CHECK(client.Frame(opcode, payload));
+	CHECK_EQUAL(8, opcode);
+	CHECK_EQUAL(std::string("\x03\xe8", 2), payload);
+	CHECK(!client.Frame(opcode, payload));
+
+	// Unmasked frames are a protocol error
+	Client rude(server.Port());
+	rude.Upgrade();
+	rude.Frame(opcode, payload);
+	rude.Send(std::string("\x81\x02hi", 4));
+	CHECK(rude.Frame(opcode, payload));
+	CHECK_EQUAL(8, opcode);
+	CHECK_EQUAL(std::string("\x03\xea", 2), payload);
+}
+
+TEST(ManyClientsAtOnce)
+{
+	// The handler forwards to a stand-in device over one HeosConnection and
+	// answers when the device did, as HEOS.cpp does
+	HeosStandIn device([](const std::string& command) {
+		return HeosStandInReply("player/get_volume", "success", "command under process")
+			+ HeosStandInReply("player/set_volume", "success", command.substr(command.find('?') + 1));
+		});
+	HeosConnection connection(device.Port(), 2000);
+	HeosServer server([&connection](const HeosApiRequest& request, HeosServer::Respond respond) {
+		auto level = request.params.find("level");
+		connection.SendAsync("127.0.0.1", "player/set_volume?pid=1&level=" + (level == request.params.end() ? "" : level->second),
+			[respond](bool ok, const std::string& reply) { respond({ ok ? 200 : 502, reply }); });
+		});
+	CHECK(server.Start(0));
+	server.PublishState("{\"v\":0}");
+
+	const int LISTENERS = 100 * HeosTestScale();
+	const int CALLERS = 40 * HeosTestScale();
+	const int CALLS = 10;
+	std::atomic<int> listening(0);
+	std::atomic<int> heardLast(0);
+	std::atomic<int> answered(0);
+	std::atomic<int> wrong(0);
+	std::vector<std::thread> clients;
+	for (int i = 0; i < LISTENERS; ++i) {
+		clients.emplace_back([&] {
+			Client client(server.Port());
+			if (!HasStatus(client.Upgrade(), 101)) {
+				++wrong;
+				++listening;
+				return;
+			}
+			++listening;
+			int opcode;
+			std::string payload;
+			while (client.Frame(opcode, payload)) {
+				if (payload == "{\"v\":\"last\"}") {
+					++heardLast;
+					client.SendFrame(8, std::string("\x03\xe8", 2));
+					return;
+				}
+			}
+			++wrong;
+			});
+	}
+	while (listening < LISTENERS)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	CHECK_EQUAL((size_t)LISTENERS, server.Clients());
+
+	for (int i = 0; i < CALLERS; ++i) {
+		clients.emplace_back([&, i] {
+			Client client(server.Port());
+			// Two at a time, so replies must come back in order
+			for (int call = 0; call < CALLS; call += 2) {
+				std::string levels[2] = { std::to_string(i * 100 + call), std::to_string(i * 100 + call + 1) };
+				client.Send(Request("POST", "/volume", "", "level=" + levels[0]) + Request("POST", "/volume", "", "level=" + levels[1]));
+				for (const auto& level : levels) {
+					std::string response = client.Response();
+					if (HasStatus(response, 200) && response.find("level=" + level + "\"") != std::string::npos)
+						++answered;
+					else
+						++wrong;
+				}
+			}
+			});
+	}
+	for (int i = 1; i <= 20; ++i) {
+		server.PublishState("{\"v\":" + std::to_string(i) + "}");
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
+	server.PublishState("{\"v\":\"last\"}");
+	for (auto& client : clients)
+		client.join();
+
+	CHECK_EQUAL(0, (int)wrong);
+	CHECK_EQUAL(LISTENERS, (int)heardLast);
+	CHECK_EQUAL(CALLERS * CALLS, (int)answered);
+	CHECK_EQUAL(1u, connection.Connects());
+	CHECK_EQUAL((size_t)CALLERS * CALLS, connection.Commands());
+
+	// Every client closed; the server notices
+	for (int i = 0; i < 100 && server.Clients() > 0; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	CHECK_EQUAL(0u, server.Clients());
+	server.Stop();
+}
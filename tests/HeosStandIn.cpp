@@ -0,0 +1,125 @@
+#include "HeosStandIn.h"
+
+#include <algorithm>
+
+namespace {
+
+void SendAll(HeosSocket sock, const std::string& data)
+{
+	for (size_t done = 0; done < data.size();) {
+		int count = send(sock, data.data() + done, (int)(data.size() - done), HEOS_SEND_FLAGS);
+		if (count <= 0)
+			return;
+		done += (size_t)count;
+	}
+}
+
+} // namespace
+
+std::string HeosStandInReply(const std::string& command, const std::string& result, const std::string& message, const std::string& payload)
+{
+	std::string line = "{\"heos\": {\"command\": \"" + command + "\", \"result\": \"" + result + "\", \"message\": \"" + message + "\"}";
+	if (!payload.empty())
+		line += ", \"payload\": " + payload;
+	return line + "}\r\n";
+}
+
+HeosStandIn::HeosStandIn(Reply reply)
+	: reply(std::move(reply))
+{
+	HeosSocketsUp();
+	listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t length = sizeof(address);
+	if (listener == HEOS_NO_SOCKET || bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 64) != 0
+		|| getsockname(listener, (sockaddr*)&address, &length) != 0)
+		return;
+	port = ntohs(address.sin_port);
+	acceptor = std::thread(&HeosStandIn::AcceptLoop, this);
+}
+
+HeosStandIn::~HeosStandIn()
+{
+	stopping = true;
+	if (acceptor.joinable())
+		acceptor.join();
+	DropConnections();
+	std::vector<std::thread> serving;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		serving.swap(threads);
+	}
+	for (auto& thread : serving)
+		thread.join();
+	if (listener != HEOS_NO_SOCKET)
+		HeosCloseSocket(listener);
+	HeosSocketsDown();
+}
+
+void HeosStandIn::Push(const std::string& line)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	for (HeosSocket sock : registered)
+		SendAll(sock, line);
+}
+
+void HeosStandIn::DropConnections()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	// The serving threads see the end of their connection and close it
+	for (HeosSocket sock : open)
+		shutdown(sock, 2);
+}
+
+void HeosStandIn::AcceptLoop()
+{
+	while (!stopping) {
+		HeosPollFd fd = {};
+		fd.fd = listener;
+		fd.events = POLLIN;
+		if (HeosPoll(&fd, 1, 20) <= 0)
+			continue;
+		HeosSocket sock = accept(listener, nullptr, nullptr);
+		if (sock == HEOS_NO_SOCKET)
+			continue;
+		int one = 1;
+		setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char*)&one, sizeof(one));
+		++connections;
+		std::lock_guard<std::mutex> lock(mutex);
+		open.push_back(sock);
+		threads.emplace_back(&HeosStandIn::Serve, this, sock);
+	}
+}
+
+void HeosStandIn::Serve(HeosSocket sock)
+{
+	std::string received;
+	char buffer[4096];
+	int count;
+	while (!stopping && (count = recv(sock, buffer, sizeof(buffer), 0)) > 0) {
+		received.append(buffer, (size_t)count);
+		size_t end;
+		while ((end = received.find("\r\n")) != std::string::npos) {
+			std::string command = received.substr(0, end);
+			received.erase(0, end + 2);
+			if (command.compare(0, 7, "heos://") == 0)
+				command.erase(0, 7);
+			std::string lines = reply(command);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			if (command.compare(0, 33, "system/register_for_change_events") == 0
+				&& std::find(registered.begin(), registered.end(), sock) == registered.end()) {
+				registered.push_back(sock);
+				++registrations;
+			}
+			SendAll(sock, lines);
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	registered.erase(std::remove(registered.begin(), registered.end(), sock), registered.end());
+	open.erase(std::remove(open.begin(), open.end(), sock), open.end());
+	HeosCloseSocket(sock);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+// A HEOS device for the tests, on a free port of 127.0.0.1. It reads
+// heos:// command lines and writes back whatever the reply function makes
+// of each; connections that register for change events get the lines
+// Push() sends.
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "HeosSocket.h"
+
+// One reply line: {"heos": {"command": ..., "result": ..., "message": ...}}
+// and the line end.
+std::string HeosStandInReply(const std::string& command, const std::string& result, const std::string& message, const std::string& payload = "");
+
+class HeosStandIn {
+public:
+	// Gets the command without "heos://" and its line end; returns the lines
+	// to send back, line ends included. Runs on the connection's thread.
+	using Reply = std::function<std::string(const std::string& command)>;
+
+	explicit HeosStandIn(Reply reply);
+	~HeosStandIn();
+
+	int Port() const { return port; }
+	// To every connection registered for change events.
+	void Push(const std::string& line);
+	// Closes every open connection, as a device restart would.
+	void DropConnections();
+	int Connections() const { return connections; }
+	int Registrations() const { return registrations; }
+
+private:
+	void AcceptLoop();
+	void Serve(HeosSocket sock);
+
+	const Reply reply;
+	HeosSocket listener = HEOS_NO_SOCKET;
+	int port = 0;
+	std::atomic<bool> stopping{ false };
+	std::atomic<int> connections{ 0 };
+	std::atomic<int> registrations{ 0 };
+	std::mutex mutex;
+	std::vector<HeosSocket> open;       // guarded by mutex
+	std::vector<HeosSocket> registered; // guarded by mutex
+	std::vector<std::thread> threads;   // guarded by mutex
+	std::thread acceptor;
+};
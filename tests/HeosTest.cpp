@@ -0,0 +1,84 @@
+#include "HeosTest.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+struct TestCase {
+	const char* name;
+	void (*run)();
+};
+
+std::vector<TestCase>& Tests()
+{
+	static std::vector<TestCase> tests;
+	return tests;
+}
+
+int failures = 0;
+const int MAX_REPORTED = 20; // per case; a fuzz loop can fail many times
+
+uint32_t EnvironmentNumber(const char* name, uint32_t fallback)
+{
+	const char* text = getenv(name);
+	return text && *text ? (uint32_t)strtoul(text, nullptr, 10) : fallback;
+}
+
+} // namespace
+
+void HeosRegisterTest(const char* name, void (*run)())
+{
+	Tests().push_back({ name, run });
+}
+
+void HeosTestFailed(const char* file, int line, const std::string& message)
+{
+	if (++failures <= MAX_REPORTED)
+		printf("  %s:%d: %s\n", file, line, message.c_str());
+	else if (failures == MAX_REPORTED + 1)
+		printf("  (more failures not shown)\n");
+}
+
+int HeosTestFailures()
+{
+	return failures;
+}
+
+uint32_t HeosTestSeed()
+{
+	static const uint32_t seed = EnvironmentNumber("HEOS_TEST_SEED", 20261019);
+	return seed;
+}
+
+int HeosTestScale()
+{
+	static const int scale = (int)EnvironmentNumber("HEOS_TEST_SCALE", 1);
+	return scale > 0 ? scale : 1;
+}
+
+int main(int argc, char** argv)
+{
+	int failed = 0;
+	int ran = 0;
+	for (const auto& test : Tests()) {
+		bool wanted = argc < 2;
+		for (int i = 1; i < argc && !wanted; ++i)
+			wanted = strcmp(argv[i], test.name) == 0;
+		if (!wanted)
+			continue;
+
+		failures = 0;
+		auto started = std::chrono::steady_clock::now();
+		test.run();
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+		printf("%-6s %s (%.0f ms)\n", failures ? "FAIL" : "ok", test.name, ms);
+		failed += failures ? 1 : 0;
+		++ran;
+	}
+	printf("%d of %d passed, seed %u\n", ran - failed, ran, (unsigned)HeosTestSeed());
+	return failed == 0 && ran > 0 ? 0 : 1;
+}
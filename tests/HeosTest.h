@@ -0,0 +1,54 @@
+#pragma once
+
+// Just enough of a test framework for the portable code. TEST() registers a
+// case; CHECK() and CHECK_EQUAL() report a failure and carry on, FAIL()
+// reports one unconditionally. Every test executable links HeosTest.cpp,
+// whose main() runs the cases named on the command line, or all of them.
+//
+// Randomized cases take their seed from HeosTestSeed() and scale their
+// iteration counts by HeosTestScale(), so a longer fuzzing run is
+//   HEOS_TEST_SEED=$RANDOM HEOS_TEST_SCALE=100 ./json_push_parser_compact
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+void HeosRegisterTest(const char* name, void (*run)());
+void HeosTestFailed(const char* file, int line, const std::string& message);
+// Failures so far in the running case, so a fuzz loop can stop at the first.
+int HeosTestFailures();
+
+// HEOS_TEST_SEED, or a fixed default so runs are repeatable.
+uint32_t HeosTestSeed();
+// HEOS_TEST_SCALE, or 1.
+int HeosTestScale();
+
+template <class T>
+std::string HeosTestText(const T& value)
+{
+	std::ostringstream out;
+	out << value;
+	return out.str();
+}
+
+#define TEST(name) \
+	static void name(); \
+	static const int name##Registered = (HeosRegisterTest(#name, name), 0); \
+	static void name()
+
+#define FAIL(message) HeosTestFailed(__FILE__, __LINE__, message)
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) \
+			HeosTestFailed(__FILE__, __LINE__, "CHECK(" #condition ")"); \
+	} while (0)
+
+#define CHECK_EQUAL(expected, actual) \
+	do { \
+		const auto& expectedValue = (expected); \
+		const auto& actualValue = (actual); \
+		if (!(expectedValue == actualValue)) \
+			HeosTestFailed(__FILE__, __LINE__, "CHECK_EQUAL(" #expected ", " #actual ")\n    expected: " \
+				+ HeosTestText(expectedValue) + "\n    actual:   " + HeosTestText(actualValue)); \
+	} while (0)
@@ -0,0 +1,159 @@
+// The toolbar's placement at any DPI and work area, what opening and losing
+// focus do to the window, and the latency probe's arithmetic.
+
+#include "HeosToolbar.h"
+#include "HeosTest.h"
+
+#include <random>
+
+namespace {
+
+HeosToolbarRect Rect(int left, int top, int right, int bottom)
+{
+	HeosToolbarRect rect;
+	rect.left = left;
+	rect.top = top;
+	rect.right = right;
+	rect.bottom = bottom;
+	return rect;
+}
+
+} // namespace
+
+TEST(LayoutSitsInTheCorner)
+{
+	HeosToolbarLayout layout = HeosLayoutToolbar(Rect(0, 0, 1920, 1040), 5, 48, 8, 96);
+	CHECK_EQUAL(48, layout.buttonSize);
+	CHECK_EQUAL(240, layout.width);
+	CHECK_EQUAL(48, layout.height);
+	CHECK_EQUAL(1920 - 240 - 8, layout.x);
+	CHECK_EQUAL(1040 - 48 - 8, layout.y);
+
+	// 150% and 125%, rounded as MulDiv rounds
+	layout = HeosLayoutToolbar(Rect(0, 0, 2560, 1400), 5, 48, 8, 144);
+	CHECK_EQUAL(72, layout.buttonSize);
+	CHECK_EQUAL(2560 - 360 - 12, layout.x);
+	layout = HeosLayoutToolbar(Rect(0, 0, 1920, 1040), 5, 45, 7, 120);
+	CHECK_EQUAL(56, layout.buttonSize); // 56.25
+	CHECK_EQUAL(1040 - 56 - 9, layout.y); // 8.75
+
+	// A work area that does not start at 0, e.g. the taskbar on the left
+	// or a second monitor
+	layout = HeosLayoutToolbar(Rect(-1280, 100, 0, 1124), 5, 48, 8, 96);
+	CHECK_EQUAL(-8 - 240, layout.x);
+	CHECK_EQUAL(1124 - 48 - 8, layout.y);
+
+	CHECK_EQUAL(0, HeosLayoutToolbar(Rect(0, 0, 1920, 1040), 0, 48, 8, 96).width);
+	CHECK_EQUAL(0, HeosLayoutToolbar(Rect(0, 0, 1920, 1040), 5, 48, 8, 0).width);
+}
+
+TEST(NarrowWorkAreaShrinksButtons)
+{
+	HeosToolbarLayout layout = HeosLayoutToolbar(Rect(0, 0, 200, 600), 5, 48, 8, 96);
+	CHECK_EQUAL(36, layout.buttonSize); // (200 - 16) / 5
+	CHECK_EQUAL(180, layout.width);
+	CHECK_EQUAL(200 - 180 - 8, layout.x);
+
+	// Whatever the work area, the toolbar stays inside it
+	std::mt19937 random(HeosTestSeed());
+	for (int i = 0; i < 10000 * HeosTestScale(); ++i) {
+		int left = (int)(random() % 4000) - 2000;
+		int top = (int)(random() % 4000) - 2000;
+		HeosToolbarRect area = Rect(left, top, left + 40 + (int)(random() % 4000), top + 200 + (int)(random() % 2000));
+		int buttons = 1 + (int)(random() % 8);
+		int dpi = 96 + (int)(random() % 4) * 24;
+		HeosToolbarLayout layout = HeosLayoutToolbar(area, buttons, 48, 8, dpi);
+		if (layout.buttonSize < 1 || layout.width != layout.buttonSize * buttons || layout.x < area.left
+			|| layout.x + layout.width > area.right || layout.y < area.top || layout.y + layout.height > area.bottom) {
+			FAIL("outside its work area at " + std::to_string(i));
+			return;
+		}
+	}
+}
+
+TEST(OpenCreatesOnceThenShows)
+{
+	HeosToolbarState state;
+	HeosToolbarLayout small;
+	small.buttonSize = 48;
+	HeosToolbarLayout large;
+	large.buttonSize = 72;
+
+	CHECK(!state.IsVisible());
+	CHECK(state.Open(small) == HeosToolbarState::Action::Create);
+	CHECK(state.IsVisible());
+	CHECK(state.Open(small) == HeosToolbarState::Action::None);
+	state.Hidden();
+	CHECK(state.Open(small) == HeosToolbarState::Action::Show);
+	state.Hidden();
+	// Moved to a monitor with another DPI
+	CHECK(state.Open(large) == HeosToolbarState::Action::Relayout);
+	state.Hidden();
+	CHECK(state.Open(large) == HeosToolbarState::Action::Show);
+}
+
+TEST(FocusLossHidesUnlessClicked)
+{
+	HeosToolbarState state;
+	HeosToolbarLayout layout;
+	layout.buttonSize = 48;
+	state.Open(layout);
+
+	// Focus went to one of the buttons
+	CHECK(!state.Deactivated(true));
+	CHECK(state.IsVisible());
+
+	// A click: the deactivation it causes keeps the toolbar, the next one
+	// does not
+	state.ButtonClicked();
+	CHECK(!state.Deactivated(false));
+	CHECK(state.IsVisible());
+	CHECK(state.Deactivated(false));
+	CHECK(!state.IsVisible());
+
+	// A click whose message was handled before focus moved on
+	state.Open(layout);
+	state.ButtonClicked();
+	state.MessageHandled();
+	CHECK(state.Deactivated(false));
+
+	// Opening again forgets a click left over from before
+	state.ButtonClicked();
+	CHECK(state.Open(layout) == HeosToolbarState::Action::Show);
+	CHECK(state.Deactivated(false));
+}
+
+TEST(LatencyProbeKeepsRecentSamples)
+{
+	typedef HeosLatencyProbe::Clock Clock;
+	HeosLatencyProbe probe;
+	Clock::time_point t0;
+	auto at = [&](int ms) { return t0 + std::chrono::milliseconds(ms); };
+
+	CHECK(!probe.Stop(at(5)));
+	CHECK_EQUAL(0u, probe.Count());
+	CHECK_EQUAL(0.0, probe.MedianMs());
+
+	probe.Start(at(0));
+	CHECK(probe.IsRunning());
+	CHECK(probe.Stop(at(12)));
+	CHECK(!probe.Stop(at(20))); // once per Start()
+	CHECK_EQUAL(12.0, probe.LastMs());
+
+	probe.Start(at(100));
+	probe.Cancel();
+	CHECK(!probe.Stop(at(150)));
+	CHECK_EQUAL(1u, probe.Count());
+
+	// 70 samples of 1..70 ms: the first 6 fall out of the ring
+	HeosLatencyProbe many;
+	for (int i = 1; i <= 70; ++i) {
+		many.Start(at(1000 * i));
+		many.Stop(at(1000 * i + i));
+	}
+	CHECK_EQUAL(70u, many.Count());
+	CHECK_EQUAL(70.0, many.LastMs());
+	CHECK_EQUAL(70.0, many.WorstMs());
+	CHECK_EQUAL(39.0, many.MedianMs()); // upper middle of 7..70
+	CHECK_EQUAL("70.0 ms (median 39.0, worst 70.0, 64 samples)", many.Report());
+}
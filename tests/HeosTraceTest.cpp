@@ -0,0 +1,211 @@
+// The startup trace: phases nest per thread, threads do not close each
+// other's phases, Close() ends what is still open and stops recording, and
+// the export is the Chrome trace event format.
+
+#include "HeosTrace.h"
+#include "HeosTest.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <thread>
+
+#include <json/json.h>
+
+namespace {
+
+void Sleep(int ms)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+Json::Value Parse(const std::string& text)
+{
+	Json::CharReaderBuilder builder;
+	builder["failIfExtra"] = true;
+	Json::Value root;
+	std::string errs;
+	std::istringstream in(text);
+	if (!Json::parseFromStream(builder, in, &root, &errs))
+		FAIL("not JSON: " + errs);
+	return root;
+}
+
+// The exported events called name, in the order they were recorded.
+std::vector<Json::Value> Events(const Json::Value& trace, const char* name)
+{
+	std::vector<Json::Value> found;
+	for (const Json::Value& event : trace["traceEvents"]) {
+		if (event["name"].asString() == name)
+			found.push_back(event);
+	}
+	return found;
+}
+
+bool Within(const Json::Value& inner, const Json::Value& outer)
+{
+	return inner["ts"].asInt64() >= outer["ts"].asInt64()
+		&& inner["ts"].asInt64() + inner["dur"].asInt64() <= outer["ts"].asInt64() + outer["dur"].asInt64();
+}
+
+} // namespace
+
+TEST(PhasesNest)
+{
+	HeosTrace trace;
+	trace.Begin("outer");
+	Sleep(2);
+	{
+		HeosTrace::Scope scope(trace, "inner");
+		Sleep(2);
+		trace.Instant("halfway");
+	}
+	Sleep(2);
+	trace.End();
+	trace.End(); // nothing left open: ignored
+	trace.Close();
+
+	Json::Value exported = Parse(trace.ToChromeJson());
+	std::vector<Json::Value> outer = Events(exported, "outer");
+	std::vector<Json::Value> inner = Events(exported, "inner");
+	std::vector<Json::Value> halfway = Events(exported, "halfway");
+	CHECK_EQUAL(1u, outer.size());
+	CHECK_EQUAL(1u, inner.size());
+	CHECK_EQUAL(1u, halfway.size());
+	if (outer.size() != 1 || inner.size() != 1 || halfway.size() != 1)
+		return;
+	CHECK(Within(inner[0], outer[0]));
+	CHECK(inner[0]["ts"].asInt64() >= outer[0]["ts"].asInt64() + 2000);
+	CHECK(inner[0]["dur"].asInt64() >= 2000);
+	CHECK(outer[0]["dur"].asInt64() >= inner[0]["dur"].asInt64() + 4000);
+	CHECK(halfway[0]["ts"].asInt64() >= inner[0]["ts"].asInt64());
+	CHECK_EQUAL(halfway[0]["ts"].asInt64(), trace.InstantAt("halfway"));
+	CHECK_EQUAL(-1, trace.InstantAt("never"));
+}
+
+TEST(ThreadsKeepTheirOwnPhases)
+{
+	HeosTrace trace;
+	trace.NameThread("main");
+	trace.Begin("main phase");
+	std::thread worker([&] {
+		trace.NameThread("worker");
+		trace.Begin("worker phase");
+		Sleep(5);
+		trace.End();
+		trace.End(); // must not close the main thread's phase
+	});
+	worker.join();
+	Sleep(2);
+	trace.End();
+	trace.Close();
+
+	Json::Value exported = Parse(trace.ToChromeJson());
+	std::vector<Json::Value> mainPhase = Events(exported, "main phase");
+	std::vector<Json::Value> workerPhase = Events(exported, "worker phase");
+	CHECK_EQUAL(1u, mainPhase.size());
+	CHECK_EQUAL(1u, workerPhase.size());
+	if (mainPhase.size() != 1 || workerPhase.size() != 1)
+		return;
+	CHECK(mainPhase[0]["tid"] != workerPhase[0]["tid"]);
+	// Ended by its own End(), after the worker's phase
+	CHECK(Within(workerPhase[0], mainPhase[0]));
+	CHECK(mainPhase[0]["ts"].asInt64() + mainPhase[0]["dur"].asInt64()
+		>= workerPhase[0]["ts"].asInt64() + workerPhase[0]["dur"].asInt64() + 2000);
+
+	// Each thread's name goes with its tid
+	std::vector<Json::Value> names = Events(exported, "thread_name");
+	CHECK_EQUAL(2u, names.size());
+	for (const Json::Value& name : names) {
+		const Json::Value& phase = name["args"]["name"].asString() == "main" ? mainPhase[0] : workerPhase[0];
+		CHECK(name["tid"] == phase["tid"]);
+	}
+}
+
+TEST(CloseEndsOpenPhases)
+{
+	HeosTrace trace;
+	trace.Begin("never ended");
+	std::thread([&] { trace.Begin("other thread, never ended"); }).join();
+	Sleep(2);
+	CHECK(!trace.IsClosed());
+	trace.Close();
+	CHECK(trace.IsClosed());
+	int64_t closedBy = trace.Now();
+
+	// Recording has stopped
+	trace.End();
+	trace.Begin("after close");
+	trace.Instant("after close");
+	trace.NameThread("after close");
+	CHECK_EQUAL(-1, trace.InstantAt("after close"));
+
+	// Exported as ending at Close(), however much later the export is
+	Sleep(5);
+	Json::Value exported = Parse(trace.ToChromeJson());
+	CHECK(Events(exported, "after close").empty());
+	CHECK(Events(exported, "thread_name").empty());
+	for (const char* name : { "never ended", "other thread, never ended" }) {
+		std::vector<Json::Value> phase = Events(exported, name);
+		CHECK_EQUAL(1u, phase.size());
+		if (phase.size() != 1)
+			continue;
+		int64_t end = phase[0]["ts"].asInt64() + phase[0]["dur"].asInt64();
+		CHECK(end >= 2000);
+		CHECK(end <= closedBy);
+	}
+	CHECK(trace.ToChromeJson() == trace.ToChromeJson());
+}
+
+TEST(ChromeJsonFormat)
+{
+	HeosTrace::Clock::time_point origin = HeosTrace::Clock::now() - std::chrono::milliseconds(10);
+	HeosTrace trace(origin);
+	trace.NameThread("main");
+	trace.Begin("phase");
+	trace.Instant("point");
+	trace.End();
+	trace.Close();
+
+	Json::Value exported = Parse(trace.ToChromeJson());
+	CHECK(exported.isObject());
+	CHECK_EQUAL("ms", exported["displayTimeUnit"].asString());
+	const Json::Value& events = exported["traceEvents"];
+	CHECK(events.isArray());
+	CHECK_EQUAL(3u, events.size());
+	for (const Json::Value& event : events) {
+		CHECK(event["name"].isString());
+		CHECK(event["ph"].isString());
+		CHECK_EQUAL(1, event["pid"].asInt());
+		CHECK(event["tid"].isInt());
+		const std::string ph = event["ph"].asString();
+		if (ph == "M") {
+			CHECK_EQUAL("thread_name", event["name"].asString());
+			CHECK_EQUAL("main", event["args"]["name"].asString());
+		}
+		else if (ph == "X") {
+			// Microseconds since the origin, which was 10 ms ago
+			CHECK(event["ts"].asInt64() >= 10000);
+			CHECK(event["dur"].isIntegral());
+			CHECK(event["dur"].asInt64() >= 0);
+		}
+		else if (ph == "i") {
+			CHECK_EQUAL("p", event["s"].asString());
+			CHECK(event["ts"].asInt64() >= 10000);
+			CHECK(!event.isMember("dur"));
+		}
+		else {
+			FAIL("unexpected phase " + ph);
+		}
+	}
+
+	const std::string path = "HeosTraceTest.json";
+	CHECK(trace.WriteChromeJson(path));
+	std::ifstream in(path, std::ios::binary);
+	std::string written((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	CHECK_EQUAL(trace.ToChromeJson(), written);
+	in.close();
+	std::remove(path.c_str());
+	CHECK(!trace.WriteChromeJson("no such directory/HeosTraceTest.json"));
+}
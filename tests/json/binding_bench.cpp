@@ -0,0 +1,141 @@
+// Decoding a get_queue reply into structs: Json::decode() straight from the
+// text against CharReader building a Value tree that is then copied out.
+// Not part of ctest; run it by hand after touching json/binding.h:
+//   ./json_binding_bench_compact [seconds per case]
+
+#include <json/binding.h>
+#include <json/reader.h>
+#include <json/writer.h>
+
+#include "json_bench.h"
+
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+namespace {
+
+struct Status {
+  Json::String command;
+  Json::String result;
+  Json::String message;
+};
+
+struct Media {
+  Json::String type;
+  Json::String song;
+  Json::String album;
+  Json::String artist;
+  Json::String imageUrl;
+  Json::String mid;
+  int qid = 0;
+  int sid = 0;
+  double duration = 0;
+  bool explicitLyrics = false;
+};
+
+struct Queue {
+  Status heos;
+  std::vector<Media> payload;
+};
+
+} // namespace
+
+namespace Json {
+template <> struct Binding<Status> {
+  static constexpr auto fields() {
+    return std::make_tuple(field("command", &Status::command),
+                           field("result", &Status::result),
+                           field("message", &Status::message));
+  }
+};
+template <> struct Binding<Media> {
+  static constexpr auto fields() {
+    return std::make_tuple(
+        field("type", &Media::type), field("song", &Media::song),
+        field("album", &Media::album), field("artist", &Media::artist),
+        field("image_url", &Media::imageUrl), field("mid", &Media::mid),
+        field("qid", &Media::qid), field("sid", &Media::sid),
+        field("duration", &Media::duration),
+        field("explicit", &Media::explicitLyrics));
+  }
+};
+template <> struct Binding<Queue> {
+  static constexpr auto fields() {
+    return std::make_tuple(field("heos", &Queue::heos),
+                           field("payload", &Queue::payload));
+  }
+};
+} // namespace Json
+
+namespace {
+
+using JsonBench::measure;
+
+// What code without the binding writes by hand.
+Queue fromValue(const Json::Value& root) {
+  Queue queue;
+  const Json::Value& heos = root["heos"];
+  queue.heos.command = heos["command"].asString();
+  queue.heos.result = heos["result"].asString();
+  queue.heos.message = heos["message"].asString();
+  const Json::Value& payload = root["payload"];
+  queue.payload.reserve(payload.size());
+  for (const Json::Value& item : payload) {
+    queue.payload.emplace_back();
+    Media& media = queue.payload.back();
+    media.type = item["type"].asString();
+    media.song = item["song"].asString();
+    media.album = item["album"].asString();
+    media.artist = item["artist"].asString();
+    media.imageUrl = item["image_url"].asString();
+    media.mid = item["mid"].asString();
+    media.qid = item["qid"].asInt();
+    media.sid = item["sid"].asInt();
+    media.duration = item["duration"].asDouble();
+    media.explicitLyrics = item["explicit"].asBool();
+  }
+  return queue;
+}
+
+void run(int length, double seconds) {
+  printf("queue (%d tracks)\n", length);
+  Json::StreamWriterBuilder writer;
+  writer["indentation"] = "";
+  const Json::String doc = Json::writeString(writer, JsonBench::queue(length));
+  char const* const begin = doc.data();
+  char const* const end = begin + doc.size();
+
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  measure("CharReader, Value tree", seconds, [&] {
+    Json::Value root;
+    reader->parse(begin, end, &root, nullptr);
+    return doc.size();
+  });
+  measure("CharReader, then copied out", seconds, [&] {
+    Json::Value root;
+    reader->parse(begin, end, &root, nullptr);
+    return fromValue(root).payload.size() ? doc.size() : 0;
+  });
+  measure("Json::decode", seconds, [&] {
+    Queue queue;
+    Json::decode(begin, end, queue, nullptr);
+    return queue.payload.size() ? doc.size() : 0;
+  });
+
+  Queue decoded;
+  Json::decode(begin, end, decoded, nullptr);
+  measure("Json::toValue", seconds, [&] {
+    return Json::toValue(decoded).size() ? doc.size() : 0;
+  });
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const double seconds = JsonBench::seconds(argc, argv);
+  run(1, seconds);
+  run(500, seconds);
+  return 0;
+}
@@ -0,0 +1,219 @@
+// The typed binding: decode() and BindingHandler against toValue() and
+// CharReader, nested structs and vectors, keys the struct does not have or
+// the document leaves out, and values that do not fit their member.
+
+#include <json/binding.h>
+#include <json/reader.h>
+#include <json/writer.h>
+
+#include "HeosTest.h"
+#include "json_test_values.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace {
+
+struct Track {
+  Json::String title;
+  int id = 0;
+  double length = 0;
+  bool explicitLyrics = false;
+};
+
+struct Album {
+  Json::String name;
+  uint16_t year = 0;
+  Track best;
+  std::vector<Track> tracks;
+  std::vector<std::vector<Json::String>> tags;
+  std::vector<int64_t> plays;
+};
+
+} // namespace
+
+namespace Json {
+template <> struct Binding<Track> {
+  static constexpr auto fields() {
+    return std::make_tuple(field("title", &Track::title),
+                           field("id", &Track::id),
+                           field("length", &Track::length),
+                           field("explicit", &Track::explicitLyrics));
+  }
+};
+template <> struct Binding<Album> {
+  static constexpr auto fields() {
+    return std::make_tuple(field("name", &Album::name),
+                           field("year", &Album::year),
+                           field("best", &Album::best),
+                           field("tracks", &Album::tracks),
+                           field("tags", &Album::tags),
+                           field("plays", &Album::plays));
+  }
+};
+} // namespace Json
+
+namespace {
+
+using JsonTest::below;
+using JsonTest::oneIn;
+using JsonTest::Random;
+
+Track randomTrack(Random& random) {
+  Track track;
+  track.title = JsonTest::randomString(random);
+  track.id = static_cast<int>(random());
+  track.length = JsonTest::randomDouble(random);
+  track.explicitLyrics = oneIn(random, 2);
+  return track;
+}
+
+Album randomAlbum(Random& random) {
+  Album album;
+  album.name = JsonTest::randomString(random);
+  album.year = static_cast<uint16_t>(random());
+  album.best = randomTrack(random);
+  for (unsigned n = below(random, 6); n > 0; --n)
+    album.tracks.push_back(randomTrack(random));
+  for (unsigned n = below(random, 4); n > 0; --n) {
+    album.tags.emplace_back();
+    for (unsigned m = below(random, 4); m > 0; --m)
+      album.tags.back().push_back(JsonTest::randomString(random, 3));
+  }
+  for (unsigned n = below(random, 5); n > 0; --n)
+    album.plays.push_back(static_cast<int64_t>(
+        (static_cast<uint64_t>(random()) << 32) | random()));
+  return album;
+}
+
+template <class T> bool decode(const Json::String& doc, T& out,
+                               Json::String* errs = nullptr) {
+  return Json::decode(doc.data(), doc.data() + doc.size(), out, errs);
+}
+
+Json::String write(const Json::Value& value) {
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "";
+  return Json::writeString(builder, value);
+}
+
+} // namespace
+
+TEST(roundTrip) {
+  Random random(HeosTestSeed());
+  for (unsigned round = 0; round < 300 * HeosTestScale(); ++round) {
+    const Album album = randomAlbum(random);
+    const Json::Value value = Json::toValue(album);
+    CHECK(value["tracks"].size() == album.tracks.size());
+    CHECK(value["best"]["explicit"].asBool() == album.best.explicitLyrics);
+    CHECK(value["plays"].size() == album.plays.size());
+
+    Album decoded;
+    Json::String errs;
+    CHECK(decode(write(value), decoded, &errs));
+    CHECK_EQUAL("", errs);
+    CHECK(Json::toValue(decoded) == value);
+
+    // Fed a byte at a time through the handler itself
+    Album pushed;
+    Json::BindingHandler<Album> handler(pushed);
+    Json::PushParser parser(handler);
+    const Json::String doc = write(value);
+    for (char c : doc)
+      parser.feed(&c, 1);
+    CHECK(parser.finish() == Json::PushParser::complete);
+    CHECK(Json::toValue(pushed) == value);
+  }
+}
+
+TEST(missingAndExtraKeys) {
+  Album album;
+  album.name = "kept";
+  album.year = 1999;
+  // Unknown keys are skipped with everything below them, including members
+  // whose names match the struct's; null leaves a member as it was
+  CHECK(decode(Json::String("{\"extra\": {\"name\": \"no\", \"year\": [1, 2]},"
+                            " \"tracks\": [{\"title\": \"a\", \"bpm\": 120},"
+                            " {\"id\": 2, \"more\": [{\"id\": 3}]}],"
+                            " \"year\": null, \"plays\": [], \"also\": 1}"),
+               album));
+  CHECK_EQUAL("kept", album.name);
+  CHECK_EQUAL(1999, album.year);
+  CHECK_EQUAL(2u, album.tracks.size());
+  CHECK_EQUAL("a", album.tracks[0].title);
+  CHECK_EQUAL(0, album.tracks[0].id);
+  CHECK_EQUAL("", album.tracks[1].title);
+  CHECK_EQUAL(2, album.tracks[1].id);
+  CHECK(album.plays.empty());
+  CHECK_EQUAL("", album.best.title);
+
+  Track empty;
+  CHECK(decode(Json::String("{}"), empty));
+  CHECK_EQUAL(0, empty.id);
+  CHECK(decode(Json::String("null"), empty));
+}
+
+TEST(typeMismatches) {
+  struct Case {
+    const char* doc;
+    const char* error;
+  };
+  static const Case cases[] = {
+      {"{\"best\": {\"id\": \"7\"}}", "'id': expected an integer"},
+      {"{\"best\": {\"id\": 1.5}}", "'id': expected an integer"},
+      {"{\"best\": {\"id\": 2147483648}}", "'id': expected an integer"},
+      {"{\"year\": 65536}", "'year': expected an integer"},
+      {"{\"year\": -1}", "'year': expected an integer"},
+      {"{\"best\": {\"length\": true}}", "'length': expected a number"},
+      {"{\"best\": {\"explicit\": 1}}", "'explicit': expected a boolean"},
+      {"{\"name\": []}", "'name': expected a string"},
+      {"{\"name\": {}}", "'name': expected a string"},
+      {"{\"best\": [1]}", "'best': expected an object"},
+      {"{\"tracks\": {\"title\": \"a\"}}", "'tracks': expected an array"},
+      {"{\"tracks\": [1]}", "'tracks': expected an object"},
+      {"{\"tags\": [[\"a\", [\"b\"]]]}", "'tags': expected a string"},
+      {"[]", "expected an object"},
+  };
+  for (const Case& c : cases) {
+    Album album;
+    Json::String errs;
+    if (decode(Json::String(c.doc), album, &errs)) {
+      FAIL(Json::String("accepted ") + c.doc);
+    } else if (errs.find(c.error) == Json::String::npos) {
+      FAIL(Json::String(c.doc) + " gave " + errs);
+    }
+  }
+
+  // Malformed JSON is reported like any parse error
+  Album album;
+  Json::String errs;
+  CHECK(!decode(Json::String("{\"name\": \"a\""), album, &errs));
+  CHECK(!errs.empty());
+  CHECK(!decode(Json::String("{\"tracks\": [{\"id\": }]}"), album, &errs));
+  CHECK(errs.find("Line 1, Column 20") != Json::String::npos);
+}
+
+TEST(lenientConversions) {
+  // Integers accept reals that hold one; strings accept any scalar
+  Album album;
+  CHECK(decode(Json::String("{\"year\": 2.0e3, \"name\": 12,"
+                            " \"best\": {\"title\": true, \"id\": -3e0,"
+                            " \"length\": 4}, \"tags\": [[1.5, false]]}"),
+               album));
+  CHECK_EQUAL(2000, album.year);
+  CHECK_EQUAL("12", album.name);
+  CHECK_EQUAL("true", album.best.title);
+  CHECK_EQUAL(-3, album.best.id);
+  CHECK(album.best.length == 4.0);
+  CHECK(album.tags.size() == 1 && album.tags[0].size() == 2);
+  CHECK(album.tags[0][0] == Json::Value(1.5).asString());
+  CHECK_EQUAL("false", album.tags[0][1]);
+
+  // Scalars and vectors bind at the root too
+  std::vector<int> numbers;
+  CHECK(decode(Json::String("[1, 2, 3]"), numbers));
+  CHECK(numbers == std::vector<int>({1, 2, 3}));
+  double real = 0;
+  CHECK(decode(Json::String("0.25"), real));
+  CHECK(real == 0.25);
+}
@@ -0,0 +1,218 @@
+// CborWriter and CborReader: random values survive the round trip with their
+// types, every truncation of an encoding is refused, and the heads and
+// canonical order are those RFC 8949 prescribes.
+
+#include <json/cbor.h>
+
+#include "HeosTest.h"
+#include "json_test_values.h"
+
+#include <sstream>
+#include <vector>
+
+namespace {
+
+using JsonTest::below;
+using JsonTest::Random;
+
+Json::String hex(const Json::String& bytes) {
+  static const char digits[] = "0123456789abcdef";
+  Json::String text;
+  for (char c : bytes) {
+    text.push_back(digits[(static_cast<unsigned char>(c) >> 4) & 0xf]);
+    text.push_back(digits[static_cast<unsigned char>(c) & 0xf]);
+  }
+  return text;
+}
+
+Json::String encode(const Json::Value& value, bool canonical = false) {
+  Json::CborWriter writer;
+  writer.setCanonical(canonical);
+  Json::String out;
+  writer.write(value, out);
+  return out;
+}
+
+bool decode(const Json::String& bytes, Json::Value& value,
+            size_t* consumed = nullptr) {
+  Json::CborReader reader;
+  return reader.parse(bytes.data(), bytes.data() + bytes.size(), &value,
+                      nullptr, consumed);
+}
+
+} // namespace
+
+TEST(valuesRoundTripWithTheirTypes) {
+  Random random(HeosTestSeed());
+  for (int i = 0; i < 5000 * HeosTestScale(); ++i) {
+    const Json::Value value = JsonTest::randomValue(random);
+    const Json::String bytes = encode(value, JsonTest::oneIn(random, 2));
+    Json::Value back;
+    size_t consumed = 0;
+    // operator== compares types first, so 1 and 1.0 would differ
+    if (!decode(bytes, back, &consumed) || !(back == value) ||
+        consumed != bytes.size()) {
+      FAIL("does not read back: " + value.toStyledString() + hex(bytes));
+      return;
+    }
+  }
+}
+
+TEST(streamMatchesString) {
+  Random random(HeosTestSeed());
+  Json::CborWriter writer;
+  Json::CborReader reader;
+  for (int i = 0; i < 1000 * HeosTestScale(); ++i) {
+    // Long enough now and then to take more than one chunk
+    Json::Value value(Json::arrayValue);
+    for (unsigned n = below(random, 30); n > 0; --n)
+      value.append(JsonTest::randomValue(random));
+    std::ostringstream out;
+    CHECK(writer.write(value, out));
+    CHECK_EQUAL(hex(encode(value)), hex(out.str()));
+
+    std::istringstream in(out.str() + out.str());
+    Json::Value first;
+    Json::Value second;
+    CHECK(reader.parse(in, &first, nullptr));
+    CHECK(reader.parse(in, &second, nullptr));
+    CHECK(first == value && second == value);
+    if (HeosTestFailures())
+      return;
+  }
+}
+
+TEST(sequencesReadItemByItem) {
+  Random random(HeosTestSeed());
+  std::vector<Json::Value> values;
+  Json::String sequence;
+  for (int n = 0; n < 50; ++n) {
+    values.push_back(JsonTest::randomValue(random, 2));
+    sequence += encode(values.back());
+  }
+  size_t at = 0;
+  for (const auto& expected : values) {
+    Json::Value value;
+    size_t consumed = 0;
+    CHECK(decode(sequence.substr(at), value, &consumed));
+    CHECK(value == expected);
+    at += consumed;
+  }
+  CHECK_EQUAL(sequence.size(), at);
+}
+
+TEST(everyTruncationFails) {
+  Random random(HeosTestSeed());
+  for (int i = 0; i < 200 * HeosTestScale(); ++i) {
+    const Json::String bytes = encode(JsonTest::randomValue(random));
+    for (size_t length = 0; length < bytes.size(); ++length) {
+      Json::Value value;
+      Json::String errs;
+      Json::CborReader reader;
+      if (reader.parse(bytes.data(), bytes.data() + length, &value, &errs) ||
+          errs.empty()) {
+        FAIL("accepted " + std::to_string(length) + " of " + hex(bytes));
+        return;
+      }
+      std::istringstream in(bytes.substr(0, length));
+      if (reader.parse(in, &value, nullptr)) {
+        FAIL("stream accepted " + std::to_string(length) + " of " + hex(bytes));
+        return;
+      }
+    }
+  }
+}
+
+TEST(headsAreShortest) {
+  CHECK_EQUAL("00", hex(encode(0)));
+  CHECK_EQUAL("17", hex(encode(23)));
+  CHECK_EQUAL("1818", hex(encode(24)));
+  CHECK_EQUAL("190100", hex(encode(256)));
+  CHECK_EQUAL("1a00010000", hex(encode(65536)));
+  CHECK_EQUAL("1b0000000100000000", hex(encode(Json::Int64(4294967296LL))));
+  CHECK_EQUAL("20", hex(encode(-1)));
+  CHECK_EQUAL("3818", hex(encode(-25)));
+  CHECK_EQUAL("1bffffffffffffffff",
+              hex(encode(Json::Value(Json::UInt64(0xffffffffffffffffULL)))));
+  CHECK_EQUAL("f93e00", hex(encode(1.5)));
+  CHECK_EQUAL("f98000", hex(encode(-0.0)));
+  CHECK_EQUAL("fa47c35000", hex(encode(100000.0)));
+  CHECK_EQUAL("fb3ff199999999999a", hex(encode(1.1)));
+  CHECK_EQUAL("f6", hex(encode(Json::Value())));
+  CHECK_EQUAL("f5", hex(encode(true)));
+  CHECK_EQUAL("6568656f7321", hex(encode("heos!")));
+  CHECK_EQUAL("80", hex(encode(Json::Value(Json::arrayValue))));
+  CHECK_EQUAL("a0", hex(encode(Json::Value(Json::objectValue))));
+}
+
+TEST(canonicalOrderSortsEncodedKeys) {
+  Json::Value object;
+  object["b"] = 1;
+  object["aa"] = 2;
+  // Shorter encoded keys first, so "b" comes before "aa"
+  CHECK_EQUAL("a2616201626161" "02", hex(encode(object, true)));
+
+  // Members added in any order encode the same way
+  Random random(HeosTestSeed());
+  for (int i = 0; i < 500 * HeosTestScale(); ++i) {
+    std::vector<Json::String> names;
+    for (unsigned n = below(random, 12); n > 0; --n)
+      names.push_back(JsonTest::randomString(random, 3));
+    Json::Value forward(Json::objectValue);
+    Json::Value backward(Json::objectValue);
+    for (size_t n = 0; n < names.size(); ++n)
+      forward[names[n]] = static_cast<int>(n);
+    for (size_t n = names.size(); n-- > 0;)
+      if (!backward.isMember(names[n]))
+        backward[names[n]] = forward[names[n]];
+    CHECK_EQUAL(hex(encode(forward, true)), hex(encode(backward, true)));
+    if (HeosTestFailures())
+      return;
+  }
+}
+
+TEST(readerHonorsStackLimit) {
+  Json::String nested(300, '\x81'); // arrays of one element
+  nested += '\x00';
+  Json::Value value;
+  Json::CborReader reader;
+  CHECK(reader.parse(nested.data(), nested.data() + nested.size(), &value,
+                     nullptr));
+  reader.setStackLimit(100);
+  Json::String errs;
+  CHECK(!reader.parse(nested.data(), nested.data() + nested.size(), &value,
+                      &errs));
+  CHECK(!errs.empty());
+}
+
+TEST(garbageIsRefusedCleanly) {
+  Random random(HeosTestSeed());
+  Json::CborReader reader;
+  reader.setStackLimit(64);
+  int accepted = 0;
+  for (int i = 0; i < 100000 * HeosTestScale(); ++i) {
+    Json::String bytes;
+    if (JsonTest::oneIn(random, 2)) {
+      bytes = encode(JsonTest::randomValue(random, 2));
+      for (unsigned n = 1 + below(random, 3); n > 0 && !bytes.empty(); --n)
+        bytes[below(random, static_cast<unsigned>(bytes.size()))] =
+            static_cast<char>(below(random, 256));
+    } else {
+      for (unsigned n = below(random, 24); n > 0; --n)
+        bytes.push_back(static_cast<char>(below(random, 256)));
+    }
+    Json::Value value;
+    size_t consumed = 0;
+    try {
+      if (reader.parse(bytes.data(), bytes.data() + bytes.size(), &value,
+                       nullptr, &consumed)) {
+        ++accepted;
+        CHECK(consumed <= bytes.size());
+      }
+    } catch (const std::exception& e) {
+      FAIL(Json::String("threw ") + e.what() + " on " + hex(bytes));
+      return;
+    }
+  }
+  CHECK(accepted > 0);
+}
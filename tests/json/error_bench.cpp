@@ -0,0 +1,100 @@
+// Reporting where parse errors are: an 8 MB queue with CRLF line breaks and
+// an error near its end, and a capture of 2,000 malformed replies read one
+// after the other by the same CharReader. The legacy Reader rescans the
+// document for every location; CharReader indexes the line breaks once. A
+// parse stops at its first error, which names at most two locations, so
+// either way locating it should cost a fraction of the parse. Not part of
+// ctest; run it by hand after touching error reporting in json_reader.cpp:
+//   ./json_error_bench_compact [seconds per case]
+
+#include <json/reader.h>
+#include <json/writer.h>
+
+#include "json_bench.h"
+
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+namespace {
+
+using JsonBench::measure;
+
+// Styled text with every "\n" turned into "\r\n".
+Json::String crlf(const Json::Value& value) {
+  Json::StreamWriterBuilder writer;
+  const Json::String text = Json::writeString(writer, value);
+  Json::String out;
+  out.reserve(text.size() + text.size() / 8);
+  for (char c : text) {
+    if (c == '\n')
+      out += '\r';
+    out += c;
+  }
+  return out;
+}
+
+// A bad escape, reported at the string and at the escape, before the
+// closing lines of doc.
+Json::String breakNearTheEnd(Json::String doc) {
+  const size_t at = doc.rfind("\"Artist\"");
+  doc.replace(at, 8, "\"Art\\ist\"");
+  return doc;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const double seconds = JsonBench::seconds(argc, argv);
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+
+  const Json::String valid = crlf(JsonBench::queue(25000));
+  const Json::String large = breakNearTheEnd(valid);
+  printf("%.1f MB queue, one error near the end\n", large.size() / 1e6);
+  Json::String errs;
+  Json::Value root;
+  reader->parse(large.data(), large.data() + large.size(), &root, &errs);
+  printf("%s", errs.c_str());
+
+  measure("CharReader, valid", seconds, [&] {
+    reader->parse(valid.data(), valid.data() + valid.size(), &root, nullptr);
+    return valid.size();
+  });
+  measure("CharReader, error located", seconds, [&] {
+    reader->parse(large.data(), large.data() + large.size(), &root, &errs);
+    return large.size();
+  });
+  measure("Reader, error located", seconds, [&] {
+    Json::Reader legacy;
+    legacy.parse(large.data(), large.data() + large.size(), root, false);
+    return legacy.getFormattedErrorMessages().size() ? large.size() : 0;
+  });
+
+  std::vector<Json::String> replies;
+  size_t bytes = 0;
+  for (int n = 0; n < 2000; ++n) {
+    replies.push_back(breakNearTheEnd(crlf(JsonBench::queue(1 + n % 16))));
+    bytes += replies.back().size();
+  }
+  printf("%.1f MB capture of %zu malformed replies\n", bytes / 1e6,
+         replies.size());
+  measure("CharReader, one per reply", seconds, [&] {
+    size_t located = 0;
+    for (const Json::String& reply : replies) {
+      reader->parse(reply.data(), reply.data() + reply.size(), &root, &errs);
+      located += errs.size();
+    }
+    return located ? bytes : 0;
+  });
+  measure("Reader, one per reply", seconds, [&] {
+    size_t located = 0;
+    for (const Json::String& reply : replies) {
+      Json::Reader legacy;
+      legacy.parse(reply.data(), reply.data() + reply.size(), root, false);
+      located += legacy.getFormattedErrorMessages().size();
+    }
+    return located ? bytes : 0;
+  });
+  return 0;
+}
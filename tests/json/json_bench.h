@@ -0,0 +1,89 @@
+// Shared by the json_*_bench programs, which are built but not run by ctest:
+// documents shaped like what the app reads and writes, and a timing loop.
+// Run one by hand after touching the code it measures:
+//   ./json_<name>_bench_compact [seconds per case]
+
+#ifndef HEOS_TESTS_JSON_BENCH_H_INCLUDED
+#define HEOS_TESTS_JSON_BENCH_H_INCLUDED
+
+#include <json/value.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+
+namespace JsonBench {
+
+/// get_now_playing_media's payload for track n.
+inline Json::Value track(int n) {
+  Json::Value media;
+  media["type"] = "song";
+  media["song"] = "Track " + std::to_string(n) + " \xe2\x80\x93 Remastered";
+  media["album"] = "Album \"Live\" at the Caf\xc3\xa9";
+  media["artist"] = "Artist";
+  media["image_url"] = "http://192.168.1.20:8080/art/" + std::to_string(n) +
+                       ".jpg?size=large&format=jpeg";
+  media["mid"] = std::to_string(100000 + n);
+  media["qid"] = n;
+  media["sid"] = 1024;
+  media["duration"] = 181.25 + n;
+  media["explicit"] = n % 7 == 0;
+  return media;
+}
+
+/// What the control API serves.
+inline Json::Value state() {
+  Json::Value root;
+  root["device"] = "Living Room";
+  root["connected"] = true;
+  root["muted"] = false;
+  root["volume"] = 23;
+  root["nowPlaying"] = track(1);
+  return root;
+}
+
+/// A get_queue reply of length tracks.
+inline Json::Value queue(int length) {
+  Json::Value root;
+  Json::Value& heos = root["heos"];
+  heos["command"] = "player/get_queue";
+  heos["result"] = "success";
+  heos["message"] = "pid=-1241384102&range=0," + std::to_string(length - 1);
+  Json::Value& items = root["payload"];
+  for (int n = 0; n < length; ++n)
+    items.append(track(n));
+  return root;
+}
+
+/// Runs work() for about seconds and prints its rate; work() returns the
+/// bytes it went through. Returns the calls per second.
+inline double measure(const char* name, double seconds,
+                      const std::function<size_t()>& work) {
+  size_t bytes = 0;
+  size_t calls = 0;
+  const auto started = std::chrono::steady_clock::now();
+  double elapsed = 0;
+  do {
+    for (int i = 0; i < 16; ++i)
+      bytes += work();
+    calls += 16;
+    elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                            started)
+                  .count();
+  } while (elapsed < seconds);
+  const double rate = static_cast<double>(calls) / elapsed;
+  printf("  %-30s %8.1f MB/s %10.0f calls/s\n", name,
+         static_cast<double>(bytes) / elapsed / 1e6, rate);
+  return rate;
+}
+
+/// The seconds per case given on the command line, 1 if none.
+inline double seconds(int argc, char** argv) {
+  return argc > 1 ? atof(argv[1]) : 1.0;
+}
+
+} // namespace JsonBench
+
+#endif // HEOS_TESTS_JSON_BENCH_H_INCLUDED
@@ -0,0 +1,136 @@
+// Random JSON values for the json tests. Everything generated survives a
+// write and read back as an equal Value (same types included): strings are
+// valid UTF-8, integers that fit a LargestInt are stored as one, and reals
+// are finite.
+
+#ifndef HEOS_TESTS_JSON_TEST_VALUES_H_INCLUDED
+#define HEOS_TESTS_JSON_TEST_VALUES_H_INCLUDED
+
+#include <json/value.h>
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <random>
+
+namespace JsonTest {
+
+using Random = std::mt19937;
+
+inline unsigned below(Random& random, unsigned n) { return random() % n; }
+
+inline bool oneIn(Random& random, unsigned n) { return below(random, n) == 0; }
+
+/// Short strings built from pieces that exercise escaping and UTF-8, now and
+/// then with a long clean run to cross the vector widths of the scanners.
+inline Json::String randomString(Random& random, unsigned maxPieces = 12) {
+  static const char* const pieces[] = {
+      "a",    "Z",    "9",    " ",        "heos",         "pid",
+      "\"",   "\\",   "/",    "~",        "\b",           "\f",
+      "\n",   "\r",   "\t",   "\x01",     "\x1f",         "\x7f",
+      "\xc3\xa9" /* e acute */, "\xe2\x82\xac" /* euro */,
+      "\xf0\x9f\x8e\xb5" /* musical note */};
+  const unsigned count = sizeof(pieces) / sizeof(pieces[0]);
+  Json::String text;
+  for (unsigned n = below(random, maxPieces + 1); n > 0; --n) {
+    if (oneIn(random, 40))
+      text.push_back('\0');
+    else if (oneIn(random, 20))
+      text.append(16 + below(random, 80), static_cast<char>('a' + below(random, 26)));
+    else
+      text += pieces[below(random, count)];
+  }
+  return text;
+}
+
+inline double randomDouble(Random& random) {
+  static const double edges[] = {0.0,
+                                 -0.0,
+                                 0.1,
+                                 0.5,
+                                 1.5,
+                                 -2.25,
+                                 1e21,
+                                 1e22,
+                                 1e23,
+                                 1e-7,
+                                 65504.0,
+                                 5e-324,
+                                 2.2250738585072014e-308,
+                                 1.7976931348623157e308,
+                                 9007199254740993.0};
+  switch (below(random, 5)) {
+  case 0:
+    return edges[below(random, sizeof(edges) / sizeof(edges[0]))];
+  case 1: // exact in half or single precision
+    return static_cast<double>(static_cast<int>(below(random, 4001)) - 2000) /
+           static_cast<double>(1u << below(random, 12));
+  case 2: { // any finite bit pattern
+    for (;;) {
+      uint64_t bits = (static_cast<uint64_t>(random()) << 32) | random();
+      double value;
+      std::memcpy(&value, &bits, sizeof(value));
+      if (value == value && value - value == 0)
+        return value;
+    }
+  }
+  case 3: // a short decimal
+    return static_cast<double>(below(random, 1000000)) *
+           std::pow(10.0, static_cast<int>(below(random, 41)) - 20);
+  default:
+    return std::uniform_real_distribution<double>(-1e6, 1e6)(random);
+  }
+}
+
+inline Json::Value randomScalar(Random& random) {
+  static const Json::LargestInt ints[] = {
+      0,          -1,          23,
+      24,         -24,         -25,
+      255,        256,         65535,
+      65536,      4294967295LL, 4294967296LL,
+      std::numeric_limits<Json::Int>::min(),
+      std::numeric_limits<Json::Int>::max(),
+      std::numeric_limits<Json::LargestInt>::min(),
+      std::numeric_limits<Json::LargestInt>::max()};
+  switch (below(random, 8)) {
+  case 0:
+    return Json::Value();
+  case 1:
+    return Json::Value(oneIn(random, 2));
+  case 2:
+    return Json::Value(ints[below(random, sizeof(ints) / sizeof(ints[0]))]);
+  case 3:
+    return Json::Value(static_cast<Json::LargestInt>(random()) -
+                       static_cast<Json::LargestInt>(random()));
+  case 4: // only a uint when it does not fit an int
+    return Json::Value(
+        std::numeric_limits<Json::LargestUInt>::max() -
+        static_cast<Json::LargestUInt>(below(random, 1u << 30)));
+  case 5:
+    return Json::Value(randomDouble(random));
+  default:
+    return Json::Value(randomString(random));
+  }
+}
+
+/// A tree at most \p depth containers deep.
+inline Json::Value randomValue(Random& random, int depth = 4) {
+  if (depth <= 0 || below(random, 3) == 0)
+    return randomScalar(random);
+  const unsigned size = below(random, 8);
+  if (oneIn(random, 2)) {
+    Json::Value array(Json::arrayValue);
+    for (unsigned i = 0; i < size; ++i)
+      array.append(randomValue(random, depth - 1));
+    return array;
+  }
+  Json::Value object(Json::objectValue);
+  for (unsigned i = 0; i < size; ++i)
+    object[randomString(random, 3)] = randomValue(random, depth - 1);
+  return object;
+}
+
+} // namespace JsonTest
+
+#endif // HEOS_TESTS_JSON_TEST_VALUES_H_INCLUDED
@@ -0,0 +1,187 @@
+// KeyPool: a reader given a pool must build the same Value as one without,
+// with the pooled keys pointing into the pool, and one filled pool must serve
+// readers on several threads at once.
+
+#include <json/reader.h>
+#include <json/writer.h>
+
+#include "HeosTest.h"
+#include "json_test_values.h"
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using JsonTest::below;
+using JsonTest::oneIn;
+using JsonTest::Random;
+
+// Fills the pool with some of the keys in value, those JSON would not escape.
+void poolSomeKeys(Random& random, const Json::Value& value,
+                  Json::KeyPool& pool) {
+  if (value.isObject()) {
+    for (auto it = value.begin(); it != value.end(); ++it) {
+      if (!oneIn(random, 3))
+        pool.add(it.name());
+      poolSomeKeys(random, *it, pool);
+    }
+  } else if (value.isArray()) {
+    for (const Json::Value& element : value)
+      poolSomeKeys(random, element, pool);
+  }
+}
+
+// Every key the pool has is the pool's copy; the others are not.
+bool keysArePooled(const Json::Value& value, const Json::KeyPool& pool) {
+  bool ok = true;
+  if (value.isObject()) {
+    for (auto it = value.begin(); it != value.end(); ++it) {
+      char const* end;
+      char const* key = it.memberName(&end);
+      ok = ok && (pool.find(key, end) == key) == (pool.find(key, end) != nullptr);
+      ok = ok && keysArePooled(*it, pool);
+    }
+  } else if (value.isArray()) {
+    for (const Json::Value& element : value)
+      ok = ok && keysArePooled(element, pool);
+  }
+  return ok;
+}
+
+bool parse(const Json::CharReaderBuilder& builder, const Json::String& doc,
+           Json::Value& root) {
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  return reader->parse(doc.data(), doc.data() + doc.size(), &root, nullptr);
+}
+
+bool push(const Json::KeyPool* pool, const Json::String& doc,
+          Json::Value& root) {
+  Json::ValueHandler handler(root);
+  handler.setKeyPool(pool);
+  Json::PushParser parser(handler);
+  parser.feed(doc.data(), doc.size());
+  return parser.finish() == Json::PushParser::complete;
+}
+
+} // namespace
+
+TEST(addAndFind) {
+  Json::KeyPool pool({"heos", "pid", "message"});
+  CHECK_EQUAL(3u, pool.size());
+  char const* pid = pool.find("pid", "pid" + 3);
+  CHECK(pid != nullptr && Json::String(pid) == "pid");
+  CHECK(pool.find("pi", "pi" + 2) == nullptr);
+  CHECK(pool.find("pidx", "pidx" + 4) == nullptr);
+
+  // Adding again keeps the one copy; escaped keys are refused
+  CHECK(pool.add("pid"));
+  CHECK_EQUAL(3u, pool.size());
+  CHECK(!pool.add("a\"b"));
+  CHECK(!pool.add("a\\b"));
+  CHECK(!pool.add(Json::String("a\nb")));
+  CHECK(!pool.add(Json::String("a\0b", 3)));
+  CHECK(pool.add("caf\xc3\xa9"));
+  CHECK_EQUAL(4u, pool.size());
+
+  // Growing the table leaves the copies where they were
+  for (unsigned n = 0; n < 1000; ++n)
+    CHECK(pool.add("key" + std::to_string(n)));
+  CHECK_EQUAL(1004u, pool.size());
+  CHECK(pool.find("pid", "pid" + 3) == pid);
+  for (unsigned n = 0; n < 1000; n += 37) {
+    const Json::String key = "key" + std::to_string(n);
+    CHECK(pool.find(key.data(), key.data() + key.size()) != nullptr);
+  }
+  CHECK(Json::KeyPool().find("pid", "pid" + 3) == nullptr);
+}
+
+TEST(pooledParsesEqualUnpooled) {
+  Random random(HeosTestSeed());
+  // Non-ASCII keys written as \u escapes would never match the pool
+  Json::StreamWriterBuilder writer;
+  writer["indentation"] = "";
+  writer["emitUTF8"] = true;
+  for (unsigned round = 0; round < 200 * HeosTestScale(); ++round) {
+    const Json::Value original = JsonTest::randomValue(random);
+    const Json::String doc = Json::writeString(writer, original);
+    Json::KeyPool pool;
+    poolSomeKeys(random, original, pool);
+
+    Json::CharReaderBuilder plain;
+    Json::CharReaderBuilder pooled;
+    pooled.setKeyPool(&pool);
+    Json::Value expected, actual, pushed;
+    CHECK(parse(plain, doc, expected));
+    CHECK(parse(pooled, doc, actual));
+    CHECK(push(&pool, doc, pushed));
+    CHECK(expected == original);
+    CHECK(actual == expected);
+    CHECK(pushed == expected);
+    CHECK(keysArePooled(actual, pool));
+    CHECK(keysArePooled(pushed, pool));
+
+    // Copies share the pooled keys rather than duplicating them
+    const Json::Value copy = actual;
+    CHECK(copy == expected);
+    CHECK(keysArePooled(copy, pool));
+  }
+}
+
+TEST(escapedKeysAreNotPooled) {
+  Json::KeyPool pool({"ab", "a\"b"});
+  CHECK_EQUAL(1u, pool.size());
+  const Json::String doc = "{\"a\\\"b\": 1, \"ab\": 2, \"a\\u0062\": 3}";
+  Json::CharReaderBuilder builder;
+  builder.setKeyPool(&pool);
+  Json::Value root;
+  CHECK(parse(builder, doc, root));
+  CHECK_EQUAL(2u, root.size());
+  CHECK_EQUAL(1, root["a\"b"].asInt());
+  // "a\u0062" is decoded, and replaces the value under the pooled "ab"
+  CHECK_EQUAL(3, root["ab"].asInt());
+  CHECK(keysArePooled(root, pool));
+}
+
+TEST(onePoolManyReaders) {
+  Random random(HeosTestSeed());
+  Json::StreamWriterBuilder writer;
+  writer["emitUTF8"] = true;
+  std::vector<Json::String> docs;
+  std::vector<Json::Value> expected;
+  Json::KeyPool pool;
+  for (unsigned n = 0; n < 50; ++n) {
+    expected.push_back(JsonTest::randomValue(random));
+    docs.push_back(Json::writeString(writer, expected.back()));
+    poolSomeKeys(random, expected.back(), pool);
+  }
+
+  // CHECK is for this thread only; the readers report back through ok
+  const unsigned threads = 4;
+  std::vector<char> ok(threads, 0);
+  std::vector<std::thread> readers;
+  for (unsigned t = 0; t < threads; ++t) {
+    readers.emplace_back([&, t] {
+      Json::CharReaderBuilder builder;
+      builder.setKeyPool(&pool);
+      bool good = true;
+      for (unsigned round = 0; round < 20 * HeosTestScale(); ++round) {
+        for (size_t n = 0; n < docs.size(); ++n) {
+          const size_t i = (n + t * 13) % docs.size();
+          Json::Value root;
+          if (t % 2)
+            good = good && push(&pool, docs[i], root);
+          else
+            good = good && parse(builder, docs[i], root);
+          good = good && root == expected[i] && keysArePooled(root, pool);
+        }
+      }
+      ok[t] = good;
+    });
+  }
+  for (std::thread& reader : readers)
+    reader.join();
+  for (unsigned t = 0; t < threads; ++t)
+    CHECK(ok[t]);
+}
@@ -0,0 +1,104 @@
+// Decoding real tokens: decodeDoubleToken() against strtod() and the
+// istringstream the reader used before, then CharReader on a document of
+// reals.
+//   ./json_number_bench_compact [seconds per case]
+
+#include <json/json_tool.h>
+#include <json/reader.h>
+
+#include "json_bench.h"
+
+#include <locale>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+using JsonBench::measure;
+
+// What a HEOS reply or the app's prefs hold: durations, levels and the odd
+// coordinate or long mantissa.
+std::vector<Json::String> tokens(int count) {
+  std::mt19937 random(20261019);
+  std::vector<Json::String> out;
+  char text[40];
+  for (int n = 0; n < count; ++n) {
+    switch (random() % 4) {
+    case 0:
+      snprintf(text, sizeof(text), "%u.%02u", random() % 600, random() % 100);
+      break;
+    case 1:
+      snprintf(text, sizeof(text), "%.17g",
+               static_cast<double>(random()) / 4294967296.0);
+      break;
+    case 2:
+      snprintf(text, sizeof(text), "%.6e",
+               static_cast<double>(random()) * 1e-9 * (random() % 1000));
+      break;
+    default:
+      snprintf(text, sizeof(text), "-%u.%u", random() % 90, random() % 1000000);
+    }
+    out.push_back(text);
+  }
+  return out;
+}
+
+size_t bytes(const std::vector<Json::String>& tokens) {
+  size_t total = 0;
+  for (const auto& token : tokens)
+    total += token.size();
+  return total;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const double seconds = JsonBench::seconds(argc, argv);
+  const std::vector<Json::String> reals = tokens(1000);
+  const size_t size = bytes(reals);
+  volatile double sink = 0;
+
+  printf("1000 real tokens, %zu bytes\n", size);
+  measure("decodeDoubleToken", seconds, [&] {
+    for (const auto& token : reals) {
+      double value = 0;
+      Json::decodeDoubleToken(token.data(), token.data() + token.size(),
+                              &value);
+      sink = sink + value;
+    }
+    return size;
+  });
+  measure("strtod", seconds, [&] {
+    for (const auto& token : reals)
+      sink = sink + strtod(token.c_str(), nullptr);
+    return size;
+  });
+  measure("istringstream, imbued C", seconds, [&] {
+    for (const auto& token : reals) {
+      std::istringstream in(token);
+      in.imbue(std::locale::classic());
+      double value = 0;
+      in >> value;
+      sink = sink + value;
+    }
+    return size;
+  });
+
+  Json::String doc = "[";
+  for (const auto& token : reals)
+    doc += token + ",";
+  doc.back() = ']';
+  printf("the same as one array\n");
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  measure("CharReader", seconds, [&] {
+    Json::Value root;
+    reader->parse(doc.data(), doc.data() + doc.size(), &root, nullptr);
+    return doc.size();
+  });
+  return 0;
+}
@@ -0,0 +1,78 @@
+// Json::diff() and applyPatch() on 1,000-track get_queue replies, for the
+// edits a queue sees: none, one changed track, one moved, one inserted, the
+// whole queue reversed or shuffled. Not part of ctest; run it by hand after
+// touching json_patch.cpp:
+//   ./json_patch_bench_compact [seconds per case]
+
+#include <json/patch.h>
+#include <json/writer.h>
+
+#include "json_bench.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+namespace {
+
+using JsonBench::measure;
+
+Json::String write(const Json::Value& value) {
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "";
+  return Json::writeString(builder, value);
+}
+
+void run(const char* title, const Json::Value& from, const Json::Value& to,
+         double seconds) {
+  const Json::Value patch = Json::diff(from, to);
+  const size_t bytes = write(to).size();
+  printf("%s: %u operations, %zu bytes against %zu for the queue\n", title,
+         patch.size(), write(patch).size(), bytes);
+  measure("diff", seconds, [&] { return Json::diff(from, to).size() + bytes; });
+  measure("applyPatch", seconds, [&] {
+    Json::Value target = from;
+    Json::applyPatch(target, patch, nullptr);
+    return bytes;
+  });
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const double seconds = JsonBench::seconds(argc, argv);
+  const int length = 1000;
+  const Json::Value queue = JsonBench::queue(length);
+
+  run("unchanged", queue, queue, seconds);
+
+  Json::Value edited = queue;
+  edited["payload"][length / 2]["song"] = "Edited";
+  run("one track edited", queue, edited, seconds);
+
+  Json::Value moved = queue;
+  Json::Value track;
+  moved["payload"].removeIndex(0, &track);
+  moved["payload"].append(track);
+  run("first track moved to the end", queue, moved, seconds);
+
+  Json::Value inserted = queue;
+  inserted["payload"].insert(0, JsonBench::track(length));
+  run("one track inserted at the front", queue, inserted, seconds);
+
+  std::vector<Json::Value> tracks(queue["payload"].begin(),
+                                  queue["payload"].end());
+  Json::Value reversed = queue;
+  Json::Value& reversedItems = reversed["payload"];
+  for (int n = 0; n < length; ++n)
+    reversedItems[n] = tracks[length - 1 - n];
+  run("reversed", queue, reversed, seconds);
+
+  std::shuffle(tracks.begin(), tracks.end(), std::mt19937(1));
+  Json::Value shuffled = queue;
+  Json::Value& shuffledItems = shuffled["payload"];
+  for (int n = 0; n < length; ++n)
+    shuffledItems[n] = tracks[n];
+  run("shuffled", queue, shuffled, seconds);
+  return 0;
+}
@@ -0,0 +1,184 @@
+// diff() and applyPatch() as inverses: for random documents and random edits
+// of them, applying diff(from, to) to a copy of from must give to, also after
+// the patch went through text, and malformed patches must be refused.
+
+#include <json/patch.h>
+#include <json/reader.h>
+#include <json/writer.h>
+
+#include "HeosTest.h"
+#include "json_test_values.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+namespace {
+
+using JsonTest::below;
+using JsonTest::oneIn;
+using JsonTest::Random;
+
+// A few edits of the kinds the now-playing queue sees: changed fields, added
+// and removed members, inserted, removed and reordered elements.
+void edit(Random& random, Json::Value& value, int depth) {
+  if (value.isArray() && value.size() > 0 && oneIn(random, 3)) {
+    std::vector<Json::Value> elements(value.begin(), value.end());
+    switch (below(random, 4)) {
+    case 0:
+      std::shuffle(elements.begin(), elements.end(), random);
+      break;
+    case 1:
+      elements.erase(elements.begin() + below(random, elements.size()));
+      break;
+    case 2:
+      elements.insert(elements.begin() + below(random, elements.size() + 1),
+                      JsonTest::randomValue(random, 1));
+      break;
+    default:
+      std::rotate(elements.begin(),
+                  elements.begin() + below(random, elements.size()),
+                  elements.end());
+    }
+    value = Json::Value(Json::arrayValue);
+    for (auto& element : elements)
+      value.append(element);
+    return;
+  }
+  if (value.isObject() && oneIn(random, 3)) {
+    const std::vector<Json::String> names = value.getMemberNames();
+    if (!names.empty() && oneIn(random, 2))
+      value.removeMember(names[below(random, names.size())]);
+    else
+      value[JsonTest::randomString(random, 3)] = JsonTest::randomValue(random, 1);
+    return;
+  }
+  if ((value.isArray() || value.isObject()) && value.size() > 0 && depth < 6) {
+    for (auto& child : value)
+      if (oneIn(random, 2))
+        edit(random, child, depth + 1);
+    return;
+  }
+  value = JsonTest::randomValue(random, 2);
+}
+
+bool apply(Json::Value target, const Json::Value& patch, Json::Value& result,
+           Json::String& errs) {
+  const bool ok = Json::applyPatch(target, patch, &errs);
+  result = target;
+  return ok;
+}
+
+Json::Value throughText(const Json::Value& patch) {
+  Json::BufferWriter writer;
+  writer.write(patch);
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  Json::Value back;
+  reader->parse(writer.data(), writer.data() + writer.size(), &back, nullptr);
+  return back;
+}
+
+Json::Value parse(const char* text) {
+  Json::Value value;
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  reader->parse(text, text + strlen(text), &value, nullptr);
+  return value;
+}
+
+} // namespace
+
+TEST(diffThenApplyGivesTarget) {
+  Random random(HeosTestSeed());
+  for (int i = 0; i < 5000 * HeosTestScale(); ++i) {
+    const Json::Value from = JsonTest::randomValue(random);
+    Json::Value to = from;
+    for (unsigned n = 1 + below(random, 3); n > 0; --n)
+      edit(random, to, 0);
+
+    const Json::Value patch = Json::diff(from, to);
+    Json::Value patched;
+    Json::String errs;
+    if (!apply(from, patch, patched, errs) || !(patched == to) ||
+        !apply(from, throughText(patch), patched, errs) || !(patched == to)) {
+      FAIL("patch " + patch.toStyledString() + "does not turn " +
+           from.toStyledString() + "into " + to.toStyledString() + errs);
+      return;
+    }
+    // Equal documents give an empty patch, in either direction
+    CHECK(Json::diff(to, to).empty());
+    CHECK(Json::diff(from, from).empty());
+  }
+}
+
+TEST(reorderedArrayOnlyMoves) {
+  Random random(HeosTestSeed());
+  for (int i = 0; i < 2000 * HeosTestScale(); ++i) {
+    Json::Value from(Json::arrayValue);
+    const unsigned size = 2 + below(random, 30);
+    for (unsigned n = 0; n < size; ++n)
+      from.append("track " + std::to_string(n));
+    std::vector<Json::Value> shuffled(from.begin(), from.end());
+    std::shuffle(shuffled.begin(), shuffled.end(), random);
+    Json::Value to(Json::arrayValue);
+    for (auto& element : shuffled)
+      to.append(element);
+
+    const Json::Value patch = Json::diff(from, to);
+    for (const auto& operation : patch)
+      CHECK_EQUAL("move", operation["op"].asString());
+    Json::Value patched;
+    Json::String errs;
+    CHECK(apply(from, patch, patched, errs) && patched == to);
+    if (HeosTestFailures())
+      return;
+  }
+}
+
+TEST(pointersEscapeTildeAndSlash) {
+  const Json::Value from = parse("{\"a/b\": 1, \"m~n\": [1, 2], \"\": {}}");
+  const Json::Value to = parse("{\"a/b\": 2, \"m~n\": [2, 1], \"\": {\"x\": 0}}");
+  const Json::Value patch = Json::diff(from, to);
+  Json::BufferWriter writer;
+  writer.write(patch);
+  CHECK(writer.str().find("/a~1b") != Json::String::npos);
+  CHECK(writer.str().find("/m~0n") != Json::String::npos);
+  Json::Value patched;
+  Json::String errs;
+  CHECK(apply(from, patch, patched, errs));
+  CHECK(patched == to);
+}
+
+TEST(badPatchesFail) {
+  const Json::Value target = parse("{\"queue\": [1, 2, 3], \"song\": \"x\"}");
+  for (const char* patch :
+       {"{}", "[1]", "[{}]", "[{\"op\": \"add\"}]",
+        "[{\"op\": \"jump\", \"path\": \"/song\"}]",
+        "[{\"op\": \"add\", \"path\": \"/song\"}]",
+        "[{\"op\": \"remove\", \"path\": \"/missing\"}]",
+        "[{\"op\": \"remove\", \"path\": \"/queue/3\"}]",
+        "[{\"op\": \"replace\", \"path\": \"/queue/01\", \"value\": 0}]",
+        "[{\"op\": \"add\", \"path\": \"/queue/4\", \"value\": 0}]",
+        "[{\"op\": \"add\", \"path\": \"song\", \"value\": 0}]",
+        "[{\"op\": \"move\", \"from\": \"/queue\", \"path\": \"/queue/0\"}]",
+        "[{\"op\": \"copy\", \"from\": \"/nothing\", \"path\": \"/x\"}]",
+        "[{\"op\": \"test\", \"path\": \"/song\", \"value\": \"y\"}]"}) {
+    Json::Value patched;
+    Json::String errs;
+    if (apply(target, parse(patch), patched, errs))
+      FAIL(Json::String("applied: ") + patch);
+    else
+      CHECK(!errs.empty());
+  }
+
+  // The operations before a failing one stay applied
+  Json::Value target2 = target;
+  Json::String errs;
+  CHECK(!Json::applyPatch(
+      target2,
+      parse("[{\"op\": \"add\", \"path\": \"/queue/-\", \"value\": 4},"
+            " {\"op\": \"test\", \"path\": \"/song\", \"value\": 1}]"),
+      &errs));
+  CHECK_EQUAL(4u, target2["queue"].size());
+}
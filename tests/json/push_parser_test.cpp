@@ -0,0 +1,230 @@
+// PushParser against CharReader: the same document fed in random chunks,
+// down to a byte at a time, must give the same Value, and a mangled document
+// must be rejected by both or accepted by both.
+
+#include <json/reader.h>
+#include <json/writer.h>
+
+#include "HeosTest.h"
+#include "json_test_values.h"
+
+#include <algorithm>
+#include <memory>
+
+namespace {
+
+using JsonTest::below;
+using JsonTest::oneIn;
+using JsonTest::Random;
+
+void space(Random& random, Json::String& out) {
+  static const char* const gaps[] = {" ",    "\t",      "\r\n",  "\n   ",
+                                     "/**/", "/* x */", "//c\n", "/*/ * **/"};
+  while (oneIn(random, 3))
+    out += gaps[below(random, sizeof(gaps) / sizeof(gaps[0]))];
+}
+
+// Like the writers, but with whitespace and comments wherever the grammar
+// allows them, to move every token boundary around.
+void writeSpaced(Random& random, const Json::Value& value, Json::String& out) {
+  space(random, out);
+  switch (value.type()) {
+  case Json::nullValue:
+    out += "null";
+    break;
+  case Json::booleanValue:
+    out += value.asBool() ? "true" : "false";
+    break;
+  case Json::intValue:
+    out += Json::valueToString(value.asLargestInt());
+    break;
+  case Json::uintValue:
+    out += Json::valueToString(value.asLargestUInt());
+    break;
+  case Json::realValue:
+    out += Json::valueToString(value.asDouble());
+    break;
+  case Json::stringValue: {
+    const char* begin;
+    const char* end;
+    value.getString(&begin, &end);
+    out += Json::valueToQuotedString(begin, static_cast<size_t>(end - begin));
+    break;
+  }
+  case Json::arrayValue:
+    out += "[";
+    for (Json::ArrayIndex i = 0; i < value.size(); ++i) {
+      if (i > 0)
+        out += ",";
+      writeSpaced(random, value[i], out);
+    }
+    // CharReader allows no comment in an empty array
+    if (value.empty())
+      out += oneIn(random, 3) ? " " : "";
+    else
+      space(random, out);
+    out += "]";
+    break;
+  case Json::objectValue: {
+    out += "{";
+    bool first = true;
+    for (auto it = value.begin(); it != value.end(); ++it) {
+      if (!first)
+        out += ",";
+      first = false;
+      space(random, out);
+      const Json::String name = it.name();
+      out += Json::valueToQuotedString(name.data(), name.size());
+      // CharReader allows no comment before the colon, only whitespace
+      out += oneIn(random, 3) ? " :" : ":";
+      writeSpaced(random, *it, out);
+    }
+    space(random, out);
+    out += "}";
+    break;
+  }
+  }
+  space(random, out);
+}
+
+Json::Value strictSettings() {
+  Json::Value settings;
+  Json::CharReaderBuilder::setDefaults(&settings);
+  settings["failIfExtra"] = true;
+  return settings;
+}
+
+struct Outcome {
+  bool ok;
+  Json::Value root;
+  Json::String errs;
+};
+
+Outcome readWhole(const Json::Value& settings, const Json::String& doc) {
+  Json::CharReaderBuilder builder;
+  builder.settings_ = settings;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  Outcome outcome;
+  outcome.ok = reader->parse(doc.data(), doc.data() + doc.size(),
+                             &outcome.root, &outcome.errs);
+  return outcome;
+}
+
+// Feed chunks of random length, a single byte a fair part of the time, and
+// keep feeding after the value is complete as failIfExtra requires.
+Outcome readPushed(Random& random, const Json::Value& settings,
+                   const Json::String& doc) {
+  Outcome outcome;
+  Json::ValueHandler handler(outcome.root);
+  Json::PushParser parser(handler, settings);
+  size_t at = 0;
+  while (at < doc.size()) {
+    size_t length = oneIn(random, 3) ? 1 : 1 + below(random, 40);
+    length = std::min(length, doc.size() - at);
+    // Copy, so reading past the chunk would be caught by a sanitizer
+    const std::unique_ptr<char[]> chunk(new char[length]);
+    std::memcpy(chunk.get(), doc.data() + at, length);
+    const Json::PushParser::Status status = parser.feed(chunk.get(), length);
+    at += length;
+    if (status == Json::PushParser::error || status == Json::PushParser::stopped)
+      break;
+  }
+  outcome.ok = parser.finish() == Json::PushParser::complete;
+  outcome.errs = parser.getFormattedErrorMessages();
+  return outcome;
+}
+
+// Small damage of the kinds a truncated or corrupted message has.
+Json::String mangle(Random& random, Json::String doc) {
+  static const char* const inserts[] = {",", ":", "\"", "\\", "[", "]", "{",
+                                        "}", "/", "*", "-", ".", "e", "0",
+                                        "x", " ", "\n", "\x01", "\xc3", "1e"};
+  for (unsigned n = 1 + below(random, 2); n > 0; --n) {
+    const size_t at = below(random, static_cast<unsigned>(doc.size()) + 1);
+    switch (below(random, 4)) {
+    case 0:
+      if (at < doc.size())
+        doc.erase(at, 1 + below(random, 3));
+      break;
+    case 1:
+      doc.resize(at);
+      break;
+    case 2:
+      if (at < doc.size())
+        doc[at] = inserts[below(random, sizeof(inserts) / sizeof(inserts[0]))][0];
+      break;
+    default:
+      doc.insert(at, inserts[below(random, sizeof(inserts) / sizeof(inserts[0]))]);
+    }
+  }
+  return doc;
+}
+
+} // namespace
+
+TEST(chunkedDocumentsMatchCharReader) {
+  Random random(HeosTestSeed());
+  const Json::Value settings = strictSettings();
+  for (int i = 0; i < 3000 * HeosTestScale(); ++i) {
+    const Json::Value value = JsonTest::randomValue(random);
+    Json::String doc;
+    writeSpaced(random, value, doc);
+
+    const Outcome whole = readWhole(settings, doc);
+    const Outcome pushed = readPushed(random, settings, doc);
+    if (!whole.ok || !pushed.ok || !(whole.root == value) ||
+        !(pushed.root == value)) {
+      FAIL("differs on " + Json::valueToQuotedString(doc.data(), doc.size()) +
+           "\nCharReader: " + whole.errs +
+           "\nPushParser: " + pushed.errs);
+      return;
+    }
+  }
+}
+
+TEST(mangledDocumentsMatchCharReader) {
+  Random random(HeosTestSeed());
+  const Json::Value settings = strictSettings();
+  Json::Value lenient;
+  Json::CharReaderBuilder::setDefaults(&lenient);
+  for (int i = 0; i < 20000 * HeosTestScale(); ++i) {
+    Json::String doc;
+    writeSpaced(random, JsonTest::randomValue(random, 2), doc);
+    doc = mangle(random, doc);
+    const Json::Value* const choices[] = {&settings, &lenient};
+    for (const Json::Value* chosen : choices) {
+      const Outcome whole = readWhole(*chosen, doc);
+      const Outcome pushed = readPushed(random, *chosen, doc);
+      if (whole.ok != pushed.ok || (whole.ok && !(whole.root == pushed.root))) {
+        FAIL(Json::String(whole.ok ? "only CharReader" : "only PushParser") +
+             " accepts " + Json::valueToQuotedString(doc.data(), doc.size()) +
+             (chosen == &settings ? " with failIfExtra\n" : "\n") +
+             whole.errs + pushed.errs);
+        return;
+      }
+    }
+  }
+}
+
+TEST(trailingCommentMustBeClosed) {
+  const Json::Value settings = strictSettings();
+  Random random(HeosTestSeed());
+  for (const char* doc : {"{\"a\":1} /*x", "{\"a\":1} /", "{\"a\":1} /*x*",
+                          "{\"a\":1} /x"}) {
+    CHECK(!readWhole(settings, doc).ok);
+    CHECK(!readPushed(random, settings, doc).ok);
+  }
+  for (const char* doc : {"{\"a\":1} /*x*/", "{\"a\":1} //x", "{\"a\":1}\n"}) {
+    CHECK(readWhole(settings, doc).ok);
+    CHECK(readPushed(random, settings, doc).ok);
+  }
+}
+
+TEST(topLevelNumberEndsWithInput) {
+  const Json::Value settings = strictSettings();
+  Random random(HeosTestSeed());
+  const Outcome pushed = readPushed(random, settings, "-12.5e1");
+  CHECK(pushed.ok);
+  CHECK_EQUAL(-125.0, pushed.root.asDouble());
+  CHECK(!readPushed(random, settings, "-12.5e").ok);
+}
@@ -0,0 +1,89 @@
+// Five fields out of 1,000 replies: Path per field on a parsed tree, one
+// Query::select() on it, and QueryHandler while parsing, without the tree.
+// Not part of ctest; run it by hand after touching Query or QueryHandler:
+//   ./json_query_bench_compact [seconds per case]
+
+#include <json/reader.h>
+#include <json/writer.h>
+
+#include "json_bench.h"
+
+#include <cstdio>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+namespace {
+
+using JsonBench::measure;
+
+const char* const fields[] = {"heos.command", "heos.result", "heos.message",
+                              "payload[*].qid", "payload[*].song"};
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const double seconds = JsonBench::seconds(argc, argv);
+
+  // Queue replies of one to eight tracks
+  Json::StreamWriterBuilder writer;
+  writer["indentation"] = "";
+  std::vector<Json::String> replies;
+  size_t bytes = 0;
+  for (int n = 0; n < 1000; ++n) {
+    replies.push_back(Json::writeString(writer, JsonBench::queue(1 + n % 8)));
+    bytes += replies.back().size();
+  }
+  printf("1,000 replies, %zu fields\n", sizeof(fields) / sizeof(fields[0]));
+
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  std::vector<Json::String> paths(std::begin(fields), std::end(fields));
+
+  measure("CharReader, Path per field", seconds, [&] {
+    // Path has no wildcard: walk the payload by hand
+    static const Json::Path command(".heos.command");
+    static const Json::Path result(".heos.result");
+    static const Json::Path message(".heos.message");
+    static const Json::Path payload(".payload");
+    size_t found = 0;
+    for (const Json::String& reply : replies) {
+      Json::Value root;
+      reader->parse(reply.data(), reply.data() + reply.size(), &root, nullptr);
+      found += !command.resolve(root).isNull();
+      found += !result.resolve(root).isNull();
+      found += !message.resolve(root).isNull();
+      for (const Json::Value& item : payload.resolve(root))
+        found += !item["qid"].isNull() + !item["song"].isNull();
+    }
+    return found ? bytes : 0;
+  });
+
+  const Json::Query query(paths);
+  std::vector<Json::Query::Hit> hits;
+  measure("CharReader, Query::select", seconds, [&] {
+    size_t found = 0;
+    for (const Json::String& reply : replies) {
+      Json::Value root;
+      reader->parse(reply.data(), reply.data() + reply.size(), &root, nullptr);
+      hits.clear();
+      query.select(root, hits);
+      found += hits.size();
+    }
+    return found ? bytes : 0;
+  });
+
+  Json::QueryHandler handler(query);
+  Json::PushParser parser(handler);
+  measure("QueryHandler", seconds, [&] {
+    size_t found = 0;
+    for (const Json::String& reply : replies) {
+      handler.reset();
+      parser.reset();
+      parser.feed(reply.data(), reply.size());
+      found += handler.captures().size();
+    }
+    return found ? bytes : 0;
+  });
+  return 0;
+}
@@ -0,0 +1,219 @@
+// Query and QueryHandler: every path resolved one at a time by a plain walk
+// must give the hits Query::select() gives on the tree and the captures
+// QueryHandler gives while parsing, and malformed paths must throw.
+
+#include <json/reader.h>
+#include <json/value.h>
+#include <json/writer.h>
+
+#include "HeosTest.h"
+#include "json_test_values.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using JsonTest::below;
+using JsonTest::oneIn;
+using JsonTest::Random;
+
+// One step of a path: a key, an index, or a wildcard for either.
+struct Step {
+  enum Kind { key, index, anyKey, anyIndex } kind;
+  Json::String name;
+  Json::ArrayIndex number;
+};
+
+struct Path {
+  Json::String text;
+  std::vector<Step> steps;
+};
+
+// A walk down value, mostly along what is there, now and then off it.
+Path randomPath(Random& random, const Json::Value* value) {
+  Path path;
+  while (value && !oneIn(random, 4)) {
+    if (value->isObject() && !value->empty()) {
+      if (oneIn(random, 4)) {
+        path.steps.push_back({Step::anyKey, "", 0});
+        path.text += ".*";
+        value = &*value->begin();
+        continue;
+      }
+      auto it = value->begin();
+      for (unsigned n = below(random, value->size()); n > 0; --n)
+        ++it;
+      Json::String name = oneIn(random, 8) ? Json::String("absent") : it.name();
+      if (name.empty())
+        break;
+      path.steps.push_back({Step::key, name, 0});
+      path.text += "." + name;
+      value = value->find(name.data(), name.data() + name.size());
+    } else if (value->isArray() && !value->empty()) {
+      if (oneIn(random, 4)) {
+        path.steps.push_back({Step::anyIndex, "", 0});
+        path.text += "[*]";
+        value = &(*value)[0];
+        continue;
+      }
+      const Json::ArrayIndex index = below(random, value->size() + 2);
+      path.steps.push_back({Step::index, "", index});
+      path.text += "[" + std::to_string(index) + "]";
+      value = index < value->size() ? &(*value)[index] : nullptr;
+    } else {
+      break;
+    }
+  }
+  return path;
+}
+
+using Found = std::vector<std::pair<Json::ArrayIndex, Json::String>>;
+
+Json::String write(const Json::Value& value) {
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "";
+  return Json::writeString(builder, value);
+}
+
+void resolve(const Json::Value& value, const std::vector<Step>& steps,
+             size_t step, Json::ArrayIndex field, Found& found) {
+  if (step == steps.size()) {
+    found.emplace_back(field, write(value));
+    return;
+  }
+  const Step& s = steps[step];
+  if (s.kind == Step::key && value.isObject()) {
+    if (const Json::Value* member =
+            value.find(s.name.data(), s.name.data() + s.name.size()))
+      resolve(*member, steps, step + 1, field, found);
+  } else if (s.kind == Step::anyKey && value.isObject()) {
+    for (const Json::Value& member : value)
+      resolve(member, steps, step + 1, field, found);
+  } else if (s.kind == Step::index && value.isArray()) {
+    if (s.number < value.size())
+      resolve(value[s.number], steps, step + 1, field, found);
+  } else if (s.kind == Step::anyIndex && value.isArray()) {
+    for (const Json::Value& element : value)
+      resolve(element, steps, step + 1, field, found);
+  }
+}
+
+Found sorted(Found found) {
+  std::sort(found.begin(), found.end());
+  return found;
+}
+
+bool throws(const char* path) {
+  try {
+    Json::Query query({path});
+  } catch (const Json::LogicError&) {
+    return true;
+  }
+  return false;
+}
+
+} // namespace
+
+TEST(selectAndCaptureMatchAPlainWalk) {
+  Random random(HeosTestSeed());
+  for (unsigned round = 0; round < 300 * HeosTestScale(); ++round) {
+    const Json::Value root = JsonTest::randomValue(random, 5);
+    std::vector<Path> paths;
+    std::vector<Json::String> texts;
+    for (unsigned n = 1 + below(random, 6); n > 0; --n) {
+      paths.push_back(oneIn(random, 6) && !paths.empty()
+                          ? paths[below(random, paths.size())]
+                          : randomPath(random, &root));
+      texts.push_back(paths.back().text);
+    }
+    const Json::Query query(texts);
+    CHECK_EQUAL(static_cast<Json::ArrayIndex>(paths.size()), query.size());
+
+    Found expected;
+    for (size_t n = 0; n < paths.size(); ++n)
+      resolve(root, paths[n].steps, 0, static_cast<Json::ArrayIndex>(n),
+              expected);
+    expected = sorted(expected);
+
+    std::vector<Json::Query::Hit> hits;
+    query.select(root, hits);
+    Found selected;
+    for (const auto& hit : hits)
+      selected.emplace_back(hit.field, write(*hit.value));
+    CHECK(sorted(selected) == expected);
+
+    // While parsing, fed in random chunks; then again after reset()
+    const Json::String doc = write(root);
+    Json::QueryHandler handler(query);
+    for (int pass = 0; pass < 2; ++pass) {
+      handler.reset();
+      Json::PushParser parser(handler);
+      for (size_t at = 0; at < doc.size();) {
+        const size_t length = std::min<size_t>(1 + below(random, 16),
+                                               doc.size() - at);
+        parser.feed(doc.data() + at, length);
+        at += length;
+      }
+      CHECK(parser.finish() == Json::PushParser::complete);
+      Found captured;
+      for (const auto& capture : handler.captures())
+        captured.emplace_back(capture.field, write(capture.value));
+      CHECK(sorted(captured) == expected);
+    }
+  }
+}
+
+TEST(reply) {
+  const Json::String doc =
+      "{\"heos\": {\"command\": \"player/get_players\", \"result\": "
+      "\"success\", \"message\": \"\"}, \"payload\": [{\"name\": \"Kitchen\", "
+      "\"pid\": 1}, {\"name\": \"Den\", \"pid\": -2, \"gid\": 1}]}";
+  const Json::Query query({"heos.result", "payload[*].pid", "payload[1].name",
+                           "payload[*].gid", "payload[7].name", "heos"});
+  Json::Value root;
+  Json::Reader().parse(doc, root);
+  std::vector<Json::Query::Hit> hits;
+  query.select(root, hits);
+  CHECK_EQUAL(6u, hits.size());
+
+  // Captures come in document order, a container where it opens
+  Json::QueryHandler handler(query);
+  Json::PushParser parser(handler);
+  parser.feed(doc.data(), doc.size());
+  CHECK(parser.finish() == Json::PushParser::complete);
+  const auto& captures = handler.captures();
+  CHECK_EQUAL(6u, captures.size());
+  if (captures.size() == 6) {
+    CHECK(captures[0].field == 5 && captures[0].value == root["heos"]);
+    CHECK(captures[1].field == 0 && captures[1].value == "success");
+    CHECK(captures[2].field == 1 && captures[2].value == 1);
+    CHECK(captures[3].field == 2 && captures[3].value == "Den");
+    CHECK(captures[4].field == 1 && captures[4].value == -2);
+    CHECK(captures[5].field == 3 && captures[5].value == 1);
+  }
+}
+
+TEST(malformedPaths) {
+  CHECK(throws("["));
+  CHECK(throws("[]"));
+  CHECK(throws("[x]"));
+  CHECK(throws("[1"));
+  CHECK(throws("a..b"));
+  CHECK(throws("a."));
+  // Indices past ArrayIndex must not wrap around to a small one
+  CHECK(throws("[4294967296]"));
+  CHECK(throws("payload[4294967300].pid"));
+  CHECK(throws("[99999999999999999999]"));
+  CHECK(!throws("[4294967295]"));
+  CHECK(!throws("[0004294967295]"));
+  CHECK(!throws("a.b[*].*"));
+
+  Json::Value array(Json::arrayValue);
+  array.append(1);
+  const Json::Query last({"[4294967295]"});
+  std::vector<Json::Query::Hit> hits;
+  last.select(array, hits);
+  CHECK(hits.empty());
+}
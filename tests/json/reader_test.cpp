@@ -0,0 +1,186 @@
+// CharReader and the legacy Reader on input the other parsers must agree
+// with: comments at the very end of the input, and the lines and columns
+// errors are reported at, whatever the line breaks.
+
+#include <json/reader.h>
+
+#include "HeosTest.h"
+#include "json_test_values.h"
+
+#include <cstdio>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace {
+
+bool strictParse(const Json::String& doc, Json::String* errs) {
+  Json::CharReaderBuilder builder;
+  builder["allowComments"] = true;
+  builder["failIfExtra"] = true;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  Json::Value root;
+  return reader->parse(doc.data(), doc.data() + doc.size(), &root, errs);
+}
+
+using JsonTest::below;
+using JsonTest::oneIn;
+using JsonTest::Random;
+using Position = std::pair<int, int>; // line, column
+
+// "\r\n" is one break; a lone "\r" or "\n" is one too.
+Position position(const Json::String& doc, size_t offset) {
+  int line = 1;
+  size_t lineStart = 0;
+  for (size_t i = 0; i < offset; ++i) {
+    if (doc[i] == '\r' && i + 1 < offset && doc[i + 1] == '\n')
+      ++i;
+    if (doc[i] == '\r' || doc[i] == '\n') {
+      ++line;
+      lineStart = i + 1;
+    }
+  }
+  return {line, static_cast<int>(offset - lineStart) + 1};
+}
+
+// Every "Line L, Column C" in a formatted error message.
+std::vector<Position> positions(const Json::String& errs) {
+  std::vector<Position> found;
+  for (size_t at = errs.find("Line "); at != Json::String::npos;
+       at = errs.find("Line ", at + 1)) {
+    Position p;
+    if (sscanf(errs.c_str() + at, "Line %d, Column %d", &p.first, &p.second) ==
+        2)
+      found.push_back(p);
+  }
+  return found;
+}
+
+void breaks(Random& random, Json::String& out) {
+  static const char* const gaps[] = {" ",  "\t", "\n",     "\r\n",
+                                     "\r", "\n\r", "\r\r\n", "\n\n"};
+  while (oneIn(random, 2))
+    out += gaps[below(random, sizeof(gaps) / sizeof(gaps[0]))];
+}
+
+// An array of values, with line breaks of every kind between its tokens and
+// inside its strings, and one error somewhere: a stray character or a bad
+// escape (which also points at the escape). *offset is where the error's
+// token starts.
+Json::String malformed(Random& random, size_t* offset) {
+  const unsigned length = 1 + below(random, 30);
+  const unsigned bad = below(random, length);
+  Json::String doc = "[";
+  for (unsigned n = 0; n < length; ++n) {
+    if (n)
+      doc += ",";
+    breaks(random, doc);
+    if (n == bad)
+      *offset = doc.size();
+    switch (below(random, 4)) {
+    case 0:
+      doc += n == bad ? "@" : "12";
+      break;
+    case 1:
+      doc += n == bad ? "tru" : "true";
+      break;
+    default:
+      doc += "\"a";
+      breaks(random, doc);
+      doc += n == bad ? "\\q\"" : "b\"";
+      break;
+    }
+    breaks(random, doc);
+  }
+  return doc + "]";
+}
+
+} // namespace
+
+TEST(unterminatedCommentAtTheEnd) {
+  // The '/' that ends the input is not the one closing "*/": these comments
+  // never end, and written back as a comment they would not read again
+  for (const char* doc : {"1 /*/", "1/* x/", "[1] /*\n/"}) {
+    Json::String errs;
+    if (strictParse(doc, &errs))
+      FAIL(Json::String("accepted: ") + doc);
+
+    Json::Reader reader;
+    Json::Value root;
+    reader.parse(doc, root, true);
+    CHECK(!root.hasComment(Json::commentAfter));
+  }
+
+  for (const char* doc : {"1 /**/", "1 /*/*/", "1/* x */", "1 /* */\n"}) {
+    Json::String errs;
+    if (!strictParse(doc, &errs))
+      FAIL(Json::String("refused: ") + doc + "\n" + errs);
+  }
+}
+
+TEST(errorLinesAndColumns) {
+  Random random(HeosTestSeed());
+  Json::CharReaderBuilder builder;
+  // One reader for every document: the line index of one parse must not
+  // leak into the next, whose error may lie before or after the last one
+  std::unique_ptr<Json::CharReader> reused(builder.newCharReader());
+  for (unsigned round = 0; round < 2000 * HeosTestScale(); ++round) {
+    size_t offset = 0;
+    const Json::String doc = malformed(random, &offset);
+    const Position expected = position(doc, offset);
+
+    Json::Value root;
+    Json::String errs;
+    CHECK(!reused->parse(doc.data(), doc.data() + doc.size(), &root, &errs));
+    const std::vector<Position> found = positions(errs);
+    CHECK(!found.empty() && found[0] == expected);
+
+    // A fresh reader, and the legacy one, which rescans for every location,
+    // give the same, "See ... for detail" included
+    std::unique_ptr<Json::CharReader> fresh(builder.newCharReader());
+    Json::String freshErrs;
+    fresh->parse(doc.data(), doc.data() + doc.size(), &root, &freshErrs);
+    CHECK(positions(freshErrs) == found);
+
+    Json::Reader legacy;
+    legacy.parse(doc.data(), doc.data() + doc.size(), root, false);
+    if (positions(legacy.getFormattedErrorMessages()) != found)
+      FAIL(Json::String("Reader and CharReader differ on ") + doc + "\n" +
+           legacy.getFormattedErrorMessages() + errs);
+  }
+}
+
+TEST(errorLinesAndColumnsByBreak) {
+  struct Case {
+    const char* doc;
+    Position error;
+  };
+  static const Case cases[] = {
+      {"[1,\n2,\n@]", {3, 1}},       {"[1,\r\n2,\r\n@]", {3, 1}},
+      {"[1,\r2,\r@]", {3, 1}},        {"[1,\n\r@]", {3, 1}},
+      {"[1,\r\r\n @]", {3, 2}},      {"\r\n\r\n\r\n[@]", {4, 2}},
+      {"[\"a\r\nb\\q\"]", {1, 2}},  {"[1,\t@]", {1, 5}},
+  };
+  for (const Case& c : cases) {
+    Json::CharReaderBuilder builder;
+    std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+    Json::Value root;
+    Json::String errs;
+    const Json::String doc = c.doc;
+    reader->parse(doc.data(), doc.data() + doc.size(), &root, &errs);
+    const std::vector<Position> found = positions(errs);
+    if (found.empty() || found[0] != c.error)
+      FAIL("wrong position for " + doc + "\n" + errs);
+  }
+
+  // The escape is reported on the line after the string's start
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  Json::Value root;
+  Json::String errs;
+  const Json::String doc = "[\"a\r\nb\\q\"]";
+  reader->parse(doc.data(), doc.data() + doc.size(), &root, &errs);
+  const std::vector<Position> found = positions(errs);
+  CHECK_EQUAL(2u, found.size());
+  CHECK(found.size() == 2 && found[1] == Position(2, 4));
+}
@@ -0,0 +1,112 @@
+// The vector scanners against the byte loops they replaced, and CharReader
+// on top of them, over a corpus of replies as the device and the writers
+// spell them: compact, indented, and heavy on long strings.
+//   ./json_scanner_bench_compact [seconds per case]
+
+#include <json/json_simd.h>
+#include <json/reader.h>
+#include <json/writer.h>
+
+#include "json_bench.h"
+
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+namespace {
+
+using JsonBench::measure;
+
+const char* skipWhitespaceByByte(const char* p, const char* end) {
+  while (p != end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+    ++p;
+  return p;
+}
+
+const char* findQuoteOrBackslashByByte(const char* p, const char* end) {
+  while (p != end && *p != '"' && *p != '\\')
+    ++p;
+  return p;
+}
+
+Json::String write(const Json::Value& value, const char* indentation) {
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = indentation;
+  builder["emitUTF8"] = true;
+  return Json::writeString(builder, value);
+}
+
+// Browse results: long titles and URLs, the strings the scanner skips whole.
+Json::Value longStrings(int count) {
+  Json::Value root;
+  Json::Value& items = root["payload"];
+  for (int n = 0; n < count; ++n) {
+    Json::Value item;
+    item["name"] = Json::String(200 + (n * 37) % 600, 'a' + n % 26);
+    item["image_url"] = "http://art.example.com/" +
+                        Json::String(100 + (n * 53) % 300, 'x') + ".jpg";
+    item["type"] = "station";
+    items.append(item);
+  }
+  return root;
+}
+
+// Every string body and whitespace run of text, the way the reader walks
+// them, and the number of positions it stopped at.
+template <class SkipWhitespace, class FindQuote>
+size_t walk(const Json::String& text, SkipWhitespace skipWhitespace,
+            FindQuote findQuote) {
+  const char* p = text.data();
+  const char* end = p + text.size();
+  size_t stops = 0;
+  while (p != end) {
+    p = skipWhitespace(p, end);
+    if (p != end && *p == '"') {
+      for (p = findQuote(p + 1, end); p != end && *p == '\\';
+           p = findQuote(p + 2 < end ? p + 2 : end, end))
+        ++stops;
+    }
+    if (p != end)
+      ++p;
+    ++stops;
+  }
+  return stops;
+}
+
+void run(const char* title, const Json::String& text, double seconds) {
+  printf("%s, %zu bytes\n", title, text.size());
+  volatile size_t sink = 0;
+
+  measure("byte loops", seconds, [&] {
+    sink = sink + walk(text, skipWhitespaceByByte,
+                       findQuoteOrBackslashByByte);
+    return text.size();
+  });
+  measure("json_simd.h scanners", seconds, [&] {
+    sink = sink + walk(text, Json::simd::skipWhitespace,
+                       [](const char* p, const char* end) {
+                         return Json::simd::findQuoteOrBackslash(p, end, '"');
+                       });
+    return text.size();
+  });
+
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  measure("CharReader", seconds, [&] {
+    Json::Value root;
+    reader->parse(text.data(), text.data() + text.size(), &root, nullptr);
+    return text.size();
+  });
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const double seconds = JsonBench::seconds(argc, argv);
+  const Json::Value queue = JsonBench::queue(500);
+  run("queue (500 tracks), compact", write(queue, ""), seconds);
+  run("queue (500 tracks), tabs", write(queue, "\t"), seconds);
+  run("queue (500 tracks), 4 spaces", write(queue, "    "), seconds);
+  run("browse (300 long strings)", write(longStrings(300), "  "), seconds);
+  return 0;
+}
@@ -0,0 +1,145 @@
+// The vector scanners of json_simd.h against plain byte loops, at every
+// alignment and length around the 16 and 32 byte steps, and the readers that
+// use them against the values their input spells.
+
+#include <json/json_simd.h>
+#include <json/reader.h>
+
+#include "HeosTest.h"
+#include "json_test_values.h"
+
+#include <memory>
+#include <vector>
+
+namespace {
+
+using JsonTest::below;
+using JsonTest::Random;
+
+const char* skipWhitespaceByByte(const char* p, const char* end) {
+  while (p != end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+    ++p;
+  return p;
+}
+
+const char* findQuoteOrBackslashByByte(const char* p, const char* end,
+                                       char quote) {
+  while (p != end && *p != quote && *p != '\\')
+    ++p;
+  return p;
+}
+
+const char* findEscapeByByte(const char* p, const char* end, bool emitUTF8) {
+  for (; p != end; ++p) {
+    const unsigned char c = static_cast<unsigned char>(*p);
+    if (c == '"' || c == '\\' || c < 0x20 || (!emitUTF8 && c > 0x7F))
+      break;
+  }
+  return p;
+}
+
+// Mostly bytes the scanner skips, with a few it has to stop at.
+void fill(Random& random, std::vector<char>& buffer, const char* common,
+          unsigned stoppers) {
+  const size_t commonCount = strlen(common);
+  for (auto& c : buffer)
+    c = common[below(random, static_cast<unsigned>(commonCount))];
+  for (unsigned i = 0; i < stoppers && !buffer.empty(); ++i)
+    buffer[below(random, static_cast<unsigned>(buffer.size()))] =
+        static_cast<char>(below(random, 256));
+}
+
+} // namespace
+
+TEST(skipWhitespaceMatchesByteLoop) {
+  Random random(HeosTestSeed());
+  std::vector<char> buffer;
+  for (int iteration = 0; iteration < 3000 * HeosTestScale(); ++iteration) {
+    buffer.resize(below(random, 140));
+    fill(random, buffer, " \t\r\n", below(random, 3));
+    const char* begin = buffer.data();
+    const char* end = begin + buffer.size();
+    for (const char* p = begin; p <= end; ++p) {
+      if (Json::simd::skipWhitespace(p, end) != skipWhitespaceByByte(p, end)) {
+        FAIL("skipWhitespace differs at offset " +
+             std::to_string(p - begin) + " of " +
+             std::to_string(buffer.size()));
+        return;
+      }
+    }
+  }
+}
+
+TEST(findQuoteOrBackslashMatchesByteLoop) {
+  Random random(HeosTestSeed());
+  std::vector<char> buffer;
+  for (int iteration = 0; iteration < 3000 * HeosTestScale(); ++iteration) {
+    buffer.resize(below(random, 140));
+    fill(random, buffer, "abc \x01\x7f\x80\xff'\"\\", 0);
+    fill(random, buffer, "abcdefgh \xc3\xa9", below(random, 3));
+    const char quote = JsonTest::oneIn(random, 2) ? '"' : '\'';
+    const char* begin = buffer.data();
+    const char* end = begin + buffer.size();
+    for (const char* p = begin; p <= end; ++p) {
+      if (Json::simd::findQuoteOrBackslash(p, end, quote) !=
+          findQuoteOrBackslashByByte(p, end, quote)) {
+        FAIL("findQuoteOrBackslash differs at offset " +
+             std::to_string(p - begin));
+        return;
+      }
+    }
+  }
+}
+
+TEST(findEscapeMatchesByteLoop) {
+  Random random(HeosTestSeed());
+  std::vector<char> buffer;
+  for (int iteration = 0; iteration < 3000 * HeosTestScale(); ++iteration) {
+    buffer.resize(below(random, 140));
+    // Bytes either side of every class boundary: 0x1F/0x20, 0x7F/0x80
+    fill(random, buffer, "az ~\x20\x7f!#[]", below(random, 4));
+    const bool emitUTF8 = JsonTest::oneIn(random, 2);
+    const char* begin = buffer.data();
+    const char* end = begin + buffer.size();
+    for (const char* p = begin; p <= end; ++p) {
+      if (Json::simd::findEscape(p, end, emitUTF8) !=
+          findEscapeByByte(p, end, emitUTF8)) {
+        FAIL("findEscape differs at offset " + std::to_string(p - begin) +
+             (emitUTF8 ? " with emitUTF8" : ""));
+        return;
+      }
+    }
+  }
+}
+
+TEST(readerFindsEveryBoundaryByte) {
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  for (int padding = 0; padding < 70; ++padding) {
+    for (int at = 0; at < 70; ++at) {
+      for (const char* special : {"\\\"", "\\\\", "\\n", "\\u00e9"}) {
+        // [<padding spaces>"xxx<special>xxx"<padding spaces>]
+        Json::String body(static_cast<size_t>(at), 'x');
+        Json::String expected = body;
+        body += special;
+        expected += special[1] == '"'    ? "\""
+                    : special[1] == '\\' ? "\\"
+                    : special[1] == 'n'  ? "\n"
+                                         : "\xc3\xa9";
+        body.append(static_cast<size_t>(70 - at), 'y');
+        expected.append(static_cast<size_t>(70 - at), 'y');
+        const Json::String spaces(static_cast<size_t>(padding), ' ');
+        const Json::String doc = "[" + spaces + "\"" + body + "\"" + spaces +
+                                 "," + spaces + "1" + spaces + "]";
+
+        Json::Value root;
+        Json::String errs;
+        if (!reader->parse(doc.data(), doc.data() + doc.size(), &root, &errs) ||
+            root[0].asString() != expected || root[1].asInt() != 1) {
+          FAIL("wrong parse of " + doc + "\n" + errs);
+          return;
+        }
+      }
+    }
+  }
+}
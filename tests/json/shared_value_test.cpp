@@ -0,0 +1,189 @@
+// Copies of a tree, taken and read on several threads while another thread
+// keeps writing to its own copy: every snapshot must keep the content it had
+// when it was taken. With JSONCPP_SHARED_VALUE the copies share containers
+// until the writer detaches them; the other layouts copy deep, and must pass
+// the same way.
+
+#include <json/value.h>
+#include <json/writer.h>
+
+#include "HeosTest.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const unsigned players = 8;
+
+// The tree after the writer's version'th change; the writer makes the same
+// changes to its copy one at a time.
+Json::Value expected(unsigned version) {
+  Json::Value root;
+  root["heos"]["command"] = "player/get_players";
+  root["version"] = version;
+  Json::Value& payload = root["payload"];
+  for (unsigned i = 0; i < players; ++i) {
+    Json::Value& player = payload[i];
+    player["name"] = "Player " + std::to_string(i);
+    player["pid"] = -1000 - static_cast<int>(i);
+    player["media"]["song"] = "Song";
+    player["media"]["plays"] =
+        version < i ? 0u : version - (version - i) % players;
+  }
+  return root;
+}
+
+void change(Json::Value& root, unsigned version) {
+  root["version"] = version;
+  root["payload"][version % players]["media"]["plays"] = version;
+}
+
+Json::String write(const Json::Value& value) {
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "";
+  return Json::writeString(builder, value);
+}
+
+} // namespace
+
+TEST(writesCloneOnlyTheirPath) {
+  const Json::Value original = expected(0);
+  Json::Value copy = original;
+  copy["payload"][3]["media"]["plays"] = 99;
+  CHECK(original == expected(0));
+  CHECK_EQUAL(99u, copy["payload"][3]["media"]["plays"].asUInt());
+  CHECK_EQUAL(0u, original["payload"][3]["media"]["plays"].asUInt());
+
+  const Json::Value& view = copy;
+#if JSONCPP_SHARED_VALUE
+  // Containers off the written path are still the original's; those on it
+  // were cloned
+  CHECK(&view["heos"]["command"] == &original["heos"]["command"]);
+  CHECK(&view["payload"][2]["name"] == &original["payload"][2]["name"]);
+  CHECK(&view["payload"][3]["name"] != &original["payload"][3]["name"]);
+  CHECK(&view["payload"][3]["media"]["song"] !=
+        &original["payload"][3]["media"]["song"]);
+#else
+  CHECK(&view["heos"]["command"] != &original["heos"]["command"]);
+#endif
+
+  // Writing to the original leaves the copy alone, too
+  Json::Value second = copy;
+  copy["payload"][3]["media"]["plays"] = 100;
+  copy.removeMember("heos");
+  CHECK_EQUAL(99u, second["payload"][3]["media"]["plays"].asUInt());
+  CHECK(second.isMember("heos"));
+  CHECK(original == expected(0));
+}
+
+TEST(snapshotsStayIsolatedAcrossThreads) {
+  // The writer publishes a copy of its tree after each change; readers take
+  // the latest under the lock, then read it without one while the writer
+  // goes on changing the containers they share.
+  std::mutex lock;
+  Json::Value published = expected(0);
+  unsigned publishedVersion = 0;
+  const unsigned versions = 400 * HeosTestScale();
+  std::atomic<bool> done(false);
+
+  const unsigned readers = 4;
+  std::vector<unsigned> failures(readers, 0);
+  std::vector<unsigned> reads(readers, 0);
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < readers; ++t) {
+    threads.emplace_back([&, t] {
+      // Each reader also holds on to a few older snapshots for a while
+      std::vector<std::pair<unsigned, Json::Value>> held;
+      while (!done.load()) {
+        std::pair<unsigned, Json::Value> snapshot;
+        {
+          std::lock_guard<std::mutex> guard(lock);
+          snapshot.first = publishedVersion;
+          snapshot.second = published;
+        }
+        const Json::Value& view = snapshot.second;
+        Json::Value subtree = view["payload"][t % players];
+        if (write(view) != write(expected(snapshot.first)) ||
+            subtree != expected(snapshot.first)["payload"][t % players])
+          ++failures[t];
+        held.push_back(std::move(snapshot));
+        if (held.size() > 4) {
+          const auto& old = held.front();
+          if (old.second != expected(old.first))
+            ++failures[t];
+          held.erase(held.begin());
+        }
+        ++reads[t];
+      }
+      for (const auto& old : held)
+        if (old.second != expected(old.first))
+          ++failures[t];
+    });
+  }
+
+  std::thread writer([&] {
+    Json::Value mine;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      mine = published;
+    }
+    for (unsigned version = 1; version <= versions; ++version) {
+      change(mine, version);
+      Json::Value snapshot = mine;
+      std::lock_guard<std::mutex> guard(lock);
+      published.swap(snapshot);
+      publishedVersion = version;
+    }
+    done = true;
+  });
+
+  writer.join();
+  for (std::thread& thread : threads)
+    thread.join();
+  for (unsigned t = 0; t < readers; ++t) {
+    CHECK_EQUAL(0u, failures[t]);
+    CHECK(reads[t] > 0);
+  }
+  CHECK(published == expected(versions));
+}
+
+TEST(concurrentCopiesOfOneTree) {
+  // Copying and destroying copies of one const tree from many threads only
+  // moves its share counts; it must end up intact and solely owned.
+  Json::Value tree = expected(5);
+  const Json::Value& shared = tree;
+  const Json::String text = write(tree);
+  const unsigned threadCount = 4;
+  std::vector<char> ok(threadCount, 0);
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < threadCount; ++t) {
+    threads.emplace_back([&, t] {
+      bool good = true;
+      for (unsigned round = 0; round < 2000 * HeosTestScale(); ++round) {
+        Json::Value copy = shared;
+        Json::Value member = shared["payload"][round % players];
+        if (round % 16 == t) {
+          copy["payload"][t]["media"]["plays"] = round;
+          good = good && copy["payload"][t]["media"]["plays"] == round;
+        }
+        good = good && member["pid"] == -1000 - int(round % players);
+      }
+      ok[t] = good;
+    });
+  }
+  for (std::thread& thread : threads)
+    thread.join();
+  for (unsigned t = 0; t < threadCount; ++t)
+    CHECK(ok[t]);
+  CHECK(write(tree) == text);
+
+  // The copies are gone, so the tree owns its containers alone again and a
+  // write goes to them in place
+  const Json::Value& view = tree;
+  const Json::Value* heos = &view["heos"];
+  tree["version"] = 6;
+  CHECK(&view["heos"] == heos);
+}
@@ -0,0 +1,243 @@
+// Value's layouts: how big a node is, and that comments and offsets stay
+// with the node through copies, moves and swaps whether they live in it or,
+// with JSONCPP_COMPACT_VALUE, in the side table; and which strings and keys
+// are short enough to be kept inline rather than on the heap.
+
+#include <json/reader.h>
+#include <json/value.h>
+
+#include "HeosTest.h"
+#include "json_test_values.h"
+
+#include <cstring>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace {
+
+Json::Value annotated(const char* text, ptrdiff_t start, ptrdiff_t limit) {
+  Json::Value value(text);
+  value.setComment(Json::String("// before"), Json::commentBefore);
+  value.setComment(Json::String("// after"), Json::commentAfter);
+  value.setOffsetStart(start);
+  value.setOffsetLimit(limit);
+  return value;
+}
+
+bool isAnnotated(const Json::Value& value, ptrdiff_t start, ptrdiff_t limit) {
+  return value.getComment(Json::commentBefore) == "// before" &&
+         value.getComment(Json::commentAfter) == "// after" &&
+         value.getOffsetStart() == start && value.getOffsetLimit() == limit;
+}
+
+// Secure memory wipes what it frees, so it keeps every string on the heap.
+const unsigned inlineValueCapacity =
+    JSONCPP_USE_SECURE_MEMORY ? 0 : sizeof(Json::LargestUInt) - 1;
+const unsigned inlineKeyCapacity =
+    JSONCPP_USE_SECURE_MEMORY ? 0 : sizeof(char const*) - 1;
+
+bool within(char const* p, void const* begin, size_t size) {
+  char const* b = static_cast<char const*>(begin);
+  return p >= b && p < b + size;
+}
+
+bool isInline(const Json::Value& value) {
+  char const* begin;
+  char const* end;
+  return value.getString(&begin, &end) && within(begin, &value, sizeof value);
+}
+
+// A member's key sits in the same map node as its Value, just before it.
+bool hasInlineKey(const Json::ValueConstIterator& it) {
+  char const* end;
+  char const* key = it.memberName(&end);
+  char const* node = reinterpret_cast<char const*>(&*it);
+  return within(key, node - 2 * sizeof(void*), 2 * sizeof(void*));
+}
+
+bool isBare(const Json::Value& value) {
+  return !value.hasComment(Json::commentBefore) &&
+         !value.hasComment(Json::commentAfter) && value.getOffsetStart() == 0 &&
+         value.getOffsetLimit() == 0;
+}
+
+} // namespace
+
+TEST(nodeSize) {
+#if JSONCPP_COMPACT_VALUE
+  // A payload word and the type bits; everything else is in the side table
+  if (sizeof(void*) == 8)
+    CHECK_EQUAL(16u, sizeof(Json::Value));
+#else
+  CHECK(sizeof(Json::Value) >= 16 + 3 * sizeof(void*));
+#endif
+}
+
+TEST(annotationsFollowTheNode) {
+  const Json::Value original = annotated("text", 3, 9);
+  CHECK(isAnnotated(original, 3, 9));
+
+  Json::Value copied(original);
+  CHECK(isAnnotated(copied, 3, 9));
+  CHECK(isAnnotated(original, 3, 9));
+
+  Json::Value assigned = annotated("other", 1, 2);
+  assigned = original;
+  CHECK(isAnnotated(assigned, 3, 9));
+
+  Json::Value moved(std::move(copied));
+  CHECK(isAnnotated(moved, 3, 9));
+  CHECK(isBare(copied));
+
+  Json::Value moveAssigned;
+  moveAssigned = std::move(moved);
+  CHECK(isAnnotated(moveAssigned, 3, 9));
+
+  // swap() takes them along; swapPayload() leaves them with the node
+  Json::Value bare("bare");
+  bare.swap(moveAssigned);
+  CHECK(isAnnotated(bare, 3, 9));
+  CHECK(isBare(moveAssigned));
+  CHECK_EQUAL("text", bare.asString());
+  bare.swapPayload(moveAssigned);
+  CHECK(isAnnotated(bare, 3, 9));
+  CHECK_EQUAL("bare", bare.asString());
+  CHECK(isBare(moveAssigned));
+  CHECK_EQUAL("text", moveAssigned.asString());
+
+  // Nested: an element keeps its own when the container is copied
+  Json::Value array(Json::arrayValue);
+  array.append(original);
+  array.append(Json::Value(5));
+  Json::Value arrayCopy = array;
+  CHECK(isAnnotated(arrayCopy[0], 3, 9));
+  CHECK(isBare(arrayCopy[1]));
+}
+
+TEST(destroyedNodeLeavesNothingBehind) {
+  // A node made where an annotated one was must not find its entry
+  alignas(Json::Value) unsigned char storage[sizeof(Json::Value)];
+  Json::Value* value = new (storage) Json::Value(annotated("gone", 4, 8));
+  CHECK(isAnnotated(*value, 4, 8));
+  value->~Value();
+  value = new (storage) Json::Value("new");
+  CHECK(isBare(*value));
+  value->~Value();
+}
+
+TEST(readersStoreOffsetsAsConfigured) {
+  const Json::String doc = "{\"pid\": 7, \"name\": \"Bar\"}";
+  Json::CharReaderBuilder builder;
+  builder["storeOffsets"] = true;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  Json::Value root;
+  CHECK(reader->parse(doc.data(), doc.data() + doc.size(), &root, nullptr));
+  CHECK_EQUAL(19, root["name"].getOffsetStart());
+  CHECK_EQUAL(24, root["name"].getOffsetLimit());
+
+  builder["storeOffsets"] = false;
+  reader.reset(builder.newCharReader());
+  CHECK(reader->parse(doc.data(), doc.data() + doc.size(), &root, nullptr));
+  CHECK(isBare(root["name"]));
+
+  // The legacy Reader has no setting; a compact build keeps its nodes bare
+  Json::Reader legacy;
+  CHECK(legacy.parse(doc, root, false));
+#if JSONCPP_COMPACT_VALUE
+  CHECK(isBare(root["name"]));
+#else
+  CHECK_EQUAL(19, root["name"].getOffsetStart());
+#endif
+}
+
+TEST(shortStringsLiveInTheNode) {
+  for (unsigned length = 0; length <= 16; ++length) {
+    Json::String text(length, 'x');
+    if (length > 1)
+      text[length / 2] = '\0';
+    const Json::Value value(text);
+    const bool expected = length <= inlineValueCapacity;
+    CHECK_EQUAL(expected, isInline(value));
+    CHECK(value.asString() == text);
+    CHECK_EQUAL(0, std::memcmp(value.asCString(), text.c_str(), length + 1));
+
+    Json::Value copied(value);
+    CHECK_EQUAL(expected, isInline(copied));
+    CHECK(copied == value);
+    Json::Value moved(std::move(copied));
+    CHECK_EQUAL(expected, isInline(moved));
+    CHECK(moved.asString() == text);
+
+    // Over a string of the other kind, both ways
+    Json::Value other(Json::String(inlineValueCapacity + 1 - length % 2, 'y'));
+    other = value;
+    CHECK(other.asString() == text);
+    other.swap(moved);
+    CHECK(other.asString() == text);
+    CHECK(moved.asString() == text);
+    other = Json::Value("ab");
+    CHECK(other.asString() == "ab");
+    CHECK(moved.asString() == text);
+  }
+}
+
+TEST(shortKeysLiveInTheMap) {
+  JsonTest::Random random(HeosTestSeed());
+  Json::Value object(Json::objectValue);
+  std::vector<Json::String> keys;
+  for (unsigned length = 0; length <= 16; ++length) {
+    Json::String key;
+    for (unsigned n = 0; n < length; ++n)
+      key.push_back(static_cast<char>('a' + JsonTest::below(random, 26)));
+    keys.push_back(key);
+    // An inline key needs a non-zero first byte to tell it from an index
+    if (length > 0) {
+      key[0] = '\0';
+      keys.push_back(key);
+    }
+    if (length > 2) {
+      key[0] = 'k';
+      key[length - 1] = '\0';
+      keys.push_back(key);
+    }
+  }
+  for (size_t n = 0; n < keys.size(); ++n)
+    object[keys[n]] = static_cast<Json::UInt>(n);
+
+  const Json::Value copied = object;
+  Json::Value detached = object;
+  detached["extra"] = true;
+  const Json::Value* const maps[] = {&object, &copied, &detached};
+  for (const Json::Value* map : maps) {
+    CHECK_EQUAL(keys.size() + (map == &detached ? 1 : 0), map->size());
+    for (size_t n = 0; n < keys.size(); ++n) {
+      const Json::Value* found =
+          map->find(keys[n].data(), keys[n].data() + keys[n].size());
+      CHECK(found != nullptr && found->asUInt() == n);
+    }
+    for (auto it = map->begin(); it != map->end(); ++it) {
+      const Json::String key = it.name();
+      const bool expected =
+          !key.empty() && key.size() <= inlineKeyCapacity && key[0] != '\0';
+      CHECK_EQUAL(expected, hasInlineKey(it));
+    }
+  }
+
+  // Inline and heap keys order the same way
+  auto a = object.begin();
+  for (auto b = copied.begin(); b != copied.end(); ++a, ++b)
+    CHECK(a.name() == b.name());
+  CHECK(copied == object);
+
+  Json::Value removing = copied;
+  for (size_t n = 0; n < keys.size(); ++n) {
+    Json::Value removed;
+    CHECK(removing.removeMember(keys[n].data(),
+                                keys[n].data() + keys[n].size(), &removed));
+    CHECK_EQUAL(static_cast<Json::UInt>(n), removed.asUInt());
+  }
+  CHECK(removing.empty());
+  CHECK_EQUAL(keys.size(), object.size());
+}
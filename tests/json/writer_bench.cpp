@@ -0,0 +1,59 @@
+// Serialization throughput of the writers on a now-playing sized document
+// and on a large queue. Not part of ctest; run it by hand after touching
+// json_writer.cpp:
+//   ./json_writer_bench_compact [seconds per case]
+
+#include <json/writer.h>
+
+#include "json_bench.h"
+
+#include <cstdio>
+#include <memory>
+#include <sstream>
+
+namespace {
+
+using JsonBench::measure;
+
+void run(const char* title, const Json::Value& value, double seconds) {
+  printf("%s\n", title);
+
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "";
+  measure("StreamWriterBuilder", seconds,
+          [&] { return Json::writeString(builder, value).size(); });
+
+  std::unique_ptr<Json::StreamWriter> streamWriter(builder.newStreamWriter());
+  std::ostringstream out;
+  measure("StreamWriter, reused", seconds, [&] {
+    out.str(Json::String());
+    streamWriter->write(value, &out);
+    return static_cast<size_t>(out.tellp());
+  });
+
+  Json::FastWriter fast;
+  measure("FastWriter", seconds, [&] { return fast.write(value).size(); });
+
+  Json::BufferWriter growable;
+  measure("BufferWriter", seconds, [&] {
+    growable.write(value);
+    return growable.size();
+  });
+
+  growable.write(value);
+  std::unique_ptr<char[]> span(new char[growable.size()]);
+  Json::BufferWriter fixed(span.get(), growable.size());
+  measure("BufferWriter, fixed span", seconds, [&] {
+    fixed.write(value);
+    return fixed.size();
+  });
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const double seconds = JsonBench::seconds(argc, argv);
+  run("state (one track)", JsonBench::state(), seconds);
+  run("queue (500 tracks)", JsonBench::queue(500), seconds);
+  return 0;
+}
@@ -0,0 +1,246 @@
+// The writers against each other and against the byte-at-a-time escaping
+// that the vector scan replaced: StreamWriterBuilder, BufferWriter (growable
+// and fixed) and valueToQuotedString() must all spell a string the same way,
+// and what they write must read back as the Value written.
+
+#include <json/reader.h>
+#include <json/writer.h>
+
+#include "HeosTest.h"
+#include "json_test_values.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+namespace {
+
+using JsonTest::below;
+using JsonTest::oneIn;
+using JsonTest::Random;
+
+// The upstream escaping loop, one byte at a time.
+unsigned referenceCodepoint(const char*& s, const char* e) {
+  const unsigned replacement = 0xFFFD;
+  const unsigned first = static_cast<unsigned char>(*s);
+  if (first < 0x80)
+    return first;
+  if (first < 0xE0) {
+    if (e - s < 2)
+      return replacement;
+    const unsigned calculated =
+        ((first & 0x1F) << 6) | (static_cast<unsigned>(s[1]) & 0x3F);
+    s += 1;
+    return calculated < 0x80 ? replacement : calculated;
+  }
+  if (first < 0xF0) {
+    if (e - s < 3)
+      return replacement;
+    const unsigned calculated = ((first & 0x0F) << 12) |
+                                ((static_cast<unsigned>(s[1]) & 0x3F) << 6) |
+                                (static_cast<unsigned>(s[2]) & 0x3F);
+    s += 2;
+    if (calculated >= 0xD800 && calculated <= 0xDFFF)
+      return replacement;
+    return calculated < 0x800 ? replacement : calculated;
+  }
+  if (first < 0xF8) {
+    if (e - s < 4)
+      return replacement;
+    const unsigned calculated = ((first & 0x07) << 18) |
+                                ((static_cast<unsigned>(s[1]) & 0x3F) << 12) |
+                                ((static_cast<unsigned>(s[2]) & 0x3F) << 6) |
+                                (static_cast<unsigned>(s[3]) & 0x3F);
+    s += 3;
+    return calculated < 0x10000 ? replacement : calculated;
+  }
+  return replacement;
+}
+
+void referenceHex(Json::String& out, unsigned unit) {
+  char text[8];
+  snprintf(text, sizeof(text), "\\u%04x", unit);
+  out += text;
+}
+
+Json::String referenceQuoted(const Json::String& value, bool emitUTF8) {
+  Json::String out = "\"";
+  const char* end = value.data() + value.size();
+  for (const char* c = value.data(); c != end; ++c) {
+    switch (*c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\b':
+      out += "\\b";
+      break;
+    case '\f':
+      out += "\\f";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    case '\r':
+      out += "\\r";
+      break;
+    case '\t':
+      out += "\\t";
+      break;
+    default:
+      if (emitUTF8) {
+        if (static_cast<unsigned char>(*c) < 0x20)
+          referenceHex(out, static_cast<unsigned char>(*c));
+        else
+          out.push_back(*c);
+      } else {
+        unsigned codepoint = referenceCodepoint(c, end);
+        if (codepoint < 0x20) {
+          referenceHex(out, codepoint);
+        } else if (codepoint < 0x80) {
+          out.push_back(static_cast<char>(codepoint));
+        } else if (codepoint < 0x10000) {
+          referenceHex(out, codepoint);
+        } else {
+          codepoint -= 0x10000;
+          referenceHex(out, 0xd800 + ((codepoint >> 10) & 0x3ff));
+          referenceHex(out, 0xdc00 + (codepoint & 0x3ff));
+        }
+      }
+    }
+  }
+  return out + "\"";
+}
+
+// Valid UTF-8 most of the time; otherwise random bytes, including truncated
+// and overlong sequences and encoded surrogates.
+Json::String randomBytes(Random& random) {
+  if (!oneIn(random, 3))
+    return JsonTest::randomString(random);
+  static const char* const invalid[] = {"\xc3", "\xe2\x82", "\xf0\x9f\x8e",
+                                        "\xc0\xaf", "\xed\xa0\x80", "\xf8",
+                                        "\xff", "\x80"};
+  Json::String text;
+  for (unsigned n = below(random, 40); n > 0; --n) {
+    if (oneIn(random, 4))
+      text += invalid[below(random, sizeof(invalid) / sizeof(invalid[0]))];
+    else
+      text.push_back(static_cast<char>(below(random, 256)));
+  }
+  return text;
+}
+
+Json::String streamWrite(const Json::Value& value, const Json::String& indent,
+                         bool emitUTF8) {
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = indent;
+  builder["emitUTF8"] = emitUTF8;
+  builder["commentStyle"] = "None";
+  return Json::writeString(builder, value);
+}
+
+} // namespace
+
+TEST(escapingMatchesByteLoop) {
+  Random random(HeosTestSeed());
+  Json::BufferWriter buffer;
+  Json::BufferWriter bufferUTF8;
+  bufferUTF8.setEmitUTF8(true);
+  for (int i = 0; i < 50000 * HeosTestScale(); ++i) {
+    const Json::String text = randomBytes(random);
+    const Json::Value value(text);
+    const Json::String ascii = referenceQuoted(text, false);
+    const Json::String utf8 = referenceQuoted(text, true);
+
+    CHECK_EQUAL(ascii, Json::valueToQuotedString(text.data(), text.size()));
+    CHECK_EQUAL(ascii, streamWrite(value, "", false));
+    CHECK_EQUAL(utf8, streamWrite(value, "", true));
+    buffer.write(value);
+    CHECK_EQUAL(ascii, buffer.str());
+    bufferUTF8.write(value);
+    CHECK_EQUAL(utf8, bufferUTF8.str());
+    if (HeosTestFailures())
+      return;
+  }
+}
+
+TEST(escapesKeepTheirForm) {
+  // DEL is not a control character to JSON
+  CHECK_EQUAL("\"\\u0001\\u001f\x7f\"",
+              Json::valueToQuotedString("\x01\x1f\x7f"));
+  CHECK_EQUAL("\"a/b\"", Json::valueToQuotedString("a/b"));
+  CHECK_EQUAL("\"\\u00e9\\u20ac\"",
+              Json::valueToQuotedString("\xc3\xa9\xe2\x82\xac"));
+  CHECK_EQUAL("\"\\ud83c\\udfb5\"",
+              Json::valueToQuotedString("\xf0\x9f\x8e\xb5"));
+  CHECK_EQUAL("\"\\ufffd\"", Json::valueToQuotedString("\xc3"));
+  CHECK_EQUAL("\"\\u0000\"", Json::valueToQuotedString("", 1));
+}
+
+TEST(bufferWriterMatchesStreamWriter) {
+  Random random(HeosTestSeed());
+  Json::BufferWriter compact;
+  Json::BufferWriter tabs;
+  tabs.setIndentation("\t");
+  Json::BufferWriter spaces;
+  spaces.setIndentation("  ");
+  for (int i = 0; i < 3000 * HeosTestScale(); ++i) {
+    const Json::Value value = JsonTest::randomValue(random);
+    compact.write(value);
+    CHECK_EQUAL(streamWrite(value, "", false), compact.str());
+    tabs.write(value);
+    CHECK_EQUAL(streamWrite(value, "\t", false), tabs.str());
+    spaces.write(value);
+    CHECK_EQUAL(streamWrite(value, "  ", false), spaces.str());
+    if (HeosTestFailures())
+      return;
+  }
+}
+
+TEST(fixedBufferReportsNeededSize) {
+  Random random(HeosTestSeed());
+  Json::BufferWriter growable;
+  std::vector<char> span;
+  for (int i = 0; i < 3000 * HeosTestScale(); ++i) {
+    const Json::Value value = JsonTest::randomValue(random);
+    growable.write(value);
+    const Json::String expected = growable.str();
+
+    span.assign(below(random, static_cast<unsigned>(expected.size()) + 8) + 1,
+                '\x55');
+    Json::BufferWriter fixed(span.data(), span.size());
+    const bool fits = fixed.write(value);
+    CHECK_EQUAL(expected.size() <= span.size(), fits);
+    CHECK_EQUAL(!fits, fixed.overflowed());
+    CHECK_EQUAL(expected.size(), fixed.size());
+    const size_t written = std::min(expected.size(), span.size());
+    CHECK(Json::String(span.data(), written) == expected.substr(0, written));
+    if (fits)
+      CHECK_EQUAL(expected, fixed.str());
+    if (HeosTestFailures())
+      return;
+  }
+}
+
+TEST(writtenValuesReadBack) {
+  Random random(HeosTestSeed());
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  Json::BufferWriter writer;
+  writer.setIndentation("\t");
+  for (int i = 0; i < 3000 * HeosTestScale(); ++i) {
+    const Json::Value value = JsonTest::randomValue(random);
+    writer.write(value);
+    Json::Value back;
+    Json::String errs;
+    if (!reader->parse(writer.data(), writer.data() + writer.size(), &back,
+                       &errs) ||
+        !(back == value)) {
+      FAIL("does not read back: " + writer.str() + "\n" + errs);
+      return;
+    }
+  }
+}